@@ -34,44 +34,133 @@ slider.oninput = function() {
   	overrideDuration.innerHTML = this.value + " min";
   }
 }
+// pump commands go over the control websocket, each one is answered with the
+// resulting command text (or an error) carrying the same id
+var control;
+var controlRequests = {};
+var nextRequest = 1;
+function connectControl() {
+  control = new WebSocket("ws://" + location.host + "/ws");
+  control.onmessage = function(e) {
+    var reply = JSON.parse(e.data);
+    var output = controlRequests[reply.id];
+    delete controlRequests[reply.id];
+    if (reply.ok) {
+      document.getElementById(reply.output + "Command").innerHTML = reply.command;
+    } else {
+      console.log("control", reply.error);
+      if (output) {
+        document.getElementById(output + "Command").innerHTML = "Error: " + reply.error;
+      }
+    }
+  };
+  control.onclose = function() {
+    // controller rebooted or wifi dropped, keep trying
+    setTimeout(connectControl, 2000);
+  };
+}
+connectControl();
+function sendCommand(command) {
+  if (control.readyState != WebSocket.OPEN) {
+    document.getElementById(command.output + "Command").innerHTML = "Not connected";
+    return;
+  }
+  command.id = nextRequest++;
+  controlRequests[command.id] = command.output;
+  control.send(JSON.stringify(command));
+}
 // set pump override
 function setOverride(button) {
-  //output = relay pin number
   //state = on/off
   //time = override time in minutes (65 = permanent)
-  var output;  // output relay pin to command
-  if (currentModal == 1){
-  	output = "22";
-  } else if(currentModal == 2){
-  	output = "21";
-  } else {
-  	output = "19";
-  }
-  var sliderValue = slider.value;
-  var xhr = new XMLHttpRequest();
-  var dataValue = button.getAttribute("data-value");
-  xhr.open("GET", "/override?output=" + output + "&state=" + dataValue + "&time=" + sliderValue, true); 
-  xhr.send();
-  // update status
-  var command = (dataValue == "1") ? "On" : "Off"
-  var timeLeft = (sliderValue == "65") ? "Permanent)" : sliderValue + " min)"
-  command += " (Override " + timeLeft;
-  if (currentModal == 1){
-  	document.getElementById("pump1Command").innerHTML = command;
-  } else if(currentModal == 2){
-  	document.getElementById("pump2Command").innerHTML = command;
-  } else {
-  	document.getElementById("airPumpCommand").innerHTML = command;
-  }
+  var outputs = ["pump1", "pump2", "airPump"];
+  sendCommand({cmd: "override", output: outputs[currentModal - 1], state: Number(button.getAttribute("data-value")), time: Number(slider.value)});
   closeModal();
 }
 function setAuto(button){
+  sendCommand({cmd: "auto", output: button.getAttribute("data-output")});
+  closeModal();
+}
+// page is static, fill it in from the controller state
+function loadState(){
   var xhr = new XMLHttpRequest();
-  var relay = button.getAttribute("data-relay");
-  xhr.open("GET", "/auto?output=" + relay, true); 
+  xhr.onload = function() {
+    var state = JSON.parse(xhr.responseText);
+    document.getElementById("lastSync").innerHTML = state.lastSync;
+    document.getElementById("temp").innerHTML = (state.temperature != null) ? state.temperature : "--";
+    document.getElementById("hum").innerHTML = (state.humidity != null) ? state.humidity : "--";
+    document.getElementById("heat").innerHTML = (state.heatIndex != null) ? state.heatIndex : "--";
+    document.getElementById("waterLevel").innerHTML = state.waterLevel;
+    changeWaterLevelTextColor();
+    document.getElementById("ledState").innerHTML = state.led ? "ON" : "OFF";
+    state.outputs.forEach(function(output) {
+      showField(output.id + "Command", output.command);
+      showField(output.id + "Status", output.status ? "1" : "0");
+      showField(output.id + "Alarm", output.alarm ? "1" : "0");
+      showField(output.id + "Health", (output.health != null) ? output.health + "%" : "learning");
+    });
+  };
+  xhr.open("GET", "/api/state", true);
+  xhr.send();
+}
+function setLed(on){
+  var xhr = new XMLHttpRequest();
+  xhr.onload = loadState;
+  xhr.open("GET", on ? "/led2on" : "/led2off", true);
+  xhr.send();
+}
+loadState();
+// pump schedule editor
+function loadSchedule(){
+  var xhr = new XMLHttpRequest();
+  xhr.onload = function() {
+    document.getElementById("scheduleEditor").value = xhr.responseText;
+  };
+  xhr.open("GET", "/schedule", true);
+  xhr.send();
+}
+function saveSchedule(){
+  var result = document.getElementById("scheduleResult");
+  var xhr = new XMLHttpRequest();
+  xhr.onload = function() {
+    result.innerHTML = (xhr.status == 200) ? "Saved" : xhr.responseText;
+    result.style.color = (xhr.status == 200) ? "green" : "red";
+  };
+  xhr.open("POST", "/schedule", true);
+  xhr.setRequestHeader("Content-Type", "application/json");
+  xhr.send(document.getElementById("scheduleEditor").value);
+}
+loadSchedule();
+var alarmSeverities = ["Info", "Warning", "Critical"];
+var alarmEvents = ["Raised", "Cleared", "Acknowledged"];
+function loadAlarms(){
+  var xhr = new XMLHttpRequest();
+  xhr.onload = function() {
+    var alarms = JSON.parse(xhr.responseText);
+    var active = "";
+    alarms.active.forEach(function(alarm) {
+      active += '<p class="alarm-' + alarm.severity + '">' + alarmSeverities[alarm.severity] + ': ' + alarm.name;
+      if (!alarm.acknowledged){
+        active += ' <button class="button button2" onclick="ackAlarm(' + alarm.id + ');">ACK</button>';
+      }
+      active += '</p>';
+    });
+    document.getElementById("activeAlarms").innerHTML = (active != "") ? active : "<p>No active alarms</p>";
+    var history = "";
+    alarms.history.forEach(function(event) {
+      history += '<tr class="alarm-' + event.severity + '"><td>' + new Date(event.epoch * 1000).toLocaleString() + '</td><td>' + event.name + '</td><td>' + alarmEvents[event.type] + '</td></tr>';
+    });
+    document.getElementById("alarmHistory").innerHTML = history;
+  };
+  xhr.open("GET", "/alarms", true);
   xhr.send();
-  closeModal();
 }
+function ackAlarm(id){
+  var xhr = new XMLHttpRequest();
+  xhr.open("GET", "/ack?alarm=" + id, true);
+  xhr.send();
+}
+loadAlarms();
 function changeWaterLevelTextColor(){
   var waterLevel = document.getElementById("waterLevel").innerHTML;
   if (waterLevel == "Low"){
@@ -79,15 +168,39 @@ function changeWaterLevelTextColor(){
     document.getElementById("waterLevel").style.color = "red";
   } else if (waterLevel == "Medium"){
     document.getElementById("waterLevel").style.color = "orange";
+  } else if (waterLevel == "Fault"){
+    document.getElementById("waterLevel").style.color = "gray";
   } else {
     document.getElementById("waterLevel").style.color = "green";
   }
 }
 
+// web element per telemetry field, other fields go to the element with the same id
+var fieldElements = {temperature: "temp", humidity: "hum", heatIndex: "heat"};
+var lastTelemetry = 0;
+function statusHtml(on){
+  return on ? '<span class = "status online"></ span>' : '<span class=" status offline "></span> ';
+}
+function showField(field, value){
+  if (field == "alarms"){
+    loadAlarms();
+  } else if (field.endsWith("Status")){
+    document.getElementById(field).innerHTML = statusHtml(value == "1");
+  } else if (field.endsWith("Alarm")){
+    document.getElementById(field).style.display = (value == "1") ? "inline" : "none";
+  } else {
+    document.getElementById(fieldElements[field] || field).innerHTML = value;
+    if (field == "waterLevel"){
+      changeWaterLevelTextColor();
+    }
+  }
+}
+
 if (!!window.EventSource) {
   var source = new EventSource('/events');
   source.addEventListener('open', function(e) {
     console.log("Events Connected");
+    loadState();
   }, false);
   source.addEventListener('error', function(e) {
     if (e.target.readyState != EventSource.OPEN) {
@@ -97,54 +210,17 @@ if (!!window.EventSource) {
   source.addEventListener('message', function(e) {
     console.log("message", e.data);
   }, false);
-  source.addEventListener('temperature', function(e) {
-    console.log("temperature", e.data);
-    document.getElementById("temp").innerHTML = e.data;
-  }, false);
-  source.addEventListener('humidity', function(e) {
-    console.log("humidity", e.data);
-    document.getElementById("hum").innerHTML = e.data;
-  }, false);
-  source.addEventListener('heatIndex', function(e) {
-    console.log("heatIndex", e.data);
-    document.getElementById("heat").innerHTML = e.data;
-  }, false);
-  source.addEventListener('pump1Status', function(e) {
-    console.log("pump1Status", e.data);
-    document.getElementById("pump1Status").innerHTML = e.data;
-  }, false);
-  source.addEventListener('pump2Status', function(e) {
-    console.log("pump2Status", e.data);
-    document.getElementById("pump2Status").innerHTML = e.data;
-  }, false);
-  source.addEventListener('airPumpStatus', function(e) {
-    console.log("airPumpStatus", e.data);
-    document.getElementById("airPumpStatus").innerHTML = e.data;
-  }, false);
-  source.addEventListener('pump1Command', function(e) {
-    console.log("pump1Command", e.data);
-    document.getElementById("pump1Command").innerHTML = e.data;
-  }, false);
-  source.addEventListener('pump2Command', function(e) {
-    console.log("pump2Command", e.data);
-    document.getElementById("pump2Command").innerHTML = e.data;
-  }, false);
-  source.addEventListener('airPumpCommand', function(e) {
-    console.log("airPumpCommand", e.data);
-    document.getElementById("airPumpCommand").innerHTML = e.data;
-  }, false);
-  source.addEventListener('waterLevel', function(e) {
-    console.log("waterLevel", e.data);
-    document.getElementById("waterLevel").innerHTML = e.data;
-    changeWaterLevelTextColor();
-  }, false);
-  source.addEventListener('waterPump1Header', function(e) {
-    document.getElementById("waterPump1Header").innerHTML = e.data;
-  }, false);
-  source.addEventListener('waterPump2Header', function(e) {
-    document.getElementById("waterPump2Header").innerHTML = e.data;
-  }, false);
-  source.addEventListener('airPumpHeader', function(e) {
-    document.getElementById("airPumpHeader").innerHTML = e.data;
+  // one frame per change, {"field":"value",..} with only the fields that changed
+  source.addEventListener('telemetry', function(e) {
+    console.log("telemetry", e.data);
+    // a frame was dropped (slow connection), the full state fills the gap
+    if (lastTelemetry && Number(e.lastEventId) != lastTelemetry + 1){
+      loadState();
+    }
+    lastTelemetry = Number(e.lastEventId);
+    var fields = JSON.parse(e.data);
+    for (var field in fields){
+      showField(field, fields[field]);
+    }
   }, false);
 }
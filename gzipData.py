@@ -0,0 +1,26 @@
+# PlatformIO pre script: builds the filesystem image from a copy of data/ with
+# the web page files gzipped into www/, served by serveStatic in main.cpp
+import gzip
+import os
+import shutil
+
+Import("env")
+
+WEB_FILES = (".html", ".css", ".js")
+
+source = env.subst("$PROJECT_DATA_DIR")
+target = os.path.join(env.subst("$BUILD_DIR"), "data")
+
+shutil.rmtree(target, ignore_errors=True)
+os.makedirs(os.path.join(target, "www"))
+for name in os.listdir(source):
+    path = os.path.join(source, name)
+    if not os.path.isfile(path):
+        continue
+    if name.endswith(WEB_FILES):
+        with open(path, "rb") as f, gzip.open(os.path.join(target, "www", name + ".gz"), "wb", 9) as out:
+            out.write(f.read())
+    else:
+        shutil.copy(path, target)
+
+env.Replace(PROJECT_DATA_DIR=target)
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ALARM_HISTORY_SIZE 64 // events kept in the history ring buffer
+#define NO_DEADLINE UINT32_MAX // no timer pending, dueIn() gives INT32_MAX
+
+enum AlarmSeverity : uint8_t
+{
+  ALARM_INFO,
+  ALARM_WARNING,
+  ALARM_CRITICAL
+};
+
+enum AlarmEventType : uint8_t
+{
+  ALARM_RAISED,
+  ALARM_CLEARED,
+  ALARM_ACKNOWLEDGED
+};
+
+struct AlarmConfig
+{
+  const char *name;
+  AlarmSeverity severity;
+  uint16_t delayOn;  // seconds the condition has to hold before the alarm is raised
+  uint16_t delayOff; // seconds the condition has to be gone before the alarm clears
+  bool latching;     // stays active after the condition is gone until acknowledged
+};
+
+// 8 bytes so the flash history is a plain array of records
+struct AlarmEvent
+{
+  uint32_t epoch;
+  uint8_t alarm;
+  AlarmEventType type;
+  AlarmSeverity severity;
+  uint8_t reserved;
+};
+
+// Fixed-size ring buffer of the most recent alarm events
+class AlarmHistory
+{
+public:
+  // returns the slot the event was written to (for persisting it)
+  uint16_t push(const AlarmEvent &event)
+  {
+    uint16_t slot = head;
+    events[slot] = event;
+    head = (head + 1) % ALARM_HISTORY_SIZE;
+    if (count < ALARM_HISTORY_SIZE)
+      count++;
+    return slot;
+  }
+  uint16_t size() const { return count; }
+  uint16_t nextSlot() const { return head; }
+  // 0 is the newest event
+  const AlarmEvent &recent(uint16_t i) const { return events[(head + ALARM_HISTORY_SIZE - 1 - i) % ALARM_HISTORY_SIZE]; }
+  // restore from flash
+  void restore(const AlarmEvent *saved, uint16_t savedHead, uint16_t savedCount)
+  {
+    for (uint16_t i = 0; i < ALARM_HISTORY_SIZE; i++)
+      events[i] = saved[i];
+    head = savedHead % ALARM_HISTORY_SIZE;
+    count = (savedCount > ALARM_HISTORY_SIZE) ? ALARM_HISTORY_SIZE : savedCount;
+  }
+
+private:
+  AlarmEvent events[ALARM_HISTORY_SIZE] = {};
+  uint16_t head = 0;
+  uint16_t count = 0;
+};
+
+// Alarm state machines with delay-on/delay-off hysteresis and latching. Inputs
+// are only pushed in when they change (setInput), between changes nothing is
+// evaluated except the single earliest pending timer (update). The delays run
+// on the millisecond clock, so a clock step or a new utcOffset neither skips
+// nor holds them back; the epoch only stamps the events.
+template <size_t N>
+class AlarmEngine
+{
+public:
+  typedef void (*EventHandler)(const AlarmEvent &event);
+
+  AlarmEngine(const AlarmConfig (&config)[N], EventHandler handler) : configs(config), onEvent(handler), states()
+  {
+    for (size_t i = 0; i < N; i++)
+      states[i].deadline = NO_DEADLINE;
+  }
+
+  static constexpr size_t size() { return N; }
+  const AlarmConfig &config(size_t i) const { return configs[i]; }
+  bool active(size_t i) const { return states[i].active; }
+  bool acknowledged(size_t i) const { return states[i].acknowledged; }
+  bool condition(size_t i) const { return states[i].condition; }
+  // ms from ms to the next delay on/off timer, late is negative; INT32_MAX when none
+  int32_t dueIn(uint32_t ms) const
+  {
+    uint32_t next = deadline; // read once, the power planner calls this from another task
+    return (next == NO_DEADLINE) ? INT32_MAX : (int32_t)(next - ms);
+  }
+  AlarmHistory &history() { return events; }
+
+  // ms is the millisecond clock the delays run on, epoch stamps the events
+  void setInput(size_t i, bool condition, uint32_t ms, uint32_t epoch)
+  {
+    State &state = states[i];
+    if (state.condition == condition)
+      return;
+    state.condition = condition;
+    if (condition)
+    {
+      // raise after delayOn, or just cancel a pending clear
+      state.deadline = state.active ? NO_DEADLINE : timer(ms, configs[i].delayOn);
+    }
+    else if (state.active)
+    {
+      // latched alarms wait for the acknowledge
+      state.deadline = (configs[i].latching and !state.acknowledged) ? NO_DEADLINE : timer(ms, configs[i].delayOff);
+    }
+    else
+    {
+      state.deadline = NO_DEADLINE; // condition went away before the alarm was raised
+    }
+    update(ms, epoch);
+  }
+
+  bool acknowledge(size_t i, uint32_t ms, uint32_t epoch)
+  {
+    State &state = states[i];
+    if (!state.active or state.acknowledged)
+      return false;
+    state.acknowledged = true;
+    emit(i, ALARM_ACKNOWLEDGED, epoch);
+    if (!state.condition)
+    {
+      state.deadline = timer(ms, configs[i].delayOff);
+    }
+    update(ms, epoch);
+    return true;
+  }
+
+  // active alarm saved before a reboot, restored without an event. The
+  // condition is taken to still hold, it clears through setInput as usual
+  void restore(size_t i, bool acknowledged)
+  {
+    State &state = states[i];
+    state.condition = true;
+    state.active = true;
+    state.acknowledged = acknowledged;
+    state.deadline = NO_DEADLINE;
+  }
+
+  // fire the timers that are due
+  void update(uint32_t ms, uint32_t epoch)
+  {
+    uint32_t next = NO_DEADLINE;
+    uint32_t nextIn = UINT32_MAX;
+    for (size_t i = 0; i < N; i++)
+    {
+      State &state = states[i];
+      if (state.deadline != NO_DEADLINE and (int32_t)(ms - state.deadline) >= 0)
+      {
+        state.deadline = NO_DEADLINE;
+        if (state.condition and !state.active)
+        {
+          state.active = true;
+          state.acknowledged = false;
+          emit(i, ALARM_RAISED, epoch);
+        }
+        else if (!state.condition and state.active)
+        {
+          state.active = false;
+          emit(i, ALARM_CLEARED, epoch);
+        }
+      }
+      // the millisecond clock wraps, the earliest is the one the fewest ms ahead
+      if (state.deadline != NO_DEADLINE and state.deadline - ms < nextIn)
+      {
+        next = state.deadline;
+        nextIn = state.deadline - ms;
+      }
+    }
+    deadline = next;
+  }
+
+private:
+  struct State
+  {
+    bool condition;
+    bool active;
+    bool acknowledged;
+    uint32_t deadline; // ms of the pending raise/clear, NO_DEADLINE when none
+  };
+
+  // delay seconds after ms; a deadline landing on NO_DEADLINE fires a ms later
+  static uint32_t timer(uint32_t ms, uint16_t delay)
+  {
+    uint32_t at = ms + delay * 1000u;
+    return (at == NO_DEADLINE) ? at + 1 : at;
+  }
+
+  void emit(size_t i, AlarmEventType type, uint32_t epoch)
+  {
+    AlarmEvent event = {epoch, (uint8_t)i, type, configs[i].severity, 0};
+    events.push(event);
+    if (onEvent)
+      onEvent(event);
+  }
+
+  const AlarmConfig *configs;
+  EventHandler onEvent;
+  State states[N];
+  AlarmHistory events;
+  uint32_t deadline = NO_DEADLINE; // earliest state deadline
+};
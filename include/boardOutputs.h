@@ -0,0 +1,21 @@
+#pragma once
+
+#include "outputs.h"
+
+// relay and current sensor pins
+#define WATER_PUMP_1_PIN 22
+#define WATER_PUMP_2_PIN 21
+#define AIR_PUMP_PIN 19
+#define WATER_PUMP_1_CURRENT 34
+#define WATER_PUMP_2_CURRENT 35
+#define AIR_PUMP_CURRENT 32
+
+// outputs wired to this controller, add a line per pump (web ids must match
+// index.html). The simulator and the unit tests run the same table
+static const OutputConfig boardOutputs[] = {
+    // relay pin, current pin, adc reference (if the chip has no adc calibration), redundancy group, name, web id, min on (s), min off (s), climate scale
+    {WATER_PUMP_1_PIN, WATER_PUMP_1_CURRENT, 3.31, 0, "Water Pump 1", "pump1", 10, 10, CLIMATE_IRRIGATION},
+    {WATER_PUMP_2_PIN, WATER_PUMP_2_CURRENT, 3.3, 0, "Water Pump 2", "pump2", 10, 10, CLIMATE_IRRIGATION},
+    {AIR_PUMP_PIN, AIR_PUMP_CURRENT, 3.3, NO_GROUP, "Air Pump", "airPump", 10, 10, CLIMATE_AERATION},
+};
+#define BOARD_OUTPUT_COUNT (sizeof(boardOutputs) / sizeof(boardOutputs[0]))
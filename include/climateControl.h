@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CLIMATE_UPDATE_INTERVAL 60000 // ms between evaluations on the control task
+#define CLIMATE_TREND_POINTS 8        // DHT readings the temperature trend is regressed over
+#define CLIMATE_TREND_MIN_POINTS 3    // before there is a trend
+#define CLIMATE_TREND_WINDOW 7200     // seconds, older readings are left out of the trend
+#define CLIMATE_MAX_TREND 10          // F per hour the trend is clamped to (a door left open)
+#define CLIMATE_LOOKAHEAD 1           // hours the trend is projected ahead
+#define CLIMATE_SPAN 15               // F past the cool or hot heat index where the scale reaches its bound
+#define CLIMATE_STEP 0.1              // scales move in steps, once the target is a whole step away
+
+// which adaptive scale the pulses of an output follow
+enum ClimateRole : uint8_t
+{
+  CLIMATE_FIXED,      // as written
+  CLIMATE_IRRIGATION, // water pumps, also held back by the reservoir
+  CLIMATE_AERATION,   // air pumps, warm water holds less oxygen
+  CLIMATE_ROLES
+};
+
+// from the settings
+struct ClimateBounds
+{
+  bool enabled;
+  float coolHeatIndex; // F, below this pulses are cut back
+  float hotHeatIndex;  // F, above this they are stepped up
+  float minScale;      // duty cycle factor at CLIMATE_SPAN below the cool heat index
+  float maxScale;      // ... above the hot one
+};
+
+// duty cycle factor for a heat index: 1 between cool and hot, linear to the bounds beyond
+float climateDemand(float heatIndex, const ClimateBounds &bounds);
+
+// share of the reservoir between the low water distance (0) and the medium one (1), NAN when unknown
+float reservoirShare(float distanceCm, float lowCm, float mediumCm);
+
+// Adaptive pulse duty for the pump schedule. Each DHT reading goes into a
+// least squares temperature trend, the heat index projected an hour ahead on
+// it sets the demand, so a warming morning steps the pumps up before it gets
+// hot. Irrigation is capped by the reservoir (the minimum scale when it is
+// low), aeration is not. Scales change in CLIMATE_STEP steps so a heat index
+// wobbling around a threshold does not keep rewriting the schedule, and go
+// straight back to 1 when disabled or without a reading. Pure math, the same
+// readings always give the same scales.
+class ClimateController
+{
+public:
+  void reading(float temperature, float heatIndex, uint32_t epoch); // a new DHT reading
+  void stale();                                                     // no recent reading, back to the schedule as written
+  // reservoir from reservoirShare(), true when a scale changed
+  bool update(const ClimateBounds &bounds, float reservoir);
+
+  float scale(ClimateRole role) const { return scales[role]; }
+  bool known() const { return valid; }
+  float trend() const { return slope; }            // F per hour, 0 until there are enough readings
+  float projected() const { return anticipated; } // heat index CLIMATE_LOOKAHEAD ahead
+
+private:
+  bool valid = false;
+  float anticipated = 0;
+  float slope = 0;
+  float scales[CLIMATE_ROLES] = {1, 1, 1};
+  uint32_t times[CLIMATE_TREND_POINTS];
+  float temperatures[CLIMATE_TREND_POINTS];
+  uint8_t head = 0;
+  uint8_t count = 0;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NTP_PACKET_SIZE 48
+#define NTP_PORT 123
+#define NTP_MAX_DELAY 500000         // microseconds round trip, slower answers are not trusted
+#define CLOCK_STEP_THRESHOLD 2000000 // microseconds, larger offsets are stepped, smaller ones slewed
+#define CLOCK_MIN_DRIFT_INTERVAL 900 // seconds between two syncs before drift is estimated from them
+#define CLOCK_MAX_DRIFT_PPM 500      // crystal tolerance plus temperature, anything above is a bad sample
+#define CLOCK_DRIFT_GAIN 0.5         // share of the measured drift error taken over per sync
+
+// One NTP exchange. offset is server time minus local time (positive: the
+// local clock is behind), delay the round trip minus the server's hold time.
+struct NtpSample
+{
+  int64_t offset; // microseconds
+  int64_t delay;  // microseconds
+  uint8_t stratum;
+};
+
+// SNTP client request carrying transmitMicros (unix time) as its transmit
+// timestamp. The server echoes it back, which is how ntpParse matches answers.
+void ntpRequest(uint8_t *packet, int64_t transmitMicros);
+
+// checks a server answer and works out offset and delay. sentMicros is the
+// transmit time of the request, receivedMicros the local time the answer came
+// in, both unix time. Returns NULL when valid, otherwise what was wrong.
+const char *ntpParse(const uint8_t *packet, size_t length, int64_t sentMicros, int64_t receivedMicros, NtpSample &sample);
+
+// Keeps the local clock on NTP time. Large offsets are stepped, small ones
+// slewed. The remaining offset after each sync interval is the drift of the
+// crystal, it is folded into a ppm estimate that compensate() slews out
+// between syncs. Pure math, the caller reads and adjusts the actual clock.
+class ClockDiscipline
+{
+public:
+  explicit ClockDiscipline(float ppm = 0) : drift(ppm) {}
+
+  // drift estimate saved before a reboot
+  void restore(float ppm);
+
+  // a valid sample taken at local time localMicros. Returns the correction to
+  // apply in microseconds, step tells whether to set the clock (true) or slew it
+  int64_t sync(const NtpSample &sample, int64_t localMicros, bool &step);
+
+  // the local clock was stepped by micros on purpose (utc offset change)
+  void shift(int64_t micros);
+
+  // drift correction owed since the last call (or sync), to be slewed
+  int64_t compensate(int64_t localMicros);
+
+  float ppm() const { return drift; } // how much the local clock runs slow (negative: fast)
+  bool synced() const { return haveSync; }
+  int64_t lastOffset() const { return offset; }
+  int64_t lastDelay() const { return delay; }
+
+private:
+  float drift;
+  bool haveSync = false;
+  int64_t lastSync = 0;       // local time of the last sync, after its correction
+  int64_t lastCompensate = 0; // local time compensate() last accounted up to
+  double owed = 0;            // fraction of a microsecond not slewed yet
+  int64_t offset = 0;
+  int64_t delay = 0;
+};
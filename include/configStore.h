@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Preferences.h>
+
+#include "settings.h"
+
+#define CONFIG_NAMESPACE "config" // NVS namespace, slots are the keys "a" and "b"
+
+// Settings in NVS, double buffered. Every save writes the slot that does not
+// hold the current settings with the next sequence number, so a reset in the
+// middle of a write leaves the previous settings intact and load() picks the
+// intact slot with the highest sequence.
+class ConfigStore
+{
+public:
+  // loads the newest intact slot into settings, defaults when there is none.
+  // Call before the tasks start
+  bool begin(Settings &settings);
+  // validates and commits settings, NULL when saved
+  const char *save(const Settings &settings);
+
+  uint32_t sequence() const { return current; } // 0 until the first save
+  uint32_t saveCount() const { return saves; }
+  const char *loadError() const { return error; } // why the slots were not used, "" if they were
+
+private:
+  const char *readSlot(uint8_t slot, Settings &settings, uint32_t &sequence);
+
+  Preferences nvs;
+  bool opened = false;
+  uint32_t current = 0;
+  uint8_t currentSlot = 1; // the first save goes to slot 0
+  uint32_t saves = 0;
+  const char *error = "";
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "outputs.h"
+
+// WebSocket control channel (/ws), one JSON object per text frame.
+//
+// request:  {"id":7,"cmd":"override","output":"pump1","state":1,"time":30}
+//           {"id":8,"cmd":"auto","output":"pump1"}
+// ack:      {"id":7,"ok":true,"output":"pump1","command":"On (Override 30 min)"}
+// error:    {"id":7,"ok":false,"error":"unknown output"}
+//
+// time is in minutes, above PERMANENT_OVERRIDE the override never expires. The
+// ack is sent once the control task has applied the command and carries the
+// resulting command text, other pages see the change through telemetry.
+
+#define CONTROL_OUTPUT_SIZE 16
+#define CONTROL_FRAME_SIZE 128
+#define CONTROL_MAX_TIME 65 // slider maximum, "Permanent"
+
+enum ControlCommand : uint8_t
+{
+  CONTROL_OVERRIDE,
+  CONTROL_AUTO
+};
+
+struct ControlRequest
+{
+  uint32_t id;
+  ControlCommand command;
+  char output[CONTROL_OUTPUT_SIZE]; // output web id
+  bool state;
+  uint8_t time;
+};
+
+// returns NULL when valid, otherwise the error for the client (request.id is
+// filled in whenever the frame had one)
+const char *parseControlRequest(const char *frame, size_t length, ControlRequest &request);
+// parseControlRequest, then the output looked up by its web id in configs (count
+// of them), output is its index. NULL when the control task can apply it
+const char *parseControlCommand(const char *frame, size_t length, const OutputConfig *configs, size_t count, ControlRequest &request, uint8_t &output);
+
+// the write functions return the frame length, 0 if it did not fit
+size_t writeControlAck(char *out, size_t size, uint32_t id, const char *output, const char *command);
+size_t writeControlError(char *out, size_t size, uint32_t id, const char *error);
+// the command text acks and the web page show for an output: "On (Auto)", "Off
+// (Override 5 min)" with the minutes left at epoch, "On (Override Permanent)"
+size_t writeCommandText(char *out, size_t size, const OutputState &state, uint32_t epoch);
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "hal.h"
+#include "outputs.h"
+#include "outputDriver.h"
+#include "failover.h"
+#include "currentCalibration.h"
+#include "pumpHealth.h"
+#include "climateControl.h"
+#include "waterLevel.h"
+#include "powerPlanner.h"
+#include "settings.h"
+
+#define HISTORY_FLUSH_INTERVAL 900000 // ms between writes of buffered sensor history
+#define MQTT_SAMPLE_INTERVAL 60000    // ms between MQTT telemetry samples
+
+// alarm inputs: one command/status mismatch alarm per output (its index), then
+// these, numbered on from the output count
+enum SensorAlarm
+{
+  SENSOR_HIGH_TEMP,
+  SENSOR_LOW_WATER,
+  SENSOR_WATER_FAULT,
+  SENSOR_PUMP_CURRENT, // a pump running well off its learned current
+  SENSOR_PUMP_HEALTH,  // a pump's current waveform or start-up well off its learned baseline
+  SENSOR_ALARMS
+};
+
+enum WaterLevel
+{
+  W_LOW,
+  W_MED,
+  W_HIGH,
+  W_FAULT // sensor did not return enough echoes
+};
+
+// what pollClimate() found in the DHT cache
+enum ClimatePoll
+{
+  CLIMATE_SAME,  // nothing new
+  CLIMATE_NEW,   // a new reading, the high temperature alarm has had it
+  CLIMATE_STALE, // the reading went stale, once until the next one
+};
+
+// how a finished ultrasonic reading went
+enum WaterReading
+{
+  WATER_READ,    // the level follows it
+  WATER_STRAY,   // too far from the filtered distance, ignored
+  WATER_NO_ECHO, // level W_FAULT
+};
+
+// Jobs of other tasks the wake plan has to be awake for, in ms from now (late is
+// negative, NO_TASK_DEADLINE when there is none). Single words of theirs, copied by
+// the caller.
+#define NO_TASK_DEADLINE INT32_MAX
+struct TaskDeadlines
+{
+  int32_t alarmMs;     // next alarm delay on/off timer, AlarmEngine::dueIn()
+  bool alarmInputs;    // inputs queued for the alarm task
+  int32_t waterMs;     // next water level reading
+  int32_t historyMs;   // next history sample
+  int32_t flushMs;     // next history flush
+  int32_t telemetryMs; // next MQTT sample
+  bool radioUp;        // the station is up outside of the upload windows
+};
+
+// level from the filtered distance to the water; low only clears WATER_HYSTERESIS_CM
+// below the low distance, so a level hovering there does not flap the alarm
+WaterLevel classifyWaterLevel(float distanceCm, WaterLevel previous, const Settings &settings);
+// high temperature alarm condition, it only clears highTempHysteresis below highTempAlarm
+bool highTemperature(float fahrenheit, bool previous, const Settings &settings);
+// the sensors, task jobs and upload windows of a wake plan started at the current epoch
+void planTasks(WakePlanner &planner, Hal &hal, uint32_t nowMs, const TaskDeadlines &deadlines, const Settings &settings);
+
+// The glue between the hal, the outputs and the pure modules, the same on the
+// board (main.cpp) and in the simulator: current windows into the calibration,
+// failover and pump health, pump captures, pump control, the alarm inputs, the
+// climate and water level readings and the wake plan. Web events, logging and
+// timing stay with the caller, which runs each part on the task main.cpp has it
+// on (sensing: pollClimate(), readWaterLevel(); control: the rest). Alarm inputs
+// go out through the handler, the pump ones only when they change, the sensor
+// ones with every reading.
+template <size_t N>
+class Controller
+{
+public:
+  typedef void (*AlarmInput)(uint8_t alarm, bool condition);
+
+  Controller(Hal &hal, OutputBank<N> &outputs, OutputDriver &driver, FailoverSupervisor<N> &failover, CurrentChannel *channels, PumpHealth *health,
+             WaterLevelEstimator &water, const Settings &settings, AlarmInput alarmInput)
+      : hal(hal), outputs(outputs), driver(driver), failover(failover), channels(channels), health(health), water(water), settings(settings),
+        alarmInput(alarmInput), mismatch()
+  {
+  }
+
+  void updateCurrentReadings()
+  {
+    // current sensors are sampled in the background, pick up each new RMS window (100ms)
+    if (hal.currentSequence() == currentSequence)
+      return;
+    currentSequence = hal.currentSequence();
+    // true RMS has the sensor's zero current offset removed already, the channel takes out the noise floor
+    uint32_t now = hal.millis();
+    for (size_t i = 0; i < N; i++)
+    {
+      uint8_t pin = outputs.config(i).pin;
+      outputs[i].current = channels[i].update(hal.currentRmsCounts(i), driver.driven(pin), driver.sinceEdge(pin, now), settings.runningCurrent);
+      outputs[i].status = channels[i].running();
+      failover.window(i, driver.driven(pin), outputs[i].status, driver.sinceEdge(pin, now), now);
+      health[i].window(outputs[i].current, driver.driven(pin), outputs[i].status, driver.sinceEdge(pin, now));
+    }
+  }
+
+  // capture a running pump's current waveform and score it, true when a capture was scored
+  bool analysePumpHealth()
+  {
+    // one capture at a time, the pumps that have been running long enough to settle take turns
+    uint32_t now = hal.millis();
+    if (capturing >= 0)
+    {
+      if (!hal.currentCaptureReady())
+        return false;
+      // a relay edge or the pump stopping during the capture spoils it
+      uint8_t pin = outputs.config(capturing).pin;
+      bool scored = driver.driven(pin) and driver.sinceEdge(pin, now) >= now - captureStart and channels[capturing].running();
+      if (scored)
+        health[capturing].capture(hal.currentCapture());
+      capturing = -1;
+      return scored;
+    }
+    if (now - captureStart < PUMP_CAPTURE_INTERVAL)
+      return false;
+    for (size_t n = 0; n < N; n++)
+    {
+      uint8_t i = (nextCapture + n) % N;
+      uint8_t pin = outputs.config(i).pin;
+      if (driver.driven(pin) and driver.sinceEdge(pin, now) >= CAL_SETTLE_MS and channels[i].running())
+      {
+        hal.startCurrentCapture(i);
+        capturing = i;
+        nextCapture = i + 1;
+        captureStart = now;
+        break;
+      }
+    }
+    return false;
+  }
+
+  // failover, then the outputs; returns the outputs whose override ran out (bit i)
+  uint32_t control(uint32_t epoch)
+  {
+    failover.update(epoch, hal.millis());
+    return outputs.control(epoch);
+  }
+
+  void feedPumpAlarms()
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      // what the relay is driven to, a command held back by the minimum times or inrush staggering is not a fault.
+      // A pump its group took over from stays in alarm until it draws current again on a trial start
+      bool now = driver.driven(outputs.config(i).pin) != outputs[i].status or failover.failed(i);
+      if (now != mismatch[i])
+      {
+        mismatch[i] = now;
+        alarmInput(i, now);
+      }
+    }
+    // running, but well off the learned current (clogged, dry, jammed), long before it stops
+    bool anyDegraded = false;
+    for (size_t i = 0; i < N; i++)
+      anyDegraded = anyDegraded or channels[i].degraded();
+    if (anyDegraded != degraded)
+    {
+      degraded = anyDegraded;
+      alarmInput(N + SENSOR_PUMP_CURRENT, degraded);
+    }
+    // waveform or start-up off the pump's own baseline (cavitation, bearings, a failing capacitor)
+    bool anyUnhealthy = false;
+    for (size_t i = 0; i < N; i++)
+      anyUnhealthy = anyUnhealthy or health[i].unhealthy();
+    if (anyUnhealthy != unhealthy)
+    {
+      unhealthy = anyUnhealthy;
+      alarmInput(N + SENSOR_PUMP_HEALTH, unhealthy);
+    }
+  }
+
+  // a mismatch alarm restored after a reboot, a matching pump posts the clear on the first feedPumpAlarms()
+  void restoreMismatch(size_t i) { mismatch[i] = true; }
+
+  // the latest DHT reading from the cache into f, h and hif (fahrenheit, %, fahrenheit)
+  ClimatePoll pollClimate(float &f, float &h, float &hif)
+  {
+    if (!hal.readClimate(f, h, hif))
+    {
+      // the high temperature alarm keeps its last state
+      if (climateStale)
+        return CLIMATE_SAME;
+      climateStale = true;
+      return CLIMATE_STALE;
+    }
+    if (hal.climateSequence() == polledSequence)
+      return CLIMATE_SAME;
+    climateStale = false;
+    polledSequence = hal.climateSequence();
+    highTemp = highTemperature(f, highTemp, settings);
+    alarmInput(N + SENSOR_HIGH_TEMP, highTemp);
+    return CLIMATE_NEW;
+  }
+
+  // follow heat index, its trend and the reservoir, true when a scale changed and the schedule has to be compiled again
+  bool followClimate(ClimateController &climate, const ClimateBounds &bounds)
+  {
+    float f, h, hif;
+    if (!hal.readClimate(f, h, hif))
+    {
+      climate.stale();
+    }
+    else if (hal.climateSequence() != adaptedSequence)
+    {
+      adaptedSequence = hal.climateSequence();
+      climate.reading(f, hif, hal.epoch());
+    }
+    return climate.update(bounds, reservoir());
+  }
+
+  // a finished ultrasonic reading into the estimator and the water level
+  WaterReading readWaterLevel()
+  {
+    uint32_t echo;
+    if (!hal.distanceMicros(echo))
+    {
+      level = W_FAULT;
+      alarmInput(N + SENSOR_WATER_FAULT, true);
+      return WATER_NO_ECHO;
+    }
+    alarmInput(N + SENSOR_WATER_FAULT, false);
+    // sound speed at the air temperature, 20C while there is no DHT reading
+    float f, h, hif;
+    float celsius = hal.readClimate(f, h, hif) ? (f - 32) / 1.8 : 20;
+    if (!water.update(echo, celsius, hal.epoch()))
+      return WATER_STRAY;
+    distanceCm = water.distance();
+    level = classifyWaterLevel(distanceCm, level, settings);
+    // the alarm latches, whoever refills the reservoir acknowledges it
+    alarmInput(N + SENSOR_LOW_WATER, level == W_LOW);
+    return WATER_READ;
+  }
+
+  WaterLevel waterLevel() const { return level; }
+  float waterDistance() const { return distanceCm; } // cm, filtered, the last reading that was not stray
+  // share of the reservoir for the climate controller, NAN without a level
+  float reservoir() const
+  {
+    return (level != W_FAULT and water.valid()) ? reservoirShare(distanceCm, settings.waterLowCm, settings.waterMediumCm) : NAN;
+  }
+
+  // next wakeup the outputs, alarms, sensors, task jobs and upload windows need
+  PowerPlan planWakeup(uint32_t nowMs, const TaskDeadlines &deadlines)
+  {
+    WakePlanner planner;
+    planner.start(hal.epoch());
+    for (size_t i = 0; i < N; i++)
+    {
+      uint8_t pin = outputs.config(i).pin;
+      const OutputState &state = outputs[i];
+      // relay on, an edge held back by the minimum times, the current still settling or a stuck relay
+      if (driver.driven(pin) or driver.commanded(pin) or state.status or driver.sinceEdge(pin, nowMs) < POWER_SETTLE_MS)
+        planner.busy(POWER_RUNNING);
+      // an output in override does not look its schedule up
+      if (state.override)
+        planner.dueAt(state.overrideEnd, POWER_OVERRIDE);
+      else
+        planner.dueAt(state.scheduleNext, POWER_SCHEDULE);
+    }
+    planTasks(planner, hal, nowMs, deadlines, settings);
+    return planner.plan();
+  }
+
+private:
+  Hal &hal;
+  OutputBank<N> &outputs;
+  OutputDriver &driver;
+  FailoverSupervisor<N> &failover;
+  CurrentChannel *channels;
+  PumpHealth *health;
+  WaterLevelEstimator &water;
+  const Settings &settings;
+  AlarmInput alarmInput;
+
+  uint32_t currentSequence = 0; // last RMS window picked up
+  int8_t capturing = -1;        // output whose capture is being taken
+  uint8_t nextCapture = 0;
+  uint32_t captureStart = 0;
+  bool mismatch[N]; // last inputs posted
+  bool degraded = false;
+  bool unhealthy = false;
+  bool highTemp = false;
+  bool climateStale = false;
+  uint32_t polledSequence = 0;  // last DHT reading polled
+  uint32_t adaptedSequence = 0; // last DHT reading fed to the climate controller
+  WaterLevel level = W_LOW;
+  float distanceCm = 0;
+};
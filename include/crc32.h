@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// CRC-32 (IEEE, as zlib), bitwise. Only used on small records, no table
+inline uint32_t crc32(const uint8_t *data, size_t length)
+{
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    for (int b = 0; b < 8; b++)
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+  }
+  return ~crc;
+}
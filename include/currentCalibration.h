@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CAL_SETTLE_MS 3000             // after a relay edge (inrush, run down) before windows are learned from
+#define CAL_ZERO_WINDOWS 50            // averaging of the idle noise floor, in RMS windows (5 s)
+#define CAL_FAST_WINDOWS 100           // averaging of the current compared with the nominal one (10 s)
+#define CAL_NOMINAL_MIN_WINDOWS 3000   // running windows before the nominal current is trusted (5 min)
+#define CAL_NOMINAL_WINDOWS 600000     // averaging of the nominal current (~17 h of running), slow so a clog builds up against it
+#define CAL_LOW_RATIO 0.8              // current below this share of nominal: clogged or running dry
+#define CAL_HIGH_RATIO 1.25            // above: jammed or bearing wear
+#define CAL_RUNNING_SHARE 0.3          // share of the nominal current that counts as running once learned
+
+// What a channel has learned, kept on SPIFFS across reboots
+struct ChannelLearned
+{
+  float noise2;          // idle RMS squared, ADC counts^2
+  float nominal;         // amps while running normally
+  uint32_t zeroWindows;  // windows averaged into noise2
+  uint32_t runWindows;   // windows averaged into nominal
+};
+
+// Calibration of one ACS712 channel from its RMS windows. The RMS already has
+// the sensor's DC offset removed, what is left at zero current is noise, which
+// adds in quadrature; it is learned while the relay is off and subtracted.
+// While the pump runs normally its current is averaged into a nominal current,
+// the running threshold and the degradation check follow from that. Pure
+// math, fed by the control task.
+class CurrentChannel
+{
+public:
+  // voltsPerCount: ADC gain (eFuse characterisation or measured reference / 4095),
+  // voltsPerAmp: sensor sensitivity as seen by the ADC (divider included)
+  void configure(float voltsPerCount, float voltsPerAmp);
+  void restore(const ChannelLearned &saved);
+
+  // one RMS window. driven: relay on, sinceEdgeMs: since it last changed,
+  // fallbackThreshold: amps that count as running until the nominal current is learned.
+  // Returns the current in amps
+  float update(float rmsCounts, bool driven, uint32_t sinceEdgeMs, float fallbackThreshold);
+
+  float amps() const { return current; }
+  bool running() const { return isRunning; }
+  bool learned() const { return saved.runWindows >= CAL_NOMINAL_MIN_WINDOWS; }
+  float nominal() const { return saved.nominal; }
+  float zeroCounts() const; // idle RMS
+  float ratio() const { return (learned() and saved.nominal > 0) ? smoothed / saved.nominal : 1; } // averaged current / nominal
+  bool degraded() const { return isDegraded; } // last run well off its nominal current
+  const ChannelLearned &state() const { return saved; }
+
+private:
+  float ampsPerCount = 0;
+  ChannelLearned saved = {};
+  float current = 0;
+  float smoothed = 0;     // CAL_FAST_WINDOWS average of the current run
+  uint32_t runLength = 0; // settled running windows of the current run
+  bool isRunning = false;
+  bool isDegraded = false;
+};
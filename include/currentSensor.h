@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+#include "hal.h"
+#include "rms.h"
+
+#define MAINS_FREQUENCY 60       // Hz (Hawaii grid)
+#define CURRENT_SAMPLE_RATE 2400 // Hz per channel, 40 samples per mains cycle
+#define CURRENT_RMS_CYCLES 6     // whole mains cycles per RMS window (100ms)
+#define CURRENT_RMS_WINDOW (CURRENT_SAMPLE_RATE / MAINS_FREQUENCY * CURRENT_RMS_CYCLES)
+#define CURRENT_MAX_CHANNELS 10 // one per output
+
+// Continuous sampling of the ACS712 current sensors. A hardware timer wakes a
+// sampling task at CURRENT_SAMPLE_RATE, the task fills one window buffer per
+// channel and publishes the RMS of each full window through atomics, so the
+// control code never waits on the ADC. The ADC gain comes from the eFuse
+// characterisation of the chip (esp_adc_cal) where it has one. On request the
+// raw samples of one channel are copied out as well, for the pump health FFT.
+class CurrentSensor
+{
+public:
+  void begin(const uint8_t *pins, uint8_t count); // up to CURRENT_MAX_CHANNELS analog pins
+  float rmsCounts(uint8_t channel) const { return rms[channel].load(std::memory_order_relaxed); } // raw ADC counts
+  uint32_t sequence() const { return windows.load(std::memory_order_acquire); } // bumps every published window
+  uint32_t missedSamples() const { return missed.load(std::memory_order_relaxed); }
+  float voltsPerCount() const { return gain; } // 0 when the chip carries no ADC calibration
+  void pause(bool paused);                      // stops the sampling timer while no relay is on (low power)
+  bool paused() const { return stopped; }
+  void startCapture(uint8_t channel);           // the next CURRENT_CAPTURE_SIZE samples of channel
+  bool captureReady() { return captureDone.exchange(false, std::memory_order_acquire); } // true once when they are in
+  const uint16_t *capture() const { return captured; }
+
+private:
+  static void samplingTask(void *arg);
+  static void IRAM_ATTR onTimer();
+  void sampleAll();
+
+  uint8_t pins[CURRENT_MAX_CHANNELS];
+  uint8_t channels = 0;
+  uint16_t window[CURRENT_MAX_CHANNELS][CURRENT_RMS_WINDOW];
+  uint16_t index = 0;
+  float gain = 0;
+  bool stopped = false;
+  std::atomic<float> rms[CURRENT_MAX_CHANNELS];
+  std::atomic<uint32_t> windows{0};
+  std::atomic<uint32_t> missed{0};
+  uint16_t captured[CURRENT_CAPTURE_SIZE];
+  uint16_t captureIndex = 0;
+  std::atomic<int8_t> captureChannel{-1}; // -1 when no capture is running
+  std::atomic<bool> captureDone{false};
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DHT_BITS 40              // 2 bytes humidity, 2 bytes temperature, checksum
+#define DHT_RESPONSE_MIN_US 40   // sensor answers low ~80us, then high ~80us
+#define DHT_RESPONSE_MAX_US 120
+#define DHT_BIT_LOW_MIN_US 30    // every bit starts low ~50us
+#define DHT_BIT_LOW_MAX_US 90
+#define DHT_BIT_HIGH_MIN_US 10   // then high 26-28us for a 0, 70us for a 1
+#define DHT_BIT_HIGH_MAX_US 100
+#define DHT_ONE_THRESHOLD_US 48
+
+enum DhtModel : uint8_t
+{
+  DHT_11, // whole degrees and %, tenths on newer parts
+  DHT_22  // tenths, 16 bit
+};
+
+// one level held on the data line, as captured by the RMT peripheral
+struct DhtPulse
+{
+  uint8_t level;
+  uint16_t micros;
+};
+
+struct DhtSample
+{
+  float celsius;
+  float humidity; // %
+};
+
+// Decodes a captured frame: anything before the sensor's response (the end of
+// the start signal) is skipped, then 40 bits are read from the length of their
+// high pulse. NULL when the frame is complete, the checksum matches and the
+// values are in range.
+const char *decodeDht(const DhtPulse *pulses, size_t count, DhtModel model, DhtSample &sample);
+
+// NWS heat index (Rothfusz regression), fahrenheit
+float computeHeatIndex(float fahrenheit, float humidity);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <driver/rmt.h>
+
+#include "dhtDecoder.h"
+
+#define DHT_START_MS 20          // host pulls the line low this long to wake the sensor (18ms minimum)
+#define DHT_CAPTURE_TIMEOUT 10   // ms for the frame to arrive, it takes ~5ms
+#define DHT_MAX_PULSES 96        // response + 40 bits, 2 pulses each, with room for the start signal
+#define DHT_RETRY_MIN 2000       // ms after the first failed read, doubles up to the read interval
+#define DHT_STALE_INTERVALS 2    // readings older than this many intervals are stale
+#define DHT_CATCH_UP_MS 100      // a read this far past due was held up by a light sleep
+#define DHT_RMT_CHANNEL RMT_CHANNEL_4
+
+// latest good reading
+struct DhtReading
+{
+  float temperature; // fahrenheit
+  float humidity;    // %
+  float heatIndex;   // fahrenheit
+  uint32_t takenMs;  // millis() when it was read
+};
+
+// DHT11/DHT22 on its own task. The frame is captured by the RMT peripheral
+// instead of bit banging with interrupts off, the task only sleeps through
+// the start signal and waits for the capture. A failed read is retried with
+// a doubling backoff. Readings are published through a sequence counter so
+// any task can take a consistent copy of the latest one without touching the
+// sensor.
+class DhtSensor
+{
+public:
+  void begin(uint8_t pin, DhtModel model, uint32_t intervalMs);
+  void setInterval(uint32_t intervalMs); // takes a reading straight away, then every intervalMs
+  uint32_t dueMs() const { return due.load(std::memory_order_relaxed); } // millis() the next read is due
+  void catchUp(uint32_t nowMs); // reads now if a light sleep held the tick count past a due read
+
+  bool latest(DhtReading &reading) const;                   // false before the first good reading
+  bool stale(uint32_t nowMs) const;                         // no good reading for DHT_STALE_INTERVALS intervals
+  uint32_t sequence() const { return published.load(std::memory_order_acquire) / 2; } // bumps with every good reading
+  uint32_t reads() const { return readCount.load(std::memory_order_relaxed); }
+  uint32_t failures() const { return failureCount.load(std::memory_order_relaxed); }
+  const char *lastError() const { return error.load(std::memory_order_relaxed); } // NULL until a read failed
+
+private:
+  static void readingTask(void *arg);
+  const char *read(DhtSample &sample);
+  void publish(const DhtSample &sample, uint32_t nowMs);
+
+  gpio_num_t pin = GPIO_NUM_0;
+  DhtModel model = DHT_11;
+  RingbufHandle_t ringbuffer = NULL;
+  TaskHandle_t task = NULL;
+  DhtPulse pulses[DHT_MAX_PULSES];
+  std::atomic<uint32_t> interval{0};
+  std::atomic<uint32_t> due{0};
+  // odd while a reading is being written
+  std::atomic<uint32_t> published{0};
+  std::atomic<float> temperature{0};
+  std::atomic<float> humidity{0};
+  std::atomic<float> heatIndex{0};
+  std::atomic<uint32_t> takenMs{0};
+  std::atomic<uint32_t> readCount{0};
+  std::atomic<uint32_t> failureCount{0};
+  std::atomic<const char *> error{NULL};
+};
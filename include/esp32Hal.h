@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ESP32Time.h>
+#include <soc/gpio_struct.h>
+
+#include "hal.h"
+#include "currentSensor.h"
+#include "dhtSensor.h"
+#include "ultrasonic.h"
+
+// Hal on the real board, the drivers are set up (begin) by main.cpp
+class Esp32Hal : public Hal
+{
+public:
+  Esp32Hal(ESP32Time &rtc, DhtSensor &dht, CurrentSensor &current, Ultrasonic &ultrasonic) : rtc(rtc), dht(dht), current(current), ultrasonic(ultrasonic) {}
+
+  uint32_t epoch() override { return rtc.getEpoch(); }
+  uint32_t micros() override { return ::micros(); }
+  uint32_t millis() override { return ::millis(); }
+  void pinWrite(uint8_t pin, bool high) override { digitalWrite(pin, high ? HIGH : LOW); }
+  bool pinRead(uint8_t pin) override { return digitalRead(pin); }
+  void writePins(uint32_t setMask, uint32_t clearMask) override;
+  uint32_t currentSequence() override { return current.sequence(); }
+  float currentRmsCounts(uint8_t channel) override { return current.rmsCounts(channel); }
+  float currentVoltsPerCount() override { return current.voltsPerCount(); }
+  void startCurrentCapture(uint8_t channel) override { current.startCapture(channel); }
+  bool currentCaptureReady() override { return current.captureReady(); }
+  const uint16_t *currentCapture() override { return current.capture(); }
+  uint32_t climateSequence() override { return dht.sequence(); }
+  bool readClimate(float &temperature, float &humidity, float &heatIndex) override;
+  int32_t climateDueIn(uint32_t nowMs) override { return (int32_t)(dht.dueMs() - nowMs); }
+  void startDistance() override { ultrasonic.startReading(); }
+  bool distanceBusy() override { return ultrasonic.busy(); }
+  bool distanceReady() override { return ultrasonic.update(::micros()); }
+  bool distanceMicros(uint32_t &echo) override;
+
+private:
+  ESP32Time &rtc;
+  DhtSensor &dht;
+  CurrentSensor &current;
+  Ultrasonic &ultrasonic;
+};
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "mqttClient.h"
+
+#define MQTT_TCP_TIMEOUT 3000 // ms for the TCP handshake, the network task blocks on it
+
+// MqttTransport on a WiFiClient socket
+class Esp32MqttTransport : public MqttTransport
+{
+public:
+  bool open(const char *host, uint16_t port) override;
+  bool connected() override { return client.connected(); }
+  size_t read(uint8_t *data, size_t size) override;
+  size_t write(const uint8_t *data, size_t length) override { return client.write(data, length); }
+  void close() override { client.stop(); }
+
+private:
+  WiFiClient client;
+};
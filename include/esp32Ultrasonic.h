@@ -0,0 +1,9 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "ultrasonic.h"
+
+// Ultrasonic wired to the ESP32, only one sensor is supported
+void beginUltrasonic(Ultrasonic &sensor, uint8_t trigPin, uint8_t echoPin); // pins and the echo interrupt
+void triggerUltrasonic();                                                   // the Ultrasonic::Trigger, 10us pulse
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+
+#include "wifiManager.h"
+
+// WifiRadio on the ESP32 WiFi driver. Scans are asynchronous and the driver's
+// own auto reconnect is off, WifiManager decides when to reconnect.
+class Esp32WifiRadio : public WifiRadio
+{
+public:
+  Esp32WifiRadio(const char *apSsid, const char *apPassword) : apSsid(apSsid), apPassword(apPassword) {}
+  void begin();
+
+  void startScan() override { WiFi.scanNetworks(true); }
+  int scanComplete() override { return WiFi.scanComplete(); }
+  void scanEntry(int i, char *ssid, size_t size, int32_t &rssi) override;
+  void scanDelete() override { WiFi.scanDelete(); }
+  void connect(const char *ssid, const char *password) override { WiFi.begin(ssid, password); }
+  bool connected() override { return WiFi.status() == WL_CONNECTED; }
+  void disconnect() override { WiFi.disconnect(); }
+  void startAccessPoint() override;
+  void stopAccessPoint() override;
+  void powerOff() override;
+  void powerOn() override { WiFi.mode(WIFI_STA); }
+
+private:
+  const char *apSsid;
+  const char *apPassword;
+};
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "outputs.h"
+
+#define FAILOVER_WINDOW_MS 100    // one RMS window of the current sensors
+#define FAILOVER_START_MS 200     // after a relay edge before a silent sensor counts (contact bounce, a window straddling the edge)
+#define FAILOVER_RETRY_MS 600000  // a failed pump gets a trial start this long after it last failed, while its group is running
+
+// why a role moved to another output
+enum FailoverReason : uint8_t
+{
+  FAILOVER_TAKEOVER, // the output running it failed
+  FAILOVER_BALANCE,  // it starts on a less worn pump of the group
+  FAILOVER_HOME,     // back on its own output
+};
+
+// Supervises the redundancy groups of an OutputBank. Outputs with the same
+// OutputConfig group can run each other's schedules (roles, role i is the
+// schedule of output i). A pump of a group that is driven but shows no current
+// for the detection time (whole RMS windows, FAILOVER_START_MS after its relay
+// edge) has failed: every role it runs moves to the least worn healthy pump of
+// its group straight away, whatever the schedule (windows, pulses, night or
+// day), and the pump drops out. FAILOVER_RETRY_MS later it gets a trial start
+// while the group is running, make before break so the water keeps flowing,
+// and it is back once it has drawn current for the detection time.
+//
+// Roles are otherwise handed out as they start, to their own output unless it
+// is ahead of the least worn healthy pump of its group by the balance time and
+// the run would narrow the gap, so wear evens out after a takeover without
+// roles hopping back and forth. Run time is the pump's whole life, the caller
+// saves it and hands it back to restoreRunSeconds() after a reboot. Pure, fed
+// by the control task from the current channels before OutputBank::control().
+template <size_t N>
+class FailoverSupervisor
+{
+public:
+  typedef void (*MoveHandler)(size_t role, size_t from, size_t to, FailoverReason why);
+
+  FailoverSupervisor(OutputBank<N> &bank, MoveHandler handler) : outputs(bank), moved(handler), members() {}
+
+  // detectMs: silence that counts as a failure, balanceMs: run time lead that
+  // hands roles to a less worn pump, 0 never does
+  void configure(uint32_t detectMs, uint32_t balanceMs)
+  {
+    detect = detectMs;
+    balanceWindows = balanceMs / FAILOVER_WINDOW_MS;
+  }
+
+  // one RMS window of output i: relay driven, current above the running threshold, since the last relay edge
+  void window(size_t i, bool driven, bool running, uint32_t sinceEdgeMs, uint32_t nowMs)
+  {
+    Member &member = members[i];
+    if (outputs.config(i).group == NO_GROUP or !driven or sinceEdgeMs < FAILOVER_START_MS)
+    {
+      member.quiet = 0;
+      member.proven = 0;
+      return;
+    }
+    if (running)
+    {
+      member.quiet = 0;
+      member.runWindows++;
+      if (member.failed and ++member.proven * FAILOVER_WINDOW_MS >= detect)
+      {
+        member.failed = false;
+        outputs.trial(i, false);
+        recoveries++;
+      }
+      return;
+    }
+    member.proven = 0;
+    if (++member.quiet * FAILOVER_WINDOW_MS < detect)
+      return;
+    // failed, or failed again on a trial start
+    member.quiet = 0;
+    member.failedAt = nowMs;
+    outputs.trial(i, false);
+    if (!member.failed)
+    {
+      member.failed = true;
+      member.failures++;
+    }
+  }
+
+  // moves roles off failed pumps, hands out the roles that start and starts
+  // the trials that are due. Returns true when a role moved
+  bool update(uint32_t epoch, uint32_t nowMs)
+  {
+    bool changed = false;
+    for (size_t role = 0; role < N; role++)
+    {
+      if (outputs.config(role).group == NO_GROUP)
+        continue;
+      bool on = outputs.scheduled(role, epoch);
+      size_t owner = outputs.owner(role);
+      bool starts = on and !(running >> role & 1);
+      running = on ? running | 1UL << role : running & ~(1UL << role);
+      // a role stays where it is while it runs, unless its pump failed or another pump running it was taken in hand
+      bool keep = (owner == role) ? !members[owner].failed : usable(owner);
+      if (!starts and keep)
+        continue;
+      size_t to = choose(role, epoch);
+      if (to == owner)
+        continue;
+      FailoverReason why = members[owner].failed ? FAILOVER_TAKEOVER : (to == role) ? FAILOVER_HOME : FAILOVER_BALANCE;
+      outputs.assign(role, to);
+      if (why == FAILOVER_TAKEOVER)
+        takeovers++;
+      else if (why == FAILOVER_BALANCE)
+        balances++;
+      if (moved)
+        moved(role, owner, to, why);
+      changed = true;
+    }
+    for (size_t i = 0; i < N; i++)
+    {
+      const Member &member = members[i];
+      if (member.failed and !outputs.onTrial(i) and !outputs[i].override and nowMs - member.failedAt >= FAILOVER_RETRY_MS and groupRunning(i))
+        outputs.trial(i, true);
+    }
+    return changed;
+  }
+
+  // run time saved before a reboot, before the first window
+  void restoreRunSeconds(size_t i, uint32_t seconds) { members[i].runWindows = seconds * (1000 / FAILOVER_WINDOW_MS); }
+
+  bool failed(size_t i) const { return members[i].failed; }
+  uint32_t failures(size_t i) const { return members[i].failures; }
+  uint32_t runSeconds(size_t i) const { return members[i].runWindows / (1000 / FAILOVER_WINDOW_MS); } // restored plus since boot
+  uint32_t takeoverCount() const { return takeovers; }
+  uint32_t balanceCount() const { return balances; }
+  uint32_t recoveryCount() const { return recoveries; }
+
+private:
+  struct Member
+  {
+    bool failed;
+    uint8_t quiet;       // silent windows in a row while driven
+    uint8_t proven;      // running windows in a row since it failed
+    uint32_t failedAt;   // ms
+    uint32_t failures;   // since boot
+    uint32_t runWindows; // wear, windows with current (~13 years)
+  };
+
+  bool sameGroup(size_t a, size_t b) const { return outputs.config(a).group == outputs.config(b).group; }
+  // can run roles: healthy and in auto
+  bool usable(size_t i) const { return !members[i].failed and !outputs[i].override; }
+
+  // least worn usable pump of the group, other than skip, N if none
+  size_t leastWorn(size_t role, size_t skip) const
+  {
+    size_t best = N;
+    for (size_t i = 0; i < N; i++)
+    {
+      if (i != skip and sameGroup(i, role) and usable(i) and (best == N or members[i].runWindows < members[best].runWindows))
+        best = i;
+    }
+    return best;
+  }
+
+  // who runs a role from now on
+  size_t choose(size_t role, uint32_t epoch)
+  {
+    if (members[role].failed)
+    {
+      size_t to = leastWorn(role, role);
+      return (to < N) ? to : role;
+    }
+    size_t other = leastWorn(role, role);
+    if (other == N or balanceWindows == 0 or outputs[role].override)
+      return role;
+    uint32_t lead = members[role].runWindows - members[other].runWindows;
+    if (members[role].runWindows < members[other].runWindows or lead < balanceWindows)
+      return role;
+    // the run about to start, a never ending one does not narrow anything
+    uint32_t end = outputs.schedule(role).nextTransition(epoch);
+    uint64_t length = (end > epoch) ? (uint64_t)(end - epoch) * (1000 / FAILOVER_WINDOW_MS) : UINT64_MAX;
+    return (length < 2 * (uint64_t)lead) ? other : role;
+  }
+
+  // one of the group's roles is running on a healthy pump
+  bool groupRunning(size_t i) const
+  {
+    for (size_t role = 0; role < N; role++)
+    {
+      if (sameGroup(role, i) and (running >> role & 1) and !members[outputs.owner(role)].failed)
+        return true;
+    }
+    return false;
+  }
+
+  OutputBank<N> &outputs;
+  MoveHandler moved;
+  Member members[N];
+  uint32_t running = 0; // roles scheduled on at the last update
+  uint32_t detect = 500;
+  uint32_t balanceWindows = 0;
+  uint32_t takeovers = 0;
+  uint32_t balances = 0;
+  uint32_t recoveries = 0;
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+
+#define CURRENT_CAPTURE_SIZE 256 // raw samples of one current channel in a capture
+
+// Hardware the controller logic touches, so the same logic runs on the ESP32
+// (esp32Hal.h) and against the simulated greenhouse of the native build
+// (src/sim). Network, web server and flash are not part of it.
+class Hal
+{
+public:
+  virtual ~Hal() {}
+
+  // clock
+  virtual uint32_t epoch() = 0; // local time, seconds
+  virtual uint32_t micros() = 0;
+  virtual uint32_t millis() = 0;
+
+  // gpio
+  virtual void pinWrite(uint8_t pin, bool high) = 0;
+  virtual bool pinRead(uint8_t pin) = 0;
+  // pins 0-31 in one go: bits of setMask go high, bits of clearMask low, other pins are left alone
+  virtual void writePins(uint32_t setMask, uint32_t clearMask) = 0;
+
+  // current sensors, RMS of the latest sampling window in ADC counts
+  virtual uint32_t currentSequence() = 0; // bumps with every new window
+  virtual float currentRmsCounts(uint8_t channel) = 0;
+  virtual float currentVoltsPerCount() = 0; // ADC gain from the chip's calibration, 0 if it has none
+  // raw samples of one channel at the sampling rate: startCurrentCapture() takes the next
+  // CURRENT_CAPTURE_SIZE, currentCaptureReady() returns true once when they are in,
+  // currentCapture() then holds them until the next capture is started
+  virtual void startCurrentCapture(uint8_t channel) = 0;
+  virtual bool currentCaptureReady() = 0;
+  virtual const uint16_t *currentCapture() = 0;
+
+  // DHT, the latest reading (fahrenheit and %) without touching the sensor,
+  // false when there is none or it is stale
+  virtual uint32_t climateSequence() = 0; // bumps with every new reading
+  virtual bool readClimate(float &temperature, float &humidity, float &heatIndex) = 0;
+  virtual int32_t climateDueIn(uint32_t nowMs) = 0; // ms until the next reading is taken, negative when late
+
+  // ultrasonic, startDistance() kicks off a reading, distanceReady() advances it
+  // and returns true once when it finished, distanceMicros() then holds the echo
+  // time (false on a fault)
+  virtual void startDistance() = 0;
+  virtual bool distanceBusy() = 0; // started and not finished yet
+  virtual bool distanceReady() = 0;
+  virtual bool distanceMicros(uint32_t &echo) = 0;
+};
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define HISTOGRAM_SUB_BITS 2 // 4 linear buckets per power of two, every bucket is within 25% of its values
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS * (33 - HISTOGRAM_SUB_BITS))
+
+// Log-linear (HDR style) histogram of 32 bit values, for timings in cycles or
+// microseconds. Fixed size (~0.5kB), record() is a few instructions and never
+// allocates. One writer; readers on another task may see a record half done,
+// which is fine for metrics.
+class Histogram
+{
+public:
+  void record(uint32_t value)
+  {
+    buckets[bucketOf(value)]++;
+    total++;
+    sumOfValues += value;
+    if (value > maxValue)
+      maxValue = value;
+  }
+
+  void reset()
+  {
+    memset(buckets, 0, sizeof(buckets));
+    total = 0;
+    sumOfValues = 0;
+    maxValue = 0;
+  }
+
+  uint32_t count() const { return total; }
+  uint64_t sum() const { return sumOfValues; }
+  uint32_t max() const { return maxValue; } // watermark, exact
+  uint32_t bucketCount(uint8_t bucket) const { return buckets[bucket]; }
+
+  // values below limit, exact when limit is a bucket boundary (any power of two is)
+  uint32_t countBelow(uint32_t limit) const
+  {
+    uint32_t below = 0;
+    uint8_t last = bucketOf(limit);
+    for (uint8_t i = 0; i < last; i++)
+      below += buckets[i];
+    return below;
+  }
+
+  // upper bound of the bucket holding the given fraction (0-1) of the values
+  uint32_t percentile(float fraction) const
+  {
+    uint32_t rank = fraction * total;
+    uint32_t seen = 0;
+    for (uint8_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+      seen += buckets[i];
+      if (seen > rank)
+        return bucketHigh(i) < maxValue ? bucketHigh(i) : maxValue;
+    }
+    return maxValue;
+  }
+
+  static uint8_t bucketOf(uint32_t value)
+  {
+    if (value < HISTOGRAM_SUB_BUCKETS)
+      return value;
+    uint8_t exponent = 31 - __builtin_clz(value);
+    uint8_t sub = (value >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return HISTOGRAM_SUB_BUCKETS * (exponent - HISTOGRAM_SUB_BITS + 1) + sub;
+  }
+
+  // largest value that lands in a bucket
+  static uint32_t bucketHigh(uint8_t bucket)
+  {
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+      return bucket;
+    uint8_t exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    uint64_t width = 1ULL << (exponent - HISTOGRAM_SUB_BITS);
+    uint64_t low = (1ULL << exponent) + (bucket % HISTOGRAM_SUB_BUCKETS) * width;
+    return low + width - 1;
+  }
+
+private:
+  uint32_t buckets[HISTOGRAM_BUCKETS] = {};
+  uint32_t total = 0;
+  uint64_t sumOfValues = 0;
+  uint32_t maxValue = 0;
+};
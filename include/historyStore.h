@@ -0,0 +1,105 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+
+#include "timeSeries.h"
+
+#define HISTORY_LEVELS 3          // 1 min, 15 min and 1 h averages
+#define HISTORY_MAX_SERIES 16
+#define HISTORY_SEGMENT_SIZE 2048 // bytes per segment file, header included
+#define HISTORY_SEGMENTS 4        // segment files per series and level, the oldest is overwritten
+#define HISTORY_BUFFER 48         // encoded bytes held in RAM before they are appended
+#define HISTORY_MAGIC 0x31475354  // "TSG1"
+
+struct SeriesConfig
+{
+  const char *name;
+  uint8_t decimals; // readings are stored as integers scaled by 10^decimals
+};
+
+struct SegmentHeader
+{
+  uint32_t magic;
+  uint32_t sequence;  // increases with every new segment of a series/level, orders the ring
+  uint32_t firstTime; // time of the first sample (epoch / level step)
+  uint8_t series;
+  uint8_t level;
+  uint16_t reserved;
+};
+
+// Sensor history on SPIFFS. Readings are averaged into one rollup per level and
+// every finished bucket is delta/varint encoded into a small RAM buffer, which is
+// appended to the current segment file when full. Each series/level writes a
+// ring of fixed-size segments, so files are only ever appended to or truncated
+// and rewritten from the start once per trip around the ring.
+class HistoryStore
+{
+public:
+  HistoryStore(const SeriesConfig *series, uint8_t count);
+  void begin();                                             // pick up the segment rings (call after SPIFFS.begin)
+  void record(uint8_t series, uint32_t epoch, float reading); // call from one task only
+  void flush();                                             // append buffered samples to flash
+
+  uint8_t seriesCount() const { return count; }
+  const SeriesConfig &series(uint8_t i) const { return configs[i]; }
+  int seriesIndex(const char *name) const;
+  static uint32_t levelStep(uint8_t level);
+  static uint8_t levelFor(uint32_t from, uint32_t to); // coarsest level still giving a useful number of points
+  static void segmentPath(char *path, size_t len, uint8_t series, uint8_t level, uint8_t segment);
+
+private:
+  struct Level
+  {
+    Rollup rollup;
+    SampleEncoder encoder;
+    uint32_t sequence;     // sequence of the current segment
+    uint16_t segmentBytes; // bytes on flash in the current segment
+    uint8_t segment;       // current segment of the ring
+    bool started;          // a segment has been started since boot
+    uint8_t buffered;
+    uint8_t buffer[HISTORY_BUFFER];
+  };
+
+  void append(uint8_t series, uint8_t level, const Sample &sample);
+  void startSegment(uint8_t series, uint8_t level, uint32_t firstTime);
+  void flushLevel(uint8_t series, uint8_t level);
+
+  const SeriesConfig *configs;
+  uint8_t count;
+  Level levels[HISTORY_MAX_SERIES][HISTORY_LEVELS];
+};
+
+// Streams one series as JSON, {"series":"..","step":60,"points":[[epoch,value],..]},
+// a few bytes at a time straight from the segment files, for a chunked response.
+class HistoryReader
+{
+public:
+  HistoryReader(HistoryStore &store, uint8_t series, uint8_t level, uint32_t from, uint32_t to);
+  ~HistoryReader();
+  size_t read(uint8_t *out, size_t maxLen); // 0 once everything has been sent
+
+private:
+  bool nextSample(Sample *sample);
+  bool openSegment();
+  void fillText();
+
+  HistoryStore &store;
+  uint8_t series;
+  uint8_t level;
+  uint32_t from;
+  uint32_t to;
+  uint8_t order[HISTORY_SEGMENTS]; // segments oldest first
+  uint8_t segments = 0;
+  uint8_t next = 0;
+  File file;
+  SampleDecoder decoder;
+  uint8_t buffer[64];
+  size_t bufferLen = 0;
+  size_t bufferPos = 0;
+  uint8_t stage = 0; // 0 header, 1 points, 2 footer, 3 done
+  bool first = true;
+  char text[64];
+  size_t textLen = 0;
+  size_t textPos = 0;
+};
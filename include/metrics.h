@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "histogram.h"
+
+#define METRICS_PART_SIZE 1536 // one part of the /metrics page, a histogram series fits easily
+
+// Prometheus text format (version 0.0.4) into a fixed buffer. length() is 0
+// once anything did not fit.
+//
+//   # HELP greenhouse_task_run_seconds Time spent in one task wakeup
+//   # TYPE greenhouse_task_run_seconds histogram
+//   greenhouse_task_run_seconds_bucket{task="control",le="4.27e-06"} 12
+//   ...
+class MetricsWriter
+{
+public:
+  MetricsWriter(char *out, size_t size) : out(out), size(size) {}
+
+  // HELP and TYPE lines, once per metric name
+  void family(const char *name, const char *type, const char *help);
+  // labels without braces (task="control"), NULL for none
+  void value(const char *name, const char *labels, double value);
+  // cumulative buckets at every other power of two from 2^firstOctave to
+  // 2^lastOctave units, then +Inf, sum and count. unitSeconds converts the
+  // recorded values (cycles, microseconds) to seconds
+  void histogram(const char *name, const char *labels, const Histogram &histogram, double unitSeconds, uint8_t firstOctave, uint8_t lastOctave);
+
+  size_t length() const { return overflow ? 0 : used; }
+
+private:
+  void sample(const char *name, const char *suffix, const char *labels, const char *le, double value);
+  void print(const char *format, ...);
+
+  char *out;
+  size_t size;
+  size_t used = 0;
+  bool overflow = false;
+};
+
+// Streams the page for a chunked response. The page is built a part at a
+// time by render(part, out, size), which returns the part length (0 if it did
+// not fit), so only one part is ever held in memory.
+class MetricsReader
+{
+public:
+  typedef size_t (*Render)(uint16_t part, char *out, size_t size);
+  MetricsReader(Render render, uint16_t parts) : render(render), parts(parts) {}
+  size_t read(uint8_t *buffer, size_t maxLen); // 0 at the end
+
+private:
+  Render render;
+  uint16_t parts;
+  uint16_t next = 0;
+  char text[METRICS_PART_SIZE];
+  size_t length = 0;
+  size_t sent = 0;
+};
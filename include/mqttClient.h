@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mqttPacket.h"
+
+#define MQTT_PACKET_SIZE 512       // largest packet sent or received
+#define MQTT_KEEP_ALIVE 60         // seconds, the broker drops us after 1.5x without a packet
+#define MQTT_CONNECT_TIMEOUT 5000  // ms for the CONNACK
+#define MQTT_ACK_TIMEOUT 10000     // ms for the PUBACK of a QoS 1 publish before the connection is dropped
+#define MQTT_RETRY_MIN 2000        // ms after the first failed connect, doubles every failure
+#define MQTT_RETRY_MAX 120000
+
+// Byte stream to the broker. open() may block for the TCP handshake, the rest
+// returns straight away.
+class MqttTransport
+{
+public:
+  virtual ~MqttTransport() {}
+  virtual bool open(const char *host, uint16_t port) = 0;
+  virtual bool connected() = 0;
+  virtual size_t read(uint8_t *data, size_t size) = 0; // what has arrived, 0 if nothing
+  virtual size_t write(const uint8_t *data, size_t length) = 0;
+  virtual void close() = 0;
+};
+
+enum MqttState : uint8_t
+{
+  MQTT_OFFLINE,    // waiting out the retry backoff (or no network)
+  MQTT_CONNECTING, // CONNECT sent, waiting for the CONNACK
+  MQTT_ONLINE
+};
+
+// Minimal MQTT 3.1.1 client, polled from the network task. Subscribes to one
+// topic at QoS 1 and publishes at QoS 0 or 1 with at most one QoS 1 publish in
+// flight, which is enough for a store-and-forward queue that only moves on
+// once the broker has acknowledged. Reconnects with a doubling backoff.
+class MqttClient
+{
+public:
+  typedef void (*MessageHandler)(const MqttMessage &message);
+
+  MqttClient(MqttTransport &transport, MessageHandler handler) : transport(transport), onMessage(handler) {}
+
+  // strings are kept, not copied. user, password and subscription may be NULL,
+  // the will topic gets "offline" when the connection drops and "online" on connect
+  void begin(const char *host, uint16_t port, const char *clientId, const char *user, const char *password, const char *subscription,
+             const char *statusTopic);
+  void update(uint32_t nowMs, bool network); // network: the station is up
+
+  MqttState state() const { return current; }
+  bool online() const { return current == MQTT_ONLINE; }
+  // false when offline, the packet does not fit, or (QoS 1) one is still in flight
+  bool publish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, bool retain = false);
+  bool inFlight() const { return pendingId != 0; }
+  bool delivered(); // true once after the QoS 1 publish in flight was acknowledged
+
+  uint32_t connects() const { return connectCount; }
+  uint32_t failures() const { return failureCount; }
+  uint32_t published() const { return publishCount; }
+  uint32_t received() const { return receiveCount; }
+
+private:
+  void connect(uint32_t nowMs);
+  void drop(uint32_t nowMs);
+  bool send(const uint8_t *data, size_t length, uint32_t nowMs);
+  void handle(const MqttPacket &packet, uint32_t nowMs);
+
+  MqttTransport &transport;
+  MessageHandler onMessage;
+  const char *host = NULL;
+  uint16_t port = 1883;
+  const char *clientId = "";
+  const char *user = NULL;
+  const char *password = NULL;
+  const char *subscription = NULL;
+  const char *statusTopic = NULL;
+  MqttState current = MQTT_OFFLINE;
+  uint32_t now = 0;      // of the last update
+  uint32_t since = 0;    // when the state was entered
+  uint32_t backoff = 0;  // 0 to connect on the next update
+  uint32_t lastSent = 0; // for the keep alive
+  uint32_t lastHeard = 0;
+  uint32_t pendingSince = 0;
+  uint16_t pendingId = 0;
+  uint16_t nextId = 1;
+  bool acked = false;
+  uint8_t rx[MQTT_PACKET_SIZE];
+  size_t rxLength = 0;
+  uint8_t tx[MQTT_PACKET_SIZE];
+  uint32_t connectCount = 0;
+  uint32_t failureCount = 0;
+  uint32_t publishCount = 0;
+  uint32_t receiveCount = 0;
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MQTT_TOPIC_SIZE 64
+
+// MQTT 3.1.1 control packet types (high nibble of the first byte)
+enum MqttPacketType : uint8_t
+{
+  MQTT_CONNECT = 1,
+  MQTT_CONNACK = 2,
+  MQTT_PUBLISH = 3,
+  MQTT_PUBACK = 4,
+  MQTT_SUBSCRIBE = 8,
+  MQTT_SUBACK = 9,
+  MQTT_PINGREQ = 12,
+  MQTT_PINGRESP = 13,
+  MQTT_DISCONNECT = 14
+};
+
+// The packet writers return the packet length, 0 if it does not fit. user,
+// password and willTopic may be NULL, the will is "offline", retained.
+size_t mqttConnect(uint8_t *out, size_t size, const char *clientId, const char *user, const char *password, uint16_t keepAlive, const char *willTopic);
+size_t mqttPublish(uint8_t *out, size_t size, const char *topic, const uint8_t *payload, size_t length, uint8_t qos, uint16_t packetId, bool retain);
+size_t mqttSubscribe(uint8_t *out, size_t size, uint16_t packetId, const char *topic, uint8_t qos);
+size_t mqttPuback(uint8_t *out, size_t size, uint16_t packetId);
+size_t mqttEmpty(uint8_t *out, size_t size, MqttPacketType type); // PINGREQ, DISCONNECT
+
+// one packet read off the stream, body points into the receive buffer
+struct MqttPacket
+{
+  MqttPacketType type;
+  uint8_t flags; // low nibble of the first byte
+  const uint8_t *body;
+  size_t length;
+};
+
+// Finds the packet at the front of a receive buffer. Returns its total length,
+// 0 while it is incomplete, -1 if the length field is malformed.
+int mqttFrame(const uint8_t *in, size_t length, MqttPacket &packet);
+
+struct MqttMessage
+{
+  char topic[MQTT_TOPIC_SIZE];
+  uint8_t qos;
+  uint16_t packetId; // QoS 1 and 2 only
+  const uint8_t *payload;
+  size_t length;
+};
+
+// NULL when the PUBLISH body is well formed and the topic fits
+const char *mqttParsePublish(const MqttPacket &packet, MqttMessage &message);
+// packet id of a PUBACK or SUBACK, the CONNACK return code, -1 when malformed
+int mqttPacketId(const MqttPacket &packet);
+int mqttConnackCode(const MqttPacket &packet);
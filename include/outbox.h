@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "stateJournal.h"
+
+#define OUTBOX_MAGIC 0x584f424d  // "MBOX"
+#define OUTBOX_CURSOR_MAGIC 0x52534355 // "UCSR"
+#define OUTBOX_RECORD_SIZE 256
+#define OUTBOX_PAYLOAD_SIZE (OUTBOX_RECORD_SIZE - 16)
+#define OUTBOX_SLOTS 128         // messages kept while offline, 32 KB
+
+struct OutboxRecord
+{
+  uint32_t magic;
+  uint32_t sequence; // goes to slot sequence % slots
+  uint16_t length;
+  uint16_t reserved;
+  uint8_t payload[OUTBOX_PAYLOAD_SIZE];
+  uint32_t crc; // of everything before it
+};
+static_assert(sizeof(OutboxRecord) == OUTBOX_RECORD_SIZE, "OutboxRecord is stored as is");
+
+// Bounded store-and-forward queue on flash. Messages are written to a ring
+// of fixed-size slots as they are queued, so they survive a reboot while the
+// broker is out of reach. When the ring is full the oldest message is
+// overwritten. Two cursor records at the start of the storage, written in
+// turn, hold the sequence of the last delivered message, so a torn write
+// loses at most the cursor update and that message is sent again
+// (at least once).
+class Outbox
+{
+public:
+  Outbox(JournalStorage &storage, uint16_t slots) : storage(storage), slots(slots) {}
+
+  void recover(); // finds the queued messages after a reboot
+  bool push(const void *payload, size_t length); // false if too long or the write failed
+  size_t peek(void *out, size_t size);           // oldest queued message, 0 when empty
+  void pop();                                    // the oldest one was delivered
+
+  uint32_t size() const { return head - tail; }
+  uint32_t dropped() const { return drops; } // overwritten before delivery, or lost to a torn write
+
+private:
+  uint32_t recordOffset(uint32_t sequence) const { return 2 * sizeof(OutboxRecord) + (sequence % slots) * sizeof(OutboxRecord); }
+
+  JournalStorage &storage;
+  uint16_t slots;
+  uint32_t head = 1; // sequence of the next push
+  uint32_t tail = 1; // sequence of the oldest queued message
+  uint32_t cursorWrites = 0;
+  uint32_t drops = 0;
+};
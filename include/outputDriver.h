@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define OUTPUT_PINS 32          // GPIO 0-31, one output register
+#define INRUSH_STAGGER_MS 500   // minimum time between two motor starts
+#define OUTPUT_EDGE_LOG_SIZE 64 // edges kept for /edges
+
+struct OutputEdge
+{
+  uint32_t epoch;
+  uint32_t millis; // uptime, orders edges within a second
+  uint8_t pin;
+  bool on;
+};
+
+// Shadow register between the output logic and the relay pins. set() only
+// updates the desired bitmask; apply() works out which pins may change now and
+// writes them all at once through the register writer (set and clear masks, on
+// the ESP32 GPIO.out_w1ts / out_w1tc, so other pins are never touched).
+//
+// A pin is held until it has been on/off for its minimum time, and inrush
+// loads start one at a time, at least INRUSH_STAGGER_MS apart. Held changes go
+// out on a later apply(). Single threaded, the control task owns it.
+class OutputDriver
+{
+public:
+  typedef void (*RegisterWriter)(uint32_t setMask, uint32_t clearMask);
+
+  explicit OutputDriver(RegisterWriter writer) : write(writer) {}
+
+  // before use, pins above 31 are not supported
+  bool configure(uint8_t pin, uint32_t minOnMs, uint32_t minOffMs, bool inrush)
+  {
+    if (pin >= OUTPUT_PINS)
+      return false;
+    minOn[pin] = minOnMs;
+    minOff[pin] = minOffMs;
+    if (inrush)
+      inrushMask |= 1UL << pin;
+    managed |= 1UL << pin;
+    return true;
+  }
+
+  void set(uint8_t pin, bool on)
+  {
+    if (pin >= OUTPUT_PINS)
+      return;
+    if (on)
+      desired |= 1UL << pin;
+    else
+      desired &= ~(1UL << pin);
+  }
+
+  bool commanded(uint8_t pin) const { return pin < OUTPUT_PINS and (desired >> pin) & 1; }
+  bool driven(uint8_t pin) const { return pin < OUTPUT_PINS and (output >> pin) & 1; }
+  bool pending() const { return ((desired ^ output) & managed) != 0; }
+
+  // write the changes that are allowed now, returns the pins that changed
+  uint32_t apply(uint32_t nowMs, uint32_t epoch)
+  {
+    uint32_t changed = (desired ^ output) & managed;
+    if (changed == 0)
+      return 0;
+    uint32_t setMask = 0;
+    uint32_t clearMask = 0;
+    for (uint8_t pin = 0; pin < OUTPUT_PINS; pin++)
+    {
+      uint32_t bit = 1UL << pin;
+      if (!(changed & bit))
+        continue;
+      bool on = desired & bit;
+      uint32_t held = nowMs - lastEdge[pin];
+      if ((edged & bit) and held < (on ? minOff[pin] : minOn[pin]))
+        continue;
+      if (on and (inrushMask & bit))
+      {
+        // one start per apply, and not within the stagger time of the last one
+        if ((setMask & inrushMask) or (started and nowMs - lastStart < INRUSH_STAGGER_MS))
+          continue;
+        lastStart = nowMs;
+        started = true;
+      }
+      if (on)
+        setMask |= bit;
+      else
+        clearMask |= bit;
+    }
+    if ((setMask | clearMask) == 0)
+      return 0;
+    write(setMask, clearMask);
+    writes++;
+    output = (output | setMask) & ~clearMask;
+    uint32_t edges = setMask | clearMask;
+    edged |= edges;
+    for (uint8_t pin = 0; pin < OUTPUT_PINS; pin++)
+    {
+      if (edges & (1UL << pin))
+      {
+        lastEdge[pin] = nowMs;
+        log[head] = {epoch, nowMs, pin, (setMask >> pin & 1) != 0};
+        head = (head + 1) % OUTPUT_EDGE_LOG_SIZE;
+        if (count < OUTPUT_EDGE_LOG_SIZE)
+          count++;
+        edgeTotal++;
+      }
+    }
+    return edges;
+  }
+
+  // ms since the pin last changed, since boot if it never did
+  uint32_t sinceEdge(uint8_t pin, uint32_t nowMs) const { return (edged >> pin & 1) ? nowMs - lastEdge[pin] : nowMs; }
+  uint32_t edgeCount() const { return edgeTotal; }  // since boot
+  uint32_t writeCount() const { return writes; }    // register writes since boot
+  uint16_t edgeLogSize() const { return count; }
+  // 0 is the newest edge
+  const OutputEdge &recentEdge(uint16_t i) const { return log[(head + OUTPUT_EDGE_LOG_SIZE - 1 - i) % OUTPUT_EDGE_LOG_SIZE]; }
+
+private:
+  RegisterWriter write;
+  uint32_t desired = 0;
+  uint32_t output = 0; // what the pins are driven to, all low at boot
+  uint32_t managed = 0;
+  uint32_t inrushMask = 0;
+  uint32_t edged = 0; // pins with an edge since boot, no minimum time before their first one
+  uint32_t minOn[OUTPUT_PINS] = {};
+  uint32_t minOff[OUTPUT_PINS] = {};
+  uint32_t lastEdge[OUTPUT_PINS] = {};
+  uint32_t lastStart = 0;
+  bool started = false;
+  uint32_t writes = 0;
+  uint32_t edgeTotal = 0;
+  OutputEdge log[OUTPUT_EDGE_LOG_SIZE] = {};
+  uint16_t head = 0;
+  uint16_t count = 0;
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "climateControl.h"
+#include "pumpSchedule.h"
+
+#define NO_GROUP -1
+#define PERMANENT_OVERRIDE 60 // override times above this (minutes) never expire
+
+// compile time description of one output (relay + current sensor)
+struct OutputConfig
+{
+  uint8_t pin;          // relay pin
+  uint8_t currentPin;   // ACS712 analog pin
+  float adcReference;   // measured ADC reference voltage of the current channel
+  int8_t group;         // redundancy group, outputs in one group can run each other's schedules (NO_GROUP)
+  const char *name;     // e.g. "Water Pump 1"
+  const char *id;       // web element prefix, e.g. "pump1" for pump1Command / pump1Status / pump1Alarm
+  uint16_t minOn;       // seconds the relay stays on at least once switched on
+  uint16_t minOff;      // seconds the relay stays off at least once switched off
+  ClimateRole climate;  // adaptive scale its schedule pulses follow
+};
+
+// runtime state, small and contiguous so a pass over all outputs stays in cache
+struct OutputState
+{
+  bool command;          // commanded on/off
+  bool status;           // running according to the current sensor
+  bool override;         // in hand, set from the web page
+  bool alarm;            // command/status mismatch alarm active (set by the alarm engine)
+  bool statusUpdated;    // override time left already sent this minute
+  bool scheduled;        // cached scheduled state
+  uint32_t scheduleNext; // epoch of the next schedule transition, 0 forces a re-evaluation
+  uint32_t overrideEnd;  // epoch the override ends, 0 is permanent
+  float current;         // amps, latest RMS window
+};
+
+// Fixed set of N outputs described by a constexpr OutputConfig table. Holds the
+// schedule/override logic only, the pin is written through a callback (an
+// OutputDriver, which applies the minimum on/off times) so the logic does not
+// depend on the Arduino core. Schedule i is a role, run by output i unless it
+// was assigned to another one of its redundancy group (FailoverSupervisor).
+template <size_t N>
+class OutputBank
+{
+  static_assert(N <= 32, "output bitmasks are 32 bits");
+
+public:
+  typedef void (*PinWriter)(uint8_t pin, bool on);
+
+  OutputBank(const OutputConfig (&config)[N], PinWriter writer) : configs(config), writePin(writer), states()
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      owners[i] = i;
+    }
+  }
+
+  static constexpr size_t size() { return N; }
+  const OutputConfig &config(size_t i) const { return configs[i]; }
+  OutputState &operator[](size_t i) { return states[i]; }
+  const OutputState &operator[](size_t i) const { return states[i]; }
+  OutputSchedule &schedule(size_t i) { return schedules[i]; }
+
+  // output with a web id, -1 if none
+  int indexOf(const char *id) const
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      if (strcmp(configs[i].id, id) == 0)
+        return i;
+    }
+    return -1;
+  }
+
+  // make every output look its schedule up again (new schedule loaded)
+  void reschedule()
+  {
+    for (size_t i = 0; i < N; i++)
+    {
+      states[i].scheduleNext = 0;
+    }
+  }
+
+  // scheduled state, the table is only searched again once the next transition is reached
+  bool scheduled(size_t i, uint32_t epoch)
+  {
+    OutputState &state = states[i];
+    if (state.scheduleNext == 0 or epoch >= state.scheduleNext)
+    {
+      state.scheduled = schedules[i].stateAt(epoch);
+      uint32_t next = schedules[i].nextTransition(epoch);
+      state.scheduleNext = (next != 0) ? next : UINT32_MAX; // constant schedule never changes
+    }
+    return state.scheduled;
+  }
+
+  // output running role's schedule, picked up on the next control()
+  void assign(size_t role, size_t output) { owners[role] = output; }
+  size_t owner(size_t role) const { return owners[role]; }
+  // auto output switched on outside of its roles, a trial start of a failed pump
+  void trial(size_t i, bool on) { trials = on ? trials | 1UL << i : trials & ~(1UL << i); }
+  bool onTrial(size_t i) const { return (trials >> i) & 1; }
+
+  // auto state: on trial or one of the roles it runs is scheduled. A role whose
+  // own output is in override is not run by another one, the pump is in hand
+  bool autoState(size_t i, uint32_t epoch)
+  {
+    if (onTrial(i))
+      return true;
+    for (size_t role = 0; role < N; role++)
+    {
+      if (owners[role] == i and (role == i or !states[role].override) and scheduled(role, epoch))
+        return true;
+    }
+    return false;
+  }
+
+  // only touches the pin on an edge
+  void command(size_t i, bool on)
+  {
+    if (states[i].command != on)
+    {
+      states[i].command = on;
+      writePin(configs[i].pin, on);
+    }
+  }
+
+  void setOverride(size_t i, bool on, int minutes, uint32_t epoch)
+  {
+    states[i].override = true;
+    states[i].overrideEnd = (minutes > PERMANENT_OVERRIDE) ? 0 : epoch + minutes * 60;
+    command(i, on);
+  }
+
+  // override saved before a reboot, end is an epoch (0 permanent). An override
+  // that ran out in the meantime goes back to auto on the next control()
+  void restoreOverride(size_t i, bool on, uint32_t end)
+  {
+    states[i].override = true;
+    states[i].overrideEnd = end;
+    command(i, on);
+  }
+
+  void setAuto(size_t i, uint32_t epoch)
+  {
+    states[i].override = false;
+    states[i].overrideEnd = 0;
+    states[i].scheduleNext = 0;
+    command(i, autoState(i, epoch));
+  }
+
+  // auto outputs follow their schedule, expired overrides go back to auto.
+  // Returns a bitmask of the outputs that went back to auto.
+  uint32_t control(uint32_t epoch)
+  {
+    uint32_t backToAuto = 0;
+    for (size_t i = 0; i < N; i++)
+    {
+      OutputState &state = states[i];
+      if (!state.override)
+      {
+        command(i, autoState(i, epoch));
+      }
+      else if (state.overrideEnd != 0 and epoch >= state.overrideEnd)
+      {
+        setAuto(i, epoch);
+        backToAuto |= 1UL << i;
+      }
+    }
+    return backToAuto;
+  }
+
+private:
+  const OutputConfig *configs;
+  PinWriter writePin;
+  OutputState states[N];
+  OutputSchedule schedules[N];
+  uint8_t owners[N];
+  uint32_t trials = 0;
+};
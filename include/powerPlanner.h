@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define POWER_WAKE_EARLY 2000    // ms awake before a deadline, so the task that owns it runs on time
+#define POWER_MIN_SLEEP 5000     // ms, shorter gaps are idled through at the low clock
+#define POWER_MAX_SLEEP 300000   // ms, wake at least this often whatever is due
+#define POWER_SETTLE_MS 3000     // ms awake after a relay edge, until the current shows it
+
+// controller draw at the supply, override in config.h with the figures of the board
+#ifndef POWER_ACTIVE_MA
+#define POWER_ACTIVE_MA 50 // mA at full clock, radio off
+#endif
+#ifndef POWER_IDLE_MA
+#define POWER_IDLE_MA 20 // ... at the low clock
+#endif
+#ifndef POWER_SLEEP_MA
+#define POWER_SLEEP_MA 2 // light sleep, regulator and sensors included
+#endif
+#ifndef POWER_WIFI_MA
+#define POWER_WIFI_MA 40 // extra while the station is up, averaged over modem sleep
+#endif
+#ifndef POWER_RELAY_MA
+#define POWER_RELAY_MA 70 // per energised relay coil
+#endif
+#ifndef POWER_SUPPLY_VOLTS
+#define POWER_SUPPLY_VOLTS 5
+#endif
+#ifndef POWER_PUMP_VOLTS
+#define POWER_PUMP_VOLTS 120 // the pumps' supply, their energy comes from the measured currents
+#endif
+// the figures above as the energy budget takes them, expanded where config.h is included
+#define POWER_RATES {POWER_ACTIVE_MA, POWER_IDLE_MA, POWER_SLEEP_MA, POWER_WIFI_MA, POWER_RELAY_MA, POWER_SUPPLY_VOLTS, POWER_PUMP_VOLTS}
+
+enum PowerState : uint8_t
+{
+  POWER_ACTIVE, // full clock
+  POWER_IDLE,   // low clock, something is due soon or the upload window is open
+  POWER_SLEEP,  // light sleep until the wakeup
+  POWER_STATES
+};
+extern const char *const POWER_STATE_NAMES[POWER_STATES];
+
+// what keeps the controller awake, or what it wakes up for
+enum PowerReason : uint8_t
+{
+  POWER_RUNNING,   // a relay is on, an edge is pending or settling
+  POWER_MEASURING, // a sensor reading is in progress
+  POWER_UPLOAD,    // batched upload window
+  POWER_SCHEDULE,  // next schedule transition
+  POWER_OVERRIDE,  // an override runs out
+  POWER_ALARM,     // alarm delay or auto clear timer
+  POWER_DHT,
+  POWER_WATER,
+  POWER_HISTORY,
+  POWER_TELEMETRY, // MQTT sample
+  POWER_LIMIT,     // nothing due before POWER_MAX_SLEEP
+  POWER_REASONS
+};
+extern const char *const POWER_REASON_NAMES[POWER_REASONS];
+
+struct PowerPlan
+{
+  PowerState state;
+  PowerReason reason; // busy reason when active or idle, what is next due when asleep
+  uint32_t dueMs;     // until that is due, 0 when busy
+  uint32_t sleepMs;   // light sleep length, 0 unless asleep
+};
+
+// Batched upload windows of length seconds every interval seconds, aligned to
+// the epoch so they land on round times. Sets nextStart to the start of the
+// next window (the current one's while inside). interval 0 is always open.
+bool inUploadWindow(uint32_t epoch, uint32_t interval, uint32_t length, uint32_t &nextStart);
+
+// Works out the next wakeup the controller needs. Each plan is built from
+// scratch: whatever needs the CPU now calls busy() or idle(), whatever is due
+// later calls due(). The controller sleeps until POWER_WAKE_EARLY before the
+// first deadline when that leaves at least POWER_MIN_SLEEP, otherwise it
+// idles. A schedule transition or override end within POWER_WAKE_EARLY is
+// busy already, the current sampling has to be running when the relay
+// closes. Pure, the board feeds it from the outputs, alarms and task jobs.
+class WakePlanner
+{
+public:
+  void start(uint32_t nowEpoch);
+  void busy(PowerReason why);                  // full clock, no sleep
+  void idle(PowerReason why);                  // awake, the clock can drop
+  void due(int32_t inMs, PowerReason why);     // work due in inMs, late work counts as due now
+  void dueAt(uint32_t epoch, PowerReason why); // ... at an epoch (whole seconds), 0 and UINT32_MAX are never
+  PowerPlan plan() const;
+
+private:
+  uint32_t epoch = 0;
+  bool active = false;
+  bool awake = false;
+  PowerReason wakeReason = POWER_LIMIT;
+  uint32_t earliest = POWER_MAX_SLEEP;
+  PowerReason earliestReason = POWER_LIMIT;
+};
+
+// what the board draws, POWER_RATES
+struct PowerRates
+{
+  float activeMa;
+  float idleMa;
+  float sleepMa;
+  float wifiMa;
+  float relayMa;
+  float supplyVolts;
+  float pumpVolts;
+};
+
+// Energy budget from the time spent in each power state, the radio, the relay
+// coils and the pump currents. Rates are projected to a day from what was
+// accounted so far.
+class EnergyBudget
+{
+public:
+  explicit EnergyBudget(const PowerRates &rates) : rates(rates) {}
+
+  void account(PowerState state, bool wifi, uint8_t relaysOn, float pumpAmps, uint32_t ms);
+  void clear() { *this = EnergyBudget(rates); }
+
+  float controllerMah() const; // at the supply voltage, so far
+  float controllerWhPerDay() const;
+  float pumpWhPerDay() const;
+  float share(PowerState state) const; // of the time accounted
+  float wifiShare() const;
+  uint32_t seconds() const { return total / 1000; }
+
+private:
+  PowerRates rates;
+  uint64_t stateMs[POWER_STATES] = {};
+  uint64_t wifiMs = 0;
+  uint64_t relayMs = 0; // summed over the relays
+  double pumpAmpMs = 0;
+  uint64_t total = 0;
+};
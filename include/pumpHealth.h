@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PUMP_FFT_LOG2 8
+#define PUMP_FFT_SIZE (1 << PUMP_FFT_LOG2) // samples per capture, 6.4 mains cycles at 2400 Hz
+#define PUMP_SAMPLE_RATE 2400              // Hz, the current sampling rate
+#define PUMP_MAINS 60                      // Hz
+#define PUMP_HARMONICS 9                   // fundamental up to the 9th go into the harmonic distortion
+#define PUMP_CAPTURE_INTERVAL 10000        // ms between captures, the running pumps take turns
+#define PUMP_INRUSH_MS 3000                // start-up profile, the same as the calibration settle time
+#define PUMP_INRUSH_WINDOWS 30             // RMS windows (100ms) in it
+#define PUMP_MIN_CAPTURES 200              // before the waveform baseline is trusted
+#define PUMP_MIN_STARTS 20                 // before the start-up baseline is trusted
+#define PUMP_BASELINE_WINDOW 5000          // averaging of the baseline, slow so wear builds up against it
+#define PUMP_SMOOTHING 5                   // captures the anomaly score is averaged over
+#define PUMP_REL_SPREAD 0.05               // smallest spread a feature is scored against, share of its mean
+#define PUMP_LEARN_Z 3                     // observations further out than this stay out of the baseline
+#define PUMP_Z_OK 2                        // score where the health starts to drop
+#define PUMP_Z_BAD 8                       // score where it reaches 0
+#define PUMP_HEALTH_ALARM 40               // health below this raises the Pump Health alarm
+
+// What is measured of a pump. The waveform features come from one capture,
+// the start-up ones from the RMS windows after the relay closed.
+enum PumpFeature : uint8_t
+{
+  FEATURE_RMS,          // ADC counts, DC removed
+  FEATURE_CREST,        // peak over RMS, 1.41 for a sine
+  FEATURE_H2,           // 2nd harmonic over the fundamental (a rectifying fault)
+  FEATURE_H3,           // 3rd harmonic over the fundamental (saturation, a failing run capacitor)
+  FEATURE_THD,          // 2nd to 9th harmonic over the fundamental
+  FEATURE_NOISE,        // share of the power between and above the harmonics (cavitation, bearings)
+  FEATURE_INRUSH_PEAK,  // highest start-up window over the running current
+  FEATURE_INRUSH_TIME,  // ms the start-up current stays above 1.2x the running current
+  FEATURE_COUNT,
+  FEATURE_WAVEFORM = FEATURE_INRUSH_PEAK // features before this come from a capture
+};
+extern const char *const PUMP_FEATURE_NAMES[FEATURE_COUNT];
+
+// In place radix-2 FFT of n = 1 << log2n complex Q15 values (log2n up to
+// PUMP_FFT_LOG2). Every stage halves, so the result is the DFT / n and never
+// overflows.
+void fftQ15(int16_t *re, int16_t *im, uint8_t log2n);
+
+// RMS, crest factor and harmonic features of PUMP_FFT_SIZE raw ADC samples,
+// into features[0..FEATURE_WAVEFORM). The block mean is the DC offset, the
+// samples are Hann windowed and scaled up to use the Q15 range before the FFT.
+// Harmonics fall between bins (6.4 bins apart), each takes the power of the
+// 5 bins around it. False when the channel is flat.
+bool extractFeatures(const uint16_t *samples, float *features);
+
+// What a pump's features look like when it is healthy, kept on SPIFFS
+struct PumpBaseline
+{
+  float mean[FEATURE_COUNT];
+  float spread2[FEATURE_COUNT]; // variance
+  uint32_t captures;            // averaged into the waveform features
+  uint32_t starts;              // ... the start-up features
+};
+
+// Health of one pump against its own learned baseline. Each feature is
+// scored by how many spreads it is off the baseline mean; the worst one,
+// averaged over a few captures, is the anomaly score, mapped to a health of
+// 100 (as learned) down to 0. Observations close to the baseline keep
+// teaching it, so slow seasonal drift is followed but a fault is not learned
+// as the new normal. Pure math, fed by the control task.
+class PumpHealth
+{
+public:
+  void restore(const PumpBaseline &saved);
+
+  // one RMS window, builds up the start-up profile after the relay closes.
+  // running: the current says the pump runs (CurrentChannel::running)
+  void window(float amps, bool driven, bool running, uint32_t sinceEdgeMs);
+  // one capture of the running pump
+  void capture(const uint16_t *samples);
+
+  bool learned() const { return saved.captures >= PUMP_MIN_CAPTURES; }
+  float score() const { return smoothed; }
+  float health() const; // 0-100, 100 until learned
+  bool unhealthy() const { return health() < PUMP_HEALTH_ALARM; }
+  PumpFeature worst() const { return worstFeature; } // feature furthest off, of the last capture
+  float feature(PumpFeature f) const { return latest[f]; }
+  const PumpBaseline &state() const { return saved; }
+
+private:
+  void observe(uint8_t from, uint8_t to, uint32_t &count, uint32_t minimum);
+
+  PumpBaseline saved = {};
+  float latest[FEATURE_COUNT] = {};
+  float z[FEATURE_COUNT] = {};
+  float smoothed = 0;
+  PumpFeature worstFeature = FEATURE_RMS;
+  float inrush[PUMP_INRUSH_WINDOWS];
+  uint8_t inrushCount = 0;
+  bool starting = false;
+};
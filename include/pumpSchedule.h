@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MINUTES_PER_DAY 1440
+#define SECONDS_PER_DAY 86400
+#define SCHEDULE_MAX_TRANSITIONS 128 // enough for an on/off pair every 15 min
+#define PULSE_MIN_EVERY ((2 * MINUTES_PER_DAY + SCHEDULE_MAX_TRANSITIONS - 1) / SCHEDULE_MAX_TRANSITIONS) // densest scaled pulse that fits the table
+
+// one on/off edge, packed into 2 bytes
+struct Transition
+{
+  uint16_t minute : 11; // minute of day, 0-1439
+  uint16_t on : 1;
+};
+
+// Compiled daily schedule for one output: a sorted table of edges. The output
+// only has to be touched when nextTransition() is reached.
+class OutputSchedule
+{
+public:
+  bool stateAt(uint32_t epoch) const;          // scheduled state at a (local) epoch
+  uint32_t nextTransition(uint32_t epoch) const; // epoch of the first edge after epoch, 0 if constant
+  uint8_t transitionCount() const { return count; }
+  const Transition &transition(uint8_t i) const { return table[i]; }
+
+private:
+  friend class ScheduleBuilder;
+  Transition table[SCHEDULE_MAX_TRANSITIONS];
+  uint8_t count = 0;
+  bool constantState = false; // used when the table is empty
+};
+
+// Minute-of-day bitmap used to build an OutputSchedule from windows and pulses,
+// overlaps simply merge. Only needed while (re)compiling a schedule.
+class ScheduleBuilder
+{
+public:
+  void clear();
+  void addWindow(uint16_t startMinute, uint16_t endMinute);      // on for [start, end), may wrap midnight
+  // on for length min every `every` min from `at`, scale multiplies its duty cycle
+  void addPulse(uint16_t every, uint16_t at, uint16_t length, float scale = 1);
+  bool compile(OutputSchedule &schedule) const;                // false if too many edges
+
+private:
+  bool bit(uint16_t minute) const { return dayMask[minute >> 5] & (1UL << (minute & 31)); }
+  uint32_t dayMask[(MINUTES_PER_DAY + 31) / 32] = {};
+};
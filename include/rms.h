@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+// True RMS of the AC part of a block of raw ADC samples (the DC bias of the
+// sensor is removed by subtracting the block mean). Plain C++ so it can be
+// built off target. Integer sums keep it exact for up to ~60000 12-bit samples.
+inline float acRms(const uint16_t *samples, size_t count)
+{
+  if (count == 0)
+    return 0.0;
+  uint64_t sum = 0;
+  uint64_t sumSquares = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    uint32_t s = samples[i];
+    sum += s;
+    sumSquares += s * s;
+  }
+  // n^2 * variance = n * sum(x^2) - sum(x)^2
+  uint64_t n = count;
+  uint64_t varianceN2 = n * sumSquares - sum * sum;
+  return sqrtf((float)varianceN2) / count;
+}
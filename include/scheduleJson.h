@@ -0,0 +1,26 @@
+#pragma once
+
+#include <ArduinoJson.h>
+#include <stddef.h>
+
+#include "outputs.h"
+#include "pumpSchedule.h"
+
+#define SCHEDULE_JSON_SIZE 2048
+
+// pump schedules (times are minutes of the day), edit from the web page or data/schedule.json
+extern const char DEFAULT_SCHEDULE[];
+
+// working memory of a compile (~2.3kB). Each task that compiles owns one, a
+// workspace is never shared between tasks
+struct ScheduleWorkspace
+{
+  StaticJsonDocument<SCHEDULE_JSON_SIZE> doc;
+  ScheduleBuilder builder;
+};
+
+// compile schedule json into one transition table per output (matched by relay
+// pin), returns NULL on success or the error. pulseScales (one per output, NULL
+// for none) scale the duty cycle of the pulses, the windows stay as written
+const char *compileSchedule(const char *json, size_t length, const OutputConfig *configs, size_t count, OutputSchedule *schedules,
+                            ScheduleWorkspace &work, const float *pulseScales = NULL);
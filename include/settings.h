@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SETTINGS_VERSION 1
+#define SETTINGS_MAGIC 0x4643 // "CF"
+#define SETTINGS_MAX_FIELDS 32 // schema lines, raise with the blob size below
+#define SETTING_MAX_BYTES 7    // encoded field, worst case: 2 byte tag + 5 byte varint
+#define SETTINGS_BLOB_SIZE (16 + SETTINGS_MAX_FIELDS * SETTING_MAX_BYTES) // encoded settings, header included
+#define SETTINGS_JSON_SIZE 768
+
+// Tuning values that can be changed at runtime (GET/PATCH /config). Every
+// field is 32 bits, so a task reading a field while it is being updated
+// sees either the old or the new value.
+struct Settings
+{
+  int32_t utcOffset;          // seconds, local time = UTC + offset
+  int32_t dhtInterval;        // seconds between DHT readings
+  int32_t waterLevelInterval; // seconds between water level readings
+  int32_t historyInterval;    // seconds between history samples
+  float mvPerAmp;             // ACS712 sensitivity, V per A (0.185 for the 5A part)
+  float runningCurrent;       // amps above which a pump counts as running, until its nominal current is learned
+  float waterLowCm;           // sensor to water distance above which the level is low
+  float waterMediumCm;        // ... medium, high below it
+  float highTempAlarm;        // fahrenheit
+  float highTempHysteresis;   // fahrenheit below highTempAlarm before the alarm condition clears
+  float tankDepthCm;          // reservoir, sensor to tank bottom
+  float tankLengthCm;         // rectangular reservoir, or
+  float tankWidthCm;
+  float tankDiameterCm;       // round one when above 0
+  int32_t climateControl;     // 1: schedule pulses follow the heat index and reservoir, 0: as written
+  float climateCoolF;         // heat index below which pulses are cut back
+  float climateHotF;          // ... above which they are stepped up
+  float climateMinScale;      // lowest pulse duty cycle factor (cold, or a low reservoir for the water pumps)
+  float climateMaxScale;      // highest
+  int32_t lowPower;           // 1: light sleep between scheduled events, wifi only in the upload windows
+  int32_t uploadInterval;     // seconds between upload windows in low power, 0 keeps wifi up
+  int32_t uploadWindow;       // seconds the station is up per window
+  int32_t failoverMs;         // ms a driven pump may show no current before its group takes over
+  int32_t balanceHours;       // run time lead that hands roles to a less worn pump of the group, 0 never
+};
+
+enum SettingType : uint8_t
+{
+  SETTING_INT,
+  SETTING_FLOAT
+};
+
+// schema: one line per Settings field. The id is what goes on flash, it is
+// never reused, so fields can be added and removed without a new version
+struct SettingField
+{
+  uint8_t id;
+  const char *name; // json key
+  SettingType type;
+  size_t offset; // offsetof(Settings, ..)
+  float min;
+  float max;
+  float defaultValue;
+};
+
+extern const SettingField SETTING_FIELDS[];
+extern const size_t SETTING_FIELD_COUNT;
+
+void defaultSettings(Settings &settings);
+
+// checks ranges and the relations between fields, NULL when valid
+const char *validateSettings(const Settings &settings);
+
+// Binary encoding: 16 byte header (magic, version, sequence, payload length,
+// crc32), then per field a varint tag (id << 1 | wire type) and the value, a
+// zigzag varint for ints or 4 little endian bytes for floats. Unknown tags are
+// skipped, missing fields keep their defaults. Returns the length, 0 if it
+// does not fit.
+size_t encodeSettings(const Settings &settings, uint32_t sequence, uint8_t *out, size_t size);
+
+// NULL when the blob is intact, older versions are migrated on the way
+const char *decodeSettings(const uint8_t *in, size_t length, Settings &settings, uint32_t &sequence);
+
+// steps a decoded blob of an older version up to SETTINGS_VERSION
+void migrateSettings(Settings &settings, uint8_t fromVersion);
+
+// applies a JSON object of {"name": value} on top of settings, all or nothing.
+// NULL when every key is known and the result is valid
+const char *patchSettings(const char *json, size_t length, Settings &settings);
+
+// {"version":1,"sequence":7,"settings":{"utcOffset":-36000,..}}, 0 if it does not fit
+size_t writeSettingsJson(const Settings &settings, uint32_t sequence, char *out, size_t size);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SPIFFS.h>
+
+#include "stateJournal.h"
+
+// JournalStorage in one preallocated SPIFFS file kept open, records are
+// rewritten in place. SPIFFS spreads the page writes over the flash itself.
+class SpiffsJournalStorage : public JournalStorage
+{
+public:
+  SpiffsJournalStorage(const char *path, size_t size) : path(path), size(size) {}
+  bool begin(); // opens the file, creates it when missing (after SPIFFS.begin)
+
+  bool read(uint32_t offset, void *data, size_t length) override;
+  bool write(uint32_t offset, const void *data, size_t length) override;
+
+private:
+  const char *path;
+  size_t size;
+  File file;
+};
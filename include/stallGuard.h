@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+// Stall detection for a task that counts its wakeups, polled every checkMs from
+// a task that cannot be held off by it. The task has stalled once its count
+// stood still for stallMs; an excused poll (a light sleep stops both of them)
+// starts over, as does the first one. Pure, the guard task feeds it and puts
+// the outputs in a safe state when check() trips.
+class StallGuard
+{
+public:
+  StallGuard(uint32_t stallMs, uint32_t checkMs) : stallMs(stallMs), checkMs(checkMs) {}
+
+  // one poll with the task's wakeup count, true once: on the poll that finds the stall
+  bool check(uint32_t wakeups, bool excused)
+  {
+    if (!started or wakeups != seen or excused)
+    {
+      started = true;
+      seen = wakeups;
+      silentMs = 0;
+      return false;
+    }
+    silentMs += checkMs;
+    if (silentMs < stallMs or tripped)
+      return false;
+    tripped = true;
+    return true;
+  }
+
+  bool stalled() const { return tripped; } // stays set, the guarded task's state is not trusted any more
+
+private:
+  uint32_t stallMs;
+  uint32_t checkMs;
+  uint32_t seen = 0;
+  uint32_t silentMs = 0;
+  bool started = false;
+  bool tripped = false;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define JOURNAL_MAX_OUTPUTS 8
+#define JOURNAL_MAGIC 0x4c4e524a // "JRNL"
+#define JOURNAL_SLOTS 32         // records in the flash ring, 2 KB
+
+// What has to survive a reboot. The schedule is a function of the clock, so
+// only what was set by hand or latched is kept: overrides with their end time
+// and the alarm latches.
+struct RuntimeState
+{
+  uint32_t epoch;              // when it was captured, not compared
+  uint32_t overrides;          // outputs in override
+  uint32_t overrideOn;         // commanded state of the outputs in override
+  uint32_t alarmsActive;       // alarm bitmasks
+  uint32_t alarmsAcknowledged;
+  uint32_t overrideEnd[JOURNAL_MAX_OUTPUTS]; // epoch, 0 is permanent
+};
+
+// same state, whenever it was captured
+bool sameState(const RuntimeState &a, const RuntimeState &b);
+
+// one journal entry, also the layout of the copy in RTC memory
+struct JournalRecord
+{
+  uint32_t magic;
+  uint32_t sequence; // highest intact one is the current state
+  RuntimeState state;
+  uint32_t crc; // of everything before it
+};
+static_assert(sizeof(JournalRecord) == 64, "JournalRecord is stored as is");
+
+void sealRecord(JournalRecord &record, const RuntimeState &state, uint32_t sequence);
+bool intactRecord(const JournalRecord &record);
+
+// byte addressed storage behind the journal, a SPIFFS file on the board and
+// RAM in the simulator
+class JournalStorage
+{
+public:
+  virtual ~JournalStorage() {}
+  virtual bool read(uint32_t offset, void *data, size_t length) = 0;
+  virtual bool write(uint32_t offset, const void *data, size_t length) = 0;
+};
+
+// Ring of fixed-size records. Every append goes to the slot after the newest
+// record, so a torn write only ever damages a slot that is not the current
+// state and the writes are spread over the whole ring. Appends of an
+// unchanged state are skipped, the journal is only written when an override
+// or an alarm latch changes.
+class StateJournal
+{
+public:
+  StateJournal(JournalStorage &storage, uint16_t slots) : storage(storage), slots(slots) {}
+
+  // newest intact record, false when there is none (new or wiped storage)
+  bool recover(RuntimeState &state);
+  // false if the write failed, the next append goes to the same slot again
+  bool append(const RuntimeState &state);
+
+  uint32_t sequence() const { return last; } // of the newest record, 0 if none
+  uint32_t writeCount() const { return writes; }
+  uint32_t skipCount() const { return skips; }
+
+private:
+  JournalStorage &storage;
+  uint16_t slots;
+  uint16_t next = 0; // slot the next append goes to
+  uint32_t last = 0;
+  bool haveState = false;
+  RuntimeState current = {};
+  uint32_t writes = 0;
+  uint32_t skips = 0;
+};
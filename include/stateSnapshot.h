@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+
+#define STATE_MAX_OUTPUTS 10
+#define STATE_JSON_SIZE 1536 // fits STATE_MAX_OUTPUTS outputs
+
+struct OutputSnapshot
+{
+  const char *id;   // web id, e.g. "pump1"
+  char command[32]; // "On (Auto)", "Off (Override 5 min)" ...
+  bool status;
+  bool alarm;
+  float current;
+  float health; // 0-100, NaN while the baseline is learned
+};
+
+// copy of everything the web page shows, taken from the globals in one go so
+// serializing it never touches a sensor
+struct StateSnapshot
+{
+  uint32_t epoch;
+  const char *lastSync;
+  float temperature;
+  float humidity;
+  float heatIndex;
+  const char *waterLevel;
+  bool led;
+  uint8_t outputCount;
+  OutputSnapshot outputs[STATE_MAX_OUTPUTS];
+};
+
+// appends to a fixed buffer, keeps track of truncation
+class JsonWriter
+{
+public:
+  JsonWriter(char *buffer, size_t size) : out(buffer), size(size) { out[0] = '\0'; }
+  size_t length() const { return used; }
+  bool overflow() const { return truncated; }
+
+  void print(const char *format, ...)
+  {
+    if (truncated)
+      return;
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(out + used, size - used, format, args);
+    va_end(args);
+    if (n < 0 or (size_t)n >= size - used)
+    {
+      truncated = true;
+      out[used] = '\0';
+      return;
+    }
+    used += n;
+  }
+  // NaN (failed sensor read) is not valid JSON
+  void number(const char *key, float value, int decimals)
+  {
+    if (isnan(value))
+      print("\"%s\":null", key);
+    else
+      print("\"%s\":%.*f", key, decimals, value);
+  }
+
+private:
+  char *out;
+  size_t size;
+  size_t used = 0;
+  bool truncated = false;
+};
+
+// returns the JSON length, 0 if it did not fit
+inline size_t writeStateJson(const StateSnapshot &state, char *buffer, size_t size)
+{
+  JsonWriter json(buffer, size);
+  json.print("{\"epoch\":%u,\"lastSync\":\"%s\",", (unsigned)state.epoch, state.lastSync);
+  json.number("temperature", state.temperature, 1);
+  json.print(",");
+  json.number("humidity", state.humidity, 1);
+  json.print(",");
+  json.number("heatIndex", state.heatIndex, 1);
+  json.print(",\"waterLevel\":\"%s\",\"led\":%s,\"outputs\":[", state.waterLevel, state.led ? "true" : "false");
+  for (uint8_t i = 0; i < state.outputCount; i++)
+  {
+    const OutputSnapshot &output = state.outputs[i];
+    json.print("%s{\"id\":\"%s\",\"command\":\"%s\",\"status\":%s,\"alarm\":%s,", i ? "," : "", output.id, output.command,
+               output.status ? "true" : "false", output.alarm ? "true" : "false");
+    json.number("current", output.current, 3);
+    json.print(",");
+    json.number("health", output.health, 0);
+    json.print("}");
+  }
+  json.print("]}");
+  return json.overflow() ? 0 : json.length();
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "histogram.h"
+
+#define SCHEDULER_MAX_JOBS 8
+
+// A FreeRTOS task pinned to a core that wakes every periodMs (vTaskDelayUntil,
+// so the period does not drift) and runs each of its jobs whose interval has
+// elapsed. Jobs with an interval of 0 run on every wakeup. The job logic is
+// plain C++ (taskScheduler.cpp), the task itself is esp32TaskScheduler.cpp on
+// the board and a std::thread on the host (sim/posixTaskScheduler.cpp, which
+// ignores priority and core) so the timing can be tested on the build machine.
+class ScheduledTask
+{
+public:
+  ScheduledTask(const char *name, uint32_t periodMs, uint8_t priority, int8_t core, uint32_t stackSize = 4096);
+  bool addJob(void (*callback)(), uint32_t intervalMs); // call before start()
+  bool setJobInterval(void (*callback)(), uint32_t intervalMs); // from any task, the job next runs intervalMs after its last run
+  int32_t jobDueIn(void (*callback)(), uint32_t nowMs) const;    // ms until the job runs next, <= 0 when due
+  void restartSlots() { restart = true; }                        // after a light sleep, the next wakeup starts the slots over
+  void watch() { watched = true; }                               // call before start(), the task feeds the task watchdog every wakeup
+  void start();
+  void stop(); // ends the task, for tests
+  uint32_t overruns() const { return overrunCount; }       // wakeups that took longer than the period
+  uint32_t maxRunMicros() const { return maxRunTime; }     // worst case time spent in one wakeup
+  uint32_t periodMillis() const { return period; }
+  uint32_t wakeupCount() const { return wakeups; }        // since start, a stall guard watches it move
+  const char *taskName() const { return name; }
+  const Histogram &runMicros() const { return runTime; }       // time spent in each wakeup
+  const Histogram &lateMicros() const { return wakeLateness; } // how far each wakeup was behind its slot
+
+private:
+  struct Job
+  {
+    void (*callback)();
+    volatile uint32_t interval;
+    unsigned long previousMillis;
+  };
+  static void run(void *arg);
+  static uint32_t clockMicros(); // the platform's clock, micros() and millis() on the board
+  static uint32_t clockMillis();
+  void wakeup(uint32_t start, uint32_t slot); // one wakeup that started at start and should have at slot (micros)
+  void runJobs();
+
+  const char *name;
+  uint32_t period;
+  uint8_t priority;
+  int8_t core;
+  uint32_t stackSize;
+  Job jobs[SCHEDULER_MAX_JOBS];
+  uint8_t jobCount = 0;
+  void *handle = NULL; // the FreeRTOS TaskHandle_t or std::thread
+  volatile bool restart = false;
+  volatile bool stopping = false;
+  bool watched = false;
+  volatile uint32_t wakeups = 0;
+  volatile uint32_t overrunCount = 0;
+  volatile uint32_t maxRunTime = 0;
+  Histogram runTime;
+  Histogram wakeLateness;
+};
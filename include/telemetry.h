@@ -0,0 +1,165 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#define TELEMETRY_MAX_FIELDS 32
+#define TELEMETRY_NAME_SIZE 24
+#define TELEMETRY_VALUE_SIZE 48
+#define TELEMETRY_FRAME_SIZE 1024
+#define TELEMETRY_MAX_WAITING 4 // average queued messages per client before frames are held back
+
+// Latest value of every web field. Fields are set as often as the producers
+// like, only the ones whose value actually changed go into the next frame:
+// one JSON object {"field":"value",..} per publish instead of an event per
+// field. Single threaded, the network task owns it.
+class Telemetry
+{
+public:
+  // returns true if the value changed
+  bool set(const char *name, const char *value)
+  {
+    Field *field = find(name);
+    if (field == NULL)
+      return false; // table full, raise TELEMETRY_MAX_FIELDS
+    if (strncmp(field->value, value, TELEMETRY_VALUE_SIZE - 1) == 0 and field->valid)
+      return false;
+    copy(field->value, TELEMETRY_VALUE_SIZE, value);
+    field->valid = true;
+    field->dirty = true;
+    dirtyCount++;
+    return true;
+  }
+
+  bool changed() const { return dirtyCount != 0; }
+
+  // forget pending changes (nobody listening, clients load the full state on connect)
+  void clear()
+  {
+    for (uint8_t i = 0; i < count; i++)
+      fields[i].dirty = false;
+    dirtyCount = 0;
+  }
+
+  // writes the changed fields as a JSON object and clears them, returns the
+  // length (0 when nothing changed). Fields that do not fit stay pending.
+  size_t frame(char *out, size_t size)
+  {
+    if (dirtyCount == 0 or size < 3)
+      return 0;
+    size_t used = 0;
+    out[used++] = '{';
+    for (uint8_t i = 0; i < count; i++)
+    {
+      Field &field = fields[i];
+      if (!field.dirty)
+        continue;
+      size_t start = used;
+      if (used > 1)
+        used = put(out, size, used, ",");
+      used = put(out, size, used, "\"");
+      used = putEscaped(out, size, used, field.name);
+      used = put(out, size, used, "\":\"");
+      used = putEscaped(out, size, used, field.value);
+      used = put(out, size, used, "\"");
+      if (used + 2 > size)
+      {
+        used = start; // no room left, rest goes in the next frame
+        break;
+      }
+      field.dirty = false;
+      dirtyCount--;
+    }
+    if (used == 1)
+      return 0;
+    out[used++] = '}';
+    out[used] = '\0';
+    frames++;
+    bytes += used;
+    return used;
+  }
+
+  // frame to send now, 0 for none. Without clients the changes are dropped (a
+  // page loads the full state when it opens), while the clients' queues are
+  // backed up they are held and coalesced into a later frame
+  size_t publish(char *out, size_t size, size_t clients, size_t averageWaiting)
+  {
+    if (dirtyCount == 0)
+      return 0;
+    if (clients == 0)
+    {
+      clear();
+      return 0;
+    }
+    if (averageWaiting > TELEMETRY_MAX_WAITING)
+      return 0;
+    return frame(out, size);
+  }
+
+  uint32_t frameCount() const { return frames; }
+  uint32_t byteCount() const { return bytes; }
+
+private:
+  struct Field
+  {
+    char name[TELEMETRY_NAME_SIZE];
+    char value[TELEMETRY_VALUE_SIZE];
+    bool valid;
+    bool dirty;
+  };
+
+  Field *find(const char *name)
+  {
+    for (uint8_t i = 0; i < count; i++)
+    {
+      if (strncmp(fields[i].name, name, TELEMETRY_NAME_SIZE - 1) == 0)
+        return &fields[i];
+    }
+    if (count == TELEMETRY_MAX_FIELDS)
+      return NULL;
+    Field &field = fields[count++];
+    copy(field.name, TELEMETRY_NAME_SIZE, name);
+    field.valid = false;
+    field.dirty = false;
+    return &field;
+  }
+
+  // text cut to fit size, always terminated
+  static void copy(char *out, size_t size, const char *text)
+  {
+    size_t length = 0;
+    while (text[length] and length < size - 1)
+      length++;
+    memcpy(out, text, length);
+    out[length] = '\0';
+  }
+
+  // append, saturating at size so the caller can check for overflow once
+  static size_t put(char *out, size_t size, size_t used, const char *text)
+  {
+    while (*text and used < size)
+      out[used++] = *text++;
+    return used;
+  }
+  static size_t putEscaped(char *out, size_t size, size_t used, const char *text)
+  {
+    for (; *text and used < size; text++)
+    {
+      if (*text == '"' or *text == '\\')
+      {
+        out[used++] = '\\';
+        if (used == size)
+          break;
+      }
+      out[used++] = *text;
+    }
+    return used;
+  }
+
+  Field fields[TELEMETRY_MAX_FIELDS];
+  uint8_t count = 0;
+  uint8_t dirtyCount = 0;
+  uint32_t frames = 0;
+  uint32_t bytes = 0;
+};
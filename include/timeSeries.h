@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define VARINT_MAX_BYTES 5                          // 32 bit value, 7 bits per byte
+#define SAMPLE_MAX_BYTES (2 * VARINT_MAX_BYTES)     // time delta + value delta
+
+// one point of a series, time is in units of the series resolution (epoch / resolution)
+struct Sample
+{
+  uint32_t time;
+  int32_t value;
+};
+
+inline uint32_t zigzag(int32_t v) { return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31); }
+inline int32_t unzigzag(uint32_t v) { return (int32_t)(v >> 1) ^ -(int32_t)(v & 1); }
+
+// LEB128 style, returns bytes written
+inline size_t putVarint(uint8_t *out, uint32_t v)
+{
+  size_t n = 0;
+  while (v >= 0x80)
+  {
+    out[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+// returns bytes read, 0 if the input ends mid varint or the varint is longer than 5 bytes
+inline size_t getVarint(const uint8_t *in, size_t len, uint32_t *v)
+{
+  uint32_t result = 0;
+  for (size_t n = 0; n < len and n < VARINT_MAX_BYTES; n++)
+  {
+    result |= (uint32_t)(in[n] & 0x7f) << (7 * n);
+    if (!(in[n] & 0x80))
+    {
+      *v = result;
+      return n + 1;
+    }
+  }
+  return 0;
+}
+
+// Delta + zigzag + varint encoding of a series. Samples usually sit one
+// resolution step apart with small value changes, so most take 2-3 bytes.
+// Time and value deltas wrap, any int32 sequence round-trips.
+class SampleEncoder
+{
+public:
+  void reset() { last = {0, 0}; }
+  // returns bytes written to out (at most SAMPLE_MAX_BYTES)
+  size_t encode(const Sample &sample, uint8_t *out)
+  {
+    size_t n = putVarint(out, zigzag((int32_t)(sample.time - last.time)));
+    n += putVarint(out + n, zigzag((int32_t)((uint32_t)sample.value - (uint32_t)last.value)));
+    last = sample;
+    return n;
+  }
+
+private:
+  Sample last = {0, 0};
+};
+
+class SampleDecoder
+{
+public:
+  void reset() { last = {0, 0}; }
+  // returns bytes consumed, 0 if in does not hold a complete sample yet (or is corrupt
+  // when len >= SAMPLE_MAX_BYTES)
+  size_t decode(const uint8_t *in, size_t len, Sample *out)
+  {
+    uint32_t timeDelta, valueDelta;
+    size_t n = getVarint(in, len, &timeDelta);
+    if (n == 0)
+      return 0;
+    size_t m = getVarint(in + n, len - n, &valueDelta);
+    if (m == 0)
+      return 0;
+    last.time += (uint32_t)unzigzag(timeDelta);
+    last.value = (int32_t)((uint32_t)last.value + (uint32_t)unzigzag(valueDelta));
+    *out = last;
+    return n + m;
+  }
+
+private:
+  Sample last = {0, 0};
+};
+
+// Averages raw readings into fixed buckets of resolution seconds. A bucket is
+// emitted when the first reading of a later bucket arrives, empty buckets are
+// skipped.
+class Rollup
+{
+public:
+  explicit Rollup(uint32_t resolutionSeconds = 60) : resolution(resolutionSeconds) {}
+
+  uint32_t step() const { return resolution; }
+
+  // returns true and fills out when a bucket completed
+  bool add(uint32_t epoch, int32_t value, Sample *out)
+  {
+    uint32_t bucket = epoch / resolution;
+    bool emitted = false;
+    if (count != 0 and bucket != current)
+    {
+      emitted = take(out);
+    }
+    if (count == 0)
+      current = bucket;
+    sum += value;
+    count++;
+    return emitted;
+  }
+
+  // emit the partial bucket, returns false when empty
+  bool take(Sample *out)
+  {
+    if (count == 0)
+      return false;
+    // round half away from zero
+    int64_t average = (sum >= 0) ? (sum + count / 2) / count : (sum - count / 2) / count;
+    *out = {current, (int32_t)average};
+    sum = 0;
+    count = 0;
+    return true;
+  }
+
+private:
+  uint32_t resolution;
+  uint32_t current = 0;
+  int64_t sum = 0;
+  uint32_t count = 0;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+
+#include "clockDiscipline.h"
+
+#define NTP_SYNC_INTERVAL 3600         // seconds between syncs
+#define NTP_RETRY_INTERVAL 60          // seconds to the first retry after a failed sync, doubles up to NTP_SYNC_INTERVAL
+#define NTP_TIMEOUT 2000               // ms to wait for an answer
+#define NTP_LOCAL_PORT 8123
+#define CLOCK_COMPENSATE_INTERVAL 60000 // ms between drift compensation slews
+#define DRIFT_FILE "/drift.bin"
+#define DRIFT_SAVE_CHANGE 0.5 // ppm the estimate moves before it is written to SPIFFS again
+
+// System clock (what ESP32Time reads) kept on NTP time. One request goes out
+// per sync and the answer is picked up on a later update(), so the network
+// task never waits on the network. Offsets are slewed with adjtime() unless
+// they are too large, the drift estimate is slewed out between syncs and kept
+// on SPIFFS so a reboot starts from it. The clock holds local time.
+class TimeService
+{
+public:
+  explicit TimeService(const char *server) : server(server) {}
+  void begin();    // restore the drift estimate (after SPIFFS.begin)
+  void syncSoon(); // sync on the next update, e.g. after getting an IP
+  void setUtcOffset(int32_t seconds); // from any task, the clock is moved on the next update
+  bool update();   // call often from one task, true when a sync was just applied
+
+  bool synced() const { return discipline.synced(); }
+  uint32_t lastSyncEpoch() const { return syncEpoch; } // local time
+  uint32_t syncCount() const { return syncs; }
+  uint32_t failureCount() const { return failures; }
+  const char *lastError() const { return error; }
+  const ClockDiscipline &clock() const { return discipline; }
+
+private:
+  static int64_t localMicros();
+  static void slew(int64_t micros);
+  void send();
+  bool receive();
+  void fail(const char *reason);
+  void saveDrift();
+
+  const char *server;
+  int64_t utcOffset = 0; // microseconds
+  volatile int32_t newUtcOffset = 0; // seconds
+  WiFiUDP udp;
+  bool udpStarted = false;
+  volatile bool syncRequested = true;
+  bool waiting = false;
+  uint32_t sentMillis = 0;
+  int64_t sentMicros = 0; // transmit timestamp of the request, unix time
+  uint32_t nextSync = 0;  // millis
+  uint32_t retryInterval = NTP_RETRY_INTERVAL;
+  uint32_t lastCompensate = 0;
+  ClockDiscipline discipline;
+  float savedPpm = 0;
+  uint32_t syncEpoch = 0;
+  uint32_t syncs = 0;
+  uint32_t failures = 0;
+  const char *error = "";
+};
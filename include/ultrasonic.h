@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+
+#define ULTRASONIC_PINGS_PER_READING 5 // pings per reading, the median echo is reported
+#define ULTRASONIC_ECHO_TIMEOUT 30000  // microseconds, ~5m round trip (HC-SR04 max range is 4m)
+#define ULTRASONIC_PING_SPACING 60000  // microseconds between pings so old echoes die out
+
+enum UltrasonicFault
+{
+  U_OK,
+  U_TIMEOUT // less than half of the pings got an echo back
+};
+
+// Non-blocking HC-SR04 driver. Echo edges are timestamped by a pin interrupt,
+// loop() only calls update() which never waits on the sensor. The pins are
+// behind trigger() and echoEdge() (esp32Ultrasonic.h on the board), so the
+// state machine itself is plain C++.
+class Ultrasonic
+{
+public:
+  typedef void (*Trigger)(); // sends one trigger pulse
+
+  explicit Ultrasonic(Trigger trigger) : trigger(trigger) {}
+  void startReading();                  // start a multi-ping reading, ignored if one is running
+  bool update(unsigned long nowMicros); // advance state machine, true when a reading completed
+  bool busy() const { return state != U_IDLE; }
+  unsigned long durationMicros() const { return medianDuration; } // median echo time of last good reading
+  UltrasonicFault fault() const { return lastFault; }
+  // called from the echo pin interrupt, inline so it lands in the interrupt's IRAM
+  void echoEdge(bool level, unsigned long nowMicros)
+  {
+    if (level)
+    {
+      echoStart = nowMicros;
+      echoHigh = true;
+    }
+    else if (echoHigh)
+    {
+      echoEnd = nowMicros;
+      echoHigh = false;
+      echoDone = true;
+    }
+  }
+
+private:
+  enum State
+  {
+    U_IDLE,
+    U_TRIGGER,
+    U_WAIT_ECHO,
+    U_SETTLE
+  };
+  void finishReading();
+
+  Trigger trigger;
+  State state = U_IDLE;
+  unsigned long triggerMicros = 0;
+  volatile unsigned long echoStart = 0;
+  volatile unsigned long echoEnd = 0;
+  volatile bool echoHigh = false;
+  volatile bool echoDone = false;
+  unsigned long pings[ULTRASONIC_PINGS_PER_READING];
+  uint8_t pingCount = 0;
+  uint8_t validCount = 0;
+  unsigned long medianDuration = 0;
+  UltrasonicFault lastFault = U_OK;
+};
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WATER_ALPHA 0.2         // alpha-beta filter gains, per reading (beta ~ alpha^2 / (2 - alpha))
+#define WATER_BETA 0.02
+#define WATER_GATE_CM 1.5       // readings further than this from the prediction are outliers
+#define WATER_GATE_RESET 3      // outliers in a row that agree with each other are a real jump (refill) and restart the filter
+#define WATER_REFILL_CM 2       // rise between two consumption points taken as a refill
+#define WATER_RATE_STEP 900     // seconds between consumption points
+#define WATER_RATE_POINTS 24    // consumption points regressed over (6 hours)
+#define WATER_RATE_MIN_POINTS 5 // before a consumption rate is given (1 hour)
+#define WATER_HYSTERESIS_CM 0.5 // below the low water distance before the level is no longer low
+
+// Reservoir below the sensor, with vertical walls. Round when diameterCm is
+// above 0, otherwise rectangular.
+struct TankGeometry
+{
+  float depthCm;  // sensor to tank bottom
+  float lengthCm;
+  float widthCm;
+  float diameterCm;
+};
+
+float soundSpeed(float celsius);                              // cm per microsecond in air
+float tankArea(const TankGeometry &tank);                     // cm^2
+float tankLitres(const TankGeometry &tank, float distanceCm); // water below distanceCm
+
+// Water level from the median echo of each ultrasonic reading. The echo is
+// turned into a distance at the speed of sound for the air temperature, then
+// an alpha-beta filter smooths it and gates out stray echoes. Consumption is
+// the least squares slope of the accepted readings, averaged into points
+// WATER_RATE_STEP apart, over the last hours, started over on a refill.
+class WaterLevelEstimator
+{
+public:
+  // false when the reading was rejected as an outlier
+  bool update(uint32_t echoMicros, float celsius, uint32_t epoch);
+  void reset();
+
+  bool valid() const { return started; }
+  float distance() const { return level; }       // cm, filtered
+  float rawDistance() const { return measured; } // cm, last reading
+  bool rateValid() const { return count >= WATER_RATE_MIN_POINTS; }
+  float dropRate() const { return slope; } // cm per hour the level falls
+  uint32_t outlierCount() const { return outliers; }
+  uint32_t refillCount() const { return refills; }
+
+  // litres per hour, hours until empty (-1 when not falling)
+  float consumption(const TankGeometry &tank) const;
+  float hoursToEmpty(const TankGeometry &tank) const;
+
+private:
+  void collect(uint32_t epoch);
+  void addPoint();
+  void restart(float distance, uint32_t epoch);
+
+  bool started = false;
+  float level = 0;    // cm
+  float velocity = 0; // cm per second
+  float measured = 0;
+  uint32_t lastEpoch = 0;
+  float jumpedTo = 0;    // first of the outliers in a row
+  uint8_t rejected = 0; // outliers in a row
+  uint32_t outliers = 0;
+  uint32_t refills = 0;
+  // consumption points, time in seconds since the filter (re)started
+  uint32_t firstEpoch = 0;
+  uint32_t nextPoint = 0;
+  float sumTime = 0; // readings towards the next point
+  float sumLevel = 0;
+  uint16_t collected = 0;
+  float times[WATER_RATE_POINTS];
+  float levels[WATER_RATE_POINTS];
+  uint8_t head = 0;
+  uint8_t count = 0;
+  float slope = 0;
+};
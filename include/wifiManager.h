@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define WIFI_MAX_NETWORKS 4
+#define WIFI_SSID_SIZE 33
+#define WIFI_SCAN_TIMEOUT 10000    // ms
+#define WIFI_CONNECT_TIMEOUT 15000 // ms per network
+#define WIFI_BACKOFF_MIN 5000      // ms after the first failed round, doubles every round
+#define WIFI_BACKOFF_MAX 300000    // ms (5 minutes)
+#define WIFI_AP_AFTER 120000       // ms without a connection before the fallback access point starts
+
+struct WifiNetwork
+{
+  const char *ssid;
+  const char *password;
+};
+
+// What the manager drives. Every call has to return straight away, scanning
+// and connecting carry on in the background and are polled.
+class WifiRadio
+{
+public:
+  virtual ~WifiRadio() {}
+  virtual void startScan() = 0;
+  virtual int scanComplete() = 0; // networks found, -1 while scanning, -2 if the scan failed
+  virtual void scanEntry(int i, char *ssid, size_t size, int32_t &rssi) = 0;
+  virtual void scanDelete() = 0;
+  virtual void connect(const char *ssid, const char *password) = 0;
+  virtual bool connected() = 0; // station up with an IP
+  virtual void disconnect() = 0;
+  virtual void startAccessPoint() = 0;
+  virtual void stopAccessPoint() = 0;
+  virtual void powerOff() = 0; // radio off, scans and connects are not called until powerOn()
+  virtual void powerOn() = 0;
+};
+
+enum WifiState : uint8_t
+{
+  WIFI_SCANNING,
+  WIFI_CONNECTING,
+  WIFI_CONNECTED,
+  WIFI_BACKOFF,  // every network failed, waiting before the next round
+  WIFI_SUSPENDED // radio off between low power upload windows
+};
+
+// Station connection state machine, polled from the network task. Each round
+// scans, then tries the stored networks that are in range strongest first
+// (all of them if the scan failed, hidden networks do not show up). A failed
+// round waits an exponential backoff with +-25% jitter so a flaky AP is not
+// hammered. After WIFI_AP_AFTER offline a fallback access point comes up for
+// local control, it stays up until the station connects again. Suspended,
+// the radio is off and nothing happens until resume() starts a new round.
+class WifiManager
+{
+public:
+  typedef void (*StateHandler)(WifiState state, bool accessPoint);
+
+  WifiManager(WifiRadio &radio, const WifiNetwork *networks, uint8_t count, StateHandler handler)
+      : radio(radio), networks(networks), count(count < WIFI_MAX_NETWORKS ? count : WIFI_MAX_NETWORKS), onChange(handler) {}
+
+  void begin(uint32_t nowMs, uint32_t seed); // seed for the backoff jitter
+  void update(uint32_t nowMs);
+  void suspend(uint32_t nowMs);
+  void resume(uint32_t nowMs);
+  bool suspended() const { return current == WIFI_SUSPENDED; }
+
+  WifiState state() const { return current; }
+  bool accessPoint() const { return apActive; }
+  const char *ssid() const { return (network >= 0) ? networks[network].ssid : ""; } // network connected or being tried
+  uint32_t connects() const { return connectCount; }
+  uint32_t failedAttempts() const { return failures; }
+  uint32_t backoffMillis() const { return backoff; } // current backoff wait
+
+private:
+  void enter(WifiState state, uint32_t nowMs);
+  void startScan(uint32_t nowMs);
+  void pickCandidates(int found);
+  void tryNext(uint32_t nowMs);
+  void roundFailed(uint32_t nowMs);
+  uint32_t random();
+
+  WifiRadio &radio;
+  const WifiNetwork *networks;
+  uint8_t count;
+  StateHandler onChange;
+  WifiState current = WIFI_SCANNING;
+  uint32_t since = 0;        // when the current state was entered
+  uint32_t offlineSince = 0; // when the station was last connected (or boot)
+  uint32_t backoff = 0;
+  uint8_t failedRounds = 0;
+  bool apActive = false;
+  int8_t network = -1;
+  uint8_t candidates[WIFI_MAX_NETWORKS]; // network indexes, strongest first
+  uint8_t candidateCount = 0;
+  uint8_t nextCandidate = 0;
+  uint32_t connectCount = 0;
+  uint32_t failures = 0;
+  uint32_t seed = 1;
+};
@@ -0,0 +1,91 @@
+#include <math.h>
+
+#include "climateControl.h"
+
+float climateDemand(float heatIndex, const ClimateBounds &bounds)
+{
+  // NAN falls through to 1
+  if (heatIndex < bounds.coolHeatIndex)
+  {
+    float share = (bounds.coolHeatIndex - heatIndex) / CLIMATE_SPAN;
+    return 1 - (1 - bounds.minScale) * ((share < 1) ? share : 1);
+  }
+  if (heatIndex > bounds.hotHeatIndex)
+  {
+    float share = (heatIndex - bounds.hotHeatIndex) / CLIMATE_SPAN;
+    return 1 + (bounds.maxScale - 1) * ((share < 1) ? share : 1);
+  }
+  return 1;
+}
+
+float reservoirShare(float distanceCm, float lowCm, float mediumCm)
+{
+  if (!(lowCm > mediumCm) or isnan(distanceCm))
+    return NAN;
+  float share = (lowCm - distanceCm) / (lowCm - mediumCm);
+  return (share < 0) ? 0 : (share > 1) ? 1 : share;
+}
+
+void ClimateController::reading(float temperature, float heatIndex, uint32_t epoch)
+{
+  times[head] = epoch;
+  temperatures[head] = temperature;
+  head = (head + 1) % CLIMATE_TREND_POINTS;
+  if (count < CLIMATE_TREND_POINTS)
+    count++;
+  // least squares slope of the readings in the window, hours back from this one
+  float n = 0, sumT = 0, sumF = 0, sumTT = 0, sumTF = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint32_t age = epoch - times[i];
+    if (age > CLIMATE_TREND_WINDOW)
+      continue;
+    float t = -(float)age / 3600;
+    n++;
+    sumT += t;
+    sumF += temperatures[i];
+    sumTT += t * t;
+    sumTF += t * temperatures[i];
+  }
+  float spread = n * sumTT - sumT * sumT;
+  slope = (n >= CLIMATE_TREND_MIN_POINTS and spread > 0) ? (n * sumTF - sumT * sumF) / spread : 0;
+  slope = (slope < -CLIMATE_MAX_TREND) ? -CLIMATE_MAX_TREND : (slope > CLIMATE_MAX_TREND) ? CLIMATE_MAX_TREND : slope;
+  anticipated = heatIndex + slope * CLIMATE_LOOKAHEAD;
+  valid = true;
+}
+
+void ClimateController::stale()
+{
+  valid = false;
+}
+
+bool ClimateController::update(const ClimateBounds &bounds, float reservoir)
+{
+  float targets[CLIMATE_ROLES] = {1, 1, 1};
+  if (bounds.enabled and valid)
+  {
+    float demand = climateDemand(anticipated, bounds);
+    targets[CLIMATE_AERATION] = demand;
+    // no extra draw on a reservoir running low, down to the minimum once it is low
+    float cap = isnan(reservoir) ? bounds.maxScale : bounds.minScale + (bounds.maxScale - bounds.minScale) * reservoir;
+    targets[CLIMATE_IRRIGATION] = (demand < cap) ? demand : cap;
+  }
+  bool changed = false;
+  for (uint8_t role = 0; role < CLIMATE_ROLES; role++)
+  {
+    float target = targets[role];
+    float current = scales[role];
+    // the little extra keeps float rounding from holding a whole step back
+    bool outside = current < bounds.minScale or current > bounds.maxScale;
+    if (target == 1 ? current == 1 : !outside and fabsf(target - current) < CLIMATE_STEP - 0.001)
+      continue;
+    float stepped = (target == 1) ? 1 : roundf(target / CLIMATE_STEP) * CLIMATE_STEP;
+    stepped = (stepped < bounds.minScale) ? bounds.minScale : (stepped > bounds.maxScale) ? bounds.maxScale : stepped;
+    if (stepped != current)
+    {
+      scales[role] = stepped;
+      changed = true;
+    }
+  }
+  return changed;
+}
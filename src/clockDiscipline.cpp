@@ -0,0 +1,122 @@
+#include <string.h>
+
+#include "clockDiscipline.h"
+
+#define NTP_UNIX_OFFSET 2208988800ULL // seconds from 1900 to 1970
+
+static void putTimestamp(uint8_t *out, int64_t unixMicros)
+{
+  uint64_t seconds = unixMicros / 1000000 + NTP_UNIX_OFFSET;
+  uint64_t fraction = ((uint64_t)(unixMicros % 1000000) << 32) / 1000000;
+  for (int i = 0; i < 4; i++)
+  {
+    out[i] = seconds >> (24 - 8 * i);
+    out[4 + i] = fraction >> (24 - 8 * i);
+  }
+}
+
+static int64_t getTimestamp(const uint8_t *in)
+{
+  uint32_t seconds = 0;
+  uint32_t fraction = 0;
+  for (int i = 0; i < 4; i++)
+  {
+    seconds = seconds << 8 | in[i];
+    fraction = fraction << 8 | in[4 + i];
+  }
+  // era 0 ends in 2036, later seconds have wrapped past 0
+  int64_t unixSeconds = (int64_t)seconds - (int64_t)NTP_UNIX_OFFSET;
+  if (seconds < 0x80000000UL)
+    unixSeconds += 1LL << 32;
+  return unixSeconds * 1000000 + (((uint64_t)fraction * 1000000) >> 32);
+}
+
+void ntpRequest(uint8_t *packet, int64_t transmitMicros)
+{
+  memset(packet, 0, NTP_PACKET_SIZE);
+  packet[0] = 0x23; // no leap warning, version 4, client mode
+  putTimestamp(packet + 40, transmitMicros);
+}
+
+const char *ntpParse(const uint8_t *packet, size_t length, int64_t sentMicros, int64_t receivedMicros, NtpSample &sample)
+{
+  if (length < NTP_PACKET_SIZE)
+    return "short packet";
+  if ((packet[0] & 0x07) != 4)
+    return "not a server reply";
+  if ((packet[0] >> 6) == 3)
+    return "server not synchronized";
+  sample.stratum = packet[1];
+  if (sample.stratum == 0 or sample.stratum > 15)
+    return "bad stratum"; // 0 is a kiss-o'-death
+  // originate timestamp has to be the one we sent, otherwise it is a stale or spoofed answer
+  uint8_t sent[8];
+  putTimestamp(sent, sentMicros);
+  if (memcmp(packet + 24, sent, 8) != 0)
+    return "reply does not match request";
+  int64_t received = getTimestamp(packet + 32);    // server receive
+  int64_t transmitted = getTimestamp(packet + 40); // server transmit
+  sample.offset = ((received - sentMicros) + (transmitted - receivedMicros)) / 2;
+  sample.delay = (receivedMicros - sentMicros) - (transmitted - received);
+  if (sample.delay < 0 or sample.delay > NTP_MAX_DELAY)
+    return "round trip too slow";
+  return NULL;
+}
+
+void ClockDiscipline::restore(float ppm)
+{
+  if (ppm > -CLOCK_MAX_DRIFT_PPM and ppm < CLOCK_MAX_DRIFT_PPM)
+    drift = ppm;
+}
+
+int64_t ClockDiscipline::sync(const NtpSample &sample, int64_t localMicros, bool &step)
+{
+  offset = sample.offset;
+  delay = sample.delay;
+  int64_t magnitude = (offset < 0) ? -offset : offset;
+  step = !haveSync or magnitude > CLOCK_STEP_THRESHOLD;
+  if (haveSync and !step)
+  {
+    // whatever is left after compensating at the old estimate is drift error
+    int64_t interval = localMicros - lastSync;
+    if (interval >= CLOCK_MIN_DRIFT_INTERVAL * 1000000LL)
+    {
+      // the drift owed since the last compensate() is in the offset too, it is not an error
+      double uncompensated = owed;
+      if (localMicros > lastCompensate)
+        uncompensated += (double)(localMicros - lastCompensate) * drift / 1e6;
+      float error = ((double)offset - uncompensated) * 1e6 / interval;
+      if (error > -CLOCK_MAX_DRIFT_PPM and error < CLOCK_MAX_DRIFT_PPM)
+      {
+        drift += CLOCK_DRIFT_GAIN * error;
+        if (drift > CLOCK_MAX_DRIFT_PPM)
+          drift = CLOCK_MAX_DRIFT_PPM;
+        if (drift < -CLOCK_MAX_DRIFT_PPM)
+          drift = -CLOCK_MAX_DRIFT_PPM;
+      }
+    }
+  }
+  haveSync = true;
+  lastSync = localMicros + offset;
+  // the correction also covers the drift since the last compensate(), start over from here
+  lastCompensate = lastSync;
+  owed = 0;
+  return offset;
+}
+
+void ClockDiscipline::shift(int64_t micros)
+{
+  lastSync += micros;
+  lastCompensate += micros;
+}
+
+int64_t ClockDiscipline::compensate(int64_t localMicros)
+{
+  if (!haveSync or localMicros <= lastCompensate)
+    return 0; // still slewing in the last sync
+  owed += (double)(localMicros - lastCompensate) * drift / 1e6;
+  lastCompensate = localMicros;
+  int64_t correction = (int64_t)owed;
+  owed -= correction;
+  return correction;
+}
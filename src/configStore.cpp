@@ -0,0 +1,74 @@
+#include "configStore.h"
+
+static const char *const slotKeys[] = {"a", "b"};
+
+bool ConfigStore::begin(Settings &settings)
+{
+  defaultSettings(settings);
+  opened = nvs.begin(CONFIG_NAMESPACE, false);
+  if (!opened)
+  {
+    error = "nvs";
+    Serial.println("Error: Could not open the config namespace, using default settings");
+    return false;
+  }
+  Settings slots[2];
+  uint32_t sequences[2] = {0, 0};
+  const char *errors[2];
+  for (uint8_t slot = 0; slot < 2; slot++)
+    errors[slot] = readSlot(slot, slots[slot], sequences[slot]);
+  int8_t newest = -1;
+  for (uint8_t slot = 0; slot < 2; slot++)
+  {
+    if (errors[slot] == NULL and (newest < 0 or sequences[slot] > sequences[newest]))
+      newest = slot;
+  }
+  if (newest < 0)
+  {
+    error = errors[0];
+    Serial.println((String) "No stored settings (" + error + "), using defaults");
+    return false;
+  }
+  if (errors[1 - newest] != NULL and sequences[newest] > 1)
+  {
+    // the other slot was being written when the power went
+    Serial.println((String) "Error: Config slot " + slotKeys[1 - newest] + " " + errors[1 - newest]);
+  }
+  settings = slots[newest];
+  current = sequences[newest];
+  currentSlot = newest;
+  Serial.println((String) "Settings " + current + " loaded from slot " + slotKeys[newest]);
+  return true;
+}
+
+const char *ConfigStore::save(const Settings &settings)
+{
+  const char *invalid = validateSettings(settings);
+  if (invalid != NULL)
+    return invalid;
+  if (!opened)
+    return "nvs not available";
+  uint8_t blob[SETTINGS_BLOB_SIZE];
+  size_t length = encodeSettings(settings, current + 1, blob, sizeof(blob));
+  if (length == 0)
+    return "settings do not fit SETTINGS_BLOB_SIZE";
+  uint8_t slot = 1 - currentSlot;
+  if (nvs.putBytes(slotKeys[slot], blob, length) != length)
+    return "nvs write failed";
+  // only now is the new slot the current one
+  currentSlot = slot;
+  current++;
+  saves++;
+  return NULL;
+}
+
+const char *ConfigStore::readSlot(uint8_t slot, Settings &settings, uint32_t &sequence)
+{
+  if (!nvs.isKey(slotKeys[slot]))
+    return "empty";
+  uint8_t blob[SETTINGS_BLOB_SIZE];
+  size_t length = nvs.getBytesLength(slotKeys[slot]);
+  if (length == 0 or length > sizeof(blob) or nvs.getBytes(slotKeys[slot], blob, length) != length)
+    return "unreadable";
+  return decodeSettings(blob, length, settings, sequence);
+}
@@ -0,0 +1,83 @@
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "controlProtocol.h"
+
+const char *parseControlRequest(const char *frame, size_t length, ControlRequest &request)
+{
+  StaticJsonDocument<192> doc;
+  request.id = 0;
+  if (deserializeJson(doc, frame, length))
+    return "bad json";
+  if (!doc["id"].is<uint32_t>())
+    return "missing id";
+  request.id = doc["id"].as<uint32_t>();
+  const char *command = doc["cmd"];
+  if (command == NULL)
+    return "missing cmd";
+  if (strcmp(command, "override") == 0)
+    request.command = CONTROL_OVERRIDE;
+  else if (strcmp(command, "auto") == 0)
+    request.command = CONTROL_AUTO;
+  else
+    return "unknown cmd";
+  const char *output = doc["output"];
+  if (output == NULL or strlen(output) >= CONTROL_OUTPUT_SIZE)
+    return "missing output";
+  strcpy(request.output, output);
+  request.state = false;
+  request.time = 0;
+  if (request.command == CONTROL_AUTO)
+    return NULL;
+  if (!doc["state"].is<int>() or (doc["state"].as<int>() != 0 and doc["state"].as<int>() != 1))
+    return "state must be 0 or 1";
+  request.state = doc["state"].as<int>() == 1;
+  if (!doc["time"].is<int>() or doc["time"].as<int>() < 1 or doc["time"].as<int>() > CONTROL_MAX_TIME)
+    return "time must be 1-65 min";
+  request.time = doc["time"].as<int>();
+  return NULL;
+}
+
+const char *parseControlCommand(const char *frame, size_t length, const OutputConfig *configs, size_t count, ControlRequest &request, uint8_t &output)
+{
+  const char *error = parseControlRequest(frame, length, request);
+  if (error != NULL)
+    return error;
+  for (size_t i = 0; i < count; i++)
+  {
+    if (strcmp(configs[i].id, request.output) == 0)
+    {
+      output = i;
+      return NULL;
+    }
+  }
+  return "unknown output";
+}
+
+static size_t fitted(int n, size_t size)
+{
+  return (n < 0 or (size_t)n >= size) ? 0 : n;
+}
+
+size_t writeControlAck(char *out, size_t size, uint32_t id, const char *output, const char *command)
+{
+  return fitted(snprintf(out, size, "{\"id\":%u,\"ok\":true,\"output\":\"%s\",\"command\":\"%s\"}", (unsigned)id, output, command), size);
+}
+
+size_t writeControlError(char *out, size_t size, uint32_t id, const char *error)
+{
+  return fitted(snprintf(out, size, "{\"id\":%u,\"ok\":false,\"error\":\"%s\"}", (unsigned)id, error), size);
+}
+
+size_t writeCommandText(char *out, size_t size, const OutputState &state, uint32_t epoch)
+{
+  const char *command = (state.command) ? "On" : "Off";
+  if (!state.override)
+    return fitted(snprintf(out, size, "%s (Auto)", command), size);
+  if (state.overrideEnd == 0)
+    return fitted(snprintf(out, size, "%s (Override Permanent)", command), size);
+  // time left in minutes
+  uint32_t left = (state.overrideEnd > epoch) ? (state.overrideEnd - epoch) / 60 : 0;
+  return fitted(snprintf(out, size, "%s (Override %u min)", command, (unsigned)left), size);
+}
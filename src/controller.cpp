@@ -0,0 +1,34 @@
+#include "controller.h"
+
+WaterLevel classifyWaterLevel(float distanceCm, WaterLevel previous, const Settings &settings)
+{
+  if (distanceCm > settings.waterLowCm - (previous == W_LOW ? WATER_HYSTERESIS_CM : 0))
+    return W_LOW;
+  if (distanceCm > settings.waterMediumCm)
+    return W_MED;
+  return W_HIGH;
+}
+
+bool highTemperature(float fahrenheit, bool previous, const Settings &settings)
+{
+  return previous ? fahrenheit > settings.highTempAlarm - settings.highTempHysteresis : fahrenheit > settings.highTempAlarm;
+}
+
+void planTasks(WakePlanner &planner, Hal &hal, uint32_t nowMs, const TaskDeadlines &deadlines, const Settings &settings)
+{
+  planner.due(deadlines.alarmMs, POWER_ALARM);
+  if (deadlines.alarmInputs)
+    planner.idle(POWER_ALARM);
+  if (hal.distanceBusy())
+    planner.idle(POWER_MEASURING);
+  planner.due(hal.climateDueIn(nowMs), POWER_DHT);
+  planner.due(deadlines.waterMs, POWER_WATER);
+  planner.due(deadlines.historyMs, POWER_HISTORY);
+  planner.due(deadlines.flushMs, POWER_HISTORY);
+  planner.due(deadlines.telemetryMs, POWER_TELEMETRY);
+  uint32_t windowStart;
+  if (deadlines.radioUp or inUploadWindow(hal.epoch(), settings.uploadInterval, settings.uploadWindow, windowStart))
+    planner.idle(POWER_UPLOAD);
+  else
+    planner.dueAt(windowStart, POWER_UPLOAD);
+}
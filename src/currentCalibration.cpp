@@ -0,0 +1,67 @@
+#include <math.h>
+
+#include "currentCalibration.h"
+
+void CurrentChannel::configure(float voltsPerCount, float voltsPerAmp)
+{
+  ampsPerCount = voltsPerCount / voltsPerAmp;
+}
+
+void CurrentChannel::restore(const ChannelLearned &learned)
+{
+  // a corrupt file must not poison the channel
+  if (!(learned.noise2 >= 0 and learned.nominal >= 0 and learned.nominal < 100))
+    return;
+  saved = learned;
+}
+
+float CurrentChannel::zeroCounts() const
+{
+  return sqrtf(saved.noise2);
+}
+
+// running average, a plain mean until count reaches windows
+static float average(float mean, float sample, uint32_t count, uint32_t windows)
+{
+  return mean + (sample - mean) / (count < windows ? count : windows);
+}
+
+float CurrentChannel::update(float rmsCounts, bool driven, uint32_t sinceEdgeMs, float fallbackThreshold)
+{
+  float power = rmsCounts * rmsCounts;
+  bool settled = sinceEdgeMs >= CAL_SETTLE_MS;
+  if (!driven and settled)
+  {
+    // auto-zero
+    if (saved.zeroWindows < UINT32_MAX)
+      saved.zeroWindows++;
+    saved.noise2 = average(saved.noise2, power, saved.zeroWindows, CAL_ZERO_WINDOWS);
+  }
+  float signal = power - saved.noise2;
+  current = (signal > 0) ? sqrtf(signal) * ampsPerCount : 0;
+  float threshold = learned() ? saved.nominal * CAL_RUNNING_SHARE : fallbackThreshold;
+  isRunning = current > threshold;
+
+  if (!(driven and settled and isRunning))
+  {
+    // stopped or failed outright (the status mismatch alarm), the verdict of the
+    // last run stands until the next one has run long enough
+    runLength = 0;
+    return current;
+  }
+  runLength++;
+  smoothed = (runLength == 1) ? current : smoothed + (current - smoothed) / CAL_FAST_WINDOWS;
+  if (runLength < CAL_FAST_WINDOWS)
+    return current;
+  float r = ratio();
+  isDegraded = learned() and (r < CAL_LOW_RATIO or r > CAL_HIGH_RATIO);
+  // learn from normal running only, so a degraded pump does not become the new normal
+  // (a slow drift inside the band is still followed)
+  if (!isDegraded)
+  {
+    if (saved.runWindows < UINT32_MAX)
+      saved.runWindows++;
+    saved.nominal = average(saved.nominal, current, saved.runWindows, CAL_NOMINAL_WINDOWS);
+  }
+  return current;
+}
@@ -0,0 +1,101 @@
+#include <esp_adc_cal.h>
+
+#include "currentSensor.h"
+
+static TaskHandle_t samplingTaskHandle = NULL;
+static hw_timer_t *samplingTimer = NULL;
+
+void CurrentSensor::begin(const uint8_t *channelPins, uint8_t count)
+{
+  channels = min(count, (uint8_t)CURRENT_MAX_CHANNELS);
+  for (uint8_t c = 0; c < channels; c++)
+  {
+    pins[c] = channelPins[c];
+    rms[c].store(0.0);
+    pinMode(pins[c], INPUT);
+  }
+  // analogRead defaults: ADC1, 11dB, 12 bit. Over the sensor's range the characterised curve is a
+  // straight line, only its slope matters for the RMS (the offset drops out with the mean)
+  esp_adc_cal_characteristics_t characteristics;
+  if (esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &characteristics) != ESP_ADC_CAL_VAL_DEFAULT_VREF)
+  {
+    gain = characteristics.coeff_a / 65536.0 / 1000.0; // coeff_a is mV per count << 16
+  }
+  // sampling task outranks loop() so sample spacing does not depend on it
+  xTaskCreatePinnedToCore(samplingTask, "currentSampling", 2048, this, 5, &samplingTaskHandle, 1);
+  // 80MHz APB / 80 = 1MHz timer tick
+  samplingTimer = timerBegin(0, 80, true);
+  timerAttachInterrupt(samplingTimer, onTimer, true);
+  timerAlarmWrite(samplingTimer, 1000000 / CURRENT_SAMPLE_RATE, true);
+  timerAlarmEnable(samplingTimer);
+}
+
+void IRAM_ATTR CurrentSensor::onTimer()
+{
+  // analogRead is not safe in an ISR, just wake the sampling task
+  BaseType_t woken = pdFALSE;
+  vTaskNotifyGiveFromISR(samplingTaskHandle, &woken);
+  portYIELD_FROM_ISR(woken);
+}
+
+void CurrentSensor::samplingTask(void *arg)
+{
+  CurrentSensor *sensor = (CurrentSensor *)arg;
+  for (;;)
+  {
+    uint32_t ticks = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (ticks > 1)
+    {
+      sensor->missed.fetch_add(ticks - 1, std::memory_order_relaxed);
+    }
+    sensor->sampleAll();
+  }
+}
+
+void CurrentSensor::pause(bool paused)
+{
+  // the window in progress carries on after the pause, every relay is off on both sides of it
+  if (paused == stopped or samplingTimer == NULL)
+    return;
+  stopped = paused;
+  if (paused)
+    timerAlarmDisable(samplingTimer);
+  else
+    timerAlarmEnable(samplingTimer);
+}
+
+void CurrentSensor::startCapture(uint8_t channel)
+{
+  if (channel >= channels or captureChannel.load(std::memory_order_relaxed) >= 0)
+    return;
+  captureDone.store(false, std::memory_order_relaxed);
+  captureIndex = 0;
+  captureChannel.store(channel, std::memory_order_release); // hands captureIndex to the sampling task
+}
+
+void CurrentSensor::sampleAll()
+{
+  for (uint8_t c = 0; c < channels; c++)
+  {
+    window[c][index] = analogRead(pins[c]);
+  }
+  int8_t capturing = captureChannel.load(std::memory_order_acquire);
+  if (capturing >= 0)
+  {
+    captured[captureIndex] = window[capturing][index];
+    if (++captureIndex == CURRENT_CAPTURE_SIZE)
+    {
+      captureChannel.store(-1, std::memory_order_relaxed);
+      captureDone.store(true, std::memory_order_release);
+    }
+  }
+  if (++index < CURRENT_RMS_WINDOW)
+    return;
+  // window covers whole mains cycles, run the batched kernel and publish
+  index = 0;
+  for (uint8_t c = 0; c < channels; c++)
+  {
+    rms[c].store(acRms(window[c], CURRENT_RMS_WINDOW), std::memory_order_relaxed);
+  }
+  windows.fetch_add(1, std::memory_order_release);
+}
@@ -0,0 +1,71 @@
+#include <math.h>
+
+#include "dhtDecoder.h"
+
+static bool within(uint16_t micros, uint16_t min, uint16_t max)
+{
+  return micros >= min and micros <= max;
+}
+
+const char *decodeDht(const DhtPulse *pulses, size_t count, DhtModel model, DhtSample &sample)
+{
+  size_t i = 0;
+  while (i + 1 < count and !(pulses[i].level == 0 and within(pulses[i].micros, DHT_RESPONSE_MIN_US, DHT_RESPONSE_MAX_US) and
+                             pulses[i + 1].level == 1 and within(pulses[i + 1].micros, DHT_RESPONSE_MIN_US, DHT_RESPONSE_MAX_US)))
+    i++;
+  if (i + 1 >= count)
+    return "no response";
+  i += 2;
+  uint8_t bytes[DHT_BITS / 8] = {};
+  for (uint8_t bit = 0; bit < DHT_BITS; bit++, i += 2)
+  {
+    if (i + 1 >= count)
+      return "short frame";
+    const DhtPulse &low = pulses[i];
+    const DhtPulse &high = pulses[i + 1];
+    if (low.level != 0 or high.level != 1 or !within(low.micros, DHT_BIT_LOW_MIN_US, DHT_BIT_LOW_MAX_US) or
+        !within(high.micros, DHT_BIT_HIGH_MIN_US, DHT_BIT_HIGH_MAX_US))
+      return "bad bit timing";
+    bytes[bit / 8] = bytes[bit / 8] << 1 | (high.micros > DHT_ONE_THRESHOLD_US);
+  }
+  if ((uint8_t)(bytes[0] + bytes[1] + bytes[2] + bytes[3]) != bytes[4])
+    return "bad checksum";
+  float humidity, celsius;
+  if (model == DHT_11)
+  {
+    humidity = bytes[0] + bytes[1] * 0.1;
+    celsius = bytes[2] + (bytes[3] & 0x7f) * 0.1;
+    if (bytes[3] & 0x80)
+      celsius = -celsius;
+  }
+  else
+  {
+    humidity = (bytes[0] << 8 | bytes[1]) * 0.1;
+    celsius = ((bytes[2] & 0x7f) << 8 | bytes[3]) * 0.1;
+    if (bytes[2] & 0x80)
+      celsius = -celsius;
+  }
+  // an all zero frame passes the checksum, 0% is not a reading
+  if (humidity <= 0 or humidity > 100 or celsius < -40 or celsius > 80)
+    return "out of range";
+  sample.humidity = humidity;
+  sample.celsius = celsius;
+  return NULL;
+}
+
+float computeHeatIndex(float fahrenheit, float humidity)
+{
+  float t = fahrenheit;
+  float rh = humidity;
+  // Steadman's simple formula, the regression only holds above ~80F
+  float index = 0.5 * (t + 61.0 + (t - 68.0) * 1.2 + rh * 0.094);
+  if (index <= 79)
+    return index;
+  index = -42.379 + 2.04901523 * t + 10.14333127 * rh - 0.22475541 * t * rh - 0.00683783 * t * t - 0.05481717 * rh * rh +
+          0.00122874 * t * t * rh + 0.00085282 * t * rh * rh - 0.00000199 * t * t * rh * rh;
+  if (rh < 13 and t >= 80 and t <= 112)
+    index -= (13 - rh) * 0.25 * sqrtf((17 - fabsf(t - 95)) / 17);
+  else if (rh > 85 and t >= 80 and t <= 87)
+    index += (rh - 85) * 0.1 * (87 - t) * 0.2;
+  return index;
+}
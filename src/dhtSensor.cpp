@@ -0,0 +1,136 @@
+#include "dhtSensor.h"
+
+void DhtSensor::begin(uint8_t dataPin, DhtModel dhtModel, uint32_t intervalMs)
+{
+  pin = (gpio_num_t)dataPin;
+  model = dhtModel;
+  interval.store(intervalMs, std::memory_order_relaxed);
+  // 1us ticks, the capture ends once the line has idled high for 200us
+  rmt_config_t config = {};
+  config.rmt_mode = RMT_MODE_RX;
+  config.channel = DHT_RMT_CHANNEL;
+  config.gpio_num = pin;
+  config.clk_div = 80;
+  config.mem_block_num = 2; // 128 items, a frame is ~43
+  config.rx_config.filter_en = true;
+  config.rx_config.filter_ticks_thresh = 200; // APB cycles, drops glitches under 2.5us
+  config.rx_config.idle_threshold = 200;
+  rmt_config(&config);
+  rmt_driver_install(DHT_RMT_CHANNEL, 512, 0);
+  rmt_get_ringbuf_handle(DHT_RMT_CHANNEL, &ringbuffer);
+  gpio_set_pull_mode(pin, GPIO_PULLUP_ONLY);
+  // outranks the sensing task so a reader can never spin on a half written reading,
+  // a read is mostly asleep through the start signal and the capture
+  xTaskCreatePinnedToCore(readingTask, "dht", 3072, this, 3, &task, 1);
+}
+
+void DhtSensor::setInterval(uint32_t intervalMs)
+{
+  interval.store(intervalMs, std::memory_order_relaxed);
+  if (task)
+    xTaskNotifyGive(task);
+}
+
+void DhtSensor::catchUp(uint32_t nowMs)
+{
+  if (task and (int32_t)(nowMs - dueMs()) >= DHT_CATCH_UP_MS)
+    xTaskNotifyGive(task);
+}
+
+void DhtSensor::readingTask(void *arg)
+{
+  DhtSensor *sensor = (DhtSensor *)arg;
+  uint32_t failedInRow = 0;
+  for (;;)
+  {
+    DhtSample sample;
+    const char *failed = sensor->read(sample);
+    sensor->readCount.fetch_add(1, std::memory_order_relaxed);
+    uint32_t period = sensor->interval.load(std::memory_order_relaxed);
+    uint32_t wait = period;
+    if (failed == NULL)
+    {
+      failedInRow = 0;
+      sensor->publish(sample, millis());
+    }
+    else
+    {
+      sensor->failureCount.fetch_add(1, std::memory_order_relaxed);
+      sensor->error.store(failed, std::memory_order_relaxed);
+      wait = DHT_RETRY_MIN;
+      for (uint32_t i = 0; i < failedInRow and wait < period; i++)
+        wait *= 2;
+      wait = min(wait, period);
+      failedInRow++;
+    }
+    // setInterval() and catchUp() cut the wait short
+    sensor->due.store(millis() + wait, std::memory_order_relaxed);
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait));
+  }
+}
+
+const char *DhtSensor::read(DhtSample &sample)
+{
+  // start signal, then let go of the line and capture the answer
+  gpio_set_direction(pin, GPIO_MODE_INPUT_OUTPUT_OD);
+  gpio_set_level(pin, 0);
+  vTaskDelay(pdMS_TO_TICKS(DHT_START_MS));
+  gpio_set_level(pin, 1);
+  rmt_rx_start(DHT_RMT_CHANNEL, true);
+  size_t size = 0;
+  rmt_item32_t *items = (rmt_item32_t *)xRingbufferReceive(ringbuffer, &size, pdMS_TO_TICKS(DHT_CAPTURE_TIMEOUT));
+  rmt_rx_stop(DHT_RMT_CHANNEL);
+  gpio_set_direction(pin, GPIO_MODE_INPUT);
+  if (items == NULL)
+    return "no capture";
+  size_t count = 0;
+  for (size_t i = 0; i < size / sizeof(rmt_item32_t) and count + 2 <= DHT_MAX_PULSES; i++)
+  {
+    // a zero duration marks the end of the capture
+    if (items[i].duration0 == 0)
+      break;
+    pulses[count++] = {(uint8_t)items[i].level0, (uint16_t)items[i].duration0};
+    if (items[i].duration1 == 0)
+      break;
+    pulses[count++] = {(uint8_t)items[i].level1, (uint16_t)items[i].duration1};
+  }
+  vRingbufferReturnItem(ringbuffer, items);
+  return decodeDht(pulses, count, model, sample);
+}
+
+void DhtSensor::publish(const DhtSample &sample, uint32_t nowMs)
+{
+  float fahrenheit = sample.celsius * 1.8 + 32;
+  uint32_t sequence = published.load(std::memory_order_relaxed);
+  published.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  temperature.store(fahrenheit, std::memory_order_relaxed);
+  humidity.store(sample.humidity, std::memory_order_relaxed);
+  heatIndex.store(computeHeatIndex(fahrenheit, sample.humidity), std::memory_order_relaxed);
+  takenMs.store(nowMs, std::memory_order_relaxed);
+  published.store(sequence + 2, std::memory_order_release);
+}
+
+bool DhtSensor::latest(DhtReading &reading) const
+{
+  uint32_t before, after;
+  do
+  {
+    before = published.load(std::memory_order_acquire);
+    reading.temperature = temperature.load(std::memory_order_relaxed);
+    reading.humidity = humidity.load(std::memory_order_relaxed);
+    reading.heatIndex = heatIndex.load(std::memory_order_relaxed);
+    reading.takenMs = takenMs.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    after = published.load(std::memory_order_relaxed);
+  } while ((before & 1) or before != after);
+  return before > 0;
+}
+
+bool DhtSensor::stale(uint32_t nowMs) const
+{
+  DhtReading reading;
+  if (!latest(reading))
+    return true;
+  return nowMs - reading.takenMs > DHT_STALE_INTERVALS * interval.load(std::memory_order_relaxed);
+}
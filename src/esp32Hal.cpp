@@ -0,0 +1,29 @@
+#include "esp32Hal.h"
+
+bool Esp32Hal::readClimate(float &temperature, float &humidity, float &heatIndex)
+{
+  DhtReading reading;
+  if (!dht.latest(reading) or dht.stale(::millis()))
+    return false;
+  temperature = reading.temperature;
+  humidity = reading.humidity;
+  heatIndex = reading.heatIndex;
+  return true;
+}
+
+void Esp32Hal::writePins(uint32_t setMask, uint32_t clearMask)
+{
+  // write-1-to-set/clear registers, each change is a single atomic store
+  if (setMask)
+    GPIO.out_w1ts = setMask;
+  if (clearMask)
+    GPIO.out_w1tc = clearMask;
+}
+
+bool Esp32Hal::distanceMicros(uint32_t &echo)
+{
+  if (ultrasonic.fault() != U_OK)
+    return false;
+  echo = ultrasonic.durationMicros(); // median of the pings
+  return true;
+}
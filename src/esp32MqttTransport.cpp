@@ -0,0 +1,19 @@
+#include "esp32MqttTransport.h"
+
+bool Esp32MqttTransport::open(const char *host, uint16_t port)
+{
+  client.stop();
+  if (!client.connect(host, port, MQTT_TCP_TIMEOUT))
+    return false;
+  client.setNoDelay(true); // small packets, do not wait to coalesce them
+  return true;
+}
+
+size_t Esp32MqttTransport::read(uint8_t *data, size_t size)
+{
+  int available = client.available();
+  if (available <= 0 or size == 0)
+    return 0;
+  int n = client.read(data, min((size_t)available, size));
+  return (n > 0) ? n : 0;
+}
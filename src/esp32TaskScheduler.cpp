@@ -0,0 +1,50 @@
+#include <Arduino.h>
+#include <esp_task_wdt.h>
+
+#include "taskScheduler.h"
+
+uint32_t ScheduledTask::clockMicros() { return micros(); }
+uint32_t ScheduledTask::clockMillis() { return millis(); }
+
+void ScheduledTask::start()
+{
+  xTaskCreatePinnedToCore(run, name, stackSize, this, priority, (TaskHandle_t *)&handle, core);
+}
+
+void ScheduledTask::stop()
+{
+  if (handle != NULL)
+  {
+    vTaskDelete((TaskHandle_t)handle);
+    handle = NULL;
+  }
+}
+
+void ScheduledTask::run(void *arg)
+{
+  ScheduledTask *task = (ScheduledTask *)arg;
+  if (task->watched)
+  {
+    esp_task_wdt_add(NULL);
+  }
+  TickType_t lastWake = xTaskGetTickCount();
+  uint32_t slot = micros(); // when this wakeup should have happened, follows lastWake
+  for (;;)
+  {
+    uint32_t start = micros();
+    if (task->watched)
+    {
+      esp_task_wdt_reset();
+    }
+    if (task->restart)
+    {
+      // whether or not the tick count ran on through the sleep, start over from now: no catch up burst, nothing counted late
+      task->restart = false;
+      lastWake = xTaskGetTickCount();
+      slot = start;
+    }
+    task->wakeup(start, slot);
+    vTaskDelayUntil(&lastWake, pdMS_TO_TICKS(task->period));
+    slot += task->period * 1000;
+  }
+}
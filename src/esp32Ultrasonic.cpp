@@ -0,0 +1,30 @@
+#include "esp32Ultrasonic.h"
+
+// only one sensor is wired, the interrupt trampoline forwards to it
+static Ultrasonic *echoInstance = nullptr;
+static uint8_t echoInstancePin = 0;
+static uint8_t triggerPin = 0;
+
+static void IRAM_ATTR echoIsr()
+{
+  echoInstance->echoEdge(digitalRead(echoInstancePin), micros());
+}
+
+void beginUltrasonic(Ultrasonic &sensor, uint8_t trigPin, uint8_t echoPin)
+{
+  triggerPin = trigPin;
+  pinMode(trigPin, OUTPUT);
+  pinMode(echoPin, INPUT);
+  digitalWrite(trigPin, LOW);
+  echoInstance = &sensor;
+  echoInstancePin = echoPin;
+  attachInterrupt(digitalPinToInterrupt(echoPin), echoIsr, CHANGE);
+}
+
+void triggerUltrasonic()
+{
+  // 10us trigger pulse is the only busy wait
+  digitalWrite(triggerPin, HIGH);
+  delayMicroseconds(10);
+  digitalWrite(triggerPin, LOW);
+}
@@ -0,0 +1,35 @@
+#include "esp32WifiRadio.h"
+
+void Esp32WifiRadio::begin()
+{
+  WiFi.persistent(false); // credentials come from config.h, no flash write per connect
+  WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);
+}
+
+void Esp32WifiRadio::scanEntry(int i, char *ssid, size_t size, int32_t &rssi)
+{
+  strlcpy(ssid, WiFi.SSID(i).c_str(), size);
+  rssi = WiFi.RSSI(i);
+}
+
+void Esp32WifiRadio::startAccessPoint()
+{
+  // station keeps trying in the background
+  WiFi.mode(WIFI_AP_STA);
+  WiFi.softAP(apSsid, apPassword);
+  Serial.println((String) "Fallback access point " + apSsid + " at " + WiFi.softAPIP().toString());
+}
+
+void Esp32WifiRadio::stopAccessPoint()
+{
+  WiFi.softAPdisconnect(true);
+  WiFi.mode(WIFI_STA);
+}
+
+void Esp32WifiRadio::powerOff()
+{
+  // drops the access point as well
+  WiFi.disconnect(true);
+  WiFi.mode(WIFI_OFF);
+}
@@ -0,0 +1,300 @@
+#include "historyStore.h"
+
+static const uint32_t levelSteps[HISTORY_LEVELS] = {60, 900, 3600};
+
+HistoryStore::HistoryStore(const SeriesConfig *series, uint8_t count) : configs(series), count(min(count, (uint8_t)HISTORY_MAX_SERIES)) {}
+
+uint32_t HistoryStore::levelStep(uint8_t level)
+{
+  return levelSteps[level];
+}
+
+uint8_t HistoryStore::levelFor(uint32_t from, uint32_t to)
+{
+  uint32_t span = (to > from) ? to - from : 0;
+  if (span <= 12 * 3600UL)
+    return 0; // up to 720 points
+  if (span <= 14 * 86400UL)
+    return 1; // up to 1344 points
+  return 2;
+}
+
+void HistoryStore::segmentPath(char *path, size_t len, uint8_t series, uint8_t level, uint8_t segment)
+{
+  snprintf(path, len, "/h/%u_%u_%u", series, level, segment);
+}
+
+int HistoryStore::seriesIndex(const char *name) const
+{
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (strcmp(configs[i].name, name) == 0)
+      return i;
+  }
+  return -1;
+}
+
+void HistoryStore::begin()
+{
+  char path[24];
+  for (uint8_t s = 0; s < count; s++)
+  {
+    for (uint8_t l = 0; l < HISTORY_LEVELS; l++)
+    {
+      Level &level = levels[s][l];
+      level.rollup = Rollup(levelSteps[l]);
+      level.sequence = 0;
+      level.segment = HISTORY_SEGMENTS - 1;
+      level.started = false;
+      level.buffered = 0;
+      // find the newest segment, writing continues in the one after it. A new
+      // segment after each boot means a torn append never gets written past.
+      for (uint8_t g = 0; g < HISTORY_SEGMENTS; g++)
+      {
+        segmentPath(path, sizeof(path), s, l, g);
+        File file = SPIFFS.open(path, FILE_READ);
+        if (!file)
+          continue;
+        SegmentHeader header;
+        if (file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) and header.magic == HISTORY_MAGIC and header.sequence >= level.sequence)
+        {
+          level.sequence = header.sequence;
+          level.segment = g;
+        }
+        file.close();
+      }
+    }
+  }
+}
+
+void HistoryStore::record(uint8_t series, uint32_t epoch, float reading)
+{
+  if (series >= count or isnan(reading))
+    return;
+  float scale = 1;
+  for (uint8_t d = 0; d < configs[series].decimals; d++)
+    scale *= 10;
+  int32_t value = lroundf(reading * scale);
+  Sample sample;
+  for (uint8_t l = 0; l < HISTORY_LEVELS; l++)
+  {
+    if (levels[series][l].rollup.add(epoch, value, &sample))
+    {
+      append(series, l, sample);
+    }
+  }
+}
+
+void HistoryStore::flush()
+{
+  for (uint8_t s = 0; s < count; s++)
+  {
+    for (uint8_t l = 0; l < HISTORY_LEVELS; l++)
+    {
+      flushLevel(s, l);
+    }
+  }
+}
+
+void HistoryStore::append(uint8_t series, uint8_t l, const Sample &sample)
+{
+  Level &level = levels[series][l];
+  if (!level.started or level.segmentBytes + level.buffered + SAMPLE_MAX_BYTES > HISTORY_SEGMENT_SIZE)
+  {
+    flushLevel(series, l);
+    startSegment(series, l, sample.time);
+  }
+  else if (level.buffered + SAMPLE_MAX_BYTES > HISTORY_BUFFER)
+  {
+    flushLevel(series, l);
+  }
+  level.buffered += level.encoder.encode(sample, level.buffer + level.buffered);
+}
+
+void HistoryStore::startSegment(uint8_t series, uint8_t l, uint32_t firstTime)
+{
+  Level &level = levels[series][l];
+  level.segment = (level.segment + 1) % HISTORY_SEGMENTS;
+  level.sequence++;
+  level.started = true;
+  level.encoder.reset();
+  level.segmentBytes = sizeof(SegmentHeader);
+  SegmentHeader header = {HISTORY_MAGIC, level.sequence, firstTime, series, l, 0};
+  char path[24];
+  segmentPath(path, sizeof(path), series, l, level.segment);
+  File file = SPIFFS.open(path, FILE_WRITE);
+  if (!file)
+  {
+    Serial.println((String) "Error: Unable to create " + path);
+    return;
+  }
+  file.write((const uint8_t *)&header, sizeof(header));
+  file.close();
+}
+
+void HistoryStore::flushLevel(uint8_t series, uint8_t l)
+{
+  Level &level = levels[series][l];
+  if (level.buffered == 0)
+    return;
+  char path[24];
+  segmentPath(path, sizeof(path), series, l, level.segment);
+  File file = SPIFFS.open(path, FILE_APPEND);
+  if (file)
+  {
+    file.write(level.buffer, level.buffered);
+    file.close();
+  }
+  level.segmentBytes += level.buffered;
+  level.buffered = 0;
+}
+
+HistoryReader::HistoryReader(HistoryStore &store, uint8_t series, uint8_t level, uint32_t from, uint32_t to)
+    : store(store), series(series), level(level), from(from), to(to)
+{
+  // order the ring by sequence, skipping segments that end before from
+  uint32_t step = HistoryStore::levelStep(level);
+  uint32_t sequences[HISTORY_SEGMENTS];
+  uint32_t firstTimes[HISTORY_SEGMENTS];
+  char path[24];
+  for (uint8_t g = 0; g < HISTORY_SEGMENTS; g++)
+  {
+    HistoryStore::segmentPath(path, sizeof(path), series, level, g);
+    File segment = SPIFFS.open(path, FILE_READ);
+    if (!segment)
+      continue;
+    SegmentHeader header;
+    if (segment.read((uint8_t *)&header, sizeof(header)) == sizeof(header) and header.magic == HISTORY_MAGIC and header.series == series and header.level == level)
+    {
+      // insertion sort, at most HISTORY_SEGMENTS entries
+      uint8_t i = segments++;
+      while (i > 0 and sequences[i - 1] > header.sequence)
+      {
+        sequences[i] = sequences[i - 1];
+        firstTimes[i] = firstTimes[i - 1];
+        order[i] = order[i - 1];
+        i--;
+      }
+      sequences[i] = header.sequence;
+      firstTimes[i] = header.firstTime;
+      order[i] = g;
+    }
+    segment.close();
+  }
+  while (next + 1 < segments and firstTimes[next + 1] <= from / step)
+  {
+    next++;
+  }
+}
+
+HistoryReader::~HistoryReader()
+{
+  if (file)
+    file.close();
+}
+
+bool HistoryReader::openSegment()
+{
+  while (next < segments)
+  {
+    char path[24];
+    HistoryStore::segmentPath(path, sizeof(path), series, level, order[next++]);
+    file = SPIFFS.open(path, FILE_READ);
+    SegmentHeader header;
+    if (file and file.read((uint8_t *)&header, sizeof(header)) == sizeof(header) and header.magic == HISTORY_MAGIC)
+    {
+      decoder.reset();
+      bufferLen = bufferPos = 0;
+      return true;
+    }
+    if (file)
+      file.close();
+  }
+  return false;
+}
+
+bool HistoryReader::nextSample(Sample *sample)
+{
+  for (;;)
+  {
+    if (!file and !openSegment())
+      return false;
+    size_t n = decoder.decode(buffer + bufferPos, bufferLen - bufferPos, sample);
+    if (n != 0)
+    {
+      bufferPos += n;
+      return true;
+    }
+    size_t left = bufferLen - bufferPos;
+    if (left >= SAMPLE_MAX_BYTES)
+    {
+      file.close(); // corrupt, skip the rest of the segment
+      continue;
+    }
+    // refill, keeping a partial sample at the end of the buffer
+    memmove(buffer, buffer + bufferPos, left);
+    bufferPos = 0;
+    size_t got = file.read(buffer + left, sizeof(buffer) - left);
+    bufferLen = left + got;
+    if (got == 0)
+    {
+      file.close(); // end of segment, a torn tail ends it too
+    }
+  }
+}
+
+void HistoryReader::fillText()
+{
+  textPos = 0;
+  textLen = 0;
+  const SeriesConfig &config = store.series(series);
+  uint32_t step = HistoryStore::levelStep(level);
+  if (stage == 0)
+  {
+    textLen = snprintf(text, sizeof(text), "{\"series\":\"%s\",\"step\":%u,\"points\":[", config.name, step);
+    stage = 1;
+    return;
+  }
+  if (stage == 1)
+  {
+    Sample sample;
+    while (nextSample(&sample))
+    {
+      uint32_t epoch = sample.time * step;
+      if (epoch < from or epoch > to)
+        continue;
+      float scale = 1;
+      for (uint8_t d = 0; d < config.decimals; d++)
+        scale *= 10;
+      textLen = snprintf(text, sizeof(text), "%s[%u,%.*f]", first ? "" : ",", epoch, config.decimals, sample.value / scale);
+      first = false;
+      return;
+    }
+    stage = 2;
+  }
+  if (stage == 2)
+  {
+    textLen = snprintf(text, sizeof(text), "]}");
+    stage = 3;
+  }
+}
+
+size_t HistoryReader::read(uint8_t *out, size_t maxLen)
+{
+  size_t written = 0;
+  while (written < maxLen)
+  {
+    if (textPos == textLen)
+    {
+      if (stage == 3)
+        break;
+      fillText();
+      continue;
+    }
+    size_t n = min(textLen - textPos, maxLen - written);
+    memcpy(out + written, text + textPos, n);
+    textPos += n;
+    written += n;
+  }
+  return written;
+}
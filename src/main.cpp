@@ -1,4 +1,3 @@
-#include <NTPClient.h>
 #include <WiFi.h>
 #include <WiFiUdp.h>
 #include <WebServer.h>
@@ -6,136 +5,393 @@
 #include <ESPAsyncWebServer.h>
 #include <SPIFFS.h>
 #include <ESP32Time.h>
-#include <DHT.h>
 #include <AsyncElegantOTA.h>
+#include <ArduinoJson.h>
+#include <memory>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <esp_task_wdt.h>
 
 #include "config.h"
+#include "controller.h"
+#include "esp32Ultrasonic.h"
+#include "dhtSensor.h"
+#include "waterLevel.h"
+#include "currentSensor.h"
+#include "currentCalibration.h"
+#include "pumpHealth.h"
+#include "esp32Hal.h"
+#include "taskScheduler.h"
+#include "timeService.h"
+#include "wifiManager.h"
+#include "esp32WifiRadio.h"
+#include "pumpSchedule.h"
+#include "scheduleJson.h"
+#include "climateControl.h"
+#include "powerPlanner.h"
+#include "outputs.h"
+#include "boardOutputs.h"
+#include "failover.h"
+#include "outputDriver.h"
+#include "alarms.h"
+#include "historyStore.h"
+#include "stateSnapshot.h"
+#include "telemetry.h"
+#include "controlProtocol.h"
+#include "histogram.h"
+#include "stallGuard.h"
+#include "metrics.h"
+#include "settings.h"
+#include "configStore.h"
+#include "stateJournal.h"
+#include "spiffsJournalStorage.h"
+#include "mqttClient.h"
+#include "esp32MqttTransport.h"
+#include "outbox.h"
 
-#define UTC_OFFSET_IN_SECONDS -36000 // offset from greenwich time (Hawaii is UTC-10)
-#define NTP_SYNC_HOUR 4
-#define NTP_SYNC_MINUTE 0
-#define NTP_SYNC_SECOND 0
-#define WIFI_RETRY_WAIT_TIME 300000 // 5 minutes in milliseconds
-#define NTP_UPDATE_INTERVAL 1800000 // 30 min in milliseconds (minimum retry time, normally daily)
-#define SOUND_SPEED 0.0343          // cm/microsecond
+#define MIN_VALID_EPOCH 1672531200   // 2023-01-01, RTC has not been set before this
+#define CLIMATE_POLL_INTERVAL 1000   // ms between checks for a new DHT reading in the cache
+#define CPU_FULL_MHZ 240             // clock while a pump runs
+#define CPU_IDLE_MHZ 80              // low power idle clock, the lowest the radio works at
+#define CONTROL_STALL_MS 1000        // control task silent this long: relays off, it is stuck
+#define CONTROL_WATCHDOG_S 5         // ... this long: the task watchdog resets the chip
+#define STALL_CHECK_MS 100           // stall guard polling
+#ifndef WIFI_AP_SSID
+#define WIFI_AP_SSID "NFT-ESP32" // fallback access point when no network is reachable, override in config.h
+#define WIFI_AP_PASSWORD "hydroponics"
+#endif
+#ifndef MQTT_HOST
+#define MQTT_HOST "" // broker for telemetry and commands, no MQTT when empty, override in config.h
+#endif
+#ifndef MQTT_PORT
+#define MQTT_PORT 1883
+#endif
+#ifndef MQTT_TOPIC
+#define MQTT_TOPIC "greenhouse" // <topic>/telemetry, <topic>/cmd, <topic>/ack and <topic>/status
+#endif
+#ifndef MQTT_USER
+#define MQTT_USER NULL
+#define MQTT_PASSWORD NULL
+#endif
 
-// pin definitons
+// pin definitons, the pumps' are with their outputs in boardOutputs.h
 #define LED_PIN 2
-#define WATER_PUMP_1_PIN 22
-#define WATER_PUMP_2_PIN 21
-#define AIR_PUMP_PIN 19
 #define DHT_PIN 23
-#define WATER_PUMP_1_CURRENT 34
-#define WATER_PUMP_2_CURRENT 35
-#define AIR_PUMP_CURRENT 32
 #define ULTRASONIC_TRIG_PIN 5
 #define ULTRASONIC_ECHO_PIN 18
 
 // function declarations
-void WiFiStationConnected(WiFiEvent_t event, WiFiEventInfo_t info);                                  // on connect to Wifi
-void WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info);                                             // on IP received from Wifi
-void WiFiStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info);                               // on disconnect from Wifi
-void updateAndSyncTime();                                                                            // update time from NTP server and sync to RTC
-String processor(const String &var);                                                                 // update web page with variables
-unsigned long setInterval(void (*callback)(), unsigned long previousMillis, unsigned long interval); // run function at interval
-void getDhtReadings();                                                                               // get temp and humidity readings from dht sensor
-void toggleAirPump();                                                                                // turn air pump on/off
-void overridePump(int pump_pin, int state, int time);                                                // put a pump in override
-void setPumpAuto(int pump_pin);                                                                      //  set a pump back to auto
-void controlPumps(int currentHour, int currentMin);                                                  // control water pumps in auto or override
-void checkPumpAlarms();                                                                              // check if pump status doesn't match command
+void onWifiChange(WifiState state, bool accessPoint);                                                // wifi connected/lost, fallback access point
+void takeSnapshot(StateSnapshot &state);                                                             // copy what the web page shows
+void publishClimate();                                                                               // post a new DHT reading from the cache to the web and alarms
+void overridePump(size_t output, bool state, int time);                                              // put a pump in override
+void setPumpAuto(size_t output);                                                                     // set a pump back to auto
+void onControlMessage(AsyncWebSocketClient *client, const char *frame, size_t length);               // command from the control websocket
+const char *queueControlRequest(const char *frame, size_t length, uint32_t client, ControlRequest &request); // validate a command, hand it to the control task
+void onMqttMessage(const MqttMessage &message);                                                      // command from the MQTT command topic
+void serviceMqtt();                                                                                  // sample telemetry into the outbox, drain it to the broker
+void sendControlAcks();                                                                              // answer applied control commands
+void controlPumps(unsigned long epoch);                                                              // control pumps in auto (schedule edges) or override
+void onRoleMoved(size_t role, size_t from, size_t to, FailoverReason why);                          // a schedule moved to another pump of its group
+void guardControl(void *arg);                                                                        // stall guard task, relays off when the control task stops
+void writeOutputPin(uint8_t pin, bool on);                                                           // relay pin writer used by the outputs
+void writeOutputRegister(uint32_t setMask, uint32_t clearMask);                                      // register writer used by the output driver
+void driveOutputs();                                                                                 // write pending relay edges
+const char *waterLevelText();                                                                        // "Low", "Medium", "High" or "Fault"
+void sendCommandEvent(size_t output);                                                                // update command of an output on the web
+bool parseSchedule(const char *json, size_t length, OutputSchedule *schedules, const float *pulseScales = NULL); // compile schedule json into transition tables
+void loadSchedule();                                                                                 // load schedule from SPIFFS (or default)
+void applySchedule();                                                                                // compile the loaded schedule with the climate scales
+void adaptSchedule();                                                                                // follow heat index, its trend and the reservoir
+ClimateBounds climateBounds();                                                                       // adaptive schedule limits from the settings
+void feedPumpAlarms();                                                                               // push pump command/status mismatches into the alarm engine
+void serviceAlarms();                                                                                // apply alarm inputs, fire due alarm timers
+void postAlarmInput(uint8_t alarm, bool condition);                                                  // hand an alarm input to the alarm task
+void onAlarmEvent(const AlarmEvent &event);                                                          // alarm raised/cleared/acknowledged
+void recordHistory();                                                                                // add the latest readings to the sensor history
+void flushHistory();                                                                                 // write buffered sensor history to SPIFFS
+void loadAlarmHistory();                                                                             // restore alarm history from SPIFFS
+void saveAlarmEvent(const AlarmEvent &event);                                                        // write one alarm event to SPIFFS
 void updatePumpStatuses();                                                                           // update web with pump statuses
-void getWaterLevel();                                                                                // get water level from ultrasonic sensor
-
-// Define NTP Client to get time
-WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, "pool.ntp.org", UTC_OFFSET_IN_SECONDS, NTP_UPDATE_INTERVAL);
-ESP32Time rtc; // no offset, as that is already added from NTPClient
-bool rtcUpdated = false;
-String lastNTPSync = "";
-
-// time interval setup
-int dhtInterval = 900000;
-int airPumpInterval = 900000;
-int updatePumpStatusInterval = 10000; // update pump statuses to web server every 10 seconds
-int waterLevelInterval = 60000;       // check water level every minute
-int adcSamplingInterval = 50;         // 50 milliseconds means 20 samples in 1 second
-unsigned long airPumpMillisCounter = 0;
-unsigned long dhtMillisCounter = 0;
-unsigned long wifiPrevMillis = 0;
-unsigned long adcSamplingMillisCounter = 0;
-unsigned long pumpStatusMillisCounter = 0;
-unsigned long waterLevelMillisCounter = 0;
-int samplingCounter = 0;
-float pump1Samples = 0.0;
-float pump2Samples = 0.0;
-float airPumpSamples = 0.0;
-unsigned long now;
-long duration;    // time for sound to travel from sensor to water and back
-float distanceCm; // distance in cm from sensor to water
-enum WaterLevel
-{
-  W_LOW,
-  W_MED,
-  W_HIGH
+void getWaterLevel();                                                                                // start a water level reading from ultrasonic sensor
+void processWaterLevel();                                                                            // convert finished ultrasonic reading to water level
+void pollUltrasonic();                                                                               // advance the ultrasonic state machine
+void updateCurrentReadings();                                                                        // pick up latest RMS currents from the sampling task
+void analysePumpHealth();                                                                            // capture a running pump's current waveform and score it
+void runPumpControl();                                                                               // apply queued web commands and settings, then control pumps
+void checkWifi();                                                                                    // run the wifi connection state machine, off between low power upload windows
+void checkTimeSync();                                                                                // NTP sync and drift compensation
+void postEvent(const char *data, const char *event);                                                 // queue a web field update for the network task
+void sendQueuedEvents();                                                                             // publish changed web fields as one telemetry frame
+size_t renderMetrics(uint16_t part, char *out, size_t size);                                         // one part of the /metrics page
+TankGeometry tankGeometry();                                                                         // reservoir shape from the settings
+void takeSettings();                                                                                 // put settings committed by the web server into effect (control task)
+void applySettings(const Settings &previous);                                                        // put changed settings into effect
+void captureState(RuntimeState &state);                                                              // overrides and alarm latches as they are now
+void saveRuntimeState();                                                                             // journal overrides and alarm latches when they change
+void restoreRuntimeState();                                                                          // overrides and alarm latches from before the reboot
+void configureCurrentChannels();                                                                     // ADC gain and sensor sensitivity of each current channel
+void loadCalibration();                                                                              // learned current zero, nominal currents and pump run time from SPIFFS
+void saveCalibration();                                                                              // write them back
+void managePower();                                                                                  // clock, current sampling and light sleep from the wakeup plan
+PowerPlan planWakeup(uint32_t now);                                                                  // next wakeup the outputs, alarms, sensors and upload windows need
+void lightSleep(uint32_t ms);                                                                        // light sleep with the relay pins held
+
+// tuning values, defaults in src/settings.cpp, changed at runtime through /config and kept in NVS.
+// Only the control task writes settings, the other tasks read single 32 bit fields
+Settings settings;
+Settings committedSettings; // last saved to NVS, web server task only once running, PATCH builds on it
+ConfigStore configStore;
+
+// system clock on NTP time (local time, synced hourly), rtc reads it. The utc offset comes from the settings
+TimeService timeService("pool.ntp.org");
+ESP32Time rtc; // no offset, as that is already added by timeService
+char lastNTPSync[48] = "";
+
+// time interval setup (dht, water level and history intervals are in the settings)
+int updatePumpStatusInterval = 1000; // check pump statuses for the web server every second (only changes are sent)
+WaterLevelEstimator waterEstimator; // filtering, consumption and forecast, sensing task only
+
+// stored networks, tried strongest first (WIFI_SSID_2 and WIFI_SSID_3 are optional in config.h)
+const WifiNetwork wifiNetworks[] = {
+    {WIFI_SSID, WIFI_PASSWORD},
+#ifdef WIFI_SSID_2
+    {WIFI_SSID_2, WIFI_PASSWORD_2},
+#endif
+#ifdef WIFI_SSID_3
+    {WIFI_SSID_3, WIFI_PASSWORD_3},
+#endif
 };
-WaterLevel waterLevel = W_LOW;
+Esp32WifiRadio wifiRadio(WIFI_AP_SSID, WIFI_AP_PASSWORD);
+WifiManager wifi(wifiRadio, wifiNetworks, sizeof(wifiNetworks) / sizeof(wifiNetworks[0]), onWifiChange);
 
 // create AsyncWebServer on port 80
 AsyncWebServer server(80);
 // Create an Event Source on /events
 AsyncEventSource events("/events");
-DHT dht(DHT_PIN, DHT11);
-
-String ledState;
-float h, f, hif; // humidity, temp in fahrenheit, heat index fahrenheit
-bool pump1Command = false;
-bool pump1Override = false;
-bool pump1Status = false;
-unsigned long pump1OverrideTimeEpochEnd = 0; // if pump overriden for 5 min, this will be set to current epoch + 5*60
-bool pump2Command = false;
-bool pump2Override = false;
-bool pump2Status = false;
-unsigned long pump2OverrideTimeEpochEnd = 0; // if pump overriden for 5 min, this will be set to current epoch + 5*60
-bool airPumpCommand = false;                 // toggle
-bool airPumpOverride = false;
-bool airPumpStatus = false;
-unsigned long airPumpOverrideTimeEpochEnd = 0; // if pump overriden for 5 min, this will be set to current epoch + 5*60
-float mvPerAmp = 0.185;                        // sensitivity for ACS712 5A current sensor
-bool readyToConnectWifi = true;                // ready to try connecting to wifi
-// GET REQUEST PARAMETERS
-const char *PARAM_OUTPUT = "output";
-const char *PARAM_STATE = "state";
-const char *PARAM_TIME = "time";
-
-// only update status once a min on web server when there is an override timer
-bool pump1StatusUpdated = false;
-bool pump2StatusUpdated = false;
-bool airPumpStatusUpdated = false;
-
-// ALARMS
-bool pump1Alarm = false;
-bool pump2Alarm = false;
-bool airPumpAlarm = false;
-// alarm after 1 minute of command/status mismatch
-unsigned long pump1AlarmTimeEpochEnd = 0;
-unsigned long pump2AlarmTimeEpochEnd = 0;
-unsigned long airPumpAlarmTimeEpochEnd = 0;
+// control commands and their acks on /ws
+AsyncWebSocket ws("/ws");
+Telemetry telemetry;            // latest web fields, owned by the network task
+uint32_t telemetrySequence = 0; // SSE id of the last frame, the page reloads /api/state on a gap
+uint32_t alarmEventCount = 0;   // bumped per alarm event, the page reloads /alarms when it changes
+DhtSensor dhtSensor; // reads on its own task, everything else gets the cached reading
+Ultrasonic ultrasonic(triggerUltrasonic);
+CurrentSensor currentSensor;
+// controller logic goes through the hal so it also runs in the native simulator
+Esp32Hal esp32Hal(rtc, dhtSensor, currentSensor, ultrasonic);
+Hal &hal = esp32Hal;
+
+// outputs wired to this controller, see boardOutputs.h
+#define OUTPUT_COUNT BOARD_OUTPUT_COUNT
+OutputBank<OUTPUT_COUNT> outputs(boardOutputs, writeOutputPin);
+// the water pumps stand in for each other within a second of one going quiet, and share the wear
+FailoverSupervisor<OUTPUT_COUNT> failover(outputs, onRoleMoved);
+// relays only switch on edges, all pumps are motors so their starts are staggered
+OutputDriver outputDriver(writeOutputRegister);
+static_assert(OUTPUT_COUNT <= STATE_MAX_OUTPUTS, "raise STATE_MAX_OUTPUTS");
+
+// alarms: one command/status mismatch alarm per output, then the sensor alarms (controller.h)
+#define ALARM_COUNT (OUTPUT_COUNT + SENSOR_ALARMS)
+const AlarmConfig alarmConfig[] = {
+    // name, severity, delay on (s), delay off (s), latching
+    {"Water Pump 1", ALARM_CRITICAL, 60, 0, false},
+    {"Water Pump 2", ALARM_CRITICAL, 60, 0, false},
+    {"Air Pump", ALARM_CRITICAL, 60, 0, false},
+    {"High Temperature", ALARM_WARNING, 0, 300, false},
+    {"Low Water", ALARM_CRITICAL, 120, 0, true}, // latched so a refill gets noticed
+    {"Water Level Sensor", ALARM_WARNING, 120, 0, false},
+    {"Pump Current", ALARM_WARNING, 60, 300, false},
+    {"Pump Health", ALARM_WARNING, 300, 600, false},
+};
+static_assert(sizeof(alarmConfig) / sizeof(alarmConfig[0]) == ALARM_COUNT, "alarmConfig needs a line per output and sensor alarm");
+AlarmEngine<ALARM_COUNT> alarms(alarmConfig, onAlarmEvent);
+// sensor history, the output currents follow the fixed series
+enum HistorySeries
+{
+  HISTORY_TEMPERATURE,
+  HISTORY_HUMIDITY,
+  HISTORY_HEAT_INDEX,
+  HISTORY_WATER_DISTANCE,
+  HISTORY_CURRENT
+};
+const SeriesConfig historySeries[] = {
+    // name, decimals
+    {"temperature", 1},
+    {"humidity", 1},
+    {"heatIndex", 1},
+    {"waterDistance", 1},
+    {"pump1Current", 3},
+    {"pump2Current", 3},
+    {"airPumpCurrent", 3},
+};
+static_assert(sizeof(historySeries) / sizeof(historySeries[0]) == HISTORY_CURRENT + OUTPUT_COUNT, "historySeries needs a current line per output");
+HistoryStore history(historySeries, sizeof(historySeries) / sizeof(historySeries[0]));
+// per current channel auto-zero and learned nominal current, fed by the control task
+CurrentChannel currentChannels[OUTPUT_COUNT];
+// per pump waveform and start-up baseline, also fed by the control task and saved with the calibration,
+// as is the failover run time
+PumpHealth pumpHealth[OUTPUT_COUNT];
+static_assert(CURRENT_CAPTURE_SIZE == PUMP_FFT_SIZE, "a capture is one FFT block");
+// the glue between them, shared with the native simulator
+Controller<OUTPUT_COUNT> controller(hal, outputs, outputDriver, failover, currentChannels, pumpHealth, waterEstimator, settings, postAlarmInput);
+#define CALIBRATION_FILE "/calibration.bin"
+#define CALIBRATION_FILE_MAGIC 0x43414c31 // "CAL1"
+#define CALIBRATION_SAVE_INTERVAL 3600000 // ms
+
+// overrides and alarm latches across reboots. RTC memory survives warm resets (OTA, watchdog,
+// brown-out), the journal on SPIFFS cold ones, whichever has the newer sequence wins
+#define STATE_FILE "/state.bin"
+static_assert(OUTPUT_COUNT <= JOURNAL_MAX_OUTPUTS and ALARM_COUNT <= 32, "RuntimeState is too small");
+SpiffsJournalStorage journalStorage(STATE_FILE, JOURNAL_SLOTS * sizeof(JournalRecord));
+StateJournal journal(journalStorage, JOURNAL_SLOTS);
+RTC_NOINIT_ATTR JournalRecord warmState;
+
+// MQTT bridge. Telemetry is sampled every minute, batched and queued on SPIFFS whether the broker
+// is reachable or not, then sent at QoS 1 one message at a time and removed once acknowledged
+#define MQTT_BATCH_SAMPLES 5       // samples per telemetry message
+#define MQTT_DRAIN_INTERVAL 250    // ms between queued messages, so a backlog does not flood the broker
+#define MQTT_CLIENT 0              // ControlAck client of commands from MQTT (websocket client ids start at 1)
+#define OUTBOX_FILE "/outbox.bin"
+Esp32MqttTransport mqttTransport;
+MqttClient mqtt(mqttTransport, onMqttMessage);
+SpiffsJournalStorage outboxStorage(OUTBOX_FILE, (OUTBOX_SLOTS + 2) * sizeof(OutboxRecord));
+Outbox outbox(outboxStorage, OUTBOX_SLOTS);
+char mqttClientId[24];
+char mqttTelemetryTopic[48];
+char mqttCommandTopic[48];
+char mqttAckTopic[48];
+char mqttStatusTopic[48];
+char mqttBatch[OUTBOX_PAYLOAD_SIZE]; // samples not queued yet, network task only
+size_t mqttBatchLength = 0;
+uint8_t mqttBatchSamples = 0;
+uint32_t lastMqttSample = 0;
+uint32_t lastMqttDrain = 0;
+
+// tasks (name, period ms, priority, core). Control has the highest priority and a fixed 50ms period,
+// networking lives on core 0 with the wifi stack so blocking calls there never stall the pumps
+ScheduledTask controlTask("control", 50, 4, 1);
+ScheduledTask alarmTask("alarms", 250, 3, 1);
+ScheduledTask sensingTask("sensing", 10, 2, 1);
+ScheduledTask networkTask("network", 100, 1, 0, 8192);
+ScheduledTask *const tasks[] = {&controlTask, &alarmTask, &sensingTask, &networkTask};
+#define TASK_COUNT (sizeof(tasks) / sizeof(tasks[0]))
+
+// timed sections in microseconds, exported on /metrics with the task timings. The
+// timer keeps counting at the same rate when low power mode lowers the CPU clock
+struct TimedSection
+{
+  const char *labels;
+  Histogram time;
+};
+TimedSection historyFlush = {"section=\"history_flush\"", Histogram()};   // SPIFFS writes of buffered history
+TimedSection telemetrySend = {"section=\"telemetry_send\"", Histogram()}; // building and sending one SSE frame
+TimedSection pumpFft = {"section=\"pump_fft\"", Histogram()};             // FFT and features of one current capture
+TimedSection *const timedSections[] = {&historyFlush, &telemetrySend, &pumpFft};
+#define SECTION_COUNT (sizeof(timedSections) / sizeof(timedSections[0]))
+// /metrics parts: gauges, counters, task counters, then one part per histogram series
+enum MetricsPart
+{
+  METRICS_GAUGES,
+  METRICS_COUNTERS,
+  METRICS_TIME,
+  METRICS_WIFI,
+  METRICS_MQTT,
+  METRICS_CURRENT,
+  METRICS_HEALTH,
+  METRICS_WATER,
+  METRICS_CLIMATE,
+  METRICS_POWER,
+  METRICS_FAILOVER,
+  METRICS_TASKS,
+  METRICS_TASK_RUN,
+  METRICS_TASK_LATE = METRICS_TASK_RUN + TASK_COUNT,
+  METRICS_SECTIONS = METRICS_TASK_LATE + TASK_COUNT,
+  METRICS_PARTS = METRICS_SECTIONS + SECTION_COUNT
+};
+
+// web commands are handed to the control task, events to the network task
+struct PumpCommand
+{
+  uint8_t output;
+  bool setAuto;
+  bool state;
+  uint8_t time;    // minutes
+  uint32_t client; // websocket client and request id the ack goes to
+  uint32_t request;
+};
+struct ControlAck
+{
+  uint32_t client;
+  uint32_t request;
+  uint8_t output;
+  char command[32]; // command text after the command was applied
+};
+struct WebEvent
+{
+  char event[24];
+  char data[96];
+};
+struct AlarmInput
+{
+  uint8_t alarm;
+  bool condition;
+  bool acknowledge; // acknowledge from web page instead of an input change
+};
+QueueHandle_t pumpCommandQueue;
+QueueHandle_t webEventQueue;
+QueueHandle_t alarmInputQueue;
+QueueHandle_t controlAckQueue;
+QueueHandle_t settingsQueue; // one slot, the newest committed settings for the control task
+
+volatile bool scheduleChanged = false; // set by web server, schedule is reloaded on the control task
+// schedule json as loaded, compiled again with new pulse scales when the climate calls for it (control task)
+char scheduleText[SCHEDULE_JSON_SIZE];
+size_t scheduleLength = 0;
+ClimateController climate;
+
+// low power mode (control task), the budget is accounted in normal mode as well
+PowerPlan powerPlan = {POWER_ACTIVE, POWER_RUNNING, 0, 0};
+EnergyBudget energy(POWER_RATES); // the POWER_* figures of config.h
+uint32_t powerAccounted = 0; // millis() the budget runs to
+uint32_t powerSleeps = 0;
+volatile bool powerSleeping = false; // in lightSleep(), the control task is not stalled
+volatile bool safeState = false;     // the stall guard switched the relays off behind the driver
 
 void setup()
 {
   Serial.begin(115200);
   Serial.println("Setup begin");
+  configStore.begin(settings);
+  committedSettings = settings;
+  if (esp_reset_reason() == ESP_RST_TASK_WDT)
+  {
+    Serial.println("Restarted by the task watchdog, the control task had stalled");
+  }
+  timeService.setUtcOffset(settings.utcOffset);
   // set pinout
   pinMode(LED_PIN, OUTPUT);
-  pinMode(WATER_PUMP_1_PIN, OUTPUT);
-  pinMode(WATER_PUMP_2_PIN, OUTPUT);
-  pinMode(AIR_PUMP_PIN, OUTPUT);
-  pinMode(ULTRASONIC_TRIG_PIN, OUTPUT);
-  pinMode(ULTRASONIC_ECHO_PIN, INPUT);
-  // water pump current pins are input only (34 and 35) and don't need to be set
-  pinMode(AIR_PUMP_CURRENT, INPUT);
-  dht.begin();
+  uint8_t currentPins[outputs.size()];
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    const OutputConfig &config = outputs.config(i);
+    pinMode(config.pin, OUTPUT);
+    if (!outputDriver.configure(config.pin, config.minOn * 1000UL, config.minOff * 1000UL, true))
+    {
+      Serial.println((String) "Error: " + config.name + " relay pin above 31");
+    }
+    currentPins[i] = config.currentPin;
+  }
+  beginUltrasonic(ultrasonic, ULTRASONIC_TRIG_PIN, ULTRASONIC_ECHO_PIN);
+  // current sensors are sampled continuously in the background
+  currentSensor.begin(currentPins, outputs.size());
+  configureCurrentChannels();
+  failover.configure(settings.failoverMs, settings.balanceHours * 3600000UL);
+  dhtSensor.begin(DHT_PIN, DHT_11, settings.dhtInterval * 1000UL);
+  pumpCommandQueue = xQueueCreate(8, sizeof(PumpCommand));
+  webEventQueue = xQueueCreate(32, sizeof(WebEvent));
+  alarmInputQueue = xQueueCreate(16, sizeof(AlarmInput));
+  controlAckQueue = xQueueCreate(8, sizeof(ControlAck));
+  settingsQueue = xQueueCreate(1, sizeof(Settings));
 
   // Initialize SPIFFS
   if (!SPIFFS.begin(true))
@@ -143,741 +399,1465 @@ void setup()
     Serial.println("An Error has occurred while mounting SPIFFS");
     return;
   }
+  restoreRuntimeState();
+  loadCalibration();
+  if (MQTT_HOST[0] != '\0')
+  {
+    if (!outboxStorage.begin())
+      Serial.println("Error: Could not open the MQTT outbox");
+    outbox.recover();
+    Serial.println((String) "MQTT outbox holds " + outbox.size() + " messages");
+    snprintf(mqttClientId, sizeof(mqttClientId), "nft-esp32-%06x", (unsigned)(ESP.getEfuseMac() >> 24 & 0xffffff));
+    snprintf(mqttTelemetryTopic, sizeof(mqttTelemetryTopic), "%s/telemetry", MQTT_TOPIC);
+    snprintf(mqttCommandTopic, sizeof(mqttCommandTopic), "%s/cmd", MQTT_TOPIC);
+    snprintf(mqttAckTopic, sizeof(mqttAckTopic), "%s/ack", MQTT_TOPIC);
+    snprintf(mqttStatusTopic, sizeof(mqttStatusTopic), "%s/status", MQTT_TOPIC);
+    mqtt.begin(MQTT_HOST, MQTT_PORT, mqttClientId, MQTT_USER, MQTT_PASSWORD, mqttCommandTopic, mqttStatusTopic);
+  }
+  loadSchedule();
+  loadAlarmHistory();
+  history.begin();
 
-  // delete old config
-  WiFi.disconnect(true);
-  delay(1000);
-  // add wifi events
-  WiFi.onEvent(WiFiStationConnected, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_CONNECTED);
-  WiFi.onEvent(WiFiGotIP, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_GOT_IP);
-  WiFi.onEvent(WiFiStationDisconnected, WiFiEvent_t::ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
-  WiFi.mode(WIFI_STA); // station mode: ESP32 connects to access point
-  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-  Serial.println("Connecting to WIFI");
-  delay(10000);
-  timeClient.begin();
-
-  // Route for root / web page
-  server.on("/", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/index.html", String(), false, processor); });
-
-  // Route to load style.css file
-  server.on("/style.css", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/style.css", "text/css"); });
-  // Route to load script.js file
-  server.on("/script.js", HTTP_GET, [](AsyncWebServerRequest *request)
-            { request->send(SPIFFS, "/script.js", "text/javascript"); });
+  // wifi connects in the background, nothing waits for it
+  wifiRadio.begin();
+  wifi.begin(millis(), esp_random());
+  timeService.begin();
+
+  // everything the page shows, the page itself is static
+  server.on("/api/state", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+    // only ever used from the async_tcp task
+    static StateSnapshot state;
+    static char json[STATE_JSON_SIZE];
+    takeSnapshot(state);
+    size_t length = writeStateJson(state, json, sizeof(json));
+    if (length == 0)
+    {
+      request->send(500, "text/plain", "State does not fit STATE_JSON_SIZE");
+      return;
+    }
+    AsyncResponseStream *response = request->beginResponseStream("application/json", length);
+    response->write((const uint8_t *)json, length);
+    response->addHeader("Cache-Control", "no-store");
+    request->send(response); });
 
   // Route to set GPIO to HIGH
   server.on("/led2on", HTTP_GET, [](AsyncWebServerRequest *request)
             {
-    digitalWrite(LED_PIN, HIGH);    
-    request->send(SPIFFS, "/index.html", String(), false, processor); });
+    hal.pinWrite(LED_PIN, HIGH);
+    request->send(200, "text/plain", "OK"); });
 
   // Route to set GPIO to LOW
   server.on("/led2off", HTTP_GET, [](AsyncWebServerRequest *request)
             {
-    digitalWrite(LED_PIN, LOW);    
-    request->send(SPIFFS, "/index.html", String(), false, processor); });
+    hal.pinWrite(LED_PIN, LOW);
+    request->send(200, "text/plain", "OK"); });
 
-  server.on("/override", HTTP_GET, [](AsyncWebServerRequest *request)
+  // pump override/auto commands, see controlProtocol.h
+  ws.onEvent([](AsyncWebSocket *server, AsyncWebSocketClient *client, AwsEventType type, void *arg, uint8_t *data, size_t len)
+             {
+    AwsFrameInfo *info = (AwsFrameInfo *)arg;
+    // commands are small, only whole single-frame text messages are accepted
+    if (type == WS_EVT_DATA and info->final and info->index == 0 and info->len == len and info->opcode == WS_TEXT)
+    {
+      onControlMessage(client, (const char *)data, len);
+    } });
+  server.addHandler(&ws);
+
+  // pump schedule json, GET to view, POST to replace
+  server.on("/schedule", HTTP_GET, [](AsyncWebServerRequest *request)
             {
-    int output, state, time;
-    //String debug = "";
-    // GET input1 value on <ESP_IP>/override?output=<output>&state=<state&time=<time>
-    if (request->hasParam(PARAM_OUTPUT) && request->hasParam(PARAM_STATE) && request->hasParam(PARAM_TIME))
+    if (SPIFFS.exists("/schedule.json"))
     {
-      output = request->getParam(PARAM_OUTPUT)->value().toInt();
-      state = request->getParam(PARAM_STATE)->value().toInt();
-      time = request->getParam(PARAM_TIME)->value().toInt();
-      overridePump(output, state, time);
-      //debug = "Set pin " + String(output) + " to " + (state == 1) ? "On " : "Off " + (time > 60) ? "permanently" : "for " + String(time) + " min"; 
+      request->send(SPIFFS, "/schedule.json", "application/json");
     }
-    else {
-      //debug = "No message sent";
+    else
+    {
+      request->send(200, "application/json", DEFAULT_SCHEDULE);
+    } });
+
+  // the body is collected in the request's _tempObject (freed with the request) and
+  // compiled once complete, the control task picks up the saved file
+  server.on(
+      "/schedule", HTTP_POST, [](AsyncWebServerRequest *request)
+      {
+    if (request->_tempObject == NULL)
+    {
+      request->send(400, "text/plain", "Schedule missing or too large");
+      return;
     }
-    //Serial.println(debug);
-    request->send(200, "text/plain", "OK"); });
+    // only ever runs on the web server task, the control task compiles with its own workspace
+    static ScheduleWorkspace work;
+    static OutputSchedule staged[outputs.size()];
+    const char *body = (const char *)request->_tempObject;
+    size_t length = request->contentLength();
+    const char *error = compileSchedule(body, length, boardOutputs, OUTPUT_COUNT, staged, work);
+    if (error != NULL)
+    {
+      request->send(400, "text/plain", error);
+      return;
+    }
+    File file = SPIFFS.open("/schedule.json", FILE_WRITE);
+    file.write((const uint8_t *)body, length);
+    file.close();
+    scheduleChanged = true;
+    request->send(200, "text/plain", "OK"); },
+      NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+      {
+    if (index == 0 and total < SCHEDULE_JSON_SIZE)
+    {
+      request->_tempObject = malloc(total);
+    }
+    if (request->_tempObject != NULL)
+    {
+      memcpy((uint8_t *)request->_tempObject + index, data, len);
+    } });
+
+  // settings, GET to view, PATCH with {"name": value, ..} to change some of them
+  server.on("/config", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+    char json[SETTINGS_JSON_SIZE];
+    size_t length = writeSettingsJson(committedSettings, configStore.sequence(), json, sizeof(json));
+    request->send(200, "application/json", length ? json : "{}"); });
+
+  // the body is collected in the request's _tempObject, only applied if it validates and was
+  // committed to NVS. The control task puts it into effect, where the settings are used
+  server.on(
+      "/config", HTTP_PATCH, [](AsyncWebServerRequest *request)
+      {
+    if (request->_tempObject == NULL)
+    {
+      request->send(400, "text/plain", "Settings missing or too large");
+      return;
+    }
+    Settings patched = committedSettings;
+    const char *error = patchSettings((const char *)request->_tempObject, request->contentLength(), patched);
+    if (error == NULL)
+    {
+      error = configStore.save(patched);
+    }
+    if (error != NULL)
+    {
+      request->send(400, "text/plain", error);
+      return;
+    }
+    committedSettings = patched;
+    xQueueOverwrite(settingsQueue, &patched);
+    char json[SETTINGS_JSON_SIZE];
+    size_t length = writeSettingsJson(patched, configStore.sequence(), json, sizeof(json));
+    request->send(200, "application/json", length ? json : "{}"); },
+      NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+      {
+    if (index == 0 and total < SETTINGS_JSON_SIZE)
+    {
+      request->_tempObject = malloc(total);
+    }
+    if (request->_tempObject != NULL)
+    {
+      memcpy((uint8_t *)request->_tempObject + index, data, len);
+    } });
+
+  server.on("/alarms", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    response->print("{\"active\":[");
+    bool first = true;
+    for (size_t i = 0; i < alarms.size(); i++)
+    {
+      if (!alarms.active(i))
+        continue;
+      response->printf("%s{\"id\":%u,\"name\":\"%s\",\"severity\":%u,\"acknowledged\":%s}", first ? "" : ",", i,
+                       alarms.config(i).name, alarms.config(i).severity, alarms.acknowledged(i) ? "true" : "false");
+      first = false;
+    }
+    response->print("],\"history\":[");
+    AlarmHistory &history = alarms.history();
+    for (uint16_t i = 0; i < history.size(); i++)
+    {
+      const AlarmEvent &event = history.recent(i);
+      response->printf("%s{\"epoch\":%u,\"name\":\"%s\",\"type\":%u,\"severity\":%u}", i ? "," : "", event.epoch,
+                       (event.alarm < alarms.size()) ? alarms.config(event.alarm).name : "?", event.type, event.severity);
+    }
+    response->print("]}");
+    request->send(response); });
+
+  // sensor history, GET /history?series=temperature&from=<epoch>&to=<epoch> (default last 24h)
+  server.on("/history", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+    int series = request->hasParam("series") ? history.seriesIndex(request->getParam("series")->value().c_str()) : -1;
+    if (series < 0)
+    {
+      request->send(400, "text/plain", "Unknown series");
+      return;
+    }
+    uint32_t to = request->hasParam("to") ? request->getParam("to")->value().toInt() : hal.epoch();
+    uint32_t from = request->hasParam("from") ? request->getParam("from")->value().toInt() : to - 86400;
+    // segments are read a few bytes at a time as the response goes out
+    std::shared_ptr<HistoryReader> reader = std::make_shared<HistoryReader>(history, series, HistoryStore::levelFor(from, to), from, to);
+    request->send(request->beginChunkedResponse("application/json", [reader](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                                                { return reader->read(buffer, maxLen); })); });
+
+  // task timings, heap and queue gauges in Prometheus text format, built a part at a time
+  server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+    std::shared_ptr<MetricsReader> reader = std::make_shared<MetricsReader>(renderMetrics, METRICS_PARTS);
+    request->send(request->beginChunkedResponse("text/plain; version=0.0.4", [reader](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+                                                { return reader->read(buffer, maxLen); })); });
 
-  server.on("/auto", HTTP_GET, [](AsyncWebServerRequest *request)
+  // latest relay edges, newest first
+  server.on("/edges", HTTP_GET, [](AsyncWebServerRequest *request)
             {
-    int output;
-    //String debug = "";
-    // GET input1 value on <ESP_IP>/auto?output=<output>
-    if (request->hasParam(PARAM_OUTPUT))
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    response->print("{\"edges\":[");
+    for (uint16_t i = 0; i < outputDriver.edgeLogSize(); i++)
     {
-      output = request->getParam(PARAM_OUTPUT)->value().toInt();
-      setPumpAuto(output);
-    //  debug = "Set pin " + String(output) + " to auto"; 
+      const OutputEdge &edge = outputDriver.recentEdge(i);
+      const char *id = "?";
+      for (size_t j = 0; j < outputs.size(); j++)
+      {
+        if (outputs.config(j).pin == edge.pin)
+          id = outputs.config(j).id;
+      }
+      response->printf("%s{\"epoch\":%u,\"millis\":%u,\"output\":\"%s\",\"on\":%u}", i ? "," : "", edge.epoch, edge.millis, id, edge.on);
     }
-    else {
-     // debug = "No message sent";
+    response->print("]}");
+    request->send(response); });
+
+  // acknowledge an alarm, GET /ack?alarm=<id>
+  server.on("/ack", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+    if (request->hasParam("alarm"))
+    {
+      AlarmInput input = {(uint8_t)request->getParam("alarm")->value().toInt(), false, true};
+      xQueueSend(alarmInputQueue, &input, 0);
     }
-    //Serial.println(debug);
     request->send(200, "text/plain", "OK"); });
 
+  // web page, gzipped into /www by gzipData.py when the filesystem image is built.
+  // Served with an ETag so the browser gets a 304 until the files change
+  server.serveStatic("/", SPIFFS, "/www/").setDefaultFile("index.html").setCacheControl("no-cache");
+
   // Handle Web Server Events
   events.onConnect([](AsyncEventSourceClient *client)
                    {
     if(client->lastId()){
       Serial.printf("Client reconnected! Last message ID that it got is: %u\n", client->lastId());
     }
-    // send event with message "hello!", id current millis
-    // and set reconnect delay to 1 second
-    client->send("hello!", NULL, millis(), 10000); });
+    // send event with message "hello!", id of the last telemetry frame
+    // and set reconnect delay to 10 seconds
+    client->send("hello!", NULL, telemetrySequence, 10000); });
   server.addHandler(&events);
   AsyncElegantOTA.begin(&server);
   server.begin();
 
-  // initial dht reading
-  getDhtReadings();
+  controlTask.addJob(updateCurrentReadings, 0);
+  controlTask.addJob(runPumpControl, 0);
+  controlTask.addJob(driveOutputs, 0);
+  controlTask.addJob(feedPumpAlarms, 0);
+  controlTask.addJob(analysePumpHealth, 0);
+  controlTask.addJob(adaptSchedule, CLIMATE_UPDATE_INTERVAL);
+  controlTask.addJob(managePower, 0);
+  alarmTask.addJob(serviceAlarms, 0);
+  alarmTask.addJob(saveRuntimeState, 0);
+  alarmTask.addJob(saveCalibration, CALIBRATION_SAVE_INTERVAL);
+  // the dht task reads every dhtInterval (default 15 min), pick up new readings
+  sensingTask.addJob(publishClimate, CLIMATE_POLL_INTERVAL);
+  // get water level every set interval (default 1 min)
+  sensingTask.addJob(getWaterLevel, settings.waterLevelInterval * 1000UL);
+  sensingTask.addJob(pollUltrasonic, 0);
+  sensingTask.addJob(recordHistory, settings.historyInterval * 1000UL);
+  sensingTask.addJob(flushHistory, HISTORY_FLUSH_INTERVAL);
+  networkTask.addJob(sendQueuedEvents, 0);
+  networkTask.addJob(sendControlAcks, 0);
+  // update pump status on the web every 10 seconds
+  networkTask.addJob(updatePumpStatuses, updatePumpStatusInterval);
+  networkTask.addJob(checkWifi, 0);
+  networkTask.addJob(checkTimeSync, 0);
+  networkTask.addJob(serviceMqtt, 0);
+  // a stalled control task panics the task watchdog, which resets the chip with the relays off
+  esp_task_wdt_init(CONTROL_WATCHDOG_S, true);
+  controlTask.watch();
+  controlTask.start();
+  alarmTask.start();
+  sensingTask.start();
+  networkTask.start();
+  xTaskCreatePinnedToCore(guardControl, "stallGuard", 2048, NULL, configMAX_PRIORITIES - 1, NULL, 0);
 }
 
 void loop()
 {
+  // everything runs on the scheduled tasks
+  vTaskDelete(NULL);
+}
 
-  now = millis();
-  // sample current sensors every 50ms
-  if (now - adcSamplingMillisCounter >= adcSamplingInterval)
-  {
-    pump1Samples += analogRead(WATER_PUMP_1_CURRENT);
-    pump2Samples += analogRead(WATER_PUMP_2_CURRENT);
-    airPumpSamples += analogRead(AIR_PUMP_CURRENT);
-
-    // increase sample counter
-    adcSamplingMillisCounter += adcSamplingInterval;
-    samplingCounter++;
-    // 50 samples = 2.5s
-    if (samplingCounter >= 50)
-    {
-      float avgPump1ADC = pump1Samples / 50;
-      float pump1Voltage = (avgPump1ADC * (3.31 / 4095.0)) - 1.52; // 1.55 is voltage reading at 0 current
-      float pump1Current = 2 * pump1Voltage / mvPerAmp;
-      float avgPump2ADC = pump2Samples / 50;
-      float pump2Voltage = avgPump2ADC * 3.3 / 4095.0 - 1.55; // 1.55 is voltage reading at 0 current
-      float pump2Current = pump2Voltage * 2 / mvPerAmp;
-      float avgAirPumpADC = airPumpSamples / 50;
-      float airPumpVoltage = avgAirPumpADC * 3.3 / 4095.0 - 1.55; // 1.55 is voltage reading at 0 current
-      float airPumpCurrent = airPumpVoltage * 2 / mvPerAmp;
-      pump1Status = (pump1Current > 0.5) ? true : false;
-      pump2Status = (pump2Current > 0.5) ? true : false;
-      airPumpStatus = (airPumpCurrent > 0.5) ? true : false;
-      // Current sensor debug calibrations
-      // Serial.println(avgPump1ADC);
-      // Serial.print("Pump 1 Voltage: ");
-      // Serial.println(pump1Voltage, 3);
-      // Serial.print("Pump 1 Current: ");
-      // Serial.println(pump1Current, 3);
-      // Serial.print("Pump 2 Voltage: ");
-      // Serial.println(pump2Voltage);
-      // Serial.print("Pump 2 Current: ");
-      // Serial.println(pump2Current);
-      // Serial.print("Air Pump Voltage: ");
-      // Serial.println(airPumpVoltage);
-      // Serial.print("Air Pump Current: ");
-      // Serial.println(airPumpCurrent);
-      samplingCounter = 0;
-      pump1Samples = 0.0;
-      pump2Samples = 0.0;
-      airPumpSamples = 0.0;
-    }
+void takeSettings()
+{
+  Settings committed;
+  if (xQueueReceive(settingsQueue, &committed, 0) != pdTRUE)
+  {
+    return;
   }
-  // update pump status on the web every 10 seconds
-  pumpStatusMillisCounter = setInterval(updatePumpStatuses, pumpStatusMillisCounter, updatePumpStatusInterval);
-  // get dht readings every set interval (default 15 min)
-  dhtMillisCounter = setInterval(getDhtReadings, dhtMillisCounter, dhtInterval);
-  // toggle air pump every set interval (default 15 min)
-  airPumpMillisCounter = setInterval(toggleAirPump, airPumpMillisCounter, airPumpInterval);
-  // get water level every set interval (default 15 min)
-  waterLevelMillisCounter = setInterval(getWaterLevel, waterLevelMillisCounter, waterLevelInterval);
-
-  // check counter if connecting to wifi
-  if (!readyToConnectWifi)
+  Settings previous = settings;
+  settings = committed;
+  applySettings(previous);
+}
+void applySettings(const Settings &previous)
+{
+  // values read by the tasks on every use (current scaling, thresholds) are live already
+  if (settings.mvPerAmp != previous.mvPerAmp)
   {
-    if (now - wifiPrevMillis > WIFI_RETRY_WAIT_TIME)
-    {
-      readyToConnectWifi = true;
-      wifiPrevMillis += WIFI_RETRY_WAIT_TIME;
-    }
+    configureCurrentChannels();
+  }
+  if (settings.utcOffset != previous.utcOffset)
+  {
+    timeService.setUtcOffset(settings.utcOffset);
+  }
+  if (settings.dhtInterval != previous.dhtInterval)
+  {
+    dhtSensor.setInterval(settings.dhtInterval * 1000UL);
   }
-  else if (readyToConnectWifi and WiFi.status() != WL_CONNECTED)
+  if (settings.waterLevelInterval != previous.waterLevelInterval)
   {
-    // ready to connect
-    delay(5000); // will attempt to reconnect before disconnect event even fires
-    Serial.println("Reconnecting to WiFi");
-    WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
-    wifiPrevMillis = now; // reset timer
-    readyToConnectWifi = false;
+    sensingTask.setJobInterval(getWaterLevel, settings.waterLevelInterval * 1000UL);
   }
+  if (settings.historyInterval != previous.historyInterval)
+  {
+    sensingTask.setJobInterval(recordHistory, settings.historyInterval * 1000UL);
+  }
+  if (settings.failoverMs != previous.failoverMs or settings.balanceHours != previous.balanceHours)
+  {
+    failover.configure(settings.failoverMs, settings.balanceHours * 3600000UL);
+  }
+  Serial.println((String) "Settings " + configStore.sequence() + " applied");
+}
+
+void updateCurrentReadings()
+{
+  controller.updateCurrentReadings();
+}
 
-  int currentHour = rtc.getHour(true);
-  int currentMin = rtc.getMinute();
-  int currentSec = rtc.getSecond();
+void analysePumpHealth()
+{
+  // only the FFT and features of a finished capture take time
+  uint32_t start = micros();
+  if (controller.analysePumpHealth())
+  {
+    pumpFft.time.record(micros() - start);
+  }
+}
 
-  // Update time using NTP at same time everyday (getHour(true) outputs 0-23)
-  if (currentHour == NTP_SYNC_HOUR and currentMin == NTP_SYNC_MINUTE and currentSec == NTP_SYNC_SECOND)
+void runPumpControl()
+{
+  PumpCommand command;
+  while (xQueueReceive(pumpCommandQueue, &command, 0) == pdTRUE)
   {
-    if (!rtcUpdated)
+    if (command.setAuto)
     {
-      updateAndSyncTime();
+      setPumpAuto(command.output);
     }
+    else
+    {
+      overridePump(command.output, command.state, command.time);
+    }
+    ControlAck ack = {command.client, command.request, command.output, ""};
+    writeCommandText(ack.command, sizeof(ack.command), outputs[command.output], hal.epoch());
+    xQueueSend(controlAckQueue, &ack, 0);
   }
+  takeSettings();
+  // controls pumps (auto vs override)
+  controlPumps(hal.epoch());
+}
+
+void checkWifi()
+{
+  // scans and connects run in the background, this only polls them
+  uint32_t now = millis();
+  uint32_t epoch = hal.epoch();
+  uint32_t windowStart;
+  // low power: the station is only up in the upload windows, and until the clock has been set
+  if (settings.lowPower == 0 or epoch < MIN_VALID_EPOCH or inUploadWindow(epoch, settings.uploadInterval, settings.uploadWindow, windowStart))
+    wifi.resume(now);
   else
+    wifi.suspend(now);
+  wifi.update(now);
+}
+
+void checkTimeSync()
+{
+  // request and answer are handled on separate wakeups, nothing here waits on the network
+  if (timeService.update())
   {
-    rtcUpdated = false;
+    strlcpy(lastNTPSync, rtc.getTime("%A, %B %d %Y %I:%M %p").c_str(), sizeof(lastNTPSync));
+    const ClockDiscipline &clock = timeService.clock();
+    Serial.println((String) "NTP sync, offset " + (long)(clock.lastOffset() / 1000) + " ms, delay " + (long)(clock.lastDelay() / 1000) + " ms, drift " + clock.ppm() + " ppm");
   }
-  // controls pumps (auto vs override)
-  controlPumps(currentHour, currentMin);
-  // check pump alarm
-  checkPumpAlarms();
 }
 
-void updateAndSyncTime()
+void onControlMessage(AsyncWebSocketClient *client, const char *frame, size_t length)
 {
-  if (timeClient.update())
+  // runs on the async_tcp task, validate here and leave the pumps to the control task
+  ControlRequest request;
+  const char *error = queueControlRequest(frame, length, client->id(), request);
+  if (error != NULL)
   {
-    // successful update
-    Serial.println("Recieved updated time from NTP!");
-    // set RTC time
-    rtc.setTime(timeClient.getEpochTime());
-    lastNTPSync = rtc.getTime("%A, %B %d %Y %I:%M %p");
-    // Serial.println("RTC: " + lastNTPSync);
-    rtcUpdated = true;
+    char reply[CONTROL_FRAME_SIZE];
+    size_t replyLength = writeControlError(reply, sizeof(reply), request.id, error);
+    client->text(reply, replyLength);
   }
-  else
+}
+const char *queueControlRequest(const char *frame, size_t length, uint32_t client, ControlRequest &request)
+{
+  uint8_t output;
+  const char *error = parseControlCommand(frame, length, boardOutputs, OUTPUT_COUNT, request, output);
+  if (error != NULL)
+    return error;
+  PumpCommand command = {output, request.command == CONTROL_AUTO, request.state, request.time, client, request.id};
+  if (xQueueSend(pumpCommandQueue, &command, 0) != pdTRUE)
+    return "busy";
+  return NULL;
+}
+void onMqttMessage(const MqttMessage &message)
+{
+  // same requests and acks as the websocket, acks go to <topic>/ack
+  if (strcmp(message.topic, mqttCommandTopic) != 0)
+    return;
+  ControlRequest request;
+  const char *error = queueControlRequest((const char *)message.payload, message.length, MQTT_CLIENT, request);
+  if (error != NULL)
   {
-    // unsuccessful update, display current unsynced RTC time
-    Serial.println("Unable to connect to NTP or already updated within the last 30 minutes");
-    Serial.println("RTC: " + rtc.getTime("%A, %B %d %Y %I:%M %p"));
+    char reply[CONTROL_FRAME_SIZE];
+    size_t replyLength = writeControlError(reply, sizeof(reply), request.id, error);
+    mqtt.publish(mqttAckTopic, (const uint8_t *)reply, replyLength, 0);
   }
 }
-String processor(const String &var)
+void serviceMqtt()
 {
-  if (var == "GPIO_STATE")
+  if (MQTT_HOST[0] == '\0')
+    return;
+  uint32_t now = millis();
+  uint32_t epoch = hal.epoch();
+  if (now - lastMqttSample >= MQTT_SAMPLE_INTERVAL and epoch >= MIN_VALID_EPOCH)
   {
-    if (digitalRead(LED_PIN))
+    lastMqttSample = now;
+    // {"t":<epoch of the first sample>,"dt":60,"c":[..column names..],"v":[[..],[..]]}, stale readings are null
+    float f, h, hif;
+    bool climate = hal.readClimate(f, h, hif);
+    uint32_t commanded = 0, running = 0;
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-      ledState = "ON";
+      commanded |= (uint32_t)outputs[i].command << i;
+      running |= (uint32_t)outputs[i].status << i;
     }
-    else
+    char sample[64];
+    char temperature[8] = "null", humidity[8] = "null", water[8] = "null";
+    if (climate)
+    {
+      snprintf(temperature, sizeof(temperature), "%.1f", f);
+      snprintf(humidity, sizeof(humidity), "%.0f", h);
+    }
+    if (controller.waterLevel() != W_FAULT and waterEstimator.valid())
+      snprintf(water, sizeof(water), "%.1f", waterEstimator.distance());
+    int n = snprintf(sample, sizeof(sample), "[%s,%s,%s,%u,%u]", temperature, humidity, water, (unsigned)commanded, (unsigned)running);
+    if (mqttBatchSamples == 0)
     {
-      ledState = "OFF";
+      mqttBatchLength = snprintf(mqttBatch, sizeof(mqttBatch), "{\"t\":%u,\"dt\":%u,\"c\":[\"temp_f\",\"humidity\",\"water_cm\",\"command\",\"running\"],\"v\":[%s",
+                                 (unsigned)epoch, MQTT_SAMPLE_INTERVAL / 1000, sample);
     }
-    return ledState;
+    else if (mqttBatchLength + 1 + n + 2 < sizeof(mqttBatch))
+    {
+      mqttBatch[mqttBatchLength++] = ',';
+      memcpy(mqttBatch + mqttBatchLength, sample, n);
+      mqttBatchLength += n;
+    }
+    if (++mqttBatchSamples == MQTT_BATCH_SAMPLES)
+    {
+      memcpy(mqttBatch + mqttBatchLength, "]}", 2);
+      if (!outbox.push(mqttBatch, mqttBatchLength + 2))
+        Serial.println("Error: Could not queue MQTT telemetry");
+      mqttBatchSamples = 0;
+    }
+  }
+  mqtt.update(now, wifi.state() == WIFI_CONNECTED);
+  if (mqtt.delivered())
+    outbox.pop();
+  if (mqtt.online() and !mqtt.inFlight() and now - lastMqttDrain >= MQTT_DRAIN_INTERVAL)
+  {
+    uint8_t message[OUTBOX_PAYLOAD_SIZE];
+    size_t length = outbox.peek(message, sizeof(message));
+    if (length and mqtt.publish(mqttTelemetryTopic, message, length, 1))
+      lastMqttDrain = now;
   }
-  else if (var == "CURRENT_TIME")
+}
+void sendControlAcks()
+{
+  ControlAck ack;
+  char reply[CONTROL_FRAME_SIZE];
+  while (xQueueReceive(controlAckQueue, &ack, 0) == pdTRUE)
   {
-    return rtc.getTime("%A, %B %d %Y %I:%M %p");
+    size_t length = writeControlAck(reply, sizeof(reply), ack.request, outputs.config(ack.output).id, ack.command);
+    if (ack.client == MQTT_CLIENT)
+      mqtt.publish(mqttAckTopic, (const uint8_t *)reply, length, 0); // dropped while offline, the command was applied anyway
+    else
+      ws.text(ack.client, reply, length); // client may have gone, that is fine
   }
-  else if (var == "LAST_SYNC_TIME")
+  ws.cleanupClients();
+}
+
+void postEvent(const char *data, const char *event)
+{
+  WebEvent webEvent;
+  strlcpy(webEvent.event, event, sizeof(webEvent.event));
+  strlcpy(webEvent.data, data, sizeof(webEvent.data));
+  // never wait on the network task, drop the event if it is backed up
+  xQueueSend(webEventQueue, &webEvent, 0);
+}
+
+void sendQueuedEvents()
+{
+  WebEvent webEvent;
+  while (xQueueReceive(webEventQueue, &webEvent, 0) == pdTRUE)
   {
-    return lastNTPSync;
+    telemetry.set(webEvent.event, webEvent.data);
   }
-  else if (var == "TEMPERATURE")
+  if (!telemetry.changed())
+    return;
+  // a client that still drops a frame sees the id gap and reloads /api/state
+  size_t clients = events.count();
+  size_t waiting = clients ? events.avgPacketsWaiting() : 0;
+  static char frame[TELEMETRY_FRAME_SIZE];
+  uint32_t start = micros();
+  if (telemetry.publish(frame, sizeof(frame), clients, waiting))
   {
-    // get current dht readings to update webpage
-    // only needs to run once and temperature is read first
-    getDhtReadings();
-    return String(f);
+    events.send(frame, "telemetry", ++telemetrySequence);
+    telemetrySend.time.record(micros() - start);
   }
-  else if (var == "HUMIDITY")
+}
+size_t renderMetrics(uint16_t part, char *out, size_t size)
+{
+  MetricsWriter metrics(out, size);
+  char labels[32];
+  if (part == METRICS_GAUGES)
   {
-    return String(h);
+    metrics.family("greenhouse_heap_free_bytes", "gauge", "Free heap");
+    metrics.value("greenhouse_heap_free_bytes", NULL, ESP.getFreeHeap());
+    metrics.family("greenhouse_heap_largest_block_bytes", "gauge", "Largest allocatable heap block");
+    metrics.value("greenhouse_heap_largest_block_bytes", NULL, ESP.getMaxAllocHeap());
+    metrics.family("greenhouse_heap_min_free_bytes", "gauge", "Lowest free heap since boot");
+    metrics.value("greenhouse_heap_min_free_bytes", NULL, ESP.getMinFreeHeap());
+    metrics.family("greenhouse_web_clients", "gauge", "Connected web clients");
+    metrics.value("greenhouse_web_clients", "channel=\"events\"", events.count());
+    metrics.value("greenhouse_web_clients", "channel=\"ws\"", ws.count());
+    metrics.family("greenhouse_queue_depth", "gauge", "Messages waiting in a task queue");
+    metrics.value("greenhouse_queue_depth", "queue=\"pump_command\"", uxQueueMessagesWaiting(pumpCommandQueue));
+    metrics.value("greenhouse_queue_depth", "queue=\"web_event\"", uxQueueMessagesWaiting(webEventQueue));
+    metrics.value("greenhouse_queue_depth", "queue=\"alarm_input\"", uxQueueMessagesWaiting(alarmInputQueue));
+    metrics.value("greenhouse_queue_depth", "queue=\"control_ack\"", uxQueueMessagesWaiting(controlAckQueue));
+    metrics.family("greenhouse_uptime_seconds", "gauge", "Time since boot");
+    metrics.value("greenhouse_uptime_seconds", NULL, millis() / 1000);
   }
-  else if (var == "HEAT_INDEX")
+  else if (part == METRICS_COUNTERS)
   {
-    return String(hif);
+    metrics.family("greenhouse_telemetry_frames_total", "counter", "Telemetry frames sent");
+    metrics.value("greenhouse_telemetry_frames_total", NULL, telemetry.frameCount());
+    metrics.family("greenhouse_telemetry_bytes_total", "counter", "Telemetry bytes sent");
+    metrics.value("greenhouse_telemetry_bytes_total", NULL, telemetry.byteCount());
+    metrics.family("greenhouse_current_missed_samples_total", "counter", "Current sensor samples missed by the sampling task");
+    metrics.value("greenhouse_current_missed_samples_total", NULL, currentSensor.missedSamples());
+    metrics.family("greenhouse_output_edges_total", "counter", "Relay edges written");
+    metrics.value("greenhouse_output_edges_total", NULL, outputDriver.edgeCount());
+    metrics.family("greenhouse_output_register_writes_total", "counter", "Output register writes, one per batch of edges");
+    metrics.value("greenhouse_output_register_writes_total", NULL, outputDriver.writeCount());
+    metrics.family("greenhouse_state_journal_writes_total", "counter", "Runtime state records written to flash");
+    metrics.value("greenhouse_state_journal_writes_total", NULL, journal.writeCount());
   }
-  else if (var == "PUMP_1_COMMAND")
+  else if (part == METRICS_TIME)
   {
-    String command = "";
-    if (digitalRead(WATER_PUMP_1_PIN))
+    const ClockDiscipline &clock = timeService.clock();
+    metrics.family("greenhouse_time_synced", "gauge", "1 once the clock has been set from NTP");
+    metrics.value("greenhouse_time_synced", NULL, timeService.synced());
+    metrics.family("greenhouse_time_offset_seconds", "gauge", "Clock offset measured by the last NTP sync");
+    metrics.value("greenhouse_time_offset_seconds", NULL, clock.lastOffset() / 1e6);
+    metrics.family("greenhouse_time_delay_seconds", "gauge", "Round trip of the last NTP sync");
+    metrics.value("greenhouse_time_delay_seconds", NULL, clock.lastDelay() / 1e6);
+    metrics.family("greenhouse_time_drift_ppm", "gauge", "Estimated clock drift, slewed out between syncs");
+    metrics.value("greenhouse_time_drift_ppm", NULL, clock.ppm());
+    metrics.family("greenhouse_time_since_sync_seconds", "gauge", "Time since the last NTP sync");
+    metrics.value("greenhouse_time_since_sync_seconds", NULL, timeService.synced() ? (double)(hal.epoch() - timeService.lastSyncEpoch()) : -1.0);
+    metrics.family("greenhouse_time_syncs_total", "counter", "NTP syncs applied");
+    metrics.value("greenhouse_time_syncs_total", NULL, timeService.syncCount());
+    metrics.family("greenhouse_time_sync_failures_total", "counter", "NTP syncs that failed");
+    metrics.value("greenhouse_time_sync_failures_total", NULL, timeService.failureCount());
+  }
+  else if (part == METRICS_WIFI)
+  {
+    metrics.family("greenhouse_wifi_state", "gauge", "0 scanning, 1 connecting, 2 connected, 3 backing off, 4 off between upload windows");
+    metrics.value("greenhouse_wifi_state", NULL, wifi.state());
+    metrics.family("greenhouse_wifi_access_point", "gauge", "1 while the fallback access point is up");
+    metrics.value("greenhouse_wifi_access_point", NULL, wifi.accessPoint());
+    metrics.family("greenhouse_wifi_rssi_dbm", "gauge", "Signal of the connected network");
+    metrics.value("greenhouse_wifi_rssi_dbm", NULL, (wifi.state() == WIFI_CONNECTED) ? WiFi.RSSI() : 0);
+    metrics.family("greenhouse_wifi_connects_total", "counter", "Station connections made");
+    metrics.value("greenhouse_wifi_connects_total", NULL, wifi.connects());
+    metrics.family("greenhouse_wifi_failed_attempts_total", "counter", "Connection attempts that timed out");
+    metrics.value("greenhouse_wifi_failed_attempts_total", NULL, wifi.failedAttempts());
+  }
+  else if (part == METRICS_MQTT)
+  {
+    metrics.family("greenhouse_mqtt_state", "gauge", "0 offline, 1 connecting, 2 online");
+    metrics.value("greenhouse_mqtt_state", NULL, mqtt.state());
+    metrics.family("greenhouse_mqtt_queued_messages", "gauge", "Telemetry messages waiting in the flash outbox");
+    metrics.value("greenhouse_mqtt_queued_messages", NULL, outbox.size());
+    metrics.family("greenhouse_mqtt_dropped_total", "counter", "Queued messages overwritten before they could be sent");
+    metrics.value("greenhouse_mqtt_dropped_total", NULL, outbox.dropped());
+    metrics.family("greenhouse_mqtt_published_total", "counter", "Messages published");
+    metrics.value("greenhouse_mqtt_published_total", NULL, mqtt.published());
+    metrics.family("greenhouse_mqtt_received_total", "counter", "Messages received on the command topic");
+    metrics.value("greenhouse_mqtt_received_total", NULL, mqtt.received());
+    metrics.family("greenhouse_mqtt_connects_total", "counter", "Broker connections made");
+    metrics.value("greenhouse_mqtt_connects_total", NULL, mqtt.connects());
+    metrics.family("greenhouse_mqtt_failures_total", "counter", "Broker connections that failed or were refused");
+    metrics.value("greenhouse_mqtt_failures_total", NULL, mqtt.failures());
+  }
+  else if (part == METRICS_CURRENT)
+  {
+    metrics.family("greenhouse_current_amps", "gauge", "Output current, noise floor removed");
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-      command = "On ";
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_current_amps", labels, currentChannels[i].amps());
     }
-    else
+    metrics.family("greenhouse_current_nominal_amps", "gauge", "Learned running current, 0 until learned");
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-      command = "Off ";
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_current_nominal_amps", labels, currentChannels[i].learned() ? currentChannels[i].nominal() : 0);
     }
-    if (pump1Override)
+    metrics.family("greenhouse_current_ratio", "gauge", "Averaged running current over the nominal current");
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-      String timeLeft = "Permanent)";
-      if (pump1OverrideTimeEpochEnd > 0)
-      {
-        timeLeft = String((pump1OverrideTimeEpochEnd - rtc.getEpoch()) / 60) + " min)"; // time left in minutes
-      }
-      return command + "(Override " + timeLeft;
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_current_ratio", labels, currentChannels[i].ratio());
+    }
+    metrics.family("greenhouse_current_zero_counts", "gauge", "Idle RMS of the channel, subtracted from readings");
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_current_zero_counts", labels, currentChannels[i].zeroCounts());
     }
-    return command + "(Auto)";
   }
-  else if (var == "PUMP_2_COMMAND")
+  else if (part == METRICS_HEALTH)
   {
-    String command = "";
-    if (digitalRead(WATER_PUMP_2_PIN))
+    metrics.family("greenhouse_pump_health", "gauge", "0-100 against the pump's learned baseline, 100 while learning");
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-      command = "On ";
+      snprintf(labels, sizeof(labels), "output=\"%s\",worst=\"%s\"", outputs.config(i).id, PUMP_FEATURE_NAMES[pumpHealth[i].worst()]);
+      metrics.value("greenhouse_pump_health", labels, pumpHealth[i].health());
     }
-    else
+    metrics.family("greenhouse_pump_thd", "gauge", "Harmonic distortion of the pump current, last capture");
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-      command = "Off ";
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_pump_thd", labels, pumpHealth[i].feature(FEATURE_THD));
     }
-    if (pump2Override)
+    metrics.family("greenhouse_pump_noise_share", "gauge", "Share of the current power outside the mains harmonics, last capture");
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-      String timeLeft = "Permanent)";
-      if (pump2OverrideTimeEpochEnd > 0)
-      {
-        timeLeft = String((pump2OverrideTimeEpochEnd - rtc.getEpoch()) / 60) + " min)"; // time left in minutes
-      }
-      return command + "(Override " + timeLeft;
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_pump_noise_share", labels, pumpHealth[i].feature(FEATURE_NOISE));
     }
-    return command + "(Auto)";
+    metrics.family("greenhouse_pump_inrush_seconds", "gauge", "Start-up current above 1.2x the running current, last start");
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_pump_inrush_seconds", labels, pumpHealth[i].feature(FEATURE_INRUSH_TIME) / 1000);
+    }
+  }
+  else if (part == METRICS_WATER)
+  {
+    // read from the network task, floats written by the sensing task are torn at worst by one reading
+    TankGeometry tank = tankGeometry();
+    metrics.family("greenhouse_water_distance_cm", "gauge", "Sensor to water surface, filtered");
+    metrics.value("greenhouse_water_distance_cm", NULL, waterEstimator.distance());
+    metrics.family("greenhouse_water_litres", "gauge", "Water in the reservoir");
+    metrics.value("greenhouse_water_litres", NULL, tankLitres(tank, waterEstimator.distance()));
+    metrics.family("greenhouse_water_consumption_litres_per_hour", "gauge", "Level drop over the last hours, 0 until an hour of readings");
+    metrics.value("greenhouse_water_consumption_litres_per_hour", NULL, waterEstimator.consumption(tank));
+    metrics.family("greenhouse_water_hours_to_empty", "gauge", "At the current consumption, -1 when the level is not falling");
+    metrics.value("greenhouse_water_hours_to_empty", NULL, waterEstimator.hoursToEmpty(tank));
+    metrics.family("greenhouse_water_outliers_total", "counter", "Water level readings rejected as stray echoes");
+    metrics.value("greenhouse_water_outliers_total", NULL, waterEstimator.outlierCount());
+    metrics.family("greenhouse_water_refills_total", "counter", "Refills seen by the water level estimator");
+    metrics.value("greenhouse_water_refills_total", NULL, waterEstimator.refillCount());
   }
-  else if (var == "AIR_PUMP_COMMAND")
+  else if (part == METRICS_CLIMATE)
   {
-    String command = "";
-    if (digitalRead(AIR_PUMP_PIN))
+    DhtReading reading;
+    bool read = dhtSensor.latest(reading);
+    metrics.family("greenhouse_dht_age_seconds", "gauge", "Age of the cached DHT reading, -1 before the first");
+    metrics.value("greenhouse_dht_age_seconds", NULL, read ? (millis() - reading.takenMs) / 1000.0 : -1.0);
+    metrics.family("greenhouse_dht_stale", "gauge", "1 when the cached DHT reading is too old to be used");
+    metrics.value("greenhouse_dht_stale", NULL, dhtSensor.stale(millis()));
+    metrics.family("greenhouse_dht_reads_total", "counter", "DHT reads, retries included");
+    metrics.value("greenhouse_dht_reads_total", NULL, dhtSensor.reads());
+    metrics.family("greenhouse_dht_failures_total", "counter", "DHT reads without a valid frame");
+    metrics.value("greenhouse_dht_failures_total", NULL, dhtSensor.failures());
+    metrics.family("greenhouse_climate_trend_f_per_hour", "gauge", "Least squares temperature trend of the recent DHT readings");
+    metrics.value("greenhouse_climate_trend_f_per_hour", NULL, climate.trend());
+    metrics.family("greenhouse_climate_projected_heat_index_f", "gauge", "Heat index an hour ahead on the trend, the adaptive schedule follows it");
+    if (climate.known())
+      metrics.value("greenhouse_climate_projected_heat_index_f", NULL, climate.projected());
+    metrics.family("greenhouse_climate_scale", "gauge", "Duty cycle factor of the schedule pulses, 1 as written");
+    metrics.value("greenhouse_climate_scale", "role=\"irrigation\"", climate.scale(CLIMATE_IRRIGATION));
+    metrics.value("greenhouse_climate_scale", "role=\"aeration\"", climate.scale(CLIMATE_AERATION));
+  }
+  else if (part == METRICS_POWER)
+  {
+    metrics.family("greenhouse_power_low_power", "gauge", "1 in low power mode");
+    metrics.value("greenhouse_power_low_power", NULL, settings.lowPower);
+    metrics.family("greenhouse_power_state", "gauge", "0 active, 1 idle at the low clock, 2 light sleep");
+    metrics.value("greenhouse_power_state", NULL, powerPlan.state);
+    metrics.family("greenhouse_power_cpu_mhz", "gauge", "CPU clock");
+    metrics.value("greenhouse_power_cpu_mhz", NULL, getCpuFrequencyMhz());
+    metrics.family("greenhouse_power_next_due_seconds", "gauge", "Until the next thing the controller has to be awake for, 0 while busy");
+    snprintf(labels, sizeof(labels), "reason=\"%s\"", POWER_REASON_NAMES[powerPlan.reason]);
+    metrics.value("greenhouse_power_next_due_seconds", labels, powerPlan.dueMs / 1000.0);
+    metrics.family("greenhouse_power_state_share", "gauge", "Share of the time since boot spent in a power state");
+    for (uint8_t state = 0; state < POWER_STATES; state++)
     {
-      command = "On ";
+      snprintf(labels, sizeof(labels), "state=\"%s\"", POWER_STATE_NAMES[state]);
+      metrics.value("greenhouse_power_state_share", labels, energy.share((PowerState)state));
     }
-    else
+    metrics.family("greenhouse_power_wifi_share", "gauge", "Share of the time since boot the radio was up");
+    metrics.value("greenhouse_power_wifi_share", NULL, energy.wifiShare());
+    metrics.family("greenhouse_power_sleeps_total", "counter", "Light sleeps entered");
+    metrics.value("greenhouse_power_sleeps_total", NULL, powerSleeps);
+    metrics.family("greenhouse_energy_controller_mah_total", "counter", "Estimated controller charge at the supply since boot, relay coils included");
+    metrics.value("greenhouse_energy_controller_mah_total", NULL, energy.controllerMah());
+    metrics.family("greenhouse_energy_controller_wh_per_day", "gauge", "Estimated controller energy per day at the rate since boot");
+    metrics.value("greenhouse_energy_controller_wh_per_day", NULL, energy.controllerWhPerDay());
+    metrics.family("greenhouse_energy_pumps_wh_per_day", "gauge", "Estimated pump energy per day from the measured currents");
+    metrics.value("greenhouse_energy_pumps_wh_per_day", NULL, energy.pumpWhPerDay());
+  }
+  else if (part == METRICS_FAILOVER)
+  {
+    metrics.family("greenhouse_failover_failed", "gauge", "1 while a pump's group runs its schedule after it went quiet");
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-      command = "Off ";
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_failover_failed", labels, failover.failed(i));
     }
-    if (airPumpOverride)
+    metrics.family("greenhouse_failover_failures_total", "counter", "Pumps found driven without current for failoverMs");
+    for (size_t i = 0; i < outputs.size(); i++)
     {
-      String timeLeft = "Permanent)";
-      if (airPumpOverrideTimeEpochEnd > 0)
-      {
-        timeLeft = String((airPumpOverrideTimeEpochEnd - rtc.getEpoch()) / 60) + " min)"; // time left in minutes
-      }
-      return command + "(Override " + timeLeft;
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_failover_failures_total", labels, failover.failures(i));
+    }
+    metrics.family("greenhouse_failover_run_seconds_total", "counter", "Pump run time with current, the wear roles are balanced on");
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+      snprintf(labels, sizeof(labels), "output=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_failover_run_seconds_total", labels, failover.runSeconds(i));
     }
-    return command + "(Auto)";
+    metrics.family("greenhouse_failover_owner", "gauge", "Output running each schedule, by index");
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+      snprintf(labels, sizeof(labels), "role=\"%s\"", outputs.config(i).id);
+      metrics.value("greenhouse_failover_owner", labels, outputs.owner(i));
+    }
+    metrics.family("greenhouse_failover_takeovers_total", "counter", "Schedules moved off a failed pump");
+    metrics.value("greenhouse_failover_takeovers_total", NULL, failover.takeoverCount());
+    metrics.family("greenhouse_failover_balances_total", "counter", "Schedule runs handed to a less worn pump");
+    metrics.value("greenhouse_failover_balances_total", NULL, failover.balanceCount());
+    metrics.family("greenhouse_failover_recoveries_total", "counter", "Failed pumps that drew current again");
+    metrics.value("greenhouse_failover_recoveries_total", NULL, failover.recoveryCount());
+    metrics.family("greenhouse_control_stalled", "gauge", "1 once the stall guard switched the relays off");
+    metrics.value("greenhouse_control_stalled", NULL, safeState);
   }
-  return String();
-}
-void WiFiStationConnected(WiFiEvent_t event, WiFiEventInfo_t info)
-{
-  Serial.println("Connected to AP successfully!");
-}
-
-void WiFiGotIP(WiFiEvent_t event, WiFiEventInfo_t info)
-{
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
-  // mdns responder for esp32.local
-  if (MDNS.begin("esp32"))
+  else if (part == METRICS_TASKS)
+  {
+    metrics.family("greenhouse_task_overruns_total", "counter", "Task wakeups that took longer than the task period");
+    for (size_t i = 0; i < TASK_COUNT; i++)
+    {
+      snprintf(labels, sizeof(labels), "task=\"%s\"", tasks[i]->taskName());
+      metrics.value("greenhouse_task_overruns_total", labels, tasks[i]->overruns());
+    }
+    metrics.family("greenhouse_task_run_max_seconds", "gauge", "Longest task wakeup since boot");
+    for (size_t i = 0; i < TASK_COUNT; i++)
+    {
+      snprintf(labels, sizeof(labels), "task=\"%s\"", tasks[i]->taskName());
+      metrics.value("greenhouse_task_run_max_seconds", labels, tasks[i]->maxRunMicros() * 1e-6);
+    }
+  }
+  else if (part < METRICS_TASK_LATE)
   {
-    Serial.println("MDNS responder started, accessible via esp32.local");
+    const ScheduledTask *task = tasks[part - METRICS_TASK_RUN];
+    if (part == METRICS_TASK_RUN)
+      metrics.family("greenhouse_task_run_seconds", "histogram", "Time spent in one task wakeup");
+    snprintf(labels, sizeof(labels), "task=\"%s\"", task->taskName());
+    metrics.histogram("greenhouse_task_run_seconds", labels, task->runMicros(), 1e-6, 2, 22); // 4us to ~4s
   }
-  delay(2000);
-  // The function timeClient.update() syncs the local time to the NTP server. In the video I call this in the main loop. However, NTP servers dont like it if
-  // they get pinged all the time, so I recommend to only re-sync to the NTP server occasionally. In this example code we only call this function once in the
-  // setup() and you will see that in the loop the local time is automatically updated. Of course the ESP/Arduino does not have an infinitely accurate clock,
-  // so if the exact time is very important you will need to re-sync once in a while.
-  updateAndSyncTime(); // anytime esp32 reconnects to wifi it will attempt to sync time
+  else if (part < METRICS_SECTIONS)
+  {
+    const ScheduledTask *task = tasks[part - METRICS_TASK_LATE];
+    if (part == METRICS_TASK_LATE)
+      metrics.family("greenhouse_task_wake_late_seconds", "histogram", "How far a task wakeup was behind its slot");
+    snprintf(labels, sizeof(labels), "task=\"%s\"", task->taskName());
+    metrics.histogram("greenhouse_task_wake_late_seconds", labels, task->lateMicros(), 1e-6, 4, 24); // 16us to ~16s
+  }
+  else
+  {
+    const TimedSection *section = timedSections[part - METRICS_SECTIONS];
+    if (part == METRICS_SECTIONS)
+      metrics.family("greenhouse_section_seconds", "histogram", "Time spent in an instrumented section");
+    metrics.histogram("greenhouse_section_seconds", section->labels, section->time, 1e-6, 2, 22);
+  }
+  return metrics.length();
 }
 
-void WiFiStationDisconnected(WiFiEvent_t event, WiFiEventInfo_t info)
-{
-  Serial.println("Disconnected from WiFi access point");
-  Serial.print("WiFi lost connection. Reason: ");
-  Serial.println(info.wifi_sta_disconnected.reason);
-  WiFi.disconnect(true);
-}
-void getDhtReadings()
+void takeSnapshot(StateSnapshot &state)
 {
-  h = dht.readHumidity();
-  f = dht.readTemperature(true); // true outputs in fahrenheit
-  if (isnan(h) || isnan(f))
+  // cached readings only, sensors are read on the sensing task
+  state.epoch = hal.epoch();
+  state.lastSync = lastNTPSync;
+  if (!hal.readClimate(state.temperature, state.humidity, state.heatIndex))
   {
-    Serial.println("Error: Failed to read from DHT sensor!");
+    state.temperature = state.humidity = state.heatIndex = NAN; // shown as --
   }
-  else
+  state.waterLevel = waterLevelText();
+  state.led = hal.pinRead(LED_PIN);
+  state.outputCount = outputs.size();
+  for (size_t i = 0; i < outputs.size(); i++)
   {
-    // Compute heat index in Fahrenheit
-    hif = dht.computeHeatIndex(f, h);
-    Serial.println((String) "Temperature: " + f + "F");
-    Serial.println((String) "Humidity: " + h + "%");
-    Serial.println((String) "Heat Index: " + hif + "F");
-    Serial.println(rtc.getTime());
-    // Send Events to the Web Client with the Sensor Readings
-    events.send(String(f).c_str(), "temperature", millis());
-    events.send(String(h).c_str(), "humidity", millis());
-    events.send(String(hif).c_str(), "heatIndex", millis());
+    OutputSnapshot &output = state.outputs[i];
+    output.id = outputs.config(i).id;
+    writeCommandText(output.command, sizeof(output.command), outputs[i], hal.epoch());
+    output.status = outputs[i].status;
+    output.alarm = outputs[i].alarm;
+    output.current = outputs[i].current;
+    output.health = pumpHealth[i].learned() ? pumpHealth[i].health() : NAN; // shown as learning
   }
 }
-void toggleAirPump()
+void onWifiChange(WifiState state, bool accessPoint)
 {
-  // if pump is overriden check timer
-  if (airPumpOverride)
+  // called from checkWifi on the network task
+  static bool mdnsStarted = false;
+  if (state == WIFI_CONNECTED)
   {
-    if (rtc.getEpoch() >= airPumpOverrideTimeEpochEnd and airPumpOverrideTimeEpochEnd != 0)
+    Serial.println((String) "Connected to " + wifi.ssid() + ", IP address: " + WiFi.localIP().toString());
+    // mdns responder for esp32.local
+    if (!mdnsStarted and MDNS.begin("esp32"))
     {
-      // timer elapsed, back to auto
-      setPumpAuto(AIR_PUMP_PIN);
+      mdnsStarted = true;
+      Serial.println("MDNS responder started, accessible via esp32.local");
     }
-    return;
+    timeService.syncSoon(); // anytime esp32 reconnects to wifi it will attempt to sync time
   }
-  // air pump will turn on for 15 minutes and then stay off for 15 minutes continuously
-  airPumpCommand = !airPumpCommand;
-  if (airPumpCommand)
+  else if (state == WIFI_CONNECTING)
   {
-    digitalWrite(AIR_PUMP_PIN, HIGH);
+    Serial.println((String) "Connecting to " + wifi.ssid());
   }
-  else
+  else if (state == WIFI_BACKOFF)
   {
-    digitalWrite(AIR_PUMP_PIN, LOW);
+    Serial.println((String) "No wifi network reachable, retrying in " + wifi.backoffMillis() / 1000 + " s");
+  }
+  else if (state == WIFI_SUSPENDED)
+  {
+    Serial.println("Wifi off until the next upload window");
   }
 }
-
-// for calling a function every interval
-unsigned long setInterval(void (*callback)(), unsigned long previousMillis, unsigned long interval)
+void publishClimate()
 {
-  if (millis() - previousMillis >= interval)
+  // the sensor is read on the dht task, this only looks at its cache
+  float f, h, hif;
+  ClimatePoll poll = controller.pollClimate(f, h, hif);
+  if (poll == CLIMATE_STALE)
   {
-    callback();
-    previousMillis += interval;
+    const char *error = dhtSensor.lastError();
+    Serial.println((String) "Error: No recent DHT reading, last error: " + (error ? error : "none"));
+    postEvent("--", "temperature");
+    postEvent("--", "humidity");
+    postEvent("--", "heatIndex");
   }
-  return previousMillis;
+  if (poll != CLIMATE_NEW)
+    return;
+  Serial.println((String) "Temperature: " + f + "F");
+  Serial.println((String) "Humidity: " + h + "%");
+  Serial.println((String) "Heat Index: " + hif + "F");
+  Serial.println(rtc.getTime());
+  // Send Events to the Web Client with the Sensor Readings
+  char value[16];
+  snprintf(value, sizeof(value), "%.1f", f);
+  postEvent(value, "temperature");
+  snprintf(value, sizeof(value), "%.1f", h);
+  postEvent(value, "humidity");
+  snprintf(value, sizeof(value), "%.1f", hif);
+  postEvent(value, "heatIndex");
+}
+void overridePump(size_t output, bool state, int time)
+{
+  outputs.setOverride(output, state, time, hal.epoch()); // time in minutes
+  sendCommandEvent(output);
 }
-void overridePump(int pump_pin, int state, int time)
+void setPumpAuto(size_t output)
 {
-  if (pump_pin == WATER_PUMP_1_PIN)
+  outputs.setAuto(output, hal.epoch());
+  sendCommandEvent(output);
+}
+void controlPumps(unsigned long epoch)
+{
+  if (scheduleChanged)
   {
-    pump1Override = true;
-    pump1Command = state ? true : false;
-    if (time > 60)
-    {
-      // permanent override
-      pump1OverrideTimeEpochEnd = 0;
-    }
-    else
-    {
-      pump1OverrideTimeEpochEnd = rtc.getEpoch() + (time * 60); // time in minutes to seconds
-    }
+    // new schedule saved from the web page
+    scheduleChanged = false;
+    loadSchedule();
   }
-  else if (pump_pin == WATER_PUMP_2_PIN)
+  // roles move off failed pumps before the auto outputs follow their schedule edges, expired overrides go back to auto
+  uint32_t backToAuto = controller.control(epoch);
+  for (size_t i = 0; i < outputs.size(); i++)
   {
-    pump2Override = true;
-    pump2Command = state ? true : false;
-    if (time > 60)
+    OutputState &output = outputs[i];
+    if (backToAuto & (1UL << i))
     {
-      // permanent override
-      pump2OverrideTimeEpochEnd = 0;
+      sendCommandEvent(i);
     }
-    else
+    else if (output.override)
     {
-      pump2OverrideTimeEpochEnd = rtc.getEpoch() + (time * 60); // time in minutes to seconds
+      // output is in override for set duration (set by user from webpage), update web page every minute
+      if (epoch % 60 == 0)
+      {
+        if (!output.statusUpdated and output.overrideEnd != 0)
+        {
+          sendCommandEvent(i);
+          output.statusUpdated = true;
+        }
+      }
+      else
+        output.statusUpdated = false;
     }
   }
-  else
+}
+void writeOutputPin(uint8_t pin, bool on)
+{
+  // only the shadow register, the pins are written by driveOutputs
+  outputDriver.set(pin, on);
+}
+void writeOutputRegister(uint32_t setMask, uint32_t clearMask)
+{
+  hal.writePins(setMask, clearMask);
+}
+void driveOutputs()
+{
+  if (safeState)
   {
-    airPumpOverride = true;
-    airPumpCommand = state ? true : false;
-    if (time > 60)
-    {
-      // permanent override
-      airPumpOverrideTimeEpochEnd = 0;
-    }
-    else
-    {
-      airPumpOverrideTimeEpochEnd = rtc.getEpoch() + (time * 60); // time in minutes to seconds
-    }
+    // back from a stall the guard cut the relays on, the driver no longer knows what the pins are
+    Serial.println("Control task was stalled, restarting");
+    Serial.flush();
+    ESP.restart();
   }
-  digitalWrite(pump_pin, state);
+  outputDriver.apply(hal.millis(), hal.epoch());
 }
-void setPumpAuto(int pump_pin)
+void onRoleMoved(size_t role, size_t from, size_t to, FailoverReason why)
 {
-  int currentHour = rtc.getHour(true); // current time
-  if (pump_pin == WATER_PUMP_1_PIN)
+  const char *reasons[] = {"failed", "wear balancing", "back home"};
+  Serial.println((String)outputs.config(to).name + " runs the schedule of " + outputs.config(role).name + " instead of " + outputs.config(from).name +
+                 " (" + reasons[why] + ")");
+}
+void guardControl(void *arg)
+{
+  // on core 0 above everything there, a control task spinning on core 1 cannot hold it off. Wakeups
+  // are counted, a light sleep stops both cores so the count standing still then is no stall
+  StallGuard guard(CONTROL_STALL_MS, STALL_CHECK_MS);
+  uint32_t relayMask = 0;
+  for (size_t i = 0; i < outputs.size(); i++)
   {
-    if (currentHour >= 6 and currentHour < 12)
-    {
-      pump1Command = true;
-      digitalWrite(WATER_PUMP_1_PIN, HIGH);
-    }
-    else
-    {
-      pump1Command = false;
-      digitalWrite(WATER_PUMP_1_PIN, LOW);
-    }
-
-    pump1Override = false;
-    pump1OverrideTimeEpochEnd = 0;
-    // Send Events to the Web Client with the Sensor Readings
-    String command = (pump1Command) ? " On " : " Off ";
-    String pumpCommand = command + "(Auto)";
-    events.send(pumpCommand.c_str(), "pump1Command", millis());
+    relayMask |= 1UL << outputs.config(i).pin;
   }
-  else if (pump_pin == WATER_PUMP_2_PIN)
+  for (;;)
   {
-    if (currentHour >= 12 and currentHour < 18)
+    if (guard.check(controlTask.wakeupCount(), powerSleeping))
     {
-      pump2Command = true;
-      digitalWrite(WATER_PUMP_2_PIN, HIGH);
+      // the register write only clears bits, it is safe next to anything the control task is doing
+      hal.writePins(0, relayMask);
+      safeState = true;
+      Serial.println("Control task stalled, relays off");
     }
-    else
-    {
-      pump2Command = false;
-      digitalWrite(WATER_PUMP_2_PIN, LOW);
-    }
-    pump2Override = false;
-    pump2OverrideTimeEpochEnd = 0;
-    // Send Events to the Web Client with the Sensor Readings
-    String command = (pump2Command) ? " On " : " Off ";
-    String pumpCommand = command + "(Auto)";
-    events.send(pumpCommand.c_str(), "pump2Command", millis());
+    vTaskDelay(pdMS_TO_TICKS(STALL_CHECK_MS));
   }
-  else
+}
+const char *waterLevelText()
+{
+  switch (controller.waterLevel())
   {
-    airPumpCommand = true;
-    digitalWrite(AIR_PUMP_PIN, HIGH); // switching back to auto will just turn it on, it'll go back to 15 min on/off
-    airPumpOverride = false;
-    airPumpOverrideTimeEpochEnd = 0;
-    // Send Events to the Web Client with the Sensor Readings
-    String pumpCommand = "On (Auto)";
-    events.send(pumpCommand.c_str(), "airPumpCommand", millis());
+  case W_LOW:
+    return "Low";
+  case W_MED:
+    return "Medium";
+  case W_HIGH:
+    return "High";
+  default:
+    return "Fault";
   }
 }
-void controlPumps(int currentHour, int currentMin)
+void sendCommandEvent(size_t output)
 {
-  if (!pump1Override)
-  { // auto mode
-    // Run water pump 1 from 6am to 12pm continuously.  The other 12 hours, the pump will run for 1 min on the hour
-    if (currentHour >= 6 and currentHour < 12)
-    {
-      digitalWrite(WATER_PUMP_1_PIN, HIGH);
-      pump1Command = true;
-      if (pump1Alarm)
-      {
-        // pump1 is in alarm mode, run pump2
-        digitalWrite(WATER_PUMP_2_PIN, HIGH);
-        pump2Command = true;
-      }
-      else
-      {
-        digitalWrite(WATER_PUMP_2_PIN, LOW);
-        pump2Command = false;
-      }
-    }
-    else if (currentMin == 0)
-      digitalWrite(WATER_PUMP_1_PIN, HIGH);
-    else
-      digitalWrite(WATER_PUMP_1_PIN, LOW);
+  char event[24];
+  char text[32];
+  snprintf(event, sizeof(event), "%sCommand", outputs.config(output).id);
+  writeCommandText(text, sizeof(text), outputs[output], hal.epoch());
+  postEvent(text, event);
+}
+bool parseSchedule(const char *json, size_t length, OutputSchedule *schedules, const float *pulseScales)
+{
+  static ScheduleWorkspace work; // setup and the control task, the web server has its own
+  const char *error = compileSchedule(json, length, boardOutputs, OUTPUT_COUNT, schedules, work, pulseScales);
+  if (error)
+  {
+    Serial.println((String) "Error: Schedule " + error);
+    return false;
   }
-  else
-  { // pump in hand
-    // pump1 is in override for set duration (set by user from webpage)
-
-    // update web page every minute
-    if (rtc.getSecond() == 0)
-    {
-      if (!pump1StatusUpdated and pump1OverrideTimeEpochEnd != 0)
-      {
-        // Send Events to the Web Client with the Sensor Readings
-        String command = (pump1Command) ? "On " : "Off ";
-        String timeLeft = command + "(Override " + String((pump1OverrideTimeEpochEnd - rtc.getEpoch()) / 60) + " min)";
-        events.send(timeLeft.c_str(), "pump1Command", millis());
-        pump1StatusUpdated = true;
-      }
-    }
-    else
-      pump1StatusUpdated = false;
-    // if pump1OverrideTimeEpochEnd is 0 and pump is in override, then override is permanent
-    if (rtc.getEpoch() >= pump1OverrideTimeEpochEnd and pump1OverrideTimeEpochEnd != 0)
-    {
-      setPumpAuto(WATER_PUMP_1_PIN);
-    }
+  return true;
+}
+void loadSchedule()
+{
+  size_t length = 0;
+  File file = SPIFFS.open("/schedule.json", FILE_READ);
+  if (file)
+  {
+    length = file.read((uint8_t *)scheduleText, sizeof(scheduleText));
+    file.close();
   }
-  /* ----------------------------- WATER PUMP 2 -----------------------------------------*/
-  if (!pump2Override)
-  { // auto mode
-    // Run water pump 2 from 12pm to 6pm continuously.  The other 12 hours, the pump will run for 1 min on the half hour
-    if (currentHour >= 12 and currentHour < 18)
-    {
-      digitalWrite(WATER_PUMP_2_PIN, HIGH);
-      pump2Command = true;
-    }
-    else if (currentMin == 30)
-      digitalWrite(WATER_PUMP_2_PIN, HIGH);
-    else
-      digitalWrite(WATER_PUMP_2_PIN, LOW);
+  static OutputSchedule loaded[outputs.size()];
+  if (length == 0 or !parseSchedule(scheduleText, length, loaded))
+  {
+    Serial.println("Using default pump schedule");
+    length = strlcpy(scheduleText, DEFAULT_SCHEDULE, sizeof(scheduleText));
+    parseSchedule(scheduleText, length, loaded);
   }
-  else
-  { // pump in hand
-    // pump2 is in override for set duration (set by user from webpage)
-
-    // update web page every minute
-    if (rtc.getSecond() == 0)
-    {
-      if (!pump2StatusUpdated and pump2OverrideTimeEpochEnd != 0)
-      {
-        // Send Events to the Web Client with the Sensor Readings
-        String command = (pump2Command) ? "On " : "Off ";
-        String timeLeft = command + "(Override " + String((pump2OverrideTimeEpochEnd - rtc.getEpoch()) / 60) + " min)";
-        events.send(timeLeft.c_str(), "pump2Command", millis());
-        pump2StatusUpdated = true;
-      }
-    }
-    else
-      pump2StatusUpdated = false;
-    // if pump2OverrideTimeEpochEnd is 0 and pump is in override, then override is permanent
-    if (rtc.getEpoch() >= pump2OverrideTimeEpochEnd and pump2OverrideTimeEpochEnd != 0)
-    {
-      setPumpAuto(WATER_PUMP_2_PIN);
-    }
+  scheduleLength = length;
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    outputs.schedule(i) = loaded[i];
+  }
+  outputs.reschedule();
+  applySchedule();
+}
+void applySchedule()
+{
+  // the pulses follow the climate, the windows stay as written
+  float scales[outputs.size()];
+  bool scaled = false;
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    scales[i] = climate.scale(outputs.config(i).climate);
+    scaled = scaled or scales[i] != 1;
+  }
+  static OutputSchedule compiled[outputs.size()];
+  if (!parseSchedule(scheduleText, scheduleLength, compiled, scaled ? scales : NULL))
+    return; // too dense to scale, the tables in use stay
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    outputs.schedule(i) = compiled[i];
   }
+  outputs.reschedule();
+}
+void adaptSchedule()
+{
+  // the DHT reading is cached, the reservoir level comes from the sensing task (32 bit reads)
+  if (!controller.followClimate(climate, climateBounds()))
+    return;
+  Serial.println((String) "Climate: heat index " + climate.projected() + "F in an hour, irrigation x" + climate.scale(CLIMATE_IRRIGATION) + ", aeration x" +
+                 climate.scale(CLIMATE_AERATION));
+  applySchedule();
+}
+ClimateBounds climateBounds()
+{
+  return {settings.climateControl == 1, settings.climateCoolF, settings.climateHotF, settings.climateMinScale, settings.climateMaxScale};
 }
 void updatePumpStatuses()
 {
-  // Send Events to the Web Client with the pump statuses (every 10 seconds)
-  String p1String = (pump1Status) ? "<span class = \"status online\"></ span>" : "<span class=\" status offline \"></span> ";
-  String p2String = (pump2Status) ? "<span class = \"status online\"></ span>" : "<span class=\" status offline \"></span> ";
-  String airPString = (airPumpStatus) ? "<span class = \"status online\"></ span>" : "<span class=\" status offline \"></span> ";
-  events.send(p1String.c_str(), "pump1Status", millis());
-  events.send(p2String.c_str(), "pump2Status", millis());
-  events.send(airPString.c_str(), "airPumpStatus", millis());
+  // Send Events to the Web Client with the pump statuses, unchanged ones are not published
+  char event[24];
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    snprintf(event, sizeof(event), "%sStatus", outputs.config(i).id);
+    postEvent(outputs[i].status ? "1" : "0", event);
+    char health[12] = "learning";
+    if (pumpHealth[i].learned())
+      snprintf(health, sizeof(health), "%.0f%%", pumpHealth[i].health());
+    snprintf(event, sizeof(event), "%sHealth", outputs.config(i).id);
+    postEvent(health, event);
+  }
+}
+void recordHistory()
+{
+  uint32_t epoch = hal.epoch();
+  if (epoch < MIN_VALID_EPOCH)
+    return; // no point keeping history against an unset clock
+  float f, h, hif;
+  if (hal.readClimate(f, h, hif))
+  {
+    history.record(HISTORY_TEMPERATURE, epoch, f);
+    history.record(HISTORY_HUMIDITY, epoch, h);
+    history.record(HISTORY_HEAT_INDEX, epoch, hif);
+  }
+  if (controller.waterLevel() != W_FAULT)
+  {
+    history.record(HISTORY_WATER_DISTANCE, epoch, controller.waterDistance());
+  }
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    history.record(HISTORY_CURRENT + i, epoch, outputs[i].current);
+  }
 }
-void checkPumpAlarms()
+void flushHistory()
 {
-  if (pump1Command != pump1Status)
+  uint32_t start = micros();
+  history.flush();
+  historyFlush.time.record(micros() - start);
+}
+void feedPumpAlarms()
+{
+  controller.feedPumpAlarms();
+}
+void serviceAlarms()
+{
+  uint32_t now = millis();
+  uint32_t epoch = hal.epoch();
+  AlarmInput input;
+  while (xQueueReceive(alarmInputQueue, &input, 0) == pdTRUE)
   {
-    if (pump1AlarmTimeEpochEnd == 0)
+    if (input.alarm >= alarms.size())
+      continue;
+    if (input.acknowledge)
     {
-      // first instance of mismatch, start timer if not already in alarm
-      if (!pump1Alarm)
-      {
-        pump1AlarmTimeEpochEnd = rtc.getEpoch() + 60; // 1 minute timer
-        Serial.println("Starting pump1 alarm timer");
-      }
+      alarms.acknowledge(input.alarm, now, epoch);
     }
     else
     {
-      if (rtc.getEpoch() >= pump1AlarmTimeEpochEnd)
-      {
-        // set alarm
-        pump1Alarm = true;
-        pump1AlarmTimeEpochEnd = 0;
-        String p1Alarm = "<i class = \"fas fa-bell\" style = \"color:#c81919;\"></ i> Water Pump 1";
-        events.send(p1Alarm.c_str(), "waterPump1Header", millis());
-        Serial.println("Pump1 alarm active");
-      }
+      alarms.setInput(input.alarm, input.condition, now, epoch);
     }
   }
-  else
+  // nothing to evaluate until the next delay on/off timer is due
+  if (alarms.dueIn(now) <= 0)
   {
-    // reset alarm
-    // as soon as status matches, clear timer
-    pump1AlarmTimeEpochEnd = 0;
-    if (pump1Alarm)
-    {
-      pump1Alarm = false;
-      String p1 = "Water Pump 1";
-      events.send(p1.c_str(), "waterPump1Header", millis());
-      Serial.println("Pump1 alarm cleared");
-    }
+    alarms.update(now, epoch);
   }
-  // check pump2
-  if (pump2Command != pump2Status)
+}
+void postAlarmInput(uint8_t alarm, bool condition)
+{
+  AlarmInput input = {alarm, condition, false};
+  if (xQueueSend(alarmInputQueue, &input, 0) != pdTRUE)
   {
-    if (pump2AlarmTimeEpochEnd == 0)
-    {
-      // first instance of mismatch, start timer if not already in alarm
-      if (!pump2Alarm)
-      {
-        pump2AlarmTimeEpochEnd = rtc.getEpoch() + 60; // 1 minute timer
-        Serial.println("Starting pump2 alarm timer");
-      }
-    }
-    else
+    Serial.println("Error: Alarm input queue full!");
+  }
+}
+void onAlarmEvent(const AlarmEvent &event)
+{
+  const char *name = alarms.config(event.alarm).name;
+  bool active = alarms.active(event.alarm);
+  if (event.alarm < outputs.size())
+  {
+    // pump alarms flag the pump card, the failover supervisor has already moved its schedule
+    outputs[event.alarm].alarm = active;
+    char field[24];
+    snprintf(field, sizeof(field), "%sAlarm", outputs.config(event.alarm).id);
+    postEvent(active ? "1" : "0", field);
+  }
+  const char *types[] = {"active", "cleared", "acknowledged"};
+  Serial.println((String)name + " alarm " + types[event.type]);
+  char count[12];
+  snprintf(count, sizeof(count), "%u", ++alarmEventCount);
+  postEvent(count, "alarms"); // web page reloads /alarms
+  saveAlarmEvent(event);
+}
+void captureState(RuntimeState &state)
+{
+  memset(&state, 0, sizeof(state));
+  state.epoch = hal.epoch();
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    if (outputs[i].override)
     {
-      if (rtc.getEpoch() >= pump2AlarmTimeEpochEnd)
-      {
-        // set alarm
-        pump2Alarm = true;
-        pump2AlarmTimeEpochEnd = 0;
-        String p2Alarm = "<i class = \"fas fa-bell\" style = \"color:#c81919;\"></ i> Water Pump 2";
-        events.send(p2Alarm.c_str(), "waterPump2Header", millis());
-        Serial.println("Pump2 alarm active");
-      }
+      state.overrides |= 1UL << i;
+      state.overrideOn |= (uint32_t)outputs[i].command << i;
+      state.overrideEnd[i] = outputs[i].overrideEnd;
     }
   }
-  else
+  for (size_t i = 0; i < alarms.size(); i++)
+  {
+    state.alarmsActive |= (uint32_t)alarms.active(i) << i;
+    state.alarmsAcknowledged |= (uint32_t)alarms.acknowledged(i) << i;
+  }
+}
+void saveRuntimeState()
+{
+  // the journal skips unchanged states itself, a failed write is retried next time
+  RuntimeState state;
+  captureState(state);
+  static bool failed = false;
+  bool saved = journal.append(state);
+  if (saved == failed)
   {
-    // reset alarm
-    // as soon as status matches, clear timer
-    pump2AlarmTimeEpochEnd = 0;
-    if (pump2Alarm)
+    failed = !saved;
+    Serial.println(saved ? "State journal writable again" : "Error: Could not write the state journal");
+  }
+  if (!intactRecord(warmState) or !sameState(state, warmState.state))
+  {
+    sealRecord(warmState, state, journal.sequence());
+  }
+}
+void restoreRuntimeState()
+{
+  RuntimeState state;
+  bool fromFlash = journalStorage.begin() and journal.recover(state);
+  // RTC memory is random after power on, the crc would almost always tell anyway
+  bool warm = esp_reset_reason() != ESP_RST_POWERON and intactRecord(warmState) and (!fromFlash or warmState.sequence >= journal.sequence());
+  if (warm)
+  {
+    state = warmState.state;
+  }
+  else if (!fromFlash)
+  {
+    Serial.println("No saved runtime state");
+    return;
+  }
+  uint32_t epoch = hal.epoch();
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    if (!(state.overrides >> i & 1))
+      continue;
+    // an unset clock keeps the override until NTP sets it, then the time off counts as well
+    uint32_t end = state.overrideEnd[i];
+    outputs.restoreOverride(i, state.overrideOn >> i & 1, end);
+    Serial.println((String) outputs.config(i).name + " override restored, " + (end == 0 ? String("permanent") : String(end > epoch ? (end - epoch) / 60 : 0) + " min left"));
+  }
+  for (size_t i = 0; i < alarms.size(); i++)
+  {
+    if (!(state.alarmsActive >> i & 1))
+      continue;
+    alarms.restore(i, state.alarmsAcknowledged >> i & 1);
+    if (i < outputs.size())
     {
-      pump2Alarm = false;
-      String p2 = "Water Pump 2";
-      events.send(p2.c_str(), "waterPump2Header", millis());
-      Serial.println("Pump2 alarm cleared");
+      outputs[i].alarm = true;
+      controller.restoreMismatch(i);
     }
   }
-  // check air pump
-  if (airPumpCommand != airPumpStatus)
+  Serial.println((String) "Runtime state " + (warm ? warmState.sequence : journal.sequence()) + " restored from " + (warm ? "RTC memory" : "flash"));
+}
+TankGeometry tankGeometry()
+{
+  return {settings.tankDepthCm, settings.tankLengthCm, settings.tankWidthCm, settings.tankDiameterCm};
+}
+void configureCurrentChannels()
+{
+  float voltsPerCount = hal.currentVoltsPerCount();
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    // x2 for the voltage divider in front of the ADC
+    currentChannels[i].configure(voltsPerCount > 0 ? voltsPerCount : outputs.config(i).adcReference / 4095, settings.mvPerAmp / 2);
+  }
+}
+// calibration file: magic, then what each channel learned, in output order, then the pump
+// health baselines and the failover run seconds (missing in files from before them, those
+// pumps learn from scratch and start from no wear)
+void loadCalibration()
+{
+  File file = SPIFFS.open(CALIBRATION_FILE, FILE_READ);
+  if (!file)
+    return;
+  uint32_t magic = 0;
+  ChannelLearned learned;
+  if (file.read((uint8_t *)&magic, sizeof(magic)) == sizeof(magic) and magic == CALIBRATION_FILE_MAGIC)
   {
-    if (airPumpAlarmTimeEpochEnd == 0)
+    for (size_t i = 0; i < outputs.size() and file.read((uint8_t *)&learned, sizeof(learned)) == sizeof(learned); i++)
     {
-      // first instance of mismatch, start timer if not already in alarm
-      if (!airPumpAlarm)
-      {
-        airPumpAlarmTimeEpochEnd = rtc.getEpoch() + 60; // 1 minute timer
-        Serial.println("Starting air pump alarm timer");
-      }
+      currentChannels[i].restore(learned);
+      Serial.println((String) outputs.config(i).name + " current zero " + currentChannels[i].zeroCounts() + " counts, nominal " + currentChannels[i].nominal() + " A");
     }
-    else
+    PumpBaseline baseline;
+    for (size_t i = 0; i < outputs.size() and file.read((uint8_t *)&baseline, sizeof(baseline)) == sizeof(baseline); i++)
     {
-      if (rtc.getEpoch() >= airPumpAlarmTimeEpochEnd)
-      {
-        // set alarm
-        airPumpAlarm = true;
-        airPumpAlarmTimeEpochEnd = 0;
-        String airPumpAlarm = "<i class = \"fas fa-bell\" style = \"color:#c81919;\"></ i> Air Pump";
-        events.send(airPumpAlarm.c_str(), "airPumpHeader", millis());
-        Serial.println("Air pump alarm active");
-      }
+      pumpHealth[i].restore(baseline);
+    }
+    uint32_t runSeconds;
+    for (size_t i = 0; i < outputs.size() and file.read((uint8_t *)&runSeconds, sizeof(runSeconds)) == sizeof(runSeconds); i++)
+    {
+      failover.restoreRunSeconds(i, runSeconds);
     }
   }
-  else
+  file.close();
+}
+void saveCalibration()
+{
+  File file = SPIFFS.open(CALIBRATION_FILE, FILE_WRITE);
+  if (!file)
+    return;
+  uint32_t magic = CALIBRATION_FILE_MAGIC;
+  file.write((const uint8_t *)&magic, sizeof(magic));
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    ChannelLearned learned = currentChannels[i].state(); // copied while the control task updates it, one window off at worst
+    file.write((const uint8_t *)&learned, sizeof(learned));
+  }
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    PumpBaseline baseline = pumpHealth[i].state(); // same, one capture off at worst
+    file.write((const uint8_t *)&baseline, sizeof(baseline));
+  }
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    uint32_t runSeconds = failover.runSeconds(i);
+    file.write((const uint8_t *)&runSeconds, sizeof(runSeconds));
+  }
+  file.close();
+}
+// alarm history file: header followed by ALARM_HISTORY_SIZE fixed-size records
+#define ALARM_FILE "/alarms.bin"
+#define ALARM_FILE_MAGIC 0x414c524d
+struct AlarmFileHeader
+{
+  uint32_t magic;
+  uint16_t head;
+  uint16_t count;
+};
+void loadAlarmHistory()
+{
+  static AlarmEvent saved[ALARM_HISTORY_SIZE];
+  AlarmFileHeader header = {0, 0, 0};
+  File file = SPIFFS.open(ALARM_FILE, FILE_READ);
+  if (file)
   {
-    // reset alarm
-    // as soon as status matches, clear timer
-    airPumpAlarmTimeEpochEnd = 0;
-    if (airPumpAlarm)
+    file.read((uint8_t *)&header, sizeof(header));
+    if (header.magic == ALARM_FILE_MAGIC and file.read((uint8_t *)saved, sizeof(saved)) == sizeof(saved))
     {
-      airPumpAlarm = false;
-      String p = "Air Pump";
-      events.send(p.c_str(), "airPumpHeader", millis());
-      Serial.println("Air Pump alarm cleared");
+      alarms.history().restore(saved, header.head, header.count);
+      file.close();
+      return;
     }
+    file.close();
+  }
+  // no (valid) history yet, create the file at its full size so events are written in place
+  header = {ALARM_FILE_MAGIC, 0, 0};
+  memset(saved, 0, sizeof(saved));
+  file = SPIFFS.open(ALARM_FILE, FILE_WRITE);
+  file.write((const uint8_t *)&header, sizeof(header));
+  file.write((const uint8_t *)saved, sizeof(saved));
+  file.close();
+}
+void saveAlarmEvent(const AlarmEvent &event)
+{
+  AlarmHistory &history = alarms.history();
+  uint16_t slot = (history.nextSlot() + ALARM_HISTORY_SIZE - 1) % ALARM_HISTORY_SIZE;
+  AlarmFileHeader header = {ALARM_FILE_MAGIC, history.nextSlot(), history.size()};
+  // only the new record and the header are rewritten
+  File file = SPIFFS.open(ALARM_FILE, "r+");
+  if (!file)
+    return;
+  file.seek(sizeof(header) + slot * sizeof(AlarmEvent));
+  file.write((const uint8_t *)&event, sizeof(event));
+  file.seek(0);
+  file.write((const uint8_t *)&header, sizeof(header));
+  file.close();
+}
+void managePower()
+{
+  // the budget runs up to now at the state the last plan chose, a light sleep included
+  uint32_t now = millis();
+  uint8_t relays = 0;
+  float amps = 0;
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    relays += outputDriver.driven(outputs.config(i).pin);
+    amps += outputs[i].current;
+  }
+  energy.account(powerPlan.state, !wifi.suspended(), relays, amps, now - powerAccounted);
+  powerAccounted = now;
+  PowerPlan plan = planWakeup(now);
+  if (settings.lowPower == 0 or hal.epoch() < MIN_VALID_EPOCH)
+  {
+    plan.state = POWER_ACTIVE;
+    plan.sleepMs = 0;
+  }
+  if (plan.state != powerPlan.state and (plan.state == POWER_ACTIVE or powerPlan.state == POWER_ACTIVE))
+  {
+    // sampling only runs while a relay may be on, the planner is busy ahead of every edge
+    setCpuFrequencyMhz(plan.state == POWER_ACTIVE ? CPU_FULL_MHZ : CPU_IDLE_MHZ);
+    currentSensor.pause(plan.state != POWER_ACTIVE);
+  }
+  powerPlan = plan;
+  if (settings.lowPower)
+  {
+    dhtSensor.catchUp(now);
+  }
+  if (plan.state == POWER_SLEEP)
+  {
+    lightSleep(plan.sleepMs);
+  }
+}
+
+PowerPlan planWakeup(uint32_t now)
+{
+  // alarms, wifi and the sensors belong to other tasks, only single words of theirs are read
+  TaskDeadlines deadlines;
+  deadlines.alarmMs = alarms.dueIn(now);
+  deadlines.alarmInputs = uxQueueMessagesWaiting(alarmInputQueue) != 0;
+  deadlines.waterMs = sensingTask.jobDueIn(getWaterLevel, now);
+  deadlines.historyMs = sensingTask.jobDueIn(recordHistory, now);
+  deadlines.flushMs = sensingTask.jobDueIn(flushHistory, now);
+  deadlines.telemetryMs = (MQTT_HOST[0] != '\0') ? (int32_t)(lastMqttSample + MQTT_SAMPLE_INTERVAL - now) : NO_TASK_DEADLINE;
+  deadlines.radioUp = !wifi.suspended();
+  return controller.planWakeup(now, deadlines);
+}
+
+void lightSleep(uint32_t ms)
+{
+  // the timer is the only wakeup, the relays are all off and held there
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    gpio_hold_en((gpio_num_t)outputs.config(i).pin);
+  }
+  Serial.flush();
+  esp_sleep_enable_timer_wakeup(ms * 1000ULL);
+  powerSleeping = true;
+  esp_light_sleep_start();
+  powerSleeping = false;
+  for (size_t i = 0; i < outputs.size(); i++)
+  {
+    gpio_hold_dis((gpio_num_t)outputs.config(i).pin);
+  }
+  powerSleeps++;
+  for (size_t i = 0; i < TASK_COUNT; i++)
+  {
+    tasks[i]->restartSlots();
   }
 }
+
 void getWaterLevel()
 {
-  // read ultrasonic sound sensor and output distance
-  digitalWrite(ULTRASONIC_TRIG_PIN, LOW);
-  delayMicroseconds(2);
-  digitalWrite(ULTRASONIC_TRIG_PIN, HIGH);
-  delayMicroseconds(10);
-  digitalWrite(ULTRASONIC_TRIG_PIN, LOW);
-  duration = pulseIn(ULTRASONIC_ECHO_PIN, HIGH);
-  distanceCm = duration * SOUND_SPEED / 2;
-  if (distanceCm > 20)
+  // kick off a multi-ping reading, echoes are timed by interrupt so the loop keeps running
+  hal.startDistance();
+}
+void pollUltrasonic()
+{
+  // ultrasonic pings run in the background, process once all pings are in
+  if (hal.distanceReady())
   {
-    waterLevel = W_LOW;
+    processWaterLevel();
   }
-  else if (distanceCm > 10)
+}
+void processWaterLevel()
+{
+  WaterReading reading = controller.readWaterLevel();
+  if (reading == WATER_NO_ECHO)
   {
-    waterLevel = W_MED;
+    Serial.println("Error: No echo from ultrasonic sensor!");
+    postEvent("Fault", "waterLevel");
+    return;
   }
-  else
+  if (reading == WATER_STRAY)
   {
-    waterLevel = W_HIGH;
+    Serial.println((String) "Water level reading " + waterEstimator.rawDistance() + " cm ignored, too far from " + controller.waterDistance() + " cm");
+    return;
   }
-  String waterLevelString = (waterLevel == W_LOW) ? "Low" : (waterLevel == W_MED) ? "Medium"
-                                                                                  : "High";
-  events.send(waterLevelString.c_str(), "waterLevel", millis());
-}
\ No newline at end of file
+  postEvent(waterLevelText(), "waterLevel");
+}
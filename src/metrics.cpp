@@ -0,0 +1,82 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "metrics.h"
+
+void MetricsWriter::print(const char *format, ...)
+{
+  if (overflow)
+    return;
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(out + used, size - used, format, args);
+  va_end(args);
+  if (n < 0 or (size_t)n >= size - used)
+  {
+    overflow = true;
+    return;
+  }
+  used += n;
+}
+
+void MetricsWriter::family(const char *name, const char *type, const char *help)
+{
+  print("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void MetricsWriter::sample(const char *name, const char *suffix, const char *labels, const char *le, double value)
+{
+  bool hasLabels = labels != NULL and labels[0] != '\0';
+  if (le != NULL)
+    print("%s%s{%s%sle=\"%s\"} %.9g\n", name, suffix, hasLabels ? labels : "", hasLabels ? "," : "", le, value);
+  else if (hasLabels)
+    print("%s%s{%s} %.9g\n", name, suffix, labels, value);
+  else
+    print("%s%s %.9g\n", name, suffix, value);
+}
+
+void MetricsWriter::value(const char *name, const char *labels, double value)
+{
+  sample(name, "", labels, NULL, value);
+}
+
+void MetricsWriter::histogram(const char *name, const char *labels, const Histogram &histogram, double unitSeconds, uint8_t firstOctave, uint8_t lastOctave)
+{
+  // buckets are read once, so the cumulative counts and the total agree even
+  // while the owning task keeps recording
+  uint32_t cumulative = 0;
+  uint8_t bucket = 0;
+  char le[16];
+  for (uint8_t octave = firstOctave; octave <= lastOctave and octave < 32; octave += 2)
+  {
+    uint8_t limit = Histogram::bucketOf(1UL << octave);
+    for (; bucket < limit; bucket++)
+      cumulative += histogram.bucketCount(bucket);
+    snprintf(le, sizeof(le), "%.3g", (double)(1UL << octave) * unitSeconds);
+    sample(name, "_bucket", labels, le, cumulative);
+  }
+  for (; bucket < HISTOGRAM_BUCKETS; bucket++)
+    cumulative += histogram.bucketCount(bucket);
+  sample(name, "_bucket", labels, "+Inf", cumulative);
+  sample(name, "_sum", labels, NULL, histogram.sum() * unitSeconds);
+  sample(name, "_count", labels, NULL, cumulative);
+}
+
+size_t MetricsReader::read(uint8_t *buffer, size_t maxLen)
+{
+  while (sent == length)
+  {
+    if (next >= parts)
+      return 0;
+    sent = 0;
+    length = render(next, text, sizeof(text));
+    if (length == 0)
+      length = snprintf(text, sizeof(text), "# part %u does not fit METRICS_PART_SIZE\n", next);
+    next++;
+  }
+  size_t n = (length - sent < maxLen) ? length - sent : maxLen;
+  memcpy(buffer, text + sent, n);
+  sent += n;
+  return n;
+}
@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "mqttClient.h"
+
+void MqttClient::begin(const char *brokerHost, uint16_t brokerPort, const char *id, const char *brokerUser, const char *brokerPassword,
+                       const char *subscribeTo, const char *status)
+{
+  host = brokerHost;
+  port = brokerPort;
+  clientId = id;
+  user = brokerUser;
+  password = brokerPassword;
+  subscription = subscribeTo;
+  statusTopic = status;
+}
+
+void MqttClient::update(uint32_t nowMs, bool network)
+{
+  now = nowMs;
+  if (current != MQTT_OFFLINE and (!network or !transport.connected()))
+    drop(nowMs);
+  if (current == MQTT_OFFLINE)
+  {
+    if (network and host and nowMs - since >= backoff)
+      connect(nowMs);
+    return;
+  }
+  // take in whatever arrived, one packet at a time
+  size_t n = transport.read(rx + rxLength, sizeof(rx) - rxLength);
+  rxLength += n;
+  for (;;)
+  {
+    MqttPacket packet;
+    int used = mqttFrame(rx, rxLength, packet);
+    if (used == 0 and rxLength == sizeof(rx))
+      used = -1; // larger than we can take
+    if (used < 0)
+    {
+      drop(nowMs);
+      return;
+    }
+    if (used == 0)
+      break;
+    lastHeard = nowMs;
+    handle(packet, nowMs);
+    if (current == MQTT_OFFLINE)
+      return;
+    memmove(rx, rx + used, rxLength - used);
+    rxLength -= used;
+  }
+  if (current == MQTT_CONNECTING)
+  {
+    if (nowMs - since >= MQTT_CONNECT_TIMEOUT)
+      drop(nowMs);
+    return;
+  }
+  if (pendingId and nowMs - pendingSince >= MQTT_ACK_TIMEOUT)
+  {
+    drop(nowMs);
+    return;
+  }
+  if (nowMs - lastHeard >= MQTT_KEEP_ALIVE * 1500UL)
+  {
+    drop(nowMs); // broker gone without closing the socket
+    return;
+  }
+  if (nowMs - lastSent >= MQTT_KEEP_ALIVE * 500UL)
+    send(tx, mqttEmpty(tx, sizeof(tx), MQTT_PINGREQ), nowMs);
+}
+
+void MqttClient::connect(uint32_t nowMs)
+{
+  rxLength = 0;
+  pendingId = 0;
+  acked = false;
+  since = nowMs;
+  if (!transport.open(host, port))
+  {
+    drop(nowMs);
+    return;
+  }
+  current = MQTT_CONNECTING;
+  lastHeard = nowMs;
+  send(tx, mqttConnect(tx, sizeof(tx), clientId, user, password, MQTT_KEEP_ALIVE, statusTopic), nowMs);
+}
+
+void MqttClient::drop(uint32_t nowMs)
+{
+  transport.close();
+  if (current != MQTT_ONLINE)
+    failureCount++;
+  // a broker that went away is tried again straight away, one that refuses us backs off
+  backoff = (current == MQTT_ONLINE) ? 0 : (backoff == 0) ? MQTT_RETRY_MIN : (backoff >= MQTT_RETRY_MAX / 2) ? MQTT_RETRY_MAX : backoff * 2;
+  current = MQTT_OFFLINE;
+  since = nowMs;
+  pendingId = 0;
+}
+
+bool MqttClient::send(const uint8_t *data, size_t length, uint32_t nowMs)
+{
+  if (length == 0 or transport.write(data, length) != length)
+    return false;
+  lastSent = nowMs;
+  return true;
+}
+
+void MqttClient::handle(const MqttPacket &packet, uint32_t nowMs)
+{
+  switch (packet.type)
+  {
+  case MQTT_CONNACK:
+    if (current != MQTT_CONNECTING or mqttConnackCode(packet) != 0)
+    {
+      drop(nowMs); // refused: bad credentials, client id or protocol
+      return;
+    }
+    current = MQTT_ONLINE;
+    since = nowMs;
+    backoff = 0;
+    connectCount++;
+    if (subscription)
+      send(tx, mqttSubscribe(tx, sizeof(tx), nextId++ | 0x8000, subscription, 1), nowMs);
+    if (statusTopic)
+      send(tx, mqttPublish(tx, sizeof(tx), statusTopic, (const uint8_t *)"online", 6, 0, 0, true), nowMs);
+    break;
+  case MQTT_PUBLISH:
+  {
+    MqttMessage message;
+    if (mqttParsePublish(packet, message) != NULL)
+      break;
+    receiveCount++;
+    if (message.qos == 1)
+    {
+      uint8_t ack[4];
+      send(ack, mqttPuback(ack, sizeof(ack), message.packetId), nowMs);
+    }
+    if (onMessage)
+      onMessage(message);
+    break;
+  }
+  case MQTT_PUBACK:
+    if (pendingId and mqttPacketId(packet) == pendingId)
+    {
+      pendingId = 0;
+      acked = true;
+    }
+    break;
+  default:
+    break; // SUBACK, PINGRESP
+  }
+}
+
+bool MqttClient::publish(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, bool retain)
+{
+  if (current != MQTT_ONLINE or (qos and pendingId))
+    return false;
+  uint16_t id = 0;
+  if (qos)
+  {
+    id = nextId++ & 0x7fff; // subscriptions use the upper half
+    if (id == 0)
+      id = nextId++ & 0x7fff;
+  }
+  if (!send(tx, mqttPublish(tx, sizeof(tx), topic, payload, length, qos ? 1 : 0, id, retain), now))
+    return false;
+  publishCount++;
+  if (qos)
+  {
+    pendingId = id;
+    pendingSince = now;
+    acked = false;
+  }
+  return true;
+}
+
+bool MqttClient::delivered()
+{
+  bool was = acked;
+  acked = false;
+  return was;
+}
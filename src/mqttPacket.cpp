@@ -0,0 +1,186 @@
+#include <string.h>
+
+#include "mqttPacket.h"
+
+// fixed header: type and flags, then the remaining length as a base 128 varint
+static size_t header(uint8_t *out, size_t size, uint8_t first, size_t remaining)
+{
+  if (remaining > 268435455 or size < 2)
+    return 0;
+  size_t n = 0;
+  out[n++] = first;
+  do
+  {
+    uint8_t digit = remaining % 128;
+    remaining /= 128;
+    if (remaining > 0)
+      digit |= 0x80;
+    if (n >= size)
+      return 0;
+    out[n++] = digit;
+  } while (remaining > 0);
+  return n;
+}
+
+static size_t headerLength(size_t remaining)
+{
+  size_t n = 2;
+  while (remaining >= 128)
+  {
+    remaining /= 128;
+    n++;
+  }
+  return n;
+}
+
+static uint8_t *putShort(uint8_t *out, uint16_t value)
+{
+  *out++ = value >> 8;
+  *out++ = value;
+  return out;
+}
+
+static uint8_t *putString(uint8_t *out, const char *text, size_t length)
+{
+  out = putShort(out, length);
+  memcpy(out, text, length);
+  return out + length;
+}
+
+size_t mqttConnect(uint8_t *out, size_t size, const char *clientId, const char *user, const char *password, uint16_t keepAlive, const char *willTopic)
+{
+  static const char will[] = "offline";
+  size_t remaining = 10 + 2 + strlen(clientId);
+  uint8_t flags = 0x02; // clean session
+  if (willTopic)
+  {
+    remaining += 2 + strlen(willTopic) + 2 + strlen(will);
+    flags |= 0x04 | 0x20; // will at QoS 0, retained
+  }
+  if (user)
+  {
+    remaining += 2 + strlen(user);
+    flags |= 0x80;
+  }
+  if (user and password)
+  {
+    remaining += 2 + strlen(password);
+    flags |= 0x40;
+  }
+  if (headerLength(remaining) + remaining > size)
+    return 0;
+  size_t n = header(out, size, MQTT_CONNECT << 4, remaining);
+  uint8_t *p = putString(out + n, "MQTT", 4);
+  *p++ = 4; // protocol level 3.1.1
+  *p++ = flags;
+  p = putShort(p, keepAlive);
+  p = putString(p, clientId, strlen(clientId));
+  if (willTopic)
+  {
+    p = putString(p, willTopic, strlen(willTopic));
+    p = putString(p, will, strlen(will));
+  }
+  if (user)
+    p = putString(p, user, strlen(user));
+  if (user and password)
+    p = putString(p, password, strlen(password));
+  return p - out;
+}
+
+size_t mqttPublish(uint8_t *out, size_t size, const char *topic, const uint8_t *payload, size_t length, uint8_t qos, uint16_t packetId, bool retain)
+{
+  size_t remaining = 2 + strlen(topic) + (qos ? 2 : 0) + length;
+  if (headerLength(remaining) + remaining > size)
+    return 0;
+  size_t n = header(out, size, MQTT_PUBLISH << 4 | qos << 1 | (retain ? 1 : 0), remaining);
+  uint8_t *p = putString(out + n, topic, strlen(topic));
+  if (qos)
+    p = putShort(p, packetId);
+  memcpy(p, payload, length);
+  return p + length - out;
+}
+
+size_t mqttSubscribe(uint8_t *out, size_t size, uint16_t packetId, const char *topic, uint8_t qos)
+{
+  size_t remaining = 2 + 2 + strlen(topic) + 1;
+  if (headerLength(remaining) + remaining > size)
+    return 0;
+  size_t n = header(out, size, MQTT_SUBSCRIBE << 4 | 0x02, remaining); // flags are fixed at 0010
+  uint8_t *p = putShort(out + n, packetId);
+  p = putString(p, topic, strlen(topic));
+  *p++ = qos;
+  return p - out;
+}
+
+size_t mqttPuback(uint8_t *out, size_t size, uint16_t packetId)
+{
+  if (size < 4)
+    return 0;
+  size_t n = header(out, size, MQTT_PUBACK << 4, 2);
+  putShort(out + n, packetId);
+  return n + 2;
+}
+
+size_t mqttEmpty(uint8_t *out, size_t size, MqttPacketType type)
+{
+  return header(out, size, type << 4, 0);
+}
+
+int mqttFrame(const uint8_t *in, size_t length, MqttPacket &packet)
+{
+  if (length < 2)
+    return 0;
+  size_t remaining = 0;
+  size_t n = 1;
+  for (int shift = 0;; shift += 7)
+  {
+    if (shift > 21)
+      return -1; // more than 4 length bytes
+    if (n >= length)
+      return 0;
+    uint8_t digit = in[n++];
+    remaining |= (size_t)(digit & 0x7f) << shift;
+    if (!(digit & 0x80))
+      break;
+  }
+  if (length - n < remaining)
+    return 0;
+  packet.type = (MqttPacketType)(in[0] >> 4);
+  packet.flags = in[0] & 0x0f;
+  packet.body = in + n;
+  packet.length = remaining;
+  return n + remaining;
+}
+
+const char *mqttParsePublish(const MqttPacket &packet, MqttMessage &message)
+{
+  if (packet.type != MQTT_PUBLISH or packet.length < 2)
+    return "not a publish";
+  size_t topicLength = packet.body[0] << 8 | packet.body[1];
+  message.qos = packet.flags >> 1 & 3;
+  size_t used = 2 + topicLength + (message.qos ? 2 : 0);
+  if (used > packet.length)
+    return "truncated";
+  if (topicLength >= sizeof(message.topic))
+    return "topic too long";
+  memcpy(message.topic, packet.body + 2, topicLength);
+  message.topic[topicLength] = '\0';
+  message.packetId = message.qos ? (packet.body[2 + topicLength] << 8 | packet.body[3 + topicLength]) : 0;
+  message.payload = packet.body + used;
+  message.length = packet.length - used;
+  return NULL;
+}
+
+int mqttPacketId(const MqttPacket &packet)
+{
+  if (packet.length < 2)
+    return -1;
+  return packet.body[0] << 8 | packet.body[1];
+}
+
+int mqttConnackCode(const MqttPacket &packet)
+{
+  if (packet.type != MQTT_CONNACK or packet.length != 2)
+    return -1;
+  return packet.body[1];
+}
@@ -0,0 +1,96 @@
+#include <string.h>
+
+#include "outbox.h"
+#include "crc32.h"
+
+static void seal(OutboxRecord &record)
+{
+  record.crc = crc32((const uint8_t *)&record, offsetof(OutboxRecord, crc));
+}
+
+static bool intact(const OutboxRecord &record, uint32_t magic)
+{
+  return record.magic == magic and record.crc == crc32((const uint8_t *)&record, offsetof(OutboxRecord, crc));
+}
+
+void Outbox::recover()
+{
+  // the cursor record's sequence counts cursor writes, its length field is unused
+  // and the delivered sequence sits in the first payload bytes
+  uint32_t delivered = 0;
+  cursorWrites = 0;
+  for (uint32_t i = 0; i < 2; i++)
+  {
+    OutboxRecord cursor;
+    if (storage.read(i * sizeof(cursor), &cursor, sizeof(cursor)) and intact(cursor, OUTBOX_CURSOR_MAGIC) and cursor.sequence >= cursorWrites)
+    {
+      cursorWrites = cursor.sequence;
+      memcpy(&delivered, cursor.payload, sizeof(delivered));
+    }
+  }
+  uint32_t newest = 0;
+  for (uint16_t slot = 0; slot < slots; slot++)
+  {
+    OutboxRecord record;
+    if (storage.read(2 * sizeof(record) + slot * sizeof(record), &record, sizeof(record)) and intact(record, OUTBOX_MAGIC) and
+        record.sequence % slots == slot and record.sequence > newest)
+      newest = record.sequence;
+  }
+  if (newest < delivered)
+    newest = delivered; // wiped ring, keep counting up
+  head = newest + 1;
+  tail = delivered + 1;
+  if (head - tail > slots)
+    tail = head - slots;
+}
+
+bool Outbox::push(const void *payload, size_t length)
+{
+  if (length > OUTBOX_PAYLOAD_SIZE)
+    return false;
+  OutboxRecord record = {};
+  record.magic = OUTBOX_MAGIC;
+  record.sequence = head;
+  record.length = length;
+  memcpy(record.payload, payload, length);
+  seal(record);
+  if (!storage.write(recordOffset(head), &record, sizeof(record)))
+    return false;
+  head++;
+  if (head - tail > slots)
+  {
+    tail++; // the oldest was just overwritten
+    drops++;
+  }
+  return true;
+}
+
+size_t Outbox::peek(void *out, size_t size)
+{
+  while (tail != head)
+  {
+    OutboxRecord record;
+    if (storage.read(recordOffset(tail), &record, sizeof(record)) and intact(record, OUTBOX_MAGIC) and record.sequence == tail and
+        record.length <= size)
+    {
+      memcpy(out, record.payload, record.length);
+      return record.length;
+    }
+    tail++; // torn or lost, skip it
+    drops++;
+  }
+  return 0;
+}
+
+void Outbox::pop()
+{
+  if (tail == head)
+    return;
+  OutboxRecord cursor = {};
+  cursor.magic = OUTBOX_CURSOR_MAGIC;
+  cursor.sequence = ++cursorWrites;
+  memcpy(cursor.payload, &tail, sizeof(tail));
+  seal(cursor);
+  storage.write((cursorWrites % 2) * sizeof(cursor), &cursor, sizeof(cursor));
+  tail++;
+}
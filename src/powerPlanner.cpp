@@ -0,0 +1,108 @@
+#include "powerPlanner.h"
+
+const char *const POWER_STATE_NAMES[POWER_STATES] = {"active", "idle", "sleep"};
+const char *const POWER_REASON_NAMES[POWER_REASONS] = {"running", "measuring", "upload", "schedule", "override", "alarm",
+                                                       "dht", "water", "history", "telemetry", "limit"};
+
+bool inUploadWindow(uint32_t epoch, uint32_t interval, uint32_t length, uint32_t &nextStart)
+{
+  if (interval == 0 or length >= interval)
+  {
+    nextStart = epoch;
+    return true;
+  }
+  uint32_t start = epoch - epoch % interval;
+  bool open = epoch - start < length;
+  nextStart = open ? start : start + interval;
+  return open;
+}
+
+void WakePlanner::start(uint32_t nowEpoch)
+{
+  *this = WakePlanner();
+  epoch = nowEpoch;
+}
+
+void WakePlanner::busy(PowerReason why)
+{
+  if (!active)
+    wakeReason = why;
+  active = true;
+  awake = true;
+}
+
+void WakePlanner::idle(PowerReason why)
+{
+  if (!awake)
+    wakeReason = why;
+  awake = true;
+}
+
+void WakePlanner::due(int32_t inMs, PowerReason why)
+{
+  uint32_t ms = (inMs > 0) ? inMs : 0;
+  if ((why == POWER_SCHEDULE or why == POWER_OVERRIDE) and ms <= POWER_WAKE_EARLY)
+    busy(why);
+  if (ms < earliest)
+  {
+    earliest = ms;
+    earliestReason = why;
+  }
+}
+
+void WakePlanner::dueAt(uint32_t at, PowerReason why)
+{
+  if (at == 0 or at == UINT32_MAX)
+    return;
+  // the current second may be almost over, count from its end
+  uint32_t ahead = (at > epoch) ? at - epoch - 1 : 0;
+  due((ahead < POWER_MAX_SLEEP / 1000) ? ahead * 1000 : POWER_MAX_SLEEP, why);
+}
+
+PowerPlan WakePlanner::plan() const
+{
+  if (active)
+    return {POWER_ACTIVE, wakeReason, 0, 0};
+  if (awake)
+    return {POWER_IDLE, wakeReason, earliest, 0};
+  if (earliest < POWER_MIN_SLEEP + POWER_WAKE_EARLY)
+    return {POWER_IDLE, earliestReason, earliest, 0};
+  return {POWER_SLEEP, earliestReason, earliest, earliest - POWER_WAKE_EARLY};
+}
+
+void EnergyBudget::account(PowerState state, bool wifi, uint8_t relaysOn, float pumpAmps, uint32_t ms)
+{
+  stateMs[state] += ms;
+  wifiMs += wifi ? ms : 0;
+  relayMs += (uint64_t)relaysOn * ms;
+  pumpAmpMs += (double)pumpAmps * ms;
+  total += ms;
+}
+
+float EnergyBudget::controllerMah() const
+{
+  double mAms = (double)stateMs[POWER_ACTIVE] * rates.activeMa + (double)stateMs[POWER_IDLE] * rates.idleMa +
+                (double)stateMs[POWER_SLEEP] * rates.sleepMa + (double)wifiMs * rates.wifiMa + (double)relayMs * rates.relayMa;
+  return mAms / 3600000;
+}
+
+float EnergyBudget::controllerWhPerDay() const
+{
+  return total ? controllerMah() / 1000 * rates.supplyVolts * (86400000.0 / total) : 0;
+}
+
+float EnergyBudget::pumpWhPerDay() const
+{
+  // amps x volts, apparent power, the sensors see no phase
+  return total ? pumpAmpMs / 3600000 * rates.pumpVolts * (86400000.0 / total) : 0;
+}
+
+float EnergyBudget::share(PowerState state) const
+{
+  return total ? (float)stateMs[state] / total : 0;
+}
+
+float EnergyBudget::wifiShare() const
+{
+  return total ? (float)wifiMs / total : 0;
+}
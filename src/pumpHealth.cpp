@@ -0,0 +1,234 @@
+#include <math.h>
+#include <string.h>
+
+#include "pumpHealth.h"
+#include "rms.h"
+
+const char *const PUMP_FEATURE_NAMES[FEATURE_COUNT] = {"rms", "crest", "h2", "h3", "thd", "noise", "inrush_peak", "inrush_ms"};
+
+// spread a feature is never scored tighter than, on top of PUMP_REL_SPREAD
+static const float FEATURE_FLOOR[FEATURE_COUNT] = {2, 0.03, 0.01, 0.01, 0.01, 0.01, 0.2, 100};
+
+// Q15 twiddles and Hann window, filled before setup() runs
+static struct FftTables
+{
+  int16_t cos[PUMP_FFT_SIZE / 2];
+  int16_t sin[PUMP_FFT_SIZE / 2];
+  int16_t hann[PUMP_FFT_SIZE];
+
+  FftTables()
+  {
+    for (int i = 0; i < PUMP_FFT_SIZE / 2; i++)
+    {
+      cos[i] = lround(32767 * ::cos(2 * M_PI * i / PUMP_FFT_SIZE));
+      sin[i] = lround(32767 * ::sin(2 * M_PI * i / PUMP_FFT_SIZE));
+    }
+    for (int i = 0; i < PUMP_FFT_SIZE; i++)
+      hann[i] = lround(32767 * 0.5 * (1 - ::cos(2 * M_PI * i / PUMP_FFT_SIZE)));
+  }
+} tables;
+
+void fftQ15(int16_t *re, int16_t *im, uint8_t log2n)
+{
+  uint16_t n = 1 << log2n;
+  // bit reversed order
+  for (uint16_t i = 1, j = 0; i < n; i++)
+  {
+    uint16_t bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j)
+    {
+      int16_t t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+      t = im[i];
+      im[i] = im[j];
+      im[j] = t;
+    }
+  }
+  for (uint16_t half = 1; half < n; half <<= 1)
+  {
+    uint16_t step = PUMP_FFT_SIZE / 2 / half;
+    for (uint16_t j = 0; j < half; j++)
+    {
+      // e^(-i 2 pi j / 2half)
+      int32_t wr = tables.cos[j * step];
+      int32_t wi = -tables.sin[j * step];
+      for (uint16_t i = j; i < n; i += 2 * half)
+      {
+        uint16_t k = i + half;
+        int32_t tr = (wr * re[k] - wi * im[k]) >> 15;
+        int32_t ti = (wr * im[k] + wi * re[k]) >> 15;
+        // magnitudes never grow past the input's, the halving keeps every stage in range
+        re[k] = (re[i] - tr) >> 1;
+        im[k] = (im[i] - ti) >> 1;
+        re[i] = (re[i] + tr) >> 1;
+        im[i] = (im[i] + ti) >> 1;
+      }
+    }
+  }
+}
+
+bool extractFeatures(const uint16_t *samples, float *features)
+{
+  uint32_t sum = 0;
+  for (int i = 0; i < PUMP_FFT_SIZE; i++)
+    sum += samples[i];
+  int32_t mean = (sum + PUMP_FFT_SIZE / 2) / PUMP_FFT_SIZE;
+  int32_t peak = 0;
+  for (int i = 0; i < PUMP_FFT_SIZE; i++)
+  {
+    int32_t d = abs((int32_t)samples[i] - mean);
+    peak = (d > peak) ? d : peak;
+  }
+  float rms = acRms(samples, PUMP_FFT_SIZE);
+  if (peak == 0 or rms == 0)
+    return false;
+  // block floating point: the largest sample lands in 8192..16383, so a quiet channel keeps its resolution
+  int shift = 0;
+  while ((peak << (shift + 1)) < 16384 and shift < 15)
+    shift++;
+  int16_t re[PUMP_FFT_SIZE];
+  int16_t im[PUMP_FFT_SIZE];
+  for (int i = 0; i < PUMP_FFT_SIZE; i++)
+  {
+    int32_t scaled = ((int32_t)samples[i] - mean) * (1 << shift);
+    scaled = (scaled < -16383) ? -16383 : (scaled > 16383) ? 16383 : scaled; // rounding of the mean
+    re[i] = (scaled * tables.hann[i]) >> 15;
+    im[i] = 0;
+  }
+  fftQ15(re, im, PUMP_FFT_LOG2);
+
+  // power per bin, DC and Nyquist left out
+  float power[PUMP_FFT_SIZE / 2];
+  float total = 0;
+  power[0] = 0;
+  for (int k = 1; k < PUMP_FFT_SIZE / 2; k++)
+  {
+    power[k] = (float)((int32_t)re[k] * re[k] + (int32_t)im[k] * im[k]);
+    total += power[k];
+  }
+  float harmonic[PUMP_HARMONICS + 1] = {};
+  float harmonics = 0;
+  for (int h = 1; h <= PUMP_HARMONICS; h++)
+  {
+    int center = lroundf((float)h * PUMP_MAINS * PUMP_FFT_SIZE / PUMP_SAMPLE_RATE);
+    for (int k = center - 2; k <= center + 2; k++)
+    {
+      if (k >= 1 and k < PUMP_FFT_SIZE / 2)
+        harmonic[h] += power[k];
+    }
+    harmonics += harmonic[h];
+  }
+  if (harmonic[1] == 0)
+    return false;
+  features[FEATURE_RMS] = rms;
+  features[FEATURE_CREST] = peak / rms;
+  features[FEATURE_H2] = sqrtf(harmonic[2] / harmonic[1]);
+  features[FEATURE_H3] = sqrtf(harmonic[3] / harmonic[1]);
+  features[FEATURE_THD] = sqrtf((harmonics - harmonic[1]) / harmonic[1]);
+  features[FEATURE_NOISE] = (total - harmonics) / total;
+  return true;
+}
+
+void PumpHealth::restore(const PumpBaseline &baseline)
+{
+  // a corrupt file must not poison the baseline
+  for (uint8_t f = 0; f < FEATURE_COUNT; f++)
+  {
+    if (!(isfinite(baseline.mean[f]) and baseline.spread2[f] >= 0 and isfinite(baseline.spread2[f])))
+      return;
+  }
+  saved = baseline;
+}
+
+float PumpHealth::health() const
+{
+  if (!learned())
+    return 100;
+  float h = 100 * (1 - (smoothed - PUMP_Z_OK) / (PUMP_Z_BAD - PUMP_Z_OK));
+  return (h < 0) ? 0 : (h > 100) ? 100 : h;
+}
+
+void PumpHealth::observe(uint8_t from, uint8_t to, uint32_t &count, uint32_t minimum)
+{
+  bool known = count >= minimum;
+  float furthest = 0;
+  for (uint8_t f = from; f < to; f++)
+  {
+    float spread = sqrtf(saved.spread2[f]);
+    float floor = fabsf(saved.mean[f]) * PUMP_REL_SPREAD;
+    spread = (spread > floor) ? spread : floor;
+    spread = (spread > FEATURE_FLOOR[f]) ? spread : FEATURE_FLOOR[f];
+    z[f] = known ? fabsf(latest[f] - saved.mean[f]) / spread : 0;
+    furthest = (z[f] > furthest) ? z[f] : furthest;
+  }
+  // learn from normal running only, a plain mean until the window is full
+  if (known and furthest >= PUMP_LEARN_Z)
+    return;
+  if (count < UINT32_MAX)
+    count++;
+  float n = (count < PUMP_BASELINE_WINDOW) ? count : PUMP_BASELINE_WINDOW;
+  for (uint8_t f = from; f < to; f++)
+  {
+    float delta = latest[f] - saved.mean[f];
+    saved.mean[f] += delta / n;
+    saved.spread2[f] += (delta * (latest[f] - saved.mean[f]) - saved.spread2[f]) / n;
+  }
+}
+
+void PumpHealth::window(float amps, bool driven, bool running, uint32_t sinceEdgeMs)
+{
+  if (!driven)
+  {
+    starting = false;
+    return;
+  }
+  if (sinceEdgeMs < PUMP_INRUSH_MS)
+  {
+    if (!starting)
+    {
+      starting = true;
+      inrushCount = 0;
+    }
+    if (inrushCount < PUMP_INRUSH_WINDOWS)
+      inrush[inrushCount++] = amps;
+    return;
+  }
+  if (!starting)
+    return;
+  // first settled window: the profile against the running current
+  starting = false;
+  if (!running or amps <= 0 or inrushCount == 0)
+    return; // did not start, that is the status mismatch alarm
+  float peak = 0;
+  uint8_t above = 0;
+  for (uint8_t i = 0; i < inrushCount; i++)
+  {
+    peak = (inrush[i] > peak) ? inrush[i] : peak;
+    above += inrush[i] > amps * 1.2;
+  }
+  latest[FEATURE_INRUSH_PEAK] = peak / amps;
+  latest[FEATURE_INRUSH_TIME] = above * (PUMP_INRUSH_MS / PUMP_INRUSH_WINDOWS);
+  observe(FEATURE_WAVEFORM, FEATURE_COUNT, saved.starts, PUMP_MIN_STARTS);
+}
+
+void PumpHealth::capture(const uint16_t *samples)
+{
+  if (!extractFeatures(samples, latest))
+    return;
+  observe(0, FEATURE_WAVEFORM, saved.captures, PUMP_MIN_CAPTURES);
+  // start-up scores stand until the next start
+  float furthest = 0;
+  for (uint8_t f = 0; f < FEATURE_COUNT; f++)
+  {
+    if (z[f] > furthest)
+    {
+      furthest = z[f];
+      worstFeature = (PumpFeature)f;
+    }
+  }
+  smoothed = learned() ? smoothed + (furthest - smoothed) / PUMP_SMOOTHING : 0;
+}
@@ -0,0 +1,120 @@
+#include "pumpSchedule.h"
+
+#include <math.h>
+#include <string.h>
+
+static uint16_t minuteOfDay(uint32_t epoch)
+{
+  return (epoch % SECONDS_PER_DAY) / 60;
+}
+
+bool OutputSchedule::stateAt(uint32_t epoch) const
+{
+  if (count == 0)
+    return constantState;
+  uint16_t minute = minuteOfDay(epoch);
+  // binary search for the last edge at or before minute
+  int low = 0;
+  int high = count - 1;
+  int found = -1;
+  while (low <= high)
+  {
+    int mid = (low + high) / 2;
+    if (table[mid].minute <= minute)
+    {
+      found = mid;
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid - 1;
+    }
+  }
+  // before the first edge of the day, the state carries over from the last edge of yesterday
+  return (found < 0) ? table[count - 1].on : table[found].on;
+}
+
+uint32_t OutputSchedule::nextTransition(uint32_t epoch) const
+{
+  if (count == 0)
+    return 0;
+  uint16_t minute = minuteOfDay(epoch);
+  uint32_t dayStart = epoch - (epoch % SECONDS_PER_DAY);
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (table[i].minute > minute)
+    {
+      return dayStart + table[i].minute * 60;
+    }
+  }
+  return dayStart + SECONDS_PER_DAY + table[0].minute * 60;
+}
+
+void ScheduleBuilder::clear()
+{
+  memset(dayMask, 0, sizeof(dayMask));
+}
+
+void ScheduleBuilder::addWindow(uint16_t startMinute, uint16_t endMinute)
+{
+  startMinute %= MINUTES_PER_DAY;
+  uint16_t length = (endMinute + MINUTES_PER_DAY - startMinute) % MINUTES_PER_DAY;
+  if (length == 0 and endMinute != startMinute)
+  {
+    length = MINUTES_PER_DAY; // [0, 1440] is all day
+  }
+  for (uint16_t i = 0; i < length; i++)
+  {
+    uint16_t minute = (startMinute + i) % MINUTES_PER_DAY;
+    dayMask[minute >> 5] |= 1UL << (minute & 31);
+  }
+}
+
+void ScheduleBuilder::addPulse(uint16_t every, uint16_t at, uint16_t length, float scale)
+{
+  if (every == 0)
+    return;
+  if (scale != 1 and length > 0 and length < every)
+  {
+    // the duty cycle is scaled on the minute grid, half of it by the pulse length and half by the period
+    float duty = scale * length / every;
+    if (duty >= 1)
+    {
+      addWindow(0, MINUTES_PER_DAY);
+      return;
+    }
+    long scaled = lroundf(length * sqrtf(scale));
+    long period = lroundf((scaled ? scaled : 1) / duty);
+    long densest = (every < PULSE_MIN_EVERY) ? every : PULSE_MIN_EVERY;
+    period = (period < densest) ? densest : (period > MINUTES_PER_DAY) ? MINUTES_PER_DAY : period;
+    scaled = lroundf(duty * period);
+    every = period;
+    length = (scaled < 1) ? 1 : (scaled >= period) ? period - 1 : scaled;
+  }
+  for (uint16_t minute = at % every; minute < MINUTES_PER_DAY; minute += every)
+  {
+    addWindow(minute, minute + length);
+  }
+}
+
+bool ScheduleBuilder::compile(OutputSchedule &schedule) const
+{
+  uint8_t count = 0;
+  bool previous = bit(MINUTES_PER_DAY - 1);
+  for (uint16_t minute = 0; minute < MINUTES_PER_DAY; minute++)
+  {
+    bool state = bit(minute);
+    if (state != previous)
+    {
+      if (count >= SCHEDULE_MAX_TRANSITIONS)
+        return false;
+      schedule.table[count].minute = minute;
+      schedule.table[count].on = state;
+      count++;
+      previous = state;
+    }
+  }
+  schedule.count = count;
+  schedule.constantState = bit(0);
+  return true;
+}
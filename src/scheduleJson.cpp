@@ -0,0 +1,50 @@
+#include "scheduleJson.h"
+
+// water pump 1 runs 6am-12pm, water pump 2 12pm-6pm, outside of that 1 min on the hour / half hour
+// air pump runs 15 min on, 15 min off
+const char DEFAULT_SCHEDULE[] = R"({"outputs":[
+{"pin":22,"on":[[360,720]],"pulse":{"every":60,"at":0,"length":1}},
+{"pin":21,"on":[[720,1080]],"pulse":{"every":60,"at":30,"length":1}},
+{"pin":19,"pulse":{"every":30,"at":0,"length":15}}]})";
+
+// minutes of the day, ends may be 1440 (midnight of the next day)
+static bool inDay(long minute, long last = MINUTES_PER_DAY - 1) { return minute >= 0 and minute <= last; }
+
+const char *compileSchedule(const char *json, size_t length, const OutputConfig *configs, size_t count, OutputSchedule *schedules,
+                            ScheduleWorkspace &work, const float *pulseScales)
+{
+  JsonDocument &doc = work.doc;
+  if (deserializeJson(doc, json, length))
+    return "bad json";
+  ScheduleBuilder &builder = work.builder;
+  for (size_t i = 0; i < count; i++)
+  {
+    builder.clear(); // outputs missing from the json stay off
+    for (JsonObject output : doc["outputs"].as<JsonArray>())
+    {
+      if ((output["pin"] | -1) != configs[i].pin)
+        continue;
+      for (JsonArray window : output["on"].as<JsonArray>())
+      {
+        long start = window[0] | -1L;
+        long end = window[1] | -1L;
+        if (window.size() != 2 or !inDay(start) or !inDay(end, MINUTES_PER_DAY))
+          return "windows need [start 0-1439, end 0-1440] minutes";
+        builder.addWindow(start, end);
+      }
+      JsonObject pulse = output["pulse"];
+      if (!pulse.isNull())
+      {
+        long every = pulse["every"] | -1L;
+        long at = pulse["at"] | 0L;
+        long onFor = pulse["length"] | 1L;
+        if (every < 1 or !inDay(every, MINUTES_PER_DAY) or !inDay(at) or !inDay(onFor, MINUTES_PER_DAY))
+          return "pulses need every 1-1440, at 0-1439 and length 0-1440 minutes";
+        builder.addPulse(every, at, onFor, pulseScales ? pulseScales[i] : 1);
+      }
+    }
+    if (!builder.compile(schedules[i]))
+      return "too many schedule transitions";
+  }
+  return NULL;
+}
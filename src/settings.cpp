@@ -0,0 +1,258 @@
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "settings.h"
+#include "crc32.h"
+#include "timeSeries.h"
+
+#define FIELD(member) offsetof(Settings, member)
+
+const SettingField SETTING_FIELDS[] = {
+    // id, name, type, offset, min, max, default
+    {1, "utcOffset", SETTING_INT, FIELD(utcOffset), -43200, 50400, -36000}, // Hawaii is UTC-10
+    {2, "dhtInterval", SETTING_INT, FIELD(dhtInterval), 2, 86400, 900},
+    {3, "waterLevelInterval", SETTING_INT, FIELD(waterLevelInterval), 1, 3600, 60},
+    {4, "historyInterval", SETTING_INT, FIELD(historyInterval), 1, 60, 10}, // at least once per history minute
+    {5, "mvPerAmp", SETTING_FLOAT, FIELD(mvPerAmp), 0.01, 1, 0.185},
+    {6, "runningCurrent", SETTING_FLOAT, FIELD(runningCurrent), 0.05, 5, 0.5},
+    {7, "waterLowCm", SETTING_FLOAT, FIELD(waterLowCm), 1, 400, 20},
+    {8, "waterMediumCm", SETTING_FLOAT, FIELD(waterMediumCm), 1, 400, 10},
+    {9, "highTempAlarm", SETTING_FLOAT, FIELD(highTempAlarm), 32, 150, 90},
+    {10, "highTempHysteresis", SETTING_FLOAT, FIELD(highTempHysteresis), 0, 20, 2},
+    {11, "tankDepthCm", SETTING_FLOAT, FIELD(tankDepthCm), 5, 400, 40},
+    {12, "tankLengthCm", SETTING_FLOAT, FIELD(tankLengthCm), 0, 500, 60},
+    {13, "tankWidthCm", SETTING_FLOAT, FIELD(tankWidthCm), 0, 500, 40},
+    {14, "tankDiameterCm", SETTING_FLOAT, FIELD(tankDiameterCm), 0, 500, 0},
+    {15, "climateControl", SETTING_INT, FIELD(climateControl), 0, 1, 1},
+    {16, "climateCoolF", SETTING_FLOAT, FIELD(climateCoolF), 32, 150, 72},
+    {17, "climateHotF", SETTING_FLOAT, FIELD(climateHotF), 32, 150, 85},
+    {18, "climateMinScale", SETTING_FLOAT, FIELD(climateMinScale), 0.25, 1, 0.5},
+    {19, "climateMaxScale", SETTING_FLOAT, FIELD(climateMaxScale), 1, 4, 2},
+    {20, "lowPower", SETTING_INT, FIELD(lowPower), 0, 1, 0},
+    {21, "uploadInterval", SETTING_INT, FIELD(uploadInterval), 0, 86400, 3600},
+    {22, "uploadWindow", SETTING_INT, FIELD(uploadWindow), 30, 3600, 120},
+    {23, "failoverMs", SETTING_INT, FIELD(failoverMs), 100, 5000, 500},
+    {24, "balanceHours", SETTING_INT, FIELD(balanceHours), 0, 1000, 12}, // above the lead one pump builds up over a day
+};
+const size_t SETTING_FIELD_COUNT = sizeof(SETTING_FIELDS) / sizeof(SETTING_FIELDS[0]);
+static_assert(sizeof(SETTING_FIELDS) / sizeof(SETTING_FIELDS[0]) <= SETTINGS_MAX_FIELDS, "raise SETTINGS_MAX_FIELDS, the blob does not fit");
+
+struct SettingsHeader
+{
+  uint16_t magic;
+  uint8_t version;
+  uint8_t reserved;
+  uint32_t sequence; // higher wins when both slots are intact
+  uint16_t length;   // payload bytes
+  uint16_t reserved2;
+  uint32_t crc; // of the payload
+};
+static_assert(sizeof(SettingsHeader) == 16, "SettingsHeader is stored as is");
+
+static int32_t &intField(Settings &settings, const SettingField &field) { return *(int32_t *)((uint8_t *)&settings + field.offset); }
+static float &floatField(Settings &settings, const SettingField &field) { return *(float *)((uint8_t *)&settings + field.offset); }
+static float fieldValue(const Settings &settings, const SettingField &field)
+{
+  const uint8_t *base = (const uint8_t *)&settings + field.offset;
+  return (field.type == SETTING_INT) ? *(const int32_t *)base : *(const float *)base;
+}
+
+static const SettingField *fieldById(uint8_t id)
+{
+  for (size_t i = 0; i < SETTING_FIELD_COUNT; i++)
+  {
+    if (SETTING_FIELDS[i].id == id)
+      return &SETTING_FIELDS[i];
+  }
+  return NULL;
+}
+
+void defaultSettings(Settings &settings)
+{
+  memset(&settings, 0, sizeof(settings));
+  for (size_t i = 0; i < SETTING_FIELD_COUNT; i++)
+  {
+    const SettingField &field = SETTING_FIELDS[i];
+    if (field.type == SETTING_INT)
+      intField(settings, field) = field.defaultValue;
+    else
+      floatField(settings, field) = field.defaultValue;
+  }
+}
+
+const char *validateSettings(const Settings &settings)
+{
+  for (size_t i = 0; i < SETTING_FIELD_COUNT; i++)
+  {
+    const SettingField &field = SETTING_FIELDS[i];
+    float value = fieldValue(settings, field);
+    // written so NaN fails as well
+    if (!(value >= field.min and value <= field.max))
+      return field.name;
+  }
+  if (settings.waterMediumCm >= settings.waterLowCm)
+    return "waterMediumCm must be below waterLowCm";
+  if (settings.tankDiameterCm == 0 and settings.tankLengthCm * settings.tankWidthCm == 0)
+    return "tank needs a diameter or a length and width";
+  if (settings.climateCoolF >= settings.climateHotF)
+    return "climateCoolF must be below climateHotF";
+  if (settings.uploadInterval != 0 and settings.uploadWindow >= settings.uploadInterval)
+    return "uploadWindow must be shorter than uploadInterval";
+  return NULL;
+}
+
+size_t encodeSettings(const Settings &settings, uint32_t sequence, uint8_t *out, size_t size)
+{
+  if (size < sizeof(SettingsHeader) + SETTING_FIELD_COUNT * SETTING_MAX_BYTES)
+    return 0;
+  uint8_t *payload = out + sizeof(SettingsHeader);
+  size_t n = 0;
+  for (size_t i = 0; i < SETTING_FIELD_COUNT; i++)
+  {
+    const SettingField &field = SETTING_FIELDS[i];
+    const uint8_t *value = (const uint8_t *)&settings + field.offset;
+    n += putVarint(payload + n, field.id << 1 | field.type);
+    if (field.type == SETTING_INT)
+    {
+      n += putVarint(payload + n, zigzag(*(const int32_t *)value));
+    }
+    else
+    {
+      uint32_t bits;
+      memcpy(&bits, value, 4);
+      for (int b = 0; b < 4; b++)
+        payload[n++] = bits >> (8 * b);
+    }
+  }
+  SettingsHeader header = {SETTINGS_MAGIC, SETTINGS_VERSION, 0, sequence, (uint16_t)n, 0, crc32(payload, n)};
+  memcpy(out, &header, sizeof(header));
+  return sizeof(header) + n;
+}
+
+const char *decodeSettings(const uint8_t *in, size_t length, Settings &settings, uint32_t &sequence)
+{
+  SettingsHeader header;
+  if (length < sizeof(header))
+    return "short";
+  memcpy(&header, in, sizeof(header));
+  if (header.magic != SETTINGS_MAGIC)
+    return "bad magic";
+  if (header.version > SETTINGS_VERSION)
+    return "newer version";
+  if (sizeof(header) + header.length > length)
+    return "truncated";
+  const uint8_t *payload = in + sizeof(header);
+  if (crc32(payload, header.length) != header.crc)
+    return "bad crc";
+  Settings decoded;
+  defaultSettings(decoded);
+  size_t n = 0;
+  while (n < header.length)
+  {
+    uint32_t tag;
+    size_t used = getVarint(payload + n, header.length - n, &tag);
+    if (used == 0)
+      return "bad tag";
+    n += used;
+    uint8_t wire = tag & 1;
+    uint32_t raw = 0;
+    if (wire == SETTING_INT)
+    {
+      used = getVarint(payload + n, header.length - n, &raw);
+      if (used == 0)
+        return "bad value";
+      n += used;
+    }
+    else
+    {
+      if (header.length - n < 4)
+        return "bad value";
+      for (int b = 0; b < 4; b++)
+        raw |= (uint32_t)payload[n++] << (8 * b);
+    }
+    const SettingField *field = fieldById(tag >> 1);
+    if (field == NULL or field->type != wire)
+      continue; // dropped or retyped field, keeps its default
+    if (wire == SETTING_INT)
+      intField(decoded, *field) = unzigzag(raw);
+    else
+      memcpy(&floatField(decoded, *field), &raw, 4);
+  }
+  migrateSettings(decoded, header.version);
+  if (validateSettings(decoded) != NULL)
+    return "out of range";
+  settings = decoded;
+  sequence = header.sequence;
+  return NULL;
+}
+
+void migrateSettings(Settings &settings, uint8_t fromVersion)
+{
+  // one step per version. Added fields need no step (they decode to their
+  // default), only a changed meaning or unit of an existing id does, e.g.
+  //   case 1: settings.dhtInterval /= 60; // version 2 stores minutes
+  // There has been no such change yet, settings is untouched until there is.
+  (void)settings;
+  for (uint8_t version = fromVersion; version < SETTINGS_VERSION; version++)
+  {
+    switch (version)
+    {
+    default:
+      break;
+    }
+  }
+}
+
+const char *patchSettings(const char *json, size_t length, Settings &settings)
+{
+  StaticJsonDocument<512> doc;
+  if (deserializeJson(doc, json, length) or !doc.is<JsonObject>())
+    return "expected a json object";
+  Settings patched = settings;
+  for (JsonPair pair : doc.as<JsonObject>())
+  {
+    const SettingField *field = NULL;
+    for (size_t i = 0; i < SETTING_FIELD_COUNT; i++)
+    {
+      if (strcmp(SETTING_FIELDS[i].name, pair.key().c_str()) == 0)
+        field = &SETTING_FIELDS[i];
+    }
+    if (field == NULL)
+      return "unknown setting";
+    if (field->type == SETTING_INT)
+    {
+      if (!pair.value().is<int32_t>())
+        return "expected an integer";
+      intField(patched, *field) = pair.value().as<int32_t>();
+    }
+    else
+    {
+      if (!pair.value().is<float>())
+        return "expected a number";
+      floatField(patched, *field) = pair.value().as<float>();
+    }
+  }
+  const char *error = validateSettings(patched);
+  if (error != NULL)
+    return error;
+  settings = patched;
+  return NULL;
+}
+
+size_t writeSettingsJson(const Settings &settings, uint32_t sequence, char *out, size_t size)
+{
+  int n = snprintf(out, size, "{\"version\":%u,\"sequence\":%u,\"settings\":{", SETTINGS_VERSION, (unsigned)sequence);
+  for (size_t i = 0; i < SETTING_FIELD_COUNT and n >= 0 and (size_t)n < size; i++)
+  {
+    const SettingField &field = SETTING_FIELDS[i];
+    float value = fieldValue(settings, field);
+    if (field.type == SETTING_INT)
+      n += snprintf(out + n, size - n, "%s\"%s\":%d", i ? "," : "", field.name, (int)value);
+    else
+      n += snprintf(out + n, size - n, "%s\"%s\":%g", i ? "," : "", field.name, value);
+  }
+  if (n >= 0 and (size_t)n < size)
+    n += snprintf(out + n, size - n, "}}");
+  return (n < 0 or (size_t)n >= size) ? 0 : n;
+}
@@ -0,0 +1,70 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "posixMqttTransport.h"
+
+bool PosixMqttTransport::open(const char *host, uint16_t port)
+{
+  close();
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *found;
+  if (getaddrinfo(host, service, &hints, &found) != 0)
+    return false;
+  for (addrinfo *address = found; address and fd < 0; address = address->ai_next)
+  {
+    fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd >= 0 and ::connect(fd, address->ai_addr, address->ai_addrlen) != 0)
+      close();
+  }
+  freeaddrinfo(found);
+  if (fd < 0)
+    return false;
+  int on = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  return true;
+}
+
+size_t PosixMqttTransport::read(uint8_t *data, size_t size)
+{
+  if (fd < 0 or size == 0)
+    return 0;
+  ssize_t n = recv(fd, data, size, 0);
+  if (n > 0)
+    return n;
+  if (n == 0 or (errno != EAGAIN and errno != EWOULDBLOCK))
+    close(); // closed by the broker
+  return 0;
+}
+
+size_t PosixMqttTransport::write(const uint8_t *data, size_t length)
+{
+  size_t sent = 0;
+  while (fd >= 0 and sent < length)
+  {
+    ssize_t n = send(fd, data + sent, length - sent, MSG_NOSIGNAL);
+    if (n > 0)
+      sent += n;
+    else if (n < 0 and errno != EAGAIN and errno != EWOULDBLOCK and errno != EINTR)
+      close();
+  }
+  return sent;
+}
+
+void PosixMqttTransport::close()
+{
+  if (fd >= 0)
+    ::close(fd);
+  fd = -1;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "mqttClient.h"
+
+// MqttTransport on a plain TCP socket, so the MQTT client can be run against
+// a broker on the build machine (mosquitto)
+class PosixMqttTransport : public MqttTransport
+{
+public:
+  ~PosixMqttTransport() { close(); }
+  bool open(const char *host, uint16_t port) override;
+  bool connected() override { return fd >= 0; }
+  size_t read(uint8_t *data, size_t size) override;
+  size_t write(const uint8_t *data, size_t length) override;
+  void close() override;
+
+private:
+  int fd = -1;
+};
@@ -0,0 +1,53 @@
+#include <chrono>
+#include <thread>
+
+#include "taskScheduler.h"
+
+// ScheduledTask on a std::thread, for the host tests. There is no real time
+// scheduling on the build machine: priority and core are ignored and wakeups
+// are as late as the host makes them.
+typedef std::chrono::steady_clock Clock;
+
+static const Clock::time_point epoch = Clock::now();
+
+uint32_t ScheduledTask::clockMicros() { return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - epoch).count(); }
+uint32_t ScheduledTask::clockMillis() { return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - epoch).count(); }
+
+void ScheduledTask::start()
+{
+  stopping = false;
+  handle = new std::thread(run, this);
+}
+
+void ScheduledTask::stop()
+{
+  if (handle == NULL)
+    return;
+  stopping = true;
+  std::thread *thread = (std::thread *)handle;
+  thread->join();
+  delete thread;
+  handle = NULL;
+}
+
+void ScheduledTask::run(void *arg)
+{
+  ScheduledTask *task = (ScheduledTask *)arg;
+  Clock::time_point lastWake = Clock::now();
+  uint32_t slot = clockMicros();
+  while (!task->stopping)
+  {
+    uint32_t start = clockMicros();
+    if (task->restart)
+    {
+      task->restart = false;
+      lastWake = Clock::now();
+      slot = start;
+    }
+    task->wakeup(start, slot);
+    // like vTaskDelayUntil: a late wakeup does not move the following slots
+    lastWake += std::chrono::milliseconds(task->period);
+    std::this_thread::sleep_until(lastWake);
+    slot += task->period * 1000;
+  }
+}
@@ -0,0 +1,251 @@
+#include <math.h>
+
+#include "simHal.h"
+#include "dhtDecoder.h"
+
+#define SIM_MV_PER_AMP 0.185          // ACS712 5A
+#define SIM_COUNTS_PER_VOLT (4095 / 3.3)
+#define SIM_NOISE_COUNTS 3            // RMS of an idle channel
+#define SIM_EVAPORATION 1.2           // cm per day
+#define SIM_FULL_DISTANCE 6           // cm after a refill
+#define SIM_READING_MICROS 300000     // 5 pings, 60ms apart
+#define SIM_DISTANCE_NOISE 0.3        // cm, standard deviation of a reading
+#define SIM_STRAY_ECHOES 50           // one reading in this many is a stray echo
+#define SIM_ZERO_COUNTS 1551          // ACS712 output at zero current (2.5V) behind the /2 divider
+#define SIM_SAMPLE_RATE 2400          // Hz, current sampling
+#define SIM_INRUSH 4                  // start-up surge on top of the running current, decays exponentially
+#define SIM_INRUSH_TAU 0.15           // seconds, healthy motor
+#define SIM_WORN_INRUSH_TAU 0.8       // ... with a failing run capacitor
+#define SIM_H3 0.08                   // 3rd harmonic of the running current
+#define SIM_WORN_H3 0.25
+#define SIM_H5 0.03
+#define SIM_LOAD_SPREAD 0.02          // capture to capture variation of the running current
+
+void SimHal::addLoad(uint8_t relayPin, uint8_t channel, float amps)
+{
+  if (loadCount < SIM_MAX_LOADS)
+    loads[loadCount++] = {relayPin, channel, amps, {}, 0, UINT32_MAX, 0};
+}
+
+void SimHal::failLoad(uint8_t channel, uint32_t fromEpoch, uint32_t toEpoch)
+{
+  clogLoad(channel, fromEpoch, toEpoch, 0);
+}
+
+void SimHal::clogLoad(uint8_t channel, uint32_t fromEpoch, uint32_t toEpoch, float share)
+{
+  for (uint8_t i = 0; i < loadCount; i++)
+  {
+    if (loads[i].channel == channel and loads[i].faultCount < SIM_MAX_FAULTS)
+      loads[i].faults[loads[i].faultCount++] = {fromEpoch, toEpoch, share};
+  }
+}
+
+void SimHal::wearLoad(uint8_t channel, uint32_t fromEpoch)
+{
+  for (uint8_t i = 0; i < loadCount; i++)
+  {
+    if (loads[i].channel == channel)
+      loads[i].wornFrom = fromEpoch;
+  }
+}
+
+void SimHal::heatWave(uint32_t fromEpoch, uint32_t toEpoch, float degrees)
+{
+  heatFrom = fromEpoch;
+  heatTo = toEpoch;
+  heatDegrees = degrees;
+}
+
+void SimHal::refillAt(uint32_t epoch)
+{
+  if (refillCount < MAX_REFILLS)
+    refills[refillCount++] = epoch;
+}
+
+void SimHal::advance(uint32_t micros)
+{
+  uint32_t before = epoch();
+  now += micros;
+  uint32_t after = epoch();
+  if (after == before)
+    return;
+  distance += SIM_EVAPORATION * (after - before) / 86400.0;
+  for (uint8_t i = 0; i < refillCount; i++)
+  {
+    if (refills[i] > before and refills[i] <= after)
+      distance = SIM_FULL_DISTANCE;
+  }
+}
+
+void SimHal::pinWrite(uint8_t pin, bool high)
+{
+  if (pin >= SIM_MAX_PINS)
+    return;
+  if (pins[pin] != high)
+    changes++;
+  pins[pin] = high;
+}
+
+void SimHal::writePins(uint32_t setMask, uint32_t clearMask)
+{
+  writes++;
+  for (uint8_t pin = 0; pin < 32; pin++)
+  {
+    if (clearMask & (1UL << pin))
+      pinWrite(pin, false);
+    if (!(setMask & (1UL << pin)) or pins[pin])
+      continue;
+    pinWrite(pin, true);
+    for (uint8_t i = 0; i < loadCount; i++)
+    {
+      if (loads[i].pin != pin)
+        continue;
+      loads[i].onSince = now;
+      // inrush: how close together loads start
+      if (started and (now - lastStart) / 1000 < closestStarts)
+        closestStarts = (now - lastStart) / 1000;
+      lastStart = now;
+      started = true;
+    }
+  }
+}
+
+float SimHal::loadCounts(const Load &load)
+{
+  uint32_t t = epoch();
+  if (!pins[load.pin])
+    return 0;
+  float share = 1;
+  for (uint8_t i = 0; i < load.faultCount; i++)
+  {
+    if (t >= load.faults[i].from and t < load.faults[i].to)
+      share = load.faults[i].share;
+  }
+  float tau = (t >= load.wornFrom) ? SIM_WORN_INRUSH_TAU : SIM_INRUSH_TAU;
+  float surge = 1 + SIM_INRUSH * expf(-(double)(now - load.onSince) / 1e6 / tau);
+  // sensor output goes through a /2 divider
+  return load.amps * share * surge * SIM_MV_PER_AMP / 2 * SIM_COUNTS_PER_VOLT;
+}
+
+float SimHal::currentRmsCounts(uint8_t channel)
+{
+  for (uint8_t i = 0; i < loadCount; i++)
+  {
+    if (loads[i].channel == channel and pins[loads[i].pin])
+    {
+      // the noise adds in quadrature
+      float counts = loadCounts(loads[i]);
+      return sqrtf(counts * counts + SIM_NOISE_COUNTS * SIM_NOISE_COUNTS);
+    }
+  }
+  return SIM_NOISE_COUNTS;
+}
+
+void SimHal::startCurrentCapture(uint8_t channel)
+{
+  captureChannel = channel;
+  captureDone = now + (uint64_t)CURRENT_CAPTURE_SIZE * 1000000 / SIM_SAMPLE_RATE;
+}
+
+bool SimHal::currentCaptureReady()
+{
+  if (captureChannel < 0 or now < captureDone)
+    return false;
+  // mains waveform at a random phase with the motor's harmonics, gaussian noise, 12 bit ADC
+  float counts = 0;
+  float h3 = SIM_H3;
+  for (uint8_t i = 0; i < loadCount; i++)
+  {
+    if (loads[i].channel == captureChannel and pins[loads[i].pin])
+    {
+      counts = loadCounts(loads[i]) * (1 + SIM_LOAD_SPREAD * gaussian(captureSeed));
+      h3 = (epoch() >= loads[i].wornFrom) ? SIM_WORN_H3 : SIM_H3;
+    }
+  }
+  float amplitude = counts * sqrtf(2 / (1 + h3 * h3 + SIM_H5 * SIM_H5));
+  float phase = 2 * M_PI * random(captureSeed);
+  for (int i = 0; i < CURRENT_CAPTURE_SIZE; i++)
+  {
+    float angle = 2 * M_PI * 60 * i / SIM_SAMPLE_RATE + phase;
+    float value = amplitude * (sinf(angle) + h3 * sinf(3 * angle + 0.5) + SIM_H5 * sinf(5 * angle + 1)) + SIM_NOISE_COUNTS * gaussian(captureSeed);
+    long sample = lroundf(SIM_ZERO_COUNTS + value);
+    captured[i] = (sample < 0) ? 0 : (sample > 4095) ? 4095 : sample;
+  }
+  captureChannel = -1;
+  return true;
+}
+
+float SimHal::currentVoltsPerCount()
+{
+  return 1 / SIM_COUNTS_PER_VOLT;
+}
+
+float SimHal::airTemperature()
+{
+  uint32_t t = epoch();
+  // coolest around 4am, warmest around 4pm
+  float hour = (t % 86400) / 3600.0;
+  float temperature = 78 + 9 * sin((hour - 10) * M_PI / 12);
+  if (t >= heatFrom and t < heatTo)
+    temperature += heatDegrees;
+  return temperature;
+}
+
+float SimHal::random(uint32_t &state)
+{
+  // xorshift32, 0..1 (24 bits, so the float never rounds up to 1)
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return (state >> 8) / 16777216.0f;
+}
+
+float SimHal::gaussian(uint32_t &state)
+{
+  // Box-Muller, standard normal
+  return sqrtf(-2 * logf(1 - random(state))) * cosf(2 * M_PI * random(state));
+}
+
+uint32_t SimHal::climateSequence()
+{
+  return now / 1000000 / climatePeriod;
+}
+
+int32_t SimHal::climateDueIn(uint32_t nowMs)
+{
+  return (int32_t)((climateSequence() + 1) * climatePeriod * 1000 - nowMs);
+}
+
+bool SimHal::readClimate(float &temperature, float &humidity, float &heatIndex)
+{
+  temperature = airTemperature();
+  humidity = 65 - (temperature - 78) * 1.5;
+  heatIndex = computeHeatIndex(temperature, humidity);
+  return true;
+}
+
+void SimHal::startDistance()
+{
+  measuring = true;
+  distanceDone = now + SIM_READING_MICROS;
+}
+
+bool SimHal::distanceReady()
+{
+  if (!measuring or now < distanceDone)
+    return false;
+  measuring = false;
+  return true;
+}
+
+bool SimHal::distanceMicros(uint32_t &echo)
+{
+  // round trip at the speed of sound in air at its temperature, gaussian noise and now and then a stray echo
+  float celsius = (airTemperature() - 32) / 1.8;
+  float measured = distance + SIM_DISTANCE_NOISE * gaussian(seed);
+  if (random() < 1.0 / SIM_STRAY_ECHOES)
+    measured = 5 + 30 * random();
+  echo = measured * 2 / ((331.3 + 0.606 * celsius) * 1e-4);
+  return true;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "hal.h"
+
+#define SIM_MAX_PINS 40
+#define SIM_MAX_LOADS 10
+#define SIM_MAX_FAULTS 4 // fail and clog windows per load
+#define SIM_CURRENT_WINDOW 100000 // microseconds, same as the real sampling window
+#define SIM_CLIMATE_PERIOD 900    // seconds between DHT readings unless set with climateEvery()
+
+// Simulated greenhouse behind the Hal: pumps that draw current while their
+// relay is on (less or none while failed), with a start-up surge and a mains
+// waveform carrying some harmonics, a daily temperature swing with a heat wave, and
+// a reservoir that evaporates and gets topped up, read with noise and stray echoes.
+// Time only moves in advance().
+class SimHal : public Hal
+{
+public:
+  explicit SimHal(uint32_t startEpoch) : start(startEpoch) {}
+
+  // setup
+  void addLoad(uint8_t relayPin, uint8_t channel, float amps); // pump on relayPin measured on current channel
+  // several windows per load, up to SIM_MAX_FAULTS
+  void failLoad(uint8_t channel, uint32_t fromEpoch, uint32_t toEpoch); // draws nothing in between
+  void clogLoad(uint8_t channel, uint32_t fromEpoch, uint32_t toEpoch, float share); // draws share of its current in between
+  void wearLoad(uint8_t channel, uint32_t fromEpoch); // run capacitor failing: slow starts, more 3rd harmonic
+  void heatWave(uint32_t fromEpoch, uint32_t toEpoch, float degrees);
+  void climateEvery(uint32_t seconds) { climatePeriod = seconds; } // the DHT task's read interval
+  void refillAt(uint32_t epoch);
+
+  void advance(uint32_t micros); // move the greenhouse forward
+  uint32_t pinChanges() const { return changes; }
+  uint32_t registerWrites() const { return writes; }
+  uint32_t closestStartsMillis() const { return closestStarts; } // shortest time between two loads starting
+  float waterDistance() const { return distance; }
+
+  uint32_t epoch() override { return start + now / 1000000; }
+  uint32_t micros() override { return (uint32_t)now; }
+  uint32_t millis() override { return (uint32_t)(now / 1000); }
+  void pinWrite(uint8_t pin, bool high) override;
+  bool pinRead(uint8_t pin) override { return pin < SIM_MAX_PINS and pins[pin]; }
+  void writePins(uint32_t setMask, uint32_t clearMask) override;
+  uint32_t currentSequence() override { return now / SIM_CURRENT_WINDOW; }
+  float currentRmsCounts(uint8_t channel) override;
+  float currentVoltsPerCount() override;
+  void startCurrentCapture(uint8_t channel) override;
+  bool currentCaptureReady() override;
+  const uint16_t *currentCapture() override { return captured; }
+  uint32_t climateSequence() override;
+  bool readClimate(float &temperature, float &humidity, float &heatIndex) override;
+  int32_t climateDueIn(uint32_t nowMs) override;
+  void startDistance() override;
+  bool distanceBusy() override { return measuring; }
+  bool distanceReady() override;
+  bool distanceMicros(uint32_t &echo) override;
+
+private:
+  float airTemperature(); // fahrenheit
+  float random() { return random(seed); }
+  float random(uint32_t &state);
+  float gaussian(uint32_t &state);
+
+  struct Load
+  {
+    uint8_t pin;
+    uint8_t channel;
+    float amps;
+    struct Fault
+    {
+      uint32_t from;
+      uint32_t to;
+      float share; // of the current drawn in between
+    } faults[SIM_MAX_FAULTS];
+    uint8_t faultCount;
+    uint32_t wornFrom;
+    uint64_t onSince; // micros the relay closed
+  };
+  float loadCounts(const Load &load); // RMS counts drawn now, start-up surge included
+
+  uint32_t start;
+  uint64_t now = 0; // microseconds since start
+  bool pins[SIM_MAX_PINS] = {};
+  uint32_t changes = 0;
+  uint32_t writes = 0;
+  uint64_t lastStart = 0;
+  bool started = false;
+  uint32_t closestStarts = UINT32_MAX;
+  Load loads[SIM_MAX_LOADS];
+  uint8_t loadCount = 0;
+  uint32_t heatFrom = 0;
+  uint32_t heatTo = 0;
+  float heatDegrees = 0;
+  uint32_t climatePeriod = SIM_CLIMATE_PERIOD;
+  static const uint8_t MAX_REFILLS = 16;
+  uint32_t refills[MAX_REFILLS];
+  uint8_t refillCount = 0;
+  float distance = 6; // cm from the sensor to the water
+  uint64_t distanceDone = 0;
+  bool measuring = false;
+  uint32_t seed = 1;
+  uint32_t captureSeed = 5; // apart from seed, so captures do not change the water level noise
+  uint16_t captured[CURRENT_CAPTURE_SIZE];
+  int8_t captureChannel = -1;
+  uint64_t captureDone = 0;
+};
@@ -0,0 +1,405 @@
+// Native build (pio run -e native): an end-to-end run of the pump control and
+// alarm logic of main.cpp (the Controller both builds share) against the
+// simulated greenhouse in simHal, as fast as it goes. The modules on their own
+// are covered by the unit tests in test/.
+//
+//   .pio/build/native/program [days]
+//
+// Water pump trips, a clogged pump, a failing air pump capacitor, a heat wave
+// and a skipped reservoir refill are scripted in. The run fails if one of them
+// is missed or a healthy pump is flagged, a relay changed without a driver edge
+// or two pumps started within INRUSH_STAGGER_MS, the wear is not balanced after
+// a failover, or something came due while the wake plan had the controller
+// asleep. Tuning values are the settings defaults.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#include "simHal.h"
+#include "controller.h"
+#include "boardOutputs.h"
+#include "alarms.h"
+#include "scheduleJson.h"
+
+#define START_EPOCH 1704067200 // 2024-01-01 00:00 local
+#define CONTROL_PERIOD 50000   // microseconds, control task period
+#define ALARM_PERIOD 250000    // microseconds, alarm task period
+#define DAY 86400
+
+static SimHal sim(START_EPOCH);
+
+static void writeOutputRegister(uint32_t setMask, uint32_t clearMask)
+{
+  sim.writePins(setMask, clearMask);
+}
+static OutputDriver driver(writeOutputRegister);
+static void writeOutputPin(uint8_t pin, bool on)
+{
+  driver.set(pin, on);
+}
+static void onAlarmEvent(const AlarmEvent &event);
+
+// same rig as main.cpp
+#define OUTPUT_COUNT BOARD_OUTPUT_COUNT
+static OutputBank<OUTPUT_COUNT> outputs(boardOutputs, writeOutputPin);
+static void onRoleMoved(size_t role, size_t from, size_t to, FailoverReason why);
+static FailoverSupervisor<OUTPUT_COUNT> failover(outputs, onRoleMoved);
+
+enum AlarmId
+{
+  ALARM_PUMP_CURRENT = OUTPUT_COUNT + SENSOR_PUMP_CURRENT,
+  ALARM_PUMP_HEALTH = OUTPUT_COUNT + SENSOR_PUMP_HEALTH,
+  ALARM_COUNT = OUTPUT_COUNT + SENSOR_ALARMS
+};
+static const AlarmConfig alarmConfig[] = {
+    {"Water Pump 1", ALARM_CRITICAL, 60, 0, false},
+    {"Water Pump 2", ALARM_CRITICAL, 60, 0, false},
+    {"Air Pump", ALARM_CRITICAL, 60, 0, false},
+    {"High Temperature", ALARM_WARNING, 0, 300, false},
+    {"Low Water", ALARM_CRITICAL, 120, 0, true},
+    {"Water Level Sensor", ALARM_WARNING, 120, 0, false},
+    {"Pump Current", ALARM_WARNING, 60, 300, false},
+    {"Pump Health", ALARM_WARNING, 300, 600, false},
+};
+static AlarmEngine<ALARM_COUNT> alarms(alarmConfig, onAlarmEvent);
+
+static Settings settings;
+static ScheduleWorkspace scheduleWork;
+static CurrentChannel currentChannels[OUTPUT_COUNT];
+static PumpHealth pumpHealth[OUTPUT_COUNT];
+static WaterLevelEstimator water;
+// the alarm task runs in the same loop, inputs go straight in
+static void postAlarmInput(uint8_t alarm, bool condition)
+{
+  alarms.setInput(alarm, condition, sim.millis(), sim.epoch());
+}
+static Controller<OUTPUT_COUNT> controller(sim, outputs, driver, failover, currentChannels, pumpHealth, water, settings, postAlarmInput);
+
+static uint32_t alarmEvents = 0;
+static uint32_t pumpCurrentRaised = 0; // epoch of the first Pump Current alarm
+static uint32_t pumpHealthRaised[16];  // epochs of the Pump Health alarms
+static uint32_t pumpHealthRaises = 0;
+static void onAlarmEvent(const AlarmEvent &event)
+{
+  if (event.alarm == ALARM_PUMP_CURRENT and event.type == ALARM_RAISED and pumpCurrentRaised == 0)
+    pumpCurrentRaised = event.epoch;
+  if (event.alarm == ALARM_PUMP_HEALTH and event.type == ALARM_RAISED and pumpHealthRaises < 16)
+    pumpHealthRaised[pumpHealthRaises++] = event.epoch;
+  if (event.alarm < OUTPUT_COUNT)
+    outputs[event.alarm].alarm = alarms.active(event.alarm);
+  const char *types[] = {"raised", "cleared", "acknowledged"};
+  uint32_t t = event.epoch - START_EPOCH;
+  printf("  day %2u %02u:%02u:%02u  %-18s %s\n", t / DAY, t % DAY / 3600, t % 3600 / 60, t % 60, alarmConfig[event.alarm].name, types[event.type]);
+  alarmEvents++;
+}
+
+static void onRoleMoved(size_t role, size_t, size_t to, FailoverReason why)
+{
+  // balancing moves a role most days, only takeovers are shown
+  if (why != FAILOVER_TAKEOVER)
+    return;
+  uint32_t t = sim.epoch() - START_EPOCH;
+  printf("  day %2u %02u:%02u:%02u  %-18s runs %s's schedule\n", t / DAY, t % DAY / 3600, t % 3600 / 60, t % 60, boardOutputs[to].name,
+         boardOutputs[role].name);
+}
+
+// the unit tests (test/, pio test -e native) link the same sources and bring their own main
+#ifndef PIO_UNIT_TESTING
+int main(int argc, char **argv)
+{
+  uint32_t days = (argc > 1) ? atoi(argv[1]) : 30;
+  defaultSettings(settings);
+  sim.climateEvery(settings.dhtInterval);
+  failover.configure(settings.failoverMs, settings.balanceHours * 3600000UL);
+
+  OutputSchedule schedules[OUTPUT_COUNT];
+  const char *error = compileSchedule(DEFAULT_SCHEDULE, strlen(DEFAULT_SCHEDULE), boardOutputs, OUTPUT_COUNT, schedules, scheduleWork);
+  if (error)
+  {
+    printf("Error: Default schedule %s\n", error);
+    return 1;
+  }
+  for (size_t i = 0; i < OUTPUT_COUNT; i++)
+  {
+    currentChannels[i].configure(sim.currentVoltsPerCount(), settings.mvPerAmp / 2);
+    outputs.schedule(i) = schedules[i];
+    driver.configure(boardOutputs[i].pin, boardOutputs[i].minOn * 1000, boardOutputs[i].minOff * 1000, true);
+  }
+
+  // water pumps ~1.2A, air pump ~0.8A
+  sim.addLoad(22, 0, 1.2);
+  sim.addLoad(21, 1, 1.2);
+  sim.addLoad(19, 2, 0.8);
+  // water pumps that stop drawing current, the other one has to take over within a second: for three
+  // days from an evening (night pulses, afternoons, then wear to balance), as a window starts and in the middle of one
+  const struct
+  {
+    uint8_t output;
+    uint32_t from, to;
+  } trips[] = {{1, START_EPOCH + 2 * DAY + 19 * 3600, START_EPOCH + 5 * DAY + 19 * 3600},
+               {0, START_EPOCH + 9 * DAY + 7 * 3600, START_EPOCH + 9 * DAY + 11 * 3600},
+               {0, START_EPOCH + 11 * DAY + 5 * 3600 + 59 * 60, START_EPOCH + 11 * DAY + 6 * 3600 + 20 * 60}};
+  uint32_t expectedFailures[OUTPUT_COUNT] = {};
+  uint32_t expectedRecoveries = 0;
+  for (const auto &trip : trips)
+  {
+    sim.failLoad(trip.output, trip.from, trip.to);
+    expectedFailures[trip.output] += trip.from < START_EPOCH + days * DAY;
+    expectedRecoveries += trip.to + 3600 < START_EPOCH + days * DAY;
+  }
+  const uint32_t clogFrom = START_EPOCH + 20 * DAY + 13 * 3600;
+  const uint32_t clogTo = START_EPOCH + 22 * DAY;
+  sim.clogLoad(1, clogFrom, clogTo, 0.7); // pump 2 intake clogs on day 20 until cleaned
+  const uint32_t wornFrom = START_EPOCH + 25 * DAY + 10 * 3600;
+  sim.wearLoad(2, wornFrom); // air pump run capacitor starts failing on day 25
+  sim.heatWave(START_EPOCH + 12 * DAY, START_EPOCH + 15 * DAY, 8);
+  uint32_t refills = 0;
+  for (uint32_t day = 7; day < days; day += 7)
+  {
+    if (day != 14) // one refill missed, the reservoir runs low
+    {
+      sim.refillAt(START_EPOCH + day * DAY + 9 * 3600);
+      refills++;
+    }
+  }
+
+  std::chrono::nanoseconds captureTime(0);
+  uint32_t captures = 0;
+  // the sensing and network task jobs, millis they are next due
+  uint32_t nextWaterLevel = 0, nextHistory = 0, nextFlush = HISTORY_FLUSH_INTERVAL, nextSample = MQTT_SAMPLE_INTERVAL;
+  uint64_t onTicks[OUTPUT_COUNT] = {};
+  ClimateController climate;
+  ClimateBounds bounds = {settings.climateControl == 1, settings.climateCoolF, settings.climateHotF, settings.climateMinScale, settings.climateMaxScale};
+  uint32_t lastAdapt = 0;
+  uint32_t scheduleChanges = 0;
+  float aerationLowest = settings.climateMaxScale, aerationHighest = settings.climateMinScale;
+  // low power is planned alongside the run as managePower does, with MQTT telemetry on; nothing may
+  // come due while the plan has the controller asleep
+  EnergyBudget sleeping(POWER_RATES), alwaysOn(POWER_RATES);
+  PowerState powerState = POWER_ACTIVE;
+  uint32_t asleepUntil = 0; // millis
+  uint32_t powerSleeps = 0, lateWakes = 0;
+  PowerReason lastSleepReason = POWER_LIMIT;
+  uint32_t dryMs = 0, longestDry = 0;
+  uint64_t ticks = (uint64_t)days * DAY * (1000000 / CONTROL_PERIOD);
+  std::chrono::nanoseconds controlTime(0);
+
+  printf("Simulating %u days, alarm events:\n", days);
+  auto begin = std::chrono::steady_clock::now();
+  for (uint64_t tick = 0; tick < ticks; tick++)
+  {
+    sim.advance(CONTROL_PERIOD);
+    uint32_t epoch = sim.epoch();
+
+    // control task: currents, pumps, alarm inputs
+    uint32_t ms = sim.millis();
+    auto controlStart = std::chrono::steady_clock::now();
+    controller.updateCurrentReadings();
+    auto captureBegin = std::chrono::steady_clock::now();
+    if (controller.analysePumpHealth())
+    {
+      captureTime += std::chrono::steady_clock::now() - captureBegin;
+      captures++;
+    }
+    if (ms - lastAdapt >= CLIMATE_UPDATE_INTERVAL)
+    {
+      lastAdapt = ms;
+      if (controller.followClimate(climate, bounds))
+      {
+        float scales[OUTPUT_COUNT];
+        for (size_t i = 0; i < OUTPUT_COUNT; i++)
+          scales[i] = climate.scale(boardOutputs[i].climate);
+        if (compileSchedule(DEFAULT_SCHEDULE, strlen(DEFAULT_SCHEDULE), boardOutputs, OUTPUT_COUNT, schedules, scheduleWork, scales) == NULL)
+        {
+          for (size_t i = 0; i < OUTPUT_COUNT; i++)
+            outputs.schedule(i) = schedules[i];
+          outputs.reschedule();
+          scheduleChanges++;
+        }
+        float aeration = climate.scale(CLIMATE_AERATION);
+        aerationLowest = (aeration < aerationLowest) ? aeration : aerationLowest;
+        aerationHighest = (aeration > aerationHighest) ? aeration : aerationHighest;
+      }
+    }
+    bool asleep = (int32_t)(ms - asleepUntil) < 0;
+    bool needed = false; // something the controller has to be awake for happened this tick
+    controller.control(epoch);
+    needed = driver.apply(ms, epoch) != 0;
+    // a water pump running for every water role that is on
+    bool dry = false;
+    for (size_t role = 0; role < OUTPUT_COUNT; role++)
+    {
+      if (boardOutputs[role].group == NO_GROUP or !outputs[role].scheduled)
+        continue;
+      bool covered = false;
+      for (size_t i = 0; i < OUTPUT_COUNT; i++)
+        covered = covered or (boardOutputs[i].group == boardOutputs[role].group and outputs[i].status);
+      dry = dry or !covered;
+    }
+    dryMs = dry ? dryMs + CONTROL_PERIOD / 1000 : 0;
+    longestDry = (dryMs > longestDry) ? dryMs : longestDry;
+    controller.feedPumpAlarms();
+    // alarm task
+    if (tick % (ALARM_PERIOD / CONTROL_PERIOD) == 0 and alarms.dueIn(ms) <= 0)
+    {
+      alarms.update(ms, epoch);
+      needed = true;
+    }
+    controlTime += std::chrono::steady_clock::now() - controlStart;
+
+    // sensing task, the history and MQTT jobs only need the controller awake
+    float f, h, hif;
+    needed = needed or controller.pollClimate(f, h, hif) == CLIMATE_NEW;
+    if ((int32_t)(ms - nextWaterLevel) >= 0)
+    {
+      needed = true;
+      nextWaterLevel += settings.waterLevelInterval * 1000;
+      sim.startDistance();
+    }
+    if (sim.distanceReady())
+      controller.readWaterLevel();
+    if ((int32_t)(ms - nextHistory) >= 0)
+    {
+      needed = true;
+      nextHistory += settings.historyInterval * 1000;
+    }
+    if ((int32_t)(ms - nextFlush) >= 0)
+    {
+      needed = true;
+      nextFlush += HISTORY_FLUSH_INTERVAL;
+    }
+    if ((int32_t)(ms - nextSample) >= 0)
+    {
+      needed = true;
+      nextSample += MQTT_SAMPLE_INTERVAL;
+    }
+
+    for (size_t i = 0; i < OUTPUT_COUNT; i++)
+      onTicks[i] += outputs[i].command;
+
+    // low power, as managePower and planWakeup
+    uint8_t relays = 0;
+    float amps = 0;
+    for (size_t i = 0; i < OUTPUT_COUNT; i++)
+    {
+      relays += driver.driven(boardOutputs[i].pin);
+      amps += outputs[i].current;
+    }
+    uint32_t windowStart;
+    bool window = inUploadWindow(epoch, settings.uploadInterval, settings.uploadWindow, windowStart);
+    alwaysOn.account(POWER_ACTIVE, true, relays, amps, CONTROL_PERIOD / 1000);
+    sleeping.account(asleep ? POWER_SLEEP : powerState, window, relays, amps, CONTROL_PERIOD / 1000);
+    if (asleep and needed)
+    {
+      if (lateWakes++ < 3)
+      {
+        uint32_t t = epoch - START_EPOCH;
+        printf("  day %2u %02u:%02u:%02u  asleep for %s, still %u ms to go\n", t / DAY, t % DAY / 3600, t % 3600 / 60, t % 60,
+               POWER_REASON_NAMES[lastSleepReason], asleepUntil - ms);
+      }
+    }
+    if (!asleep)
+    {
+      TaskDeadlines deadlines = {alarms.dueIn(ms), false, (int32_t)(nextWaterLevel - ms), (int32_t)(nextHistory - ms), (int32_t)(nextFlush - ms),
+                                 (int32_t)(nextSample - ms), false};
+      PowerPlan plan = controller.planWakeup(ms, deadlines);
+      powerState = plan.state;
+      if (plan.state == POWER_SLEEP)
+      {
+        asleepUntil = ms + plan.sleepMs;
+        lastSleepReason = plan.reason;
+        powerSleeps++;
+      }
+    }
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+  printf("\n%llu control ticks in %.2f s, %.0fx real time\n", (unsigned long long)ticks, elapsed, days * (double)DAY / elapsed);
+  printf("control + alarm logic: %.1f ns per tick, %u pump captures at %.2f us each\n", controlTime.count() / (double)ticks, captures,
+         captures ? captureTime.count() / 1000.0 / captures : 0.0);
+  printf("%u relay changes (%.1f/day) in %u register writes, %u alarm events\n", sim.pinChanges(), sim.pinChanges() / (double)days, sim.registerWrites(), alarmEvents);
+  for (size_t i = 0; i < OUTPUT_COUNT; i++)
+  {
+    printf("%-14s on %5.2f h/day, zero %.2f counts, nominal %.3f A, health %.0f (%s)\n", boardOutputs[i].name,
+           onTicks[i] * (CONTROL_PERIOD / 1e6) / 3600 / days, currentChannels[i].zeroCounts(), currentChannels[i].nominal(), pumpHealth[i].health(),
+           PUMP_FEATURE_NAMES[pumpHealth[i].worst()]);
+  }
+  printf("reservoir: %u stray echoes rejected, %u refills seen\n", water.outlierCount(), water.refillCount());
+  printf("climate: schedule compiled %u times (%.1f/day), aeration x%.1f-%.1f\n", scheduleChanges, scheduleChanges / (double)days, aerationLowest,
+         aerationHighest);
+  printf("low power: asleep %.0f%%, idle %.0f%%, active %.0f%% in %u sleeps (%.0f/day), wifi up %.0f%%\n", 100 * sleeping.share(POWER_SLEEP),
+         100 * sleeping.share(POWER_IDLE), 100 * sleeping.share(POWER_ACTIVE), powerSleeps, powerSleeps / (double)days, 100 * sleeping.wifiShare());
+  printf("energy: controller %.1f Wh/day in low power, %.1f Wh/day always on, pumps %.0f Wh/day\n", sleeping.controllerWhPerDay(),
+         alwaysOn.controllerWhPerDay(), sleeping.pumpWhPerDay());
+  printf("failover: %u takeovers, %u recoveries, %u runs balanced, longest a water role ran dry %u ms, water pumps ran %.1f h and %.1f h\n",
+         failover.takeoverCount(), failover.recoveryCount(), failover.balanceCount(), longestDry, failover.runSeconds(0) / 3600.0,
+         failover.runSeconds(1) / 3600.0);
+  bool ok = true;
+  if (water.refillCount() != refills)
+  {
+    printf("FAIL: %u reservoir refills seen, %u were made\n", water.refillCount(), refills);
+    ok = false;
+  }
+  if (sim.pinChanges() != driver.edgeCount())
+  {
+    printf("FAIL: %u pin changes but %u driver edges\n", sim.pinChanges(), driver.edgeCount());
+    ok = false;
+  }
+  // the clogged pump runs at 70%, it still counts as running so only the calibration can see it
+  bool clogged = days * DAY > clogFrom - START_EPOCH + 3 * 3600;
+  if (clogged ? (pumpCurrentRaised < clogFrom or pumpCurrentRaised > clogFrom + 3 * 3600) : pumpCurrentRaised != 0)
+  {
+    printf("FAIL: pump current alarm %s\n", pumpCurrentRaised == 0 ? "never raised for the clogged pump" : "raised outside the clog");
+    ok = false;
+  }
+  // the clog and the failing capacitor both show in the waveforms, nothing else may
+  bool clogSeen = false, wearSeen = false;
+  for (uint32_t i = 0; i < pumpHealthRaises; i++)
+  {
+    uint32_t t = pumpHealthRaised[i];
+    clogSeen = clogSeen or (t >= clogFrom and t <= clogFrom + 3 * 3600);
+    wearSeen = wearSeen or (t >= wornFrom and t <= wornFrom + 3 * 3600);
+    if (!(t >= clogFrom and t < clogTo) and t < wornFrom)
+    {
+      printf("FAIL: pump health alarm raised on day %u for a healthy pump\n", (t - START_EPOCH) / DAY);
+      ok = false;
+    }
+  }
+  if (clogSeen != (days * DAY > clogFrom - START_EPOCH + 3 * 3600) or wearSeen != (days * DAY > wornFrom - START_EPOCH + 3 * 3600))
+  {
+    printf("FAIL: pump health alarm %s for the clogged pump, %s for the failing capacitor\n", clogSeen ? "raised" : "not raised",
+           wearSeen ? "raised" : "not raised");
+    ok = false;
+  }
+  if (lateWakes != 0 or sleeping.share(POWER_SLEEP) < 0.1)
+  {
+    printf("FAIL: low power: %u events while asleep, asleep %.0f%% of the time\n", lateWakes, 100 * sleeping.share(POWER_SLEEP));
+    ok = false;
+  }
+  // every trip and nothing else is a failure, taken over within the detection time, a start and a window or two
+  bool failuresRight = failover.recoveryCount() == expectedRecoveries;
+  for (size_t i = 0; i < OUTPUT_COUNT; i++)
+    failuresRight = failuresRight and failover.failures(i) == expectedFailures[i];
+  if (!failuresRight or longestDry > FAILOVER_START_MS + (uint32_t)settings.failoverMs + INRUSH_STAGGER_MS + 2 * FAILOVER_WINDOW_MS)
+  {
+    printf("FAIL: failover: %u, %u and %u failures, %u recoveries (%u trips), a water role ran dry for %u ms\n", failover.failures(0), failover.failures(1),
+           failover.failures(2), failover.recoveryCount(), expectedRecoveries, longestDry);
+    ok = false;
+  }
+  // the three days of one pump doing all the water are worked off down to the balance time
+  int32_t lead = (int32_t)failover.runSeconds(0) - (int32_t)failover.runSeconds(1);
+  if (days > 9 and (failover.balanceCount() == 0 or abs(lead) > settings.balanceHours * 3600))
+  {
+    printf("FAIL: wear balancing: %u runs balanced, water pump 1 ahead by %.1f h\n", failover.balanceCount(), lead / 3600.0);
+    ok = false;
+  }
+  if (sim.closestStartsMillis() < INRUSH_STAGGER_MS)
+  {
+    printf("FAIL: two pumps started %u ms apart\n", sim.closestStartsMillis());
+    ok = false;
+  }
+  return ok ? 0 : 1;
+}
+#endif
@@ -0,0 +1,31 @@
+#include "spiffsJournalStorage.h"
+
+bool SpiffsJournalStorage::begin()
+{
+  if (!SPIFFS.exists(path) or SPIFFS.open(path, FILE_READ).size() != size)
+  {
+    // zeros are no valid record
+    File created = SPIFFS.open(path, FILE_WRITE);
+    if (!created)
+      return false;
+    uint8_t zeros[64] = {};
+    for (size_t n = 0; n < size; n += sizeof(zeros))
+      created.write(zeros, min(sizeof(zeros), size - n));
+    created.close();
+  }
+  file = SPIFFS.open(path, "r+");
+  return file;
+}
+
+bool SpiffsJournalStorage::read(uint32_t offset, void *data, size_t length)
+{
+  return file and file.seek(offset) and file.read((uint8_t *)data, length) == length;
+}
+
+bool SpiffsJournalStorage::write(uint32_t offset, const void *data, size_t length)
+{
+  if (!file or !file.seek(offset) or file.write((const uint8_t *)data, length) != length)
+    return false;
+  file.flush(); // commit the pages now, the next reset may not be clean
+  return true;
+}
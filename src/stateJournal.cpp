@@ -0,0 +1,64 @@
+#include <string.h>
+
+#include "stateJournal.h"
+#include "crc32.h"
+
+bool sameState(const RuntimeState &a, const RuntimeState &b)
+{
+  return memcmp(&a.overrides, &b.overrides, sizeof(RuntimeState) - offsetof(RuntimeState, overrides)) == 0;
+}
+
+void sealRecord(JournalRecord &record, const RuntimeState &state, uint32_t sequence)
+{
+  record.magic = JOURNAL_MAGIC;
+  record.sequence = sequence;
+  record.state = state;
+  record.crc = crc32((const uint8_t *)&record, offsetof(JournalRecord, crc));
+}
+
+bool intactRecord(const JournalRecord &record)
+{
+  return record.magic == JOURNAL_MAGIC and record.crc == crc32((const uint8_t *)&record, offsetof(JournalRecord, crc));
+}
+
+bool StateJournal::recover(RuntimeState &state)
+{
+  haveState = false;
+  last = 0;
+  next = 0;
+  for (uint16_t slot = 0; slot < slots; slot++)
+  {
+    JournalRecord record;
+    if (!storage.read(slot * sizeof(record), &record, sizeof(record)) or !intactRecord(record))
+      continue;
+    if (!haveState or record.sequence > last)
+    {
+      haveState = true;
+      last = record.sequence;
+      current = record.state;
+      next = (slot + 1) % slots;
+    }
+  }
+  if (haveState)
+    state = current;
+  return haveState;
+}
+
+bool StateJournal::append(const RuntimeState &state)
+{
+  if (haveState and sameState(state, current))
+  {
+    skips++;
+    return true;
+  }
+  JournalRecord record;
+  sealRecord(record, state, last + 1);
+  if (!storage.write(next * sizeof(record), &record, sizeof(record)))
+    return false;
+  haveState = true;
+  current = state;
+  last = record.sequence;
+  next = (next + 1) % slots;
+  writes++;
+  return true;
+}
@@ -0,0 +1,83 @@
+#include "taskScheduler.h"
+
+ScheduledTask::ScheduledTask(const char *name, uint32_t periodMs, uint8_t priority, int8_t core, uint32_t stackSize)
+    : name(name), period(periodMs), priority(priority), core(core), stackSize(stackSize)
+{
+}
+
+bool ScheduledTask::addJob(void (*callback)(), uint32_t intervalMs)
+{
+  if (jobCount >= SCHEDULER_MAX_JOBS or handle != NULL)
+  {
+    return false;
+  }
+  jobs[jobCount++] = {callback, intervalMs, clockMillis()};
+  return true;
+}
+
+bool ScheduledTask::setJobInterval(void (*callback)(), uint32_t intervalMs)
+{
+  for (uint8_t i = 0; i < jobCount; i++)
+  {
+    if (jobs[i].callback == callback)
+    {
+      jobs[i].interval = intervalMs;
+      return true;
+    }
+  }
+  return false;
+}
+
+int32_t ScheduledTask::jobDueIn(void (*callback)(), uint32_t nowMs) const
+{
+  for (uint8_t i = 0; i < jobCount; i++)
+  {
+    const Job &job = jobs[i];
+    if (job.callback == callback)
+      return (job.interval == 0) ? 0 : (int32_t)(job.previousMillis + job.interval - nowMs);
+  }
+  return INT32_MAX;
+}
+
+void ScheduledTask::wakeup(uint32_t start, uint32_t slot)
+{
+  wakeups++;
+  wakeLateness.record(start - slot);
+  runJobs();
+  uint32_t elapsed = clockMicros() - start;
+  // a light sleep during the wakeup is not run time
+  if (!restart)
+  {
+    runTime.record(elapsed);
+    if (elapsed > maxRunTime)
+    {
+      maxRunTime = elapsed;
+    }
+    if (elapsed > period * 1000)
+    {
+      overrunCount++;
+    }
+  }
+}
+
+void ScheduledTask::runJobs()
+{
+  unsigned long now = clockMillis();
+  for (uint8_t i = 0; i < jobCount; i++)
+  {
+    Job &job = jobs[i];
+    if (job.interval == 0)
+    {
+      job.callback();
+    }
+    else if (now - job.previousMillis >= job.interval)
+    {
+      job.callback();
+      job.previousMillis += job.interval;
+      if (now - job.previousMillis >= job.interval)
+      {
+        job.previousMillis = now; // more than one interval behind (shortened interval), do not catch up
+      }
+    }
+  }
+}
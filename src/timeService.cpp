@@ -0,0 +1,179 @@
+#include <SPIFFS.h>
+#include <WiFi.h>
+#include <sys/time.h>
+
+#include "timeService.h"
+
+#define DRIFT_FILE_MAGIC 0x44524654
+
+struct DriftFile
+{
+  uint32_t magic;
+  float ppm;
+};
+
+void TimeService::begin()
+{
+  DriftFile saved = {0, 0};
+  File file = SPIFFS.open(DRIFT_FILE, FILE_READ);
+  if (file)
+  {
+    if (file.read((uint8_t *)&saved, sizeof(saved)) == sizeof(saved) and saved.magic == DRIFT_FILE_MAGIC)
+    {
+      discipline.restore(saved.ppm);
+      savedPpm = discipline.ppm();
+      Serial.println((String) "Clock drift estimate " + savedPpm + " ppm");
+    }
+    file.close();
+  }
+}
+
+void TimeService::syncSoon()
+{
+  syncRequested = true;
+}
+
+void TimeService::setUtcOffset(int32_t seconds)
+{
+  newUtcOffset = seconds;
+}
+
+bool TimeService::update()
+{
+  uint32_t now = millis();
+  int64_t offset = newUtcOffset * 1000000LL;
+  if (offset != utcOffset and discipline.synced())
+  {
+    // the clock holds local time, move it by the difference
+    int64_t shifted = localMicros() + offset - utcOffset;
+    struct timeval tv = {(time_t)(shifted / 1000000), (suseconds_t)(shifted % 1000000)};
+    settimeofday(&tv, NULL);
+    discipline.shift(offset - utcOffset);
+  }
+  utcOffset = offset; // before the first sync the step sets the clock anyway
+  // drift compensation between syncs, in small slews
+  if (discipline.synced() and now - lastCompensate >= CLOCK_COMPENSATE_INTERVAL)
+  {
+    lastCompensate = now;
+    int64_t correction = discipline.compensate(localMicros());
+    if (correction != 0)
+      slew(correction);
+  }
+  if (waiting)
+  {
+    if (receive())
+      return true;
+    if (waiting and now - sentMillis >= NTP_TIMEOUT)
+      fail("timeout");
+    return false;
+  }
+  if ((syncRequested or (int32_t)(now - nextSync) >= 0) and WiFi.status() == WL_CONNECTED)
+  {
+    syncRequested = false;
+    send();
+  }
+  return false;
+}
+
+int64_t TimeService::localMicros()
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void TimeService::slew(int64_t micros)
+{
+  // adds to a slew still in progress instead of replacing it
+  struct timeval pending;
+  adjtime(NULL, &pending);
+  int64_t total = (int64_t)pending.tv_sec * 1000000 + pending.tv_usec + micros;
+  struct timeval delta = {(time_t)(total / 1000000), (suseconds_t)(total % 1000000)};
+  adjtime(&delta, NULL);
+}
+
+void TimeService::send()
+{
+  if (!udpStarted)
+    udpStarted = udp.begin(NTP_LOCAL_PORT);
+  // drop late answers to earlier requests
+  while (udp.parsePacket() > 0)
+    udp.flush();
+  uint8_t packet[NTP_PACKET_SIZE];
+  sentMicros = localMicros() - utcOffset;
+  ntpRequest(packet, sentMicros);
+  // beginPacket resolves the server name, a lookup only ever blocks the calling task
+  if (!udp.beginPacket(server, NTP_PORT))
+  {
+    fail("dns");
+    return;
+  }
+  udp.write(packet, sizeof(packet));
+  if (!udp.endPacket())
+  {
+    fail("send");
+    return;
+  }
+  sentMillis = millis();
+  waiting = true;
+}
+
+bool TimeService::receive()
+{
+  if (udp.parsePacket() < NTP_PACKET_SIZE)
+    return false;
+  int64_t received = localMicros() - utcOffset;
+  uint8_t packet[NTP_PACKET_SIZE];
+  int length = udp.read(packet, sizeof(packet));
+  NtpSample sample;
+  const char *reason = ntpParse(packet, (length > 0) ? length : 0, sentMicros, received, sample);
+  if (reason != NULL)
+  {
+    if (strcmp(reason, "reply does not match request") != 0)
+      fail(reason);
+    return false; // stale answer, keep waiting for ours
+  }
+  waiting = false;
+  bool step;
+  int64_t correction = discipline.sync(sample, received + utcOffset, step);
+  if (step)
+  {
+    int64_t corrected = localMicros() + correction;
+    struct timeval tv = {(time_t)(corrected / 1000000), (suseconds_t)(corrected % 1000000)};
+    settimeofday(&tv, NULL);
+  }
+  else
+  {
+    slew(correction);
+  }
+  lastCompensate = millis();
+  syncEpoch = localMicros() / 1000000;
+  syncs++;
+  error = "";
+  retryInterval = NTP_RETRY_INTERVAL;
+  nextSync = millis() + NTP_SYNC_INTERVAL * 1000UL;
+  if (fabs(discipline.ppm() - savedPpm) >= DRIFT_SAVE_CHANGE)
+    saveDrift();
+  return true;
+}
+
+void TimeService::fail(const char *reason)
+{
+  waiting = false;
+  failures++;
+  error = reason;
+  Serial.println((String) "Error: NTP sync failed (" + reason + "), retry in " + retryInterval + " s");
+  nextSync = millis() + retryInterval * 1000UL;
+  retryInterval = min(retryInterval * 2, (uint32_t)NTP_SYNC_INTERVAL);
+}
+
+void TimeService::saveDrift()
+{
+  DriftFile saved = {DRIFT_FILE_MAGIC, discipline.ppm()};
+  File file = SPIFFS.open(DRIFT_FILE, FILE_WRITE);
+  if (!file)
+    return;
+  file.write((const uint8_t *)&saved, sizeof(saved));
+  file.close();
+  savedPpm = saved.ppm;
+}
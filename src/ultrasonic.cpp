@@ -0,0 +1,76 @@
+#include "ultrasonic.h"
+
+void Ultrasonic::startReading()
+{
+  if (busy())
+    return;
+  pingCount = 0;
+  validCount = 0;
+  state = U_TRIGGER;
+}
+
+bool Ultrasonic::update(unsigned long nowMicros)
+{
+  switch (state)
+  {
+  case U_IDLE:
+    return false;
+  case U_TRIGGER:
+    echoHigh = false;
+    echoDone = false;
+    trigger();
+    triggerMicros = nowMicros;
+    state = U_WAIT_ECHO;
+    return false;
+  case U_WAIT_ECHO:
+    if (echoDone)
+    {
+      pings[validCount++] = echoEnd - echoStart;
+      pingCount++;
+      state = U_SETTLE;
+    }
+    else if (nowMicros - triggerMicros > ULTRASONIC_ECHO_TIMEOUT)
+    {
+      // no echo (or echo longer than max range), count the ping as lost
+      pingCount++;
+      state = U_SETTLE;
+    }
+    return false;
+  case U_SETTLE:
+    if (nowMicros - triggerMicros < ULTRASONIC_PING_SPACING)
+      return false;
+    if (pingCount < ULTRASONIC_PINGS_PER_READING)
+    {
+      state = U_TRIGGER;
+      return false;
+    }
+    finishReading();
+    return true;
+  }
+  return false;
+}
+
+void Ultrasonic::finishReading()
+{
+  state = U_IDLE;
+  if (validCount <= ULTRASONIC_PINGS_PER_READING / 2)
+  {
+    // keep the previous duration, just flag the fault
+    lastFault = U_TIMEOUT;
+    return;
+  }
+  // insertion sort, at most a handful of pings
+  for (uint8_t i = 1; i < validCount; i++)
+  {
+    unsigned long value = pings[i];
+    int8_t j = i - 1;
+    while (j >= 0 and pings[j] > value)
+    {
+      pings[j + 1] = pings[j];
+      j--;
+    }
+    pings[j + 1] = value;
+  }
+  medianDuration = pings[validCount / 2];
+  lastFault = U_OK;
+}
@@ -0,0 +1,150 @@
+#include <math.h>
+
+#include "waterLevel.h"
+
+float soundSpeed(float celsius)
+{
+  // 331.3 m/s at 0C, +0.606 m/s per degree
+  return (331.3 + 0.606 * celsius) * 1e-4;
+}
+
+float tankArea(const TankGeometry &tank)
+{
+  if (tank.diameterCm > 0)
+    return M_PI * tank.diameterCm * tank.diameterCm / 4;
+  return tank.lengthCm * tank.widthCm;
+}
+
+float tankLitres(const TankGeometry &tank, float distanceCm)
+{
+  float height = tank.depthCm - distanceCm;
+  return (height > 0) ? tankArea(tank) * height / 1000 : 0;
+}
+
+void WaterLevelEstimator::reset()
+{
+  started = false;
+  rejected = 0;
+  count = 0;
+  slope = 0;
+}
+
+bool WaterLevelEstimator::update(uint32_t echoMicros, float celsius, uint32_t epoch)
+{
+  measured = echoMicros * soundSpeed(celsius) / 2;
+  if (!started)
+  {
+    restart(measured, epoch);
+    return true;
+  }
+  float dt = (float)(epoch - lastEpoch);
+  float predicted = level + velocity * dt;
+  float residual = measured - predicted;
+  if (fabsf(residual) > WATER_GATE_CM)
+  {
+    outliers++;
+    if (rejected == 0 or fabsf(measured - jumpedTo) > WATER_GATE_CM)
+    {
+      // stray echoes land all over the place, a refill keeps reading the same
+      jumpedTo = measured;
+      rejected = 0;
+    }
+    if (++rejected < WATER_GATE_RESET)
+      return false;
+    // a real jump, the water was topped up (or drained)
+    restart(measured, epoch);
+    return true;
+  }
+  rejected = 0;
+  level = predicted + WATER_ALPHA * residual;
+  if (dt > 0)
+    velocity += WATER_BETA * residual / dt;
+  lastEpoch = epoch;
+  if ((int32_t)(epoch - nextPoint) >= 0)
+    addPoint();
+  collect(epoch);
+  return true;
+}
+
+void WaterLevelEstimator::restart(float distance, uint32_t epoch)
+{
+  if (started and distance < level - WATER_REFILL_CM)
+    refills++;
+  started = true;
+  level = distance;
+  velocity = 0;
+  lastEpoch = epoch;
+  rejected = 0;
+  count = 0;
+  slope = 0;
+  firstEpoch = epoch;
+  nextPoint = epoch + WATER_RATE_STEP;
+  collected = 0;
+  collect(epoch);
+}
+
+void WaterLevelEstimator::collect(uint32_t epoch)
+{
+  if (collected == 0)
+    sumTime = sumLevel = 0;
+  sumTime += epoch - firstEpoch;
+  sumLevel += measured;
+  collected++;
+}
+
+void WaterLevelEstimator::addPoint()
+{
+  // the mean of the readings since the last point, the raw readings are
+  // independent where the filtered level is not
+  nextPoint += WATER_RATE_STEP;
+  if (collected == 0)
+    return;
+  float time = sumTime / collected;
+  float mean = sumLevel / collected;
+  collected = 0;
+  if (count > 0 and mean < levels[(head + WATER_RATE_POINTS - 1) % WATER_RATE_POINTS] - WATER_REFILL_CM)
+  {
+    // topped up slowly enough for the filter to follow
+    refills++;
+    count = 0;
+    slope = 0;
+  }
+  times[head] = time;
+  levels[head] = mean;
+  head = (head + 1) % WATER_RATE_POINTS;
+  if (count < WATER_RATE_POINTS)
+    count++;
+  if (count < 2)
+    return;
+  // least squares slope over the window, about the means so floats stay exact enough
+  float meanT = 0, meanL = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint8_t at = (head + WATER_RATE_POINTS - 1 - i) % WATER_RATE_POINTS;
+    meanT += times[at];
+    meanL += levels[at];
+  }
+  meanT /= count;
+  meanL /= count;
+  float sxy = 0, sxx = 0;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    uint8_t at = (head + WATER_RATE_POINTS - 1 - i) % WATER_RATE_POINTS;
+    sxy += (times[at] - meanT) * (levels[at] - meanL);
+    sxx += (times[at] - meanT) * (times[at] - meanT);
+  }
+  slope = (sxx > 0) ? sxy / sxx * 3600 : 0;
+}
+
+float WaterLevelEstimator::consumption(const TankGeometry &tank) const
+{
+  return rateValid() ? dropRate() * tankArea(tank) / 1000 : 0;
+}
+
+float WaterLevelEstimator::hoursToEmpty(const TankGeometry &tank) const
+{
+  float perHour = consumption(tank);
+  if (!valid() or perHour <= 0)
+    return -1;
+  return tankLitres(tank, level) / perHour;
+}
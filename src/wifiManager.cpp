@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "wifiManager.h"
+
+void WifiManager::begin(uint32_t nowMs, uint32_t randomSeed)
+{
+  seed = randomSeed ? randomSeed : 1;
+  offlineSince = nowMs;
+  startScan(nowMs);
+}
+
+void WifiManager::update(uint32_t nowMs)
+{
+  uint32_t elapsed = nowMs - since;
+  switch (current)
+  {
+  case WIFI_SCANNING:
+  {
+    int found = radio.scanComplete();
+    if (found == -1 and elapsed < WIFI_SCAN_TIMEOUT)
+      break;
+    if (found >= 0)
+      pickCandidates(found);
+    else
+    {
+      // scan failed or hung, try every stored network blind
+      candidateCount = count;
+      for (uint8_t i = 0; i < count; i++)
+        candidates[i] = i;
+    }
+    radio.scanDelete();
+    nextCandidate = 0;
+    tryNext(nowMs);
+    break;
+  }
+  case WIFI_CONNECTING:
+    if (radio.connected())
+    {
+      failedRounds = 0;
+      backoff = 0;
+      connectCount++;
+      if (apActive)
+      {
+        radio.stopAccessPoint();
+        apActive = false;
+      }
+      enter(WIFI_CONNECTED, nowMs);
+    }
+    else if (elapsed >= WIFI_CONNECT_TIMEOUT)
+    {
+      failures++;
+      radio.disconnect();
+      tryNext(nowMs);
+    }
+    break;
+  case WIFI_CONNECTED:
+    if (!radio.connected())
+    {
+      // lost the AP, rescan straight away, the backoff only starts once a round fails
+      offlineSince = nowMs;
+      startScan(nowMs);
+    }
+    break;
+  case WIFI_BACKOFF:
+    if (elapsed >= backoff)
+      startScan(nowMs);
+    break;
+  case WIFI_SUSPENDED:
+    return;
+  }
+  if (current != WIFI_CONNECTED and !apActive and nowMs - offlineSince >= WIFI_AP_AFTER)
+  {
+    radio.startAccessPoint();
+    apActive = true;
+    if (onChange)
+      onChange(current, apActive);
+  }
+}
+
+void WifiManager::suspend(uint32_t nowMs)
+{
+  if (current == WIFI_SUSPENDED)
+    return;
+  if (current == WIFI_SCANNING)
+    radio.scanDelete();
+  radio.disconnect();
+  apActive = false;
+  radio.powerOff();
+  enter(WIFI_SUSPENDED, nowMs);
+}
+
+void WifiManager::resume(uint32_t nowMs)
+{
+  if (current != WIFI_SUSPENDED)
+    return;
+  radio.powerOn();
+  // a fresh start: no backoff carried over, the access point only after WIFI_AP_AFTER of this window
+  failedRounds = 0;
+  backoff = 0;
+  offlineSince = nowMs;
+  startScan(nowMs);
+}
+
+void WifiManager::enter(WifiState state, uint32_t nowMs)
+{
+  current = state;
+  since = nowMs;
+  if (onChange)
+    onChange(current, apActive);
+}
+
+void WifiManager::startScan(uint32_t nowMs)
+{
+  radio.startScan();
+  enter(WIFI_SCANNING, nowMs);
+}
+
+void WifiManager::pickCandidates(int found)
+{
+  int32_t strongest[WIFI_MAX_NETWORKS];
+  candidateCount = 0;
+  for (uint8_t n = 0; n < count; n++)
+  {
+    bool seen = false;
+    int32_t best = 0;
+    for (int i = 0; i < found; i++)
+    {
+      char ssid[WIFI_SSID_SIZE];
+      int32_t rssi;
+      radio.scanEntry(i, ssid, sizeof(ssid), rssi);
+      if (strcmp(ssid, networks[n].ssid) == 0 and (!seen or rssi > best))
+      {
+        seen = true;
+        best = rssi;
+      }
+    }
+    if (!seen)
+      continue;
+    // insertion sort, strongest first
+    uint8_t at = candidateCount++;
+    while (at > 0 and strongest[at - 1] < best)
+    {
+      strongest[at] = strongest[at - 1];
+      candidates[at] = candidates[at - 1];
+      at--;
+    }
+    strongest[at] = best;
+    candidates[at] = n;
+  }
+}
+
+void WifiManager::tryNext(uint32_t nowMs)
+{
+  if (nextCandidate >= candidateCount)
+  {
+    roundFailed(nowMs);
+    return;
+  }
+  network = candidates[nextCandidate++];
+  radio.connect(networks[network].ssid, networks[network].password);
+  enter(WIFI_CONNECTING, nowMs);
+}
+
+void WifiManager::roundFailed(uint32_t nowMs)
+{
+  uint32_t wait = WIFI_BACKOFF_MIN;
+  for (uint8_t i = 0; i < failedRounds and wait < WIFI_BACKOFF_MAX; i++)
+    wait *= 2;
+  if (wait > WIFI_BACKOFF_MAX)
+    wait = WIFI_BACKOFF_MAX;
+  if (failedRounds < 255)
+    failedRounds++;
+  // +-25% so devices that lost the same AP do not retry in lockstep
+  backoff = wait - wait / 4 + random() % (wait / 2 + 1);
+  enter(WIFI_BACKOFF, nowMs);
+}
+
+uint32_t WifiManager::random()
+{
+  // xorshift32
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// Shared by the host unit tests, pio test puts test/ on their include path.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <new>
+
+#define START_EPOCH 1704067200 // 2024-01-01 00:00, local time
+
+// Every heap allocation of the test binary, for the tests that check a code
+// path makes none or count them per call. A replacement operator new cannot be
+// inline, so the test defines TEST_COUNT_ALLOCATIONS before including this in
+// its one source file.
+#ifdef TEST_COUNT_ALLOCATIONS
+static size_t allocations = 0;
+void *operator new(size_t size)
+{
+  allocations++;
+  void *p = malloc(size ? size : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+#endif
@@ -0,0 +1,212 @@
+#include <unity.h>
+#include <vector>
+
+#include "alarms.h"
+
+enum
+{
+  MISMATCH,
+  HIGH_TEMP,
+  LOW_WATER
+};
+
+static const AlarmConfig configs[] = {
+    // name, severity, delay on (s), delay off (s), latching
+    {"Pump mismatch", ALARM_WARNING, 60, 10, false},
+    {"High temperature", ALARM_WARNING, 0, 300, false},
+    {"Low water", ALARM_CRITICAL, 30, 0, true},
+};
+
+static std::vector<AlarmEvent> events;
+static void onEvent(const AlarmEvent &event) { events.push_back(event); }
+
+#define T0 1000000              // epoch, stamps the events
+#define M0 (UINT32_MAX - 30500) // millisecond clock the delays run on, wraps 30.5 s in
+static uint32_t ms(uint32_t seconds) { return M0 + seconds * 1000; }
+
+void setUp() { events.clear(); }
+void tearDown() {}
+
+void test_delay_on()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  alarms.setInput(MISMATCH, true, ms(0), T0);
+  TEST_ASSERT_FALSE(alarms.active(MISMATCH));
+  TEST_ASSERT_EQUAL(60000, alarms.dueIn(ms(0)));
+  alarms.update(ms(59), T0 + 59);
+  TEST_ASSERT_FALSE(alarms.active(MISMATCH));
+  alarms.update(ms(60), T0 + 60);
+  TEST_ASSERT_TRUE(alarms.active(MISMATCH));
+  TEST_ASSERT_EQUAL(1, events.size());
+  TEST_ASSERT_EQUAL(ALARM_RAISED, events[0].type);
+  TEST_ASSERT_EQUAL(ALARM_WARNING, events[0].severity);
+  TEST_ASSERT_EQUAL(T0 + 60, events[0].epoch);
+  TEST_ASSERT_EQUAL(INT32_MAX, alarms.dueIn(ms(0)));
+}
+
+void test_glitch_shorter_than_delay_on()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  alarms.setInput(MISMATCH, true, ms(0), T0);
+  alarms.setInput(MISMATCH, false, ms(30), T0 + 30);
+  TEST_ASSERT_EQUAL(INT32_MAX, alarms.dueIn(ms(0)));
+  alarms.update(ms(1000), T0 + 1000);
+  TEST_ASSERT_FALSE(alarms.active(MISMATCH));
+  TEST_ASSERT_EQUAL(0, events.size());
+}
+
+void test_delay_off_hysteresis()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  alarms.setInput(HIGH_TEMP, true, ms(0), T0); // no delay on, raised right away
+  TEST_ASSERT_TRUE(alarms.active(HIGH_TEMP));
+  alarms.setInput(HIGH_TEMP, false, ms(100), T0 + 100);
+  TEST_ASSERT_EQUAL(400000, alarms.dueIn(ms(0)));
+  // back over the limit before the delay off ran out: the clear is cancelled
+  alarms.setInput(HIGH_TEMP, true, ms(200), T0 + 200);
+  TEST_ASSERT_EQUAL(INT32_MAX, alarms.dueIn(ms(0)));
+  alarms.update(ms(500), T0 + 500);
+  TEST_ASSERT_TRUE(alarms.active(HIGH_TEMP));
+  alarms.setInput(HIGH_TEMP, false, ms(600), T0 + 600);
+  alarms.update(ms(899), T0 + 899);
+  TEST_ASSERT_TRUE(alarms.active(HIGH_TEMP));
+  alarms.update(ms(900), T0 + 900);
+  TEST_ASSERT_FALSE(alarms.active(HIGH_TEMP));
+  TEST_ASSERT_EQUAL(2, events.size());
+  TEST_ASSERT_EQUAL(ALARM_CLEARED, events[1].type);
+}
+
+void test_latching_needs_acknowledge()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  alarms.setInput(LOW_WATER, true, ms(0), T0);
+  alarms.update(ms(30), T0 + 30);
+  TEST_ASSERT_TRUE(alarms.active(LOW_WATER));
+  alarms.setInput(LOW_WATER, false, ms(100), T0 + 100); // refilled
+  alarms.update(ms(10000), T0 + 10000);
+  TEST_ASSERT_TRUE(alarms.active(LOW_WATER));
+  TEST_ASSERT_EQUAL(INT32_MAX, alarms.dueIn(ms(0)));
+  TEST_ASSERT_TRUE(alarms.acknowledge(LOW_WATER, ms(10001), T0 + 10001));
+  TEST_ASSERT_FALSE(alarms.acknowledge(LOW_WATER, ms(10002), T0 + 10002)); // already acknowledged
+  TEST_ASSERT_FALSE(alarms.active(LOW_WATER));                  // no delay off
+  TEST_ASSERT_EQUAL(3, events.size());
+  TEST_ASSERT_EQUAL(ALARM_RAISED, events[0].type);
+  TEST_ASSERT_EQUAL(ALARM_ACKNOWLEDGED, events[1].type);
+  TEST_ASSERT_EQUAL(ALARM_CLEARED, events[2].type);
+}
+
+void test_acknowledge_while_condition_holds()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  TEST_ASSERT_FALSE(alarms.acknowledge(LOW_WATER, ms(0), T0)); // nothing to acknowledge
+  alarms.setInput(LOW_WATER, true, ms(0), T0);
+  alarms.update(ms(30), T0 + 30);
+  TEST_ASSERT_TRUE(alarms.acknowledge(LOW_WATER, ms(40), T0 + 40));
+  TEST_ASSERT_TRUE(alarms.active(LOW_WATER));
+  TEST_ASSERT_TRUE(alarms.acknowledged(LOW_WATER));
+  // acknowledged latches clear as soon as the condition goes
+  alarms.setInput(LOW_WATER, false, ms(50), T0 + 50);
+  TEST_ASSERT_FALSE(alarms.active(LOW_WATER));
+  // a new raise needs a new acknowledge
+  alarms.setInput(LOW_WATER, true, ms(60), T0 + 60);
+  alarms.update(ms(90), T0 + 90);
+  TEST_ASSERT_TRUE(alarms.active(LOW_WATER));
+  TEST_ASSERT_FALSE(alarms.acknowledged(LOW_WATER));
+}
+
+void test_unchanged_input_is_not_evaluated()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  alarms.setInput(MISMATCH, true, ms(0), T0);
+  // the same input again does not restart the delay
+  alarms.setInput(MISMATCH, true, ms(50), T0 + 50);
+  TEST_ASSERT_EQUAL(60000, alarms.dueIn(ms(0)));
+  alarms.update(ms(60), T0 + 60);
+  TEST_ASSERT_TRUE(alarms.active(MISMATCH));
+  alarms.setInput(MISMATCH, true, ms(70), T0 + 70);
+  TEST_ASSERT_EQUAL(1, events.size());
+}
+
+void test_earliest_deadline_across_alarms()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  alarms.setInput(MISMATCH, true, ms(0), T0);
+  alarms.setInput(LOW_WATER, true, ms(10), T0 + 10);
+  TEST_ASSERT_EQUAL(40000, alarms.dueIn(ms(0)));
+  alarms.update(ms(40), T0 + 40);
+  TEST_ASSERT_TRUE(alarms.active(LOW_WATER));
+  TEST_ASSERT_EQUAL(60000, alarms.dueIn(ms(0)));
+}
+
+void test_clock_step_keeps_delays()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  // NTP steps the clock an hour ahead during the delay on: still 60 s
+  alarms.setInput(MISMATCH, true, ms(0), T0);
+  alarms.update(ms(59), T0 + 3600 + 59);
+  TEST_ASSERT_FALSE(alarms.active(MISMATCH));
+  alarms.update(ms(60), T0 + 3600 + 60);
+  TEST_ASSERT_TRUE(alarms.active(MISMATCH));
+  TEST_ASSERT_EQUAL(T0 + 3600 + 60, events[0].epoch);
+  // ... and back two hours during the delay off: still 10 s
+  alarms.setInput(MISMATCH, false, ms(100), T0 - 3600 + 100);
+  alarms.update(ms(110), T0 - 3600 + 110);
+  TEST_ASSERT_FALSE(alarms.active(MISMATCH));
+  TEST_ASSERT_EQUAL(T0 - 3600 + 110, events[1].epoch);
+}
+
+void test_restore_without_event()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  alarms.restore(LOW_WATER, false);
+  TEST_ASSERT_TRUE(alarms.active(LOW_WATER));
+  TEST_ASSERT_TRUE(alarms.condition(LOW_WATER));
+  TEST_ASSERT_EQUAL(0, events.size());
+  alarms.setInput(LOW_WATER, false, ms(0), T0);
+  TEST_ASSERT_TRUE(alarms.active(LOW_WATER)); // still latched
+  alarms.acknowledge(LOW_WATER, ms(1), T0 + 1);
+  TEST_ASSERT_FALSE(alarms.active(LOW_WATER));
+}
+
+void test_history_ring()
+{
+  AlarmEngine<3> alarms(configs, onEvent);
+  for (uint32_t i = 0; i < ALARM_HISTORY_SIZE; i++)
+  {
+    alarms.setInput(HIGH_TEMP, true, ms(i * 1000), T0 + i * 1000);
+    alarms.setInput(HIGH_TEMP, false, ms(i * 1000 + 1), T0 + i * 1000 + 1);
+    alarms.update(ms(i * 1000 + 301), T0 + i * 1000 + 301);
+  }
+  AlarmHistory &history = alarms.history();
+  TEST_ASSERT_EQUAL(ALARM_HISTORY_SIZE, history.size());
+  TEST_ASSERT_EQUAL(ALARM_CLEARED, history.recent(0).type);
+  TEST_ASSERT_EQUAL(T0 + (ALARM_HISTORY_SIZE - 1) * 1000 + 301, history.recent(0).epoch);
+  TEST_ASSERT_EQUAL(ALARM_RAISED, history.recent(ALARM_HISTORY_SIZE - 1).type);
+  TEST_ASSERT_EQUAL(T0 + ALARM_HISTORY_SIZE / 2 * 1000, history.recent(ALARM_HISTORY_SIZE - 1).epoch);
+  // the flash copy comes back in the same order
+  AlarmEvent saved[ALARM_HISTORY_SIZE];
+  for (uint16_t i = 0; i < ALARM_HISTORY_SIZE; i++)
+    saved[(history.nextSlot() + i) % ALARM_HISTORY_SIZE] = history.recent(ALARM_HISTORY_SIZE - 1 - i);
+  AlarmHistory restored;
+  restored.restore(saved, history.nextSlot(), 1000);
+  TEST_ASSERT_EQUAL(ALARM_HISTORY_SIZE, restored.size());
+  for (uint16_t i = 0; i < ALARM_HISTORY_SIZE; i++)
+    TEST_ASSERT_EQUAL(history.recent(i).epoch, restored.recent(i).epoch);
+  TEST_ASSERT_EQUAL(8, sizeof(AlarmEvent));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_delay_on);
+  RUN_TEST(test_glitch_shorter_than_delay_on);
+  RUN_TEST(test_delay_off_hysteresis);
+  RUN_TEST(test_latching_needs_acknowledge);
+  RUN_TEST(test_acknowledge_while_condition_holds);
+  RUN_TEST(test_unchanged_input_is_not_evaluated);
+  RUN_TEST(test_earliest_deadline_across_alarms);
+  RUN_TEST(test_clock_step_keeps_delays);
+  RUN_TEST(test_restore_without_event);
+  RUN_TEST(test_history_ring);
+  return UNITY_END();
+}
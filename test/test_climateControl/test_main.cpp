@@ -0,0 +1,227 @@
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "boardOutputs.h"
+#include "climateControl.h"
+#include "dhtDecoder.h"
+#include "outputs.h"
+#include "pumpSchedule.h"
+#include "scheduleJson.h"
+#include "settings.h"
+#include "testSupport.h"
+
+#define COUNT BOARD_OUTPUT_COUNT
+
+// only the pulses of the water pumps are scaled, not their 6 hour window
+#define WINDOW_MINUTES 360
+
+static ScheduleWorkspace work;
+static ClimateBounds bounds;
+
+// a day of weather: a daily swing around meanF, drier as it warms
+struct WeatherTrace
+{
+  const char *name;
+  float meanF;
+  float swingF;
+  float humidity; // % at meanF
+};
+static const WeatherTrace COOL = {"cool", 62, 5, 70};
+static const WeatherTrace MILD = {"mild", 78, 3, 55};
+static const WeatherTrace HOT = {"hot", 92, 6, 60};
+
+// what the default schedule did on the second day of a trace
+struct Day
+{
+  uint32_t minutes[COUNT];
+  uint32_t starts[COUNT];
+  float lowest[CLIMATE_ROLES];
+  float highest[CLIMATE_ROLES];
+};
+
+// The climate controller over two days of a weather trace, a DHT reading every
+// 15 min and an evaluation every minute as adaptSchedule. Every scaled schedule
+// has to compile.
+static Day runWeatherTrace(const WeatherTrace &trace, const ClimateBounds &bounds, float reservoir)
+{
+  Day day = {};
+  ClimateController controller;
+  OutputSchedule schedules[COUNT];
+  TEST_ASSERT_NULL(compileSchedule(DEFAULT_SCHEDULE, strlen(DEFAULT_SCHEDULE), boardOutputs, COUNT, schedules, work));
+  bool previous[COUNT] = {};
+  for (uint8_t role = 0; role < CLIMATE_ROLES; role++)
+  {
+    day.lowest[role] = bounds.maxScale;
+    day.highest[role] = bounds.minScale;
+  }
+  for (uint32_t minute = 0; minute < 2 * MINUTES_PER_DAY; minute++)
+  {
+    uint32_t epoch = START_EPOCH + minute * 60;
+    if (minute % 15 == 0)
+    {
+      float f = trace.meanF + trace.swingF * sinf((minute % MINUTES_PER_DAY / 60.0f - 10) * M_PI / 12);
+      controller.reading(f, computeHeatIndex(f, trace.humidity - (f - trace.meanF) * 1.5f), epoch);
+    }
+    if (controller.update(bounds, reservoir))
+    {
+      float scales[COUNT];
+      for (size_t i = 0; i < COUNT; i++)
+        scales[i] = controller.scale(boardOutputs[i].climate);
+      TEST_ASSERT_NULL(compileSchedule(DEFAULT_SCHEDULE, strlen(DEFAULT_SCHEDULE), boardOutputs, COUNT, schedules, work, scales));
+    }
+    if (minute < MINUTES_PER_DAY)
+      continue;
+    for (uint8_t role = 0; role < CLIMATE_ROLES; role++)
+    {
+      float scale = controller.scale((ClimateRole)role);
+      day.lowest[role] = fminf(scale, day.lowest[role]);
+      day.highest[role] = fmaxf(scale, day.highest[role]);
+    }
+    for (size_t i = 0; i < COUNT; i++)
+    {
+      bool on = schedules[i].stateAt(epoch);
+      day.minutes[i] += on;
+      day.starts[i] += on and !previous[i];
+      previous[i] = on;
+    }
+  }
+  return day;
+}
+
+static Day asWritten()
+{
+  ClimateBounds off = bounds;
+  off.enabled = false;
+  return runWeatherTrace(HOT, off, 1);
+}
+
+static void report(const char *name, const Day &day)
+{
+  char line[160];
+  snprintf(line, sizeof(line), "%-4s day water pump 1 %3u min (%2u starts), air pump %4u min (%2u starts), aeration x%.1f-%.1f", name, day.minutes[0],
+           day.starts[0], day.minutes[2], day.starts[2], day.lowest[CLIMATE_AERATION], day.highest[CLIMATE_AERATION]);
+  TEST_MESSAGE(line);
+}
+
+static void assertWithinBounds(const Day &day)
+{
+  for (uint8_t role = 0; role < CLIMATE_ROLES; role++)
+  {
+    TEST_ASSERT_TRUE(day.lowest[role] >= bounds.minScale);
+    TEST_ASSERT_TRUE(day.highest[role] <= bounds.maxScale);
+  }
+}
+
+void setUp()
+{
+  Settings defaults;
+  defaultSettings(defaults);
+  bounds = {true, defaults.climateCoolF, defaults.climateHotF, defaults.climateMinScale, defaults.climateMaxScale};
+}
+void tearDown() {}
+
+void test_disabled_keeps_schedule()
+{
+  Day fixed = asWritten();
+  report("any", fixed);
+  TEST_ASSERT_EQUAL_FLOAT(1, fixed.highest[CLIMATE_IRRIGATION]);
+  TEST_ASSERT_EQUAL_FLOAT(1, fixed.lowest[CLIMATE_AERATION]);
+}
+
+void test_mild_day_as_written()
+{
+  Day fixed = asWritten();
+  Day day = runWeatherTrace(MILD, bounds, 1);
+  report(MILD.name, day);
+  assertWithinBounds(day);
+  TEST_ASSERT_EQUAL_UINT32_ARRAY(fixed.minutes, day.minutes, COUNT);
+}
+
+void test_cool_day_pumps_less()
+{
+  Day fixed = asWritten();
+  Day day = runWeatherTrace(COOL, bounds, 1);
+  report(COOL.name, day);
+  assertWithinBounds(day);
+  TEST_ASSERT_LESS_THAN((fixed.minutes[0] - WINDOW_MINUTES) * 3 / 4, day.minutes[0] - WINDOW_MINUTES);
+  TEST_ASSERT_LESS_THAN(fixed.starts[0], day.starts[0]);
+  TEST_ASSERT_LESS_THAN(fixed.minutes[2] * 3 / 4, day.minutes[2]);
+}
+
+void test_hot_day_pumps_more()
+{
+  Day fixed = asWritten();
+  Day day = runWeatherTrace(HOT, bounds, 1);
+  report(HOT.name, day);
+  assertWithinBounds(day);
+  TEST_ASSERT_GREATER_THAN((fixed.minutes[0] - WINDOW_MINUTES) * 5 / 4, day.minutes[0] - WINDOW_MINUTES);
+  TEST_ASSERT_GREATER_THAN(fixed.minutes[2] * 5 / 4, day.minutes[2]);
+  // longer pulses, not more of them
+  TEST_ASSERT_LESS_OR_EQUAL(fixed.starts[2], day.starts[2]);
+  // the same weather gives the same schedule
+  Day again = runWeatherTrace(HOT, bounds, 1);
+  TEST_ASSERT_EQUAL_UINT32_ARRAY(day.minutes, again.minutes, COUNT);
+  TEST_ASSERT_EQUAL_UINT32_ARRAY(day.starts, again.starts, COUNT);
+}
+
+void test_low_reservoir_holds_irrigation_back()
+{
+  // on a hot day the aeration still goes up
+  Day fixed = asWritten();
+  Day day = runWeatherTrace(HOT, bounds, 0);
+  TEST_ASSERT_TRUE(day.highest[CLIMATE_IRRIGATION] <= bounds.minScale);
+  TEST_ASSERT_TRUE(day.highest[CLIMATE_AERATION] > 1);
+  TEST_ASSERT_LESS_THAN(fixed.minutes[0] - WINDOW_MINUTES, day.minutes[0] - WINDOW_MINUTES);
+}
+
+void test_trend_looks_ahead()
+{
+  // the same heat index warming up is stepped up, cooling down it is not
+  ClimateController rising, falling;
+  for (int i = 0; i < 4; i++)
+  {
+    rising.reading(80 + 2 * i, 80 + 2 * i, START_EPOCH + i * 900);
+    falling.reading(92 - 2 * i, 92 - 2 * i, START_EPOCH + i * 900);
+  }
+  rising.update(bounds, 1);
+  falling.update(bounds, 1);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 8, rising.trend());
+  TEST_ASSERT_TRUE(rising.scale(CLIMATE_AERATION) > 1);
+  TEST_ASSERT_EQUAL_FLOAT(1, falling.scale(CLIMATE_AERATION));
+  // without a reading it goes back to the schedule as written straight away
+  rising.stale();
+  TEST_ASSERT_TRUE(rising.update(bounds, 1));
+  TEST_ASSERT_EQUAL_FLOAT(1, rising.scale(CLIMATE_AERATION));
+}
+
+void test_scaled_pulses_keep_duty_cycle()
+{
+  // every scale fits the transition table and keeps the duty cycle of the air pump's 15/30 pulse
+  for (int step = 5; step <= 80; step++)
+  {
+    float scale = step * 0.05f;
+    float scales[COUNT] = {scale, scale, scale};
+    OutputSchedule schedules[COUNT];
+    TEST_ASSERT_NULL(compileSchedule(DEFAULT_SCHEDULE, strlen(DEFAULT_SCHEDULE), boardOutputs, COUNT, schedules, work, scales));
+    uint32_t on = 0;
+    for (uint32_t minute = 0; minute < MINUTES_PER_DAY; minute++)
+      on += schedules[2].stateAt(START_EPOCH + minute * 60);
+    float target = (scale * 0.5f < 1) ? scale * 0.5f : 1;
+    TEST_ASSERT_FLOAT_WITHIN(0.04, target, on / (float)MINUTES_PER_DAY);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_disabled_keeps_schedule);
+  RUN_TEST(test_mild_day_as_written);
+  RUN_TEST(test_cool_day_pumps_less);
+  RUN_TEST(test_hot_day_pumps_more);
+  RUN_TEST(test_low_reservoir_holds_irrigation_back);
+  RUN_TEST(test_trend_looks_ahead);
+  RUN_TEST(test_scaled_pulses_keep_duty_cycle);
+  return UNITY_END();
+}
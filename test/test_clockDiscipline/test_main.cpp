@@ -0,0 +1,223 @@
+#include <unity.h>
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+#include "clockDiscipline.h"
+
+#define START 1718000000000000LL // unix microseconds
+#define SECOND 1000000LL
+#define HOUR (3600 * SECOND)
+
+static std::mt19937 random32(1234);
+
+// The ESP32's clock: runs slowPpm slow against true time, set and slewed by the time service
+struct DriftingClock
+{
+  double slowPpm;
+  int64_t trueStart;
+  int64_t localStart;
+  int64_t adjust = 0;
+
+  DriftingClock(double slowPpm, int64_t trueStart, int64_t localStart) : slowPpm(slowPpm), trueStart(trueStart), localStart(localStart) {}
+
+  int64_t local(int64_t trueMicros) const { return localStart + (int64_t)((trueMicros - trueStart) * (1 - slowPpm / 1e6)) + adjust; }
+};
+
+// A local NTP server on true time, answering after a hold time, over a link
+// whose two directions take different times
+struct FakeNtpServer
+{
+  uint8_t stratum = 2;
+  int64_t holdMicros = 40;
+
+  // the reply to a request the client sent at true time sentTrue, and the true time it arrives back
+  void answer(const uint8_t *request, int64_t sentTrue, int64_t upMicros, int64_t downMicros, uint8_t *reply, int64_t &arrivesTrue)
+  {
+    memset(reply, 0, NTP_PACKET_SIZE);
+    int64_t received = sentTrue + upMicros;
+    int64_t transmitted = received + holdMicros;
+    reply[0] = 0x24; // version 4, server mode
+    reply[1] = stratum;
+    memcpy(reply + 24, request + 40, 8); // originate: the client's transmit timestamp
+    uint8_t stamp[NTP_PACKET_SIZE];
+    ntpRequest(stamp, received); // the client code writes NTP timestamps, borrow it
+    memcpy(reply + 32, stamp + 40, 8);
+    ntpRequest(stamp, transmitted);
+    memcpy(reply + 40, stamp + 40, 8);
+    arrivesTrue = transmitted + downMicros;
+  }
+};
+
+// one exchange at true time now, the way the time service runs it
+static const char *exchange(FakeNtpServer &server, DriftingClock &clock, int64_t now, NtpSample &sample, int64_t up = -1, int64_t down = -1)
+{
+  if (up < 0)
+    up = 1000 + random32() % 4000; // a LAN, 1-5 ms each way
+  if (down < 0)
+    down = 1000 + random32() % 4000;
+  uint8_t request[NTP_PACKET_SIZE];
+  uint8_t reply[NTP_PACKET_SIZE];
+  int64_t sent = clock.local(now);
+  ntpRequest(request, sent);
+  int64_t arrives;
+  server.answer(request, now, up, down, reply, arrives);
+  return ntpParse(reply, sizeof(reply), sent, clock.local(arrives), sample);
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_offset_and_delay()
+{
+  FakeNtpServer server;
+  DriftingClock clock(0, START, START - 5 * SECOND); // 5 s behind
+  NtpSample sample;
+  TEST_ASSERT_NULL(exchange(server, clock, START, sample, 10000, 10000));
+  TEST_ASSERT_INT_WITHIN(1, 5 * SECOND, sample.offset); // symmetric link: exact up to timestamp rounding
+  TEST_ASSERT_INT_WITHIN(1, 20000, sample.delay);
+  TEST_ASSERT_EQUAL(2, sample.stratum);
+  // an asymmetric link is off by half the difference, never more
+  TEST_ASSERT_NULL(exchange(server, clock, START, sample, 2000, 30000));
+  TEST_ASSERT_INT_WITHIN(1, 5 * SECOND - 14000, sample.offset);
+  // after the NTP era rolls over in 2036
+  DriftingClock later(0, 2200000000LL * SECOND, 2200000000LL * SECOND + 3 * SECOND);
+  TEST_ASSERT_NULL(exchange(server, later, 2200000000LL * SECOND, sample, 5000, 5000));
+  TEST_ASSERT_INT_WITHIN(1, -3 * SECOND, sample.offset);
+}
+
+void test_bad_replies()
+{
+  FakeNtpServer server;
+  DriftingClock clock(0, START, START);
+  uint8_t request[NTP_PACKET_SIZE];
+  uint8_t reply[NTP_PACKET_SIZE];
+  int64_t arrives;
+  NtpSample sample;
+  ntpRequest(request, START);
+  TEST_ASSERT_EQUAL_HEX8(0x23, request[0]);
+  server.answer(request, START, 1000, 1000, reply, arrives);
+  TEST_ASSERT_NULL(ntpParse(reply, sizeof(reply), START, arrives, sample));
+  TEST_ASSERT_EQUAL_STRING("short packet", ntpParse(reply, NTP_PACKET_SIZE - 1, START, arrives, sample));
+  TEST_ASSERT_EQUAL_STRING("reply does not match request", ntpParse(reply, sizeof(reply), START + 1, arrives, sample));
+  TEST_ASSERT_EQUAL_STRING("round trip too slow", ntpParse(reply, sizeof(reply), START, START + NTP_MAX_DELAY + 2000, sample));
+  reply[0] = 0x23; // a client request reflected back
+  TEST_ASSERT_EQUAL_STRING("not a server reply", ntpParse(reply, sizeof(reply), START, arrives, sample));
+  reply[0] = 0xe4; // alarm: not synchronized
+  TEST_ASSERT_EQUAL_STRING("server not synchronized", ntpParse(reply, sizeof(reply), START, arrives, sample));
+  reply[0] = 0x24;
+  reply[1] = 0; // kiss-o'-death
+  TEST_ASSERT_EQUAL_STRING("bad stratum", ntpParse(reply, sizeof(reply), START, arrives, sample));
+}
+
+void test_first_sync_steps_then_slews()
+{
+  ClockDiscipline discipline;
+  NtpSample sample = {5 * SECOND, 10000, 2};
+  bool step = false;
+  TEST_ASSERT_FALSE(discipline.synced());
+  TEST_ASSERT_EQUAL(5 * SECOND, discipline.sync(sample, START, step));
+  TEST_ASSERT_TRUE(step);
+  sample.offset = 1500;
+  discipline.sync(sample, START + 60 * SECOND, step);
+  TEST_ASSERT_FALSE(step);
+  sample.offset = CLOCK_STEP_THRESHOLD + 1;
+  discipline.sync(sample, START + 120 * SECOND, step);
+  TEST_ASSERT_TRUE(step);
+  TEST_ASSERT_EQUAL(CLOCK_STEP_THRESHOLD + 1, discipline.lastOffset());
+  TEST_ASSERT_EQUAL(10000, discipline.lastDelay());
+  // no drift estimate from syncs closer than CLOCK_MIN_DRIFT_INTERVAL
+  TEST_ASSERT_EQUAL_FLOAT(0, discipline.ppm());
+}
+
+// a week on a drifting clock: hourly syncs, compensation slewed every minute
+static void runWeek(double slowPpm, float restoredPpm, int64_t &worstLate, float &ppm)
+{
+  FakeNtpServer server;
+  DriftingClock clock(slowPpm, START, START - 30 * SECOND);
+  ClockDiscipline discipline(restoredPpm);
+  worstLate = 0;
+  for (int64_t now = START; now < START + 7 * 24 * HOUR; now += 60 * SECOND)
+  {
+    if ((now - START) % HOUR == 0)
+    {
+      NtpSample sample;
+      TEST_ASSERT_NULL(exchange(server, clock, now, sample));
+      bool step;
+      int64_t correction = discipline.sync(sample, clock.local(now), step);
+      if (!step)
+        TEST_ASSERT_LESS_OR_EQUAL(CLOCK_STEP_THRESHOLD, correction < 0 ? -correction : correction);
+      clock.adjust += correction;
+    }
+    else
+      clock.adjust += discipline.compensate(clock.local(now));
+    // error once the first day has gone into the estimate
+    int64_t error = clock.local(now) - now;
+    if (now >= START + 24 * HOUR and (error < 0 ? -error : error) > worstLate)
+      worstLate = error < 0 ? -error : error;
+  }
+  ppm = discipline.ppm();
+}
+
+void test_drift_estimate_converges()
+{
+  const double drifts[] = {-120, -37, 0, 45, 200};
+  for (double slowPpm : drifts)
+  {
+    int64_t worst;
+    float ppm;
+    runWeek(slowPpm, 0, worst, ppm);
+    char line[100];
+    snprintf(line, sizeof(line), "crystal %+.0f ppm: estimate %+.2f ppm, worst error after a day %.1f ms", slowPpm, ppm, worst / 1000.0);
+    TEST_MESSAGE(line);
+    // one sync's link asymmetry, up to 2 ms, is 0.6 ppm over the hour
+    TEST_ASSERT_FLOAT_WITHIN(1, slowPpm, ppm);
+    // the asymmetry dominates, drift alone would be 0.72 s an hour at 200 ppm
+    TEST_ASSERT_LESS_THAN(5000, worst);
+  }
+}
+
+void test_restored_estimate()
+{
+  // with the estimate saved before the reboot the clock is good from the second sync on
+  int64_t worst;
+  float ppm;
+  runWeek(-37, -37, worst, ppm);
+  TEST_ASSERT_FLOAT_WITHIN(1, -37, ppm);
+  ClockDiscipline discipline;
+  discipline.restore(CLOCK_MAX_DRIFT_PPM + 1); // corrupt, ignored
+  TEST_ASSERT_EQUAL_FLOAT(0, discipline.ppm());
+  discipline.restore(-37);
+  TEST_ASSERT_EQUAL_FLOAT(-37, discipline.ppm());
+}
+
+void test_compensate_and_shift()
+{
+  ClockDiscipline discipline(100);
+  TEST_ASSERT_EQUAL(0, discipline.compensate(START)); // nothing before the first sync
+  NtpSample sample = {0, 1000, 1};
+  bool step;
+  discipline.sync(sample, START, step);
+  // 100 ppm over an hour is 360 ms, handed out whole microseconds at a time with nothing lost
+  int64_t total = 0;
+  for (int64_t t = START + 7 * SECOND; t <= START + HOUR; t += 7 * SECOND)
+    total += discipline.compensate(t);
+  total += discipline.compensate(START + HOUR);
+  TEST_ASSERT_INT_WITHIN(1, 360000, total);
+  // a deliberate step (utc offset change) is not owed as drift
+  discipline.shift(3600 * SECOND);
+  TEST_ASSERT_EQUAL(0, discipline.compensate(START + 2 * HOUR));
+  TEST_ASSERT_INT_WITHIN(1, 100, discipline.compensate(START + 2 * HOUR + SECOND));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_offset_and_delay);
+  RUN_TEST(test_bad_replies);
+  RUN_TEST(test_first_sync_steps_then_slews);
+  RUN_TEST(test_drift_estimate_converges);
+  RUN_TEST(test_restored_estimate);
+  RUN_TEST(test_compensate_and_shift);
+  return UNITY_END();
+}
@@ -0,0 +1,192 @@
+#include <unity.h>
+#include <ArduinoJson.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "boardOutputs.h"
+#include "controlProtocol.h"
+#include "outputs.h"
+#include "pumpSchedule.h"
+#include "testSupport.h"
+
+static bool pins[32];
+static void writePin(uint8_t pin, bool on) { pins[pin] = on; }
+
+static const char *parse(const char *frame, ControlRequest &request) { return parseControlRequest(frame, strlen(frame), request); }
+
+// what the control task does with a queued request (runPumpControl in main.cpp), returns the reply frame
+static size_t handle(OutputBank<3> &bank, const char *frame, uint32_t now, char *reply, size_t size)
+{
+  ControlRequest request;
+  uint8_t output;
+  const char *error = parseControlCommand(frame, strlen(frame), boardOutputs, bank.size(), request, output);
+  if (error != NULL)
+    return writeControlError(reply, size, request.id, error);
+  if (request.command == CONTROL_AUTO)
+    bank.setAuto(output, now);
+  else
+    bank.setOverride(output, request.state, request.time, now);
+  char command[32];
+  writeCommandText(command, sizeof(command), bank[output], now);
+  return writeControlAck(reply, size, request.id, request.output, command);
+}
+
+void setUp() { memset(pins, 0, sizeof(pins)); }
+void tearDown() {}
+
+void test_parse_override_and_auto()
+{
+  ControlRequest request;
+  TEST_ASSERT_NULL(parse(R"({"id":7,"cmd":"override","output":"pump1","state":1,"time":30})", request));
+  TEST_ASSERT_EQUAL(7, request.id);
+  TEST_ASSERT_EQUAL(CONTROL_OVERRIDE, request.command);
+  TEST_ASSERT_EQUAL_STRING("pump1", request.output);
+  TEST_ASSERT_TRUE(request.state);
+  TEST_ASSERT_EQUAL(30, request.time);
+  TEST_ASSERT_NULL(parse(R"({"id":4294967295,"cmd":"auto","output":"airPump"})", request));
+  TEST_ASSERT_EQUAL_UINT32(4294967295u, request.id);
+  TEST_ASSERT_EQUAL(CONTROL_AUTO, request.command);
+  TEST_ASSERT_FALSE(request.state);
+  TEST_ASSERT_EQUAL(0, request.time);
+  // only the given length is parsed, the WebSocket buffer is not terminated
+  const char *frame = R"({"id":1,"cmd":"auto","output":"pump2"}garbage)";
+  TEST_ASSERT_NULL(parseControlRequest(frame, strlen(frame) - 7, request));
+}
+
+void test_parse_errors()
+{
+  struct
+  {
+    const char *frame;
+    const char *error;
+    uint32_t id;
+  } cases[] = {
+      {"{", "bad json", 0},
+      {R"({"cmd":"auto","output":"pump1"})", "missing id", 0},
+      {R"({"id":"7","cmd":"auto","output":"pump1"})", "missing id", 0},
+      {R"({"id":-1,"cmd":"auto","output":"pump1"})", "missing id", 0},
+      {R"({"id":3,"output":"pump1"})", "missing cmd", 3},
+      {R"({"id":3,"cmd":"toggle","output":"pump1"})", "unknown cmd", 3},
+      {R"({"id":3,"cmd":"auto"})", "missing output", 3},
+      {R"({"id":3,"cmd":"auto","output":"aVeryLongOutputName"})", "missing output", 3},
+      {R"({"id":3,"cmd":"override","output":"pump1","time":30})", "state must be 0 or 1", 3},
+      {R"({"id":3,"cmd":"override","output":"pump1","state":2,"time":30})", "state must be 0 or 1", 3},
+      {R"({"id":3,"cmd":"override","output":"pump1","state":1})", "time must be 1-65 min", 3},
+      {R"({"id":3,"cmd":"override","output":"pump1","state":1,"time":0})", "time must be 1-65 min", 3},
+      {R"({"id":3,"cmd":"override","output":"pump1","state":1,"time":66})", "time must be 1-65 min", 3},
+  };
+  for (auto &c : cases)
+  {
+    ControlRequest request;
+    const char *error = parse(c.frame, request);
+    TEST_ASSERT_NOT_NULL_MESSAGE(error, c.frame);
+    TEST_ASSERT_EQUAL_STRING_MESSAGE(c.error, error, c.frame);
+    TEST_ASSERT_EQUAL_MESSAGE(c.id, request.id, c.frame); // errors carry the id whenever there was one
+  }
+}
+
+void test_replies_are_json()
+{
+  char reply[CONTROL_FRAME_SIZE];
+  size_t length = writeControlAck(reply, sizeof(reply), 7, "pump1", "On (Override 30 min)");
+  TEST_ASSERT_EQUAL(strlen(reply), length);
+  StaticJsonDocument<256> doc;
+  TEST_ASSERT_FALSE(deserializeJson(doc, reply, length));
+  TEST_ASSERT_EQUAL(7, doc["id"].as<uint32_t>());
+  TEST_ASSERT_TRUE(doc["ok"].as<bool>());
+  TEST_ASSERT_EQUAL_STRING("pump1", doc["output"].as<const char *>());
+  TEST_ASSERT_EQUAL_STRING("On (Override 30 min)", doc["command"].as<const char *>());
+  length = writeControlError(reply, sizeof(reply), 8, "unknown output");
+  TEST_ASSERT_FALSE(deserializeJson(doc, reply, length));
+  TEST_ASSERT_FALSE(doc["ok"].as<bool>());
+  TEST_ASSERT_EQUAL_STRING("unknown output", doc["error"].as<const char *>());
+  // the longest ack fits a frame, one too small a buffer is refused rather than cut
+  char output[CONTROL_OUTPUT_SIZE];
+  memset(output, 'o', sizeof(output) - 1);
+  output[sizeof(output) - 1] = '\0';
+  length = writeControlAck(reply, sizeof(reply), 4294967295u, output, "Off (Override Permanent)");
+  TEST_ASSERT_GREATER_THAN(0, length);
+  TEST_ASSERT_EQUAL(0, writeControlAck(reply, length, 4294967295u, output, "Off (Override Permanent)"));
+  TEST_ASSERT_EQUAL(length, writeControlAck(reply, length + 1, 4294967295u, output, "Off (Override Permanent)"));
+}
+
+void test_command_text()
+{
+  OutputState state = {};
+  char text[32];
+  TEST_ASSERT_EQUAL(strlen("Off (Auto)"), writeCommandText(text, sizeof(text), state, START_EPOCH));
+  TEST_ASSERT_EQUAL_STRING("Off (Auto)", text);
+  state.command = true;
+  state.override = true;
+  state.overrideEnd = START_EPOCH + 5 * 60 + 59;
+  writeCommandText(text, sizeof(text), state, START_EPOCH);
+  TEST_ASSERT_EQUAL_STRING("On (Override 5 min)", text);
+  // ran out, the control task puts it back in auto on its next pass
+  writeCommandText(text, sizeof(text), state, START_EPOCH + 3600);
+  TEST_ASSERT_EQUAL_STRING("On (Override 0 min)", text);
+  state.overrideEnd = 0;
+  writeCommandText(text, sizeof(text), state, START_EPOCH);
+  TEST_ASSERT_EQUAL_STRING("On (Override Permanent)", text);
+  TEST_ASSERT_EQUAL(0, writeCommandText(text, strlen("On (Override Permanent)"), state, START_EPOCH));
+}
+
+void test_round_trip_through_the_outputs()
+{
+  OutputBank<3> bank(boardOutputs, writePin);
+  uint32_t now = START_EPOCH;
+  bank.control(now); // no schedule, everything off
+  char reply[CONTROL_FRAME_SIZE];
+  StaticJsonDocument<256> doc;
+
+  size_t length = handle(bank, R"({"id":1,"cmd":"override","output":"pump2","state":1,"time":30})", now, reply, sizeof(reply));
+  TEST_ASSERT_FALSE(deserializeJson(doc, reply, length));
+  TEST_ASSERT_EQUAL(1, doc["id"].as<uint32_t>());
+  TEST_ASSERT_TRUE(doc["ok"].as<bool>());
+  TEST_ASSERT_EQUAL_STRING("On (Override 30 min)", doc["command"].as<const char *>());
+  TEST_ASSERT_TRUE(pins[21]);
+
+  length = handle(bank, R"({"id":2,"cmd":"override","output":"airPump","state":0,"time":65})", now, reply, sizeof(reply));
+  TEST_ASSERT_FALSE(deserializeJson(doc, reply, length));
+  TEST_ASSERT_EQUAL_STRING("Off (Override Permanent)", doc["command"].as<const char *>());
+  TEST_ASSERT_EQUAL(0, bank[2].overrideEnd);
+
+  length = handle(bank, R"({"id":3,"cmd":"auto","output":"pump2"})", now + 60, reply, sizeof(reply));
+  TEST_ASSERT_FALSE(deserializeJson(doc, reply, length));
+  TEST_ASSERT_EQUAL(3, doc["id"].as<uint32_t>());
+  TEST_ASSERT_EQUAL_STRING("Off (Auto)", doc["command"].as<const char *>());
+  TEST_ASSERT_FALSE(pins[21]);
+
+  // a rejected command leaves the outputs alone and its error names the request
+  length = handle(bank, R"({"id":4,"cmd":"override","output":"pump3","state":1,"time":5})", now, reply, sizeof(reply));
+  TEST_ASSERT_FALSE(deserializeJson(doc, reply, length));
+  TEST_ASSERT_EQUAL(4, doc["id"].as<uint32_t>());
+  TEST_ASSERT_FALSE(doc["ok"].as<bool>());
+  TEST_ASSERT_EQUAL_STRING("unknown output", doc["error"].as<const char *>());
+  TEST_ASSERT_FALSE(pins[22]);
+}
+
+void test_frame_smaller_than_http_request()
+{
+  // the GET every override used to cost, before the TCP handshake and the "OK" response
+  const char *http = "GET /override?output=pump1&state=1&time=30 HTTP/1.1\r\nHost: 192.168.1.50\r\nUser-Agent: Mozilla/5.0\r\n"
+                     "Accept: */*\r\nConnection: keep-alive\r\n\r\n";
+  const char *frame = R"({"id":7,"cmd":"override","output":"pump1","state":1,"time":30})";
+  size_t wsBytes = strlen(frame) + 6; // client frames have a 2 byte header and a 4 byte mask
+  char line[100];
+  snprintf(line, sizeof(line), "override: %u bytes as a WebSocket frame, %u as an HTTP request", (unsigned)wsBytes, (unsigned)strlen(http));
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_THAN(CONTROL_FRAME_SIZE, strlen(frame));
+  TEST_ASSERT_LESS_THAN(strlen(http), wsBytes);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_parse_override_and_auto);
+  RUN_TEST(test_parse_errors);
+  RUN_TEST(test_replies_are_json);
+  RUN_TEST(test_command_text);
+  RUN_TEST(test_round_trip_through_the_outputs);
+  RUN_TEST(test_frame_smaller_than_http_request);
+  return UNITY_END();
+}
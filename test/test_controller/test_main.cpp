@@ -0,0 +1,142 @@
+#include <unity.h>
+#include <string.h>
+
+#include "boardOutputs.h"
+#include "controller.h"
+#include "simHal.h"
+#include "testSupport.h"
+
+#define COUNT BOARD_OUTPUT_COUNT
+
+static Settings settings;
+static bool inputs[COUNT + SENSOR_ALARMS];
+static uint32_t inputCount;
+
+static void ignorePin(uint8_t, bool) {}
+static void ignoreRegister(uint32_t, uint32_t) {}
+static void ignoreMove(size_t, size_t, size_t, FailoverReason) {}
+static void onAlarmInput(uint8_t alarm, bool condition)
+{
+  TEST_ASSERT_LESS_THAN(COUNT + SENSOR_ALARMS, alarm);
+  inputs[alarm] = condition;
+  inputCount++;
+}
+
+static void assertPlan(const WakePlanner &planner, PowerState state, PowerReason reason)
+{
+  PowerPlan plan = planner.plan();
+  TEST_ASSERT_EQUAL_STRING(POWER_STATE_NAMES[state], POWER_STATE_NAMES[plan.state]);
+  TEST_ASSERT_EQUAL_STRING(POWER_REASON_NAMES[reason], POWER_REASON_NAMES[plan.reason]);
+}
+
+void setUp()
+{
+  defaultSettings(settings);
+  memset(inputs, 0, sizeof(inputs));
+  inputCount = 0;
+}
+void tearDown() {}
+
+void test_water_level_hysteresis()
+{
+  // low from 20 cm down, it takes WATER_HYSTERESIS_CM below that to clear
+  TEST_ASSERT_EQUAL(W_LOW, classifyWaterLevel(20.2, W_MED, settings));
+  TEST_ASSERT_EQUAL(W_MED, classifyWaterLevel(19.8, W_MED, settings));
+  TEST_ASSERT_EQUAL(W_LOW, classifyWaterLevel(19.8, W_LOW, settings));
+  TEST_ASSERT_EQUAL(W_MED, classifyWaterLevel(19.4, W_LOW, settings));
+  TEST_ASSERT_EQUAL(W_HIGH, classifyWaterLevel(9, W_MED, settings));
+  TEST_ASSERT_EQUAL(W_LOW, classifyWaterLevel(25, W_FAULT, settings));
+}
+
+void test_high_temperature_hysteresis()
+{
+  TEST_ASSERT_FALSE(highTemperature(89.9, false, settings));
+  TEST_ASSERT_TRUE(highTemperature(90.1, false, settings));
+  TEST_ASSERT_TRUE(highTemperature(88.5, true, settings));
+  TEST_ASSERT_FALSE(highTemperature(87.9, true, settings));
+}
+
+void test_plan_covers_task_jobs()
+{
+  // 00:11, the next DHT reading at 00:15 and upload window at 01:00
+  SimHal sim(START_EPOCH);
+  sim.climateEvery(settings.dhtInterval);
+  sim.advance(660000000);
+  TaskDeadlines deadlines = {NO_TASK_DEADLINE, false, 40000, 30000, NO_TASK_DEADLINE, NO_TASK_DEADLINE, false};
+  WakePlanner planner;
+  planner.start(sim.epoch());
+  planTasks(planner, sim, sim.millis(), deadlines, settings);
+  assertPlan(planner, POWER_SLEEP, POWER_HISTORY);
+  TEST_ASSERT_EQUAL(30000 - POWER_WAKE_EARLY, planner.plan().sleepMs);
+  // with nothing else due the DHT reading, then the upload window
+  deadlines = {NO_TASK_DEADLINE, false, NO_TASK_DEADLINE, NO_TASK_DEADLINE, NO_TASK_DEADLINE, NO_TASK_DEADLINE, false};
+  planner.start(sim.epoch());
+  planTasks(planner, sim, sim.millis(), deadlines, settings);
+  assertPlan(planner, POWER_SLEEP, POWER_DHT);
+  TEST_ASSERT_EQUAL(240000 - POWER_WAKE_EARLY, planner.plan().sleepMs);
+  // queued alarm inputs, a reading in progress and the radio keep it awake
+  deadlines.alarmInputs = true;
+  planner.start(sim.epoch());
+  planTasks(planner, sim, sim.millis(), deadlines, settings);
+  assertPlan(planner, POWER_IDLE, POWER_ALARM);
+  deadlines.alarmInputs = false;
+  sim.startDistance();
+  planner.start(sim.epoch());
+  planTasks(planner, sim, sim.millis(), deadlines, settings);
+  assertPlan(planner, POWER_IDLE, POWER_MEASURING);
+  sim.advance(1000000);
+  TEST_ASSERT_TRUE(sim.distanceReady());
+  deadlines.radioUp = true;
+  planner.start(sim.epoch());
+  planTasks(planner, sim, sim.millis(), deadlines, settings);
+  assertPlan(planner, POWER_IDLE, POWER_UPLOAD);
+}
+
+void test_water_readings_post_inputs()
+{
+  // a reading an hour while the reservoir evaporates: high, then low. The low water
+  // input follows the level, acknowledging the latched alarm is up to the grower
+  SimHal sim(START_EPOCH);
+  OutputBank<COUNT> bank(boardOutputs, ignorePin);
+  OutputDriver driver(ignoreRegister);
+  FailoverSupervisor<COUNT> failover(bank, ignoreMove);
+  CurrentChannel channels[COUNT];
+  PumpHealth health[COUNT];
+  WaterLevelEstimator water;
+  Controller<COUNT> controller(sim, bank, driver, failover, channels, health, water, settings, onAlarmInput);
+  uint32_t read = 0, stray = 0;
+  bool wasHigh = false;
+  for (int hour = 0; hour < 16 * 24; hour++)
+  {
+    sim.startDistance();
+    sim.advance(1000000);
+    TEST_ASSERT_TRUE(sim.distanceReady());
+    WaterReading reading = controller.readWaterLevel();
+    read += reading == WATER_READ;
+    stray += reading == WATER_STRAY;
+    TEST_ASSERT_FALSE(inputs[COUNT + SENSOR_WATER_FAULT]);
+    wasHigh = wasHigh or controller.waterLevel() == W_HIGH;
+    if (reading == WATER_READ)
+      TEST_ASSERT_EQUAL(controller.waterLevel() == W_LOW, inputs[COUNT + SENSOR_LOW_WATER]);
+    sim.advance(3599000000);
+  }
+  TEST_ASSERT_TRUE(wasHigh);
+  TEST_ASSERT_EQUAL(W_LOW, controller.waterLevel());
+  TEST_ASSERT_TRUE(inputs[COUNT + SENSOR_LOW_WATER]);
+  TEST_ASSERT_EQUAL(16 * 24, read + stray);
+  TEST_ASSERT_GREATER_THAN(16 * 24 * 9 / 10, read);
+  // the reservoir share for the climate controller follows the level
+  TEST_ASSERT_EQUAL_FLOAT(0, controller.reservoir());
+  // the sensor and low water inputs go out with every reading, the first one included
+  TEST_ASSERT_EQUAL(2 * read + stray, inputCount);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_water_level_hysteresis);
+  RUN_TEST(test_high_temperature_hysteresis);
+  RUN_TEST(test_plan_covers_task_jobs);
+  RUN_TEST(test_water_readings_post_inputs);
+  return UNITY_END();
+}
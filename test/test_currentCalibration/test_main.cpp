@@ -0,0 +1,206 @@
+#include <unity.h>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+#include "currentCalibration.h"
+
+#define VOLTS_PER_COUNT (3.3 / 4095)
+#define VOLTS_PER_AMP (0.185 / 2) // ACS712-05B behind the 1:2 divider
+#define AMPS_PER_COUNT (VOLTS_PER_COUNT / VOLTS_PER_AMP)
+#define NOISE_COUNTS 4.0 // idle RMS of the board's channels
+#define WINDOW_MS 100
+#define FALLBACK_AMPS 0.5
+
+static std::mt19937 random32(18);
+static std::normal_distribution<float> gauss(0, 1);
+
+// One channel's RMS windows as the control task sees them: the pump draws
+// amps while its relay is on, plus an inrush for the first second, the
+// sensor noise adds in quadrature and every window jitters by 1%
+struct Trace
+{
+  CurrentChannel channel;
+  uint32_t nowMs = 0;
+  uint32_t edgeMs = 0;
+  bool on = false;
+  uint32_t degradedWindows = 0;
+
+  Trace() { channel.configure(VOLTS_PER_COUNT, VOLTS_PER_AMP); }
+
+  float window(float amps)
+  {
+    float load = on ? amps * (nowMs - edgeMs < 1000 ? 5 : 1) : 0;
+    float counts = load / AMPS_PER_COUNT;
+    float rms = sqrtf(counts * counts + NOISE_COUNTS * NOISE_COUNTS) * (1 + 0.01 * gauss(random32));
+    float current = channel.update(rms, on, nowMs - edgeMs, FALLBACK_AMPS);
+    degradedWindows += channel.degraded();
+    nowMs += WINDOW_MS;
+    return current;
+  }
+
+  void set(bool relay)
+  {
+    if (relay != on)
+      edgeMs = nowMs;
+    on = relay;
+  }
+
+  // the air pump cycle, 15 min on and 15 off, drawing amps while on
+  void cycles(uint32_t count, float amps)
+  {
+    for (uint32_t c = 0; c < count; c++)
+    {
+      set(true);
+      for (int i = 0; i < 9000; i++)
+        window(amps);
+      set(false);
+      for (int i = 0; i < 9000; i++)
+        window(amps);
+    }
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_auto_zero()
+{
+  Trace trace;
+  // before the noise floor is known the idle channel reads its noise as current
+  float first = trace.window(0);
+  TEST_ASSERT_TRUE(first > 0.02);
+  for (int i = 0; i < 600; i++)
+    trace.window(0);
+  TEST_ASSERT_FLOAT_WITHIN(0.3, NOISE_COUNTS, trace.channel.zeroCounts());
+  TEST_ASSERT_TRUE(trace.channel.amps() < 0.01); // within the 1% jitter of the noise
+  // small currents come out of the noise, not on top of it
+  trace.set(true);
+  trace.nowMs += 10000;
+  float small = 0;
+  for (int i = 0; i < 100; i++)
+    small += trace.window(0.1) / 100;
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0.1, small);
+}
+
+void test_not_zeroed_while_running_or_settling()
+{
+  Trace trace;
+  for (int i = 0; i < 600; i++)
+    trace.window(0);
+  float zero = trace.channel.zeroCounts();
+  trace.set(true);
+  for (int i = 0; i < 3000; i++)
+    trace.window(1.2);
+  TEST_ASSERT_EQUAL_FLOAT(zero, trace.channel.zeroCounts());
+  // the pump runs down after the relay opens, that is not noise either
+  trace.set(false);
+  for (uint32_t sinceEdge = 0; sinceEdge < CAL_SETTLE_MS; sinceEdge += WINDOW_MS)
+    trace.channel.update(100, false, sinceEdge, FALLBACK_AMPS);
+  TEST_ASSERT_EQUAL_FLOAT(zero, trace.channel.zeroCounts());
+}
+
+void test_nominal_learned_and_threshold()
+{
+  Trace trace;
+  for (int i = 0; i < 600; i++)
+    trace.window(0);
+  trace.set(true);
+  for (int i = 0; i < CAL_NOMINAL_MIN_WINDOWS; i++)
+    trace.window(1.2);
+  TEST_ASSERT_FALSE(trace.channel.learned()); // the first CAL_FAST_WINDOWS after settling are not learned from
+  for (int i = 0; i < 200; i++)
+    trace.window(1.2);
+  TEST_ASSERT_TRUE(trace.channel.learned());
+  TEST_ASSERT_FLOAT_WITHIN(0.02, 1.2, trace.channel.nominal());
+  TEST_ASSERT_TRUE(trace.channel.running());
+  TEST_ASSERT_FALSE(trace.channel.degraded());
+  // once learned, 30% of nominal counts as running instead of the fixed fallback
+  trace.window(0.45);
+  TEST_ASSERT_TRUE(trace.channel.running());
+  trace.window(0.3);
+  TEST_ASSERT_FALSE(trace.channel.running());
+}
+
+void test_clog_and_dry_run_flagged()
+{
+  Trace trace;
+  trace.cycles(48, 1.2); // a day of normal running
+  TEST_ASSERT_TRUE(trace.channel.learned());
+  TEST_ASSERT_EQUAL(0, trace.degradedWindows);
+  float nominal = trace.channel.nominal();
+  // the intake clogs: 70% of the current, well above any fixed running threshold
+  trace.cycles(4, 1.2 * 0.7);
+  TEST_ASSERT_TRUE(trace.channel.degraded()); // the verdict of the last run stands while the pump is off
+  TEST_ASSERT_FLOAT_WITHIN(0.05, 0.7, trace.channel.ratio());
+  TEST_ASSERT_EQUAL_FLOAT(nominal, trace.channel.nominal()); // a degraded pump is not learned as the new normal
+  // flagged within the averaging time of the first clogged run (settle plus a few fast windows)
+  Trace fresh;
+  fresh.cycles(48, 1.2);
+  fresh.set(true);
+  uint32_t windows = 0;
+  while (!fresh.channel.degraded() and windows < 9000)
+  {
+    fresh.window(1.2 * 0.7);
+    windows++;
+  }
+  TEST_ASSERT_LESS_THAN((CAL_SETTLE_MS / WINDOW_MS + 3 * CAL_FAST_WINDOWS), windows);
+  TEST_ASSERT_TRUE(fresh.channel.running());
+  // cleaned: back to normal on the next run
+  trace.cycles(1, 1.2);
+  TEST_ASSERT_FALSE(trace.channel.degraded());
+  // running dry and jammed
+  trace.cycles(1, 1.2 * 0.4);
+  TEST_ASSERT_TRUE(trace.channel.degraded());
+  trace.cycles(1, 1.2);
+  trace.cycles(1, 1.2 * 1.4);
+  TEST_ASSERT_TRUE(trace.channel.degraded());
+}
+
+void test_slow_drift_is_followed()
+{
+  // brushes and bearings change the current slowly over weeks, that is the new normal
+  Trace trace;
+  float amps = 1.2;
+  for (int day = 0; day < 28; day++)
+  {
+    trace.cycles(48, amps);
+    amps *= 0.99;
+  }
+  TEST_ASSERT_EQUAL(0, trace.degradedWindows);
+  TEST_ASSERT_FLOAT_WITHIN(0.1, amps, trace.channel.nominal());
+}
+
+void test_restore()
+{
+  Trace trace;
+  trace.cycles(48, 1.2);
+  ChannelLearned saved = trace.channel.state();
+  CurrentChannel rebooted;
+  rebooted.configure(VOLTS_PER_COUNT, VOLTS_PER_AMP);
+  rebooted.restore(saved);
+  TEST_ASSERT_TRUE(rebooted.learned());
+  TEST_ASSERT_EQUAL_FLOAT(trace.channel.nominal(), rebooted.nominal());
+  TEST_ASSERT_EQUAL_FLOAT(trace.channel.zeroCounts(), rebooted.zeroCounts());
+  CurrentChannel corrupt;
+  ChannelLearned bad = saved;
+  bad.nominal = NAN;
+  corrupt.restore(bad);
+  TEST_ASSERT_FALSE(corrupt.learned());
+  bad = saved;
+  bad.noise2 = -1;
+  corrupt.restore(bad);
+  TEST_ASSERT_FALSE(corrupt.learned());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_auto_zero);
+  RUN_TEST(test_not_zeroed_while_running_or_settling);
+  RUN_TEST(test_nominal_learned_and_threshold);
+  RUN_TEST(test_clog_and_dry_run_flagged);
+  RUN_TEST(test_slow_drift_is_followed);
+  RUN_TEST(test_restore);
+  return UNITY_END();
+}
@@ -0,0 +1,129 @@
+#include <unity.h>
+#include <math.h>
+#include <string.h>
+
+#include "dhtDecoder.h"
+
+static uint32_t seed = 3;
+
+// the pulses of a frame as the RMT captures them, each one jittered by up to +-6us
+static size_t dhtFrame(const uint8_t bytes[5], DhtPulse *pulses)
+{
+  auto jitter = [](int micros) {
+    seed = seed * 1103515245 + 12345;
+    return (uint16_t)(micros - 6 + (seed >> 16) % 13);
+  };
+  size_t n = 0;
+  pulses[n++] = {1, jitter(30)};
+  pulses[n++] = {0, jitter(80)};
+  pulses[n++] = {1, jitter(80)};
+  for (int bit = 0; bit < DHT_BITS; bit++)
+  {
+    pulses[n++] = {0, jitter(50)};
+    pulses[n++] = {1, jitter((bytes[bit / 8] >> (7 - bit % 8) & 1) ? 70 : 27)};
+  }
+  pulses[n++] = {0, jitter(50)};
+  return n;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_frames()
+{
+  struct
+  {
+    const char *name;
+    DhtModel model;
+    uint8_t bytes[5];
+    int flipBit; // -1 for none
+    size_t keep; // pulses kept, 0 for all
+    const char *error;
+    float celsius;
+    float humidity;
+  } cases[] = {
+      {"dht11", DHT_11, {46, 0, 23, 4, 73}, -1, 0, NULL, 23.4, 46},
+      {"dht11 below zero", DHT_11, {80, 0, 2, 0x85, 215}, -1, 0, NULL, -2.5, 80},
+      {"dht22", DHT_22, {0x02, 0x8c, 0x80, 0x65, 0x73}, -1, 0, NULL, -10.1, 65.2},
+      {"flipped bit", DHT_11, {46, 0, 23, 4, 73}, 20, 0, "bad checksum", 0, 0},
+      {"cut short", DHT_11, {46, 0, 23, 4, 73}, -1, 60, "short frame", 0, 0},
+      {"all zeros", DHT_11, {0, 0, 0, 0, 0}, -1, 0, "out of range", 0, 0},
+      {"no answer", DHT_11, {46, 0, 23, 4, 73}, -1, 1, "no response", 0, 0},
+  };
+  for (auto &test : cases)
+  {
+    // every case a few times over, with different jitter
+    for (int round = 0; round < 50; round++)
+    {
+      DhtPulse pulses[DHT_BITS * 2 + 4];
+      size_t count = dhtFrame(test.bytes, pulses);
+      if (test.flipBit >= 0)
+      {
+        DhtPulse &high = pulses[4 + 2 * test.flipBit];
+        high.micros = (high.micros > DHT_ONE_THRESHOLD_US) ? 27 : 70;
+      }
+      if (test.keep)
+        count = test.keep;
+      DhtSample sample = {};
+      const char *error = decodeDht(pulses, count, test.model, sample);
+      if (test.error == NULL)
+      {
+        TEST_ASSERT_NULL_MESSAGE(error, test.name);
+        TEST_ASSERT_FLOAT_WITHIN(0.05, test.celsius, sample.celsius);
+        TEST_ASSERT_FLOAT_WITHIN(0.05, test.humidity, sample.humidity);
+      }
+      else
+      {
+        TEST_ASSERT_NOT_NULL_MESSAGE(error, test.name);
+        TEST_ASSERT_EQUAL_STRING_MESSAGE(test.error, error, test.name);
+      }
+    }
+  }
+}
+
+void test_start_signal_skipped()
+{
+  // the line may already show part of the host's start signal before the response
+  const uint8_t bytes[5] = {46, 0, 23, 4, 73};
+  DhtPulse pulses[DHT_BITS * 2 + 8];
+  pulses[0] = {0, 1100};
+  pulses[1] = {1, 25};
+  size_t count = 2 + dhtFrame(bytes, pulses + 2);
+  DhtSample sample;
+  TEST_ASSERT_NULL(decodeDht(pulses, count, DHT_11, sample));
+  TEST_ASSERT_FLOAT_WITHIN(0.05, 23.4, sample.celsius);
+}
+
+void test_glitch_is_not_two_bits()
+{
+  // a glitch splitting a bit is not taken as two bits
+  DhtPulse pulses[DHT_BITS * 2 + 6];
+  const uint8_t bytes[5] = {46, 0, 23, 4, 73};
+  size_t count = dhtFrame(bytes, pulses);
+  memmove(pulses + 12, pulses + 10, (count - 10) * sizeof(DhtPulse));
+  pulses[10] = {1, 35};
+  pulses[11] = {0, 4};
+  pulses[12].micros = 31;
+  DhtSample sample;
+  TEST_ASSERT_NOT_NULL(decodeDht(pulses, count + 2, DHT_11, sample));
+}
+
+void test_heat_index()
+{
+  // NWS table: 90F at 60% feels like 100F, 80F at 40% like 80F, 100F at 60% like 129F
+  TEST_ASSERT_FLOAT_WITHIN(1, 100, computeHeatIndex(90, 60));
+  TEST_ASSERT_FLOAT_WITHIN(1, 80, computeHeatIndex(80, 40));
+  TEST_ASSERT_FLOAT_WITHIN(1, 129, computeHeatIndex(100, 60));
+  // cool air is close to the temperature itself
+  TEST_ASSERT_FLOAT_WITHIN(2, 60, computeHeatIndex(60, 50));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_frames);
+  RUN_TEST(test_start_signal_skipped);
+  RUN_TEST(test_glitch_is_not_two_bits);
+  RUN_TEST(test_heat_index);
+  return UNITY_END();
+}
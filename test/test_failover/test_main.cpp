@@ -0,0 +1,159 @@
+#include <unity.h>
+#include <string.h>
+
+#include "boardOutputs.h"
+#include "failover.h"
+#include "outputs.h"
+#include "pumpSchedule.h"
+#include "scheduleJson.h"
+#include "testSupport.h"
+
+#define DAY 86400
+
+#define COUNT BOARD_OUTPUT_COUNT
+
+// pump 1 06:00-12:00, pump 2 12:00-18:00, their pulses on the hour and half hour
+static const uint32_t MORNING = START_EPOCH + 7 * 3600;
+static const uint32_t NOON = START_EPOCH + 12 * 3600 + 1800;
+static const uint32_t EVENING = START_EPOCH + 19 * 3600 + 1800;
+
+static ScheduleWorkspace work;
+static FailoverReason lastMove;
+
+static void ignorePin(uint8_t, bool) {}
+static void onMove(size_t, size_t, size_t, FailoverReason why)
+{
+  lastMove = why;
+}
+
+// the supervisor on the default schedule, windows fed by hand
+struct Bench
+{
+  OutputBank<COUNT> bank;
+  FailoverSupervisor<COUNT> supervisor;
+
+  Bench() : bank(boardOutputs, ignorePin), supervisor(bank, onMove)
+  {
+    OutputSchedule schedules[COUNT];
+    TEST_ASSERT_NULL(compileSchedule(DEFAULT_SCHEDULE, strlen(DEFAULT_SCHEDULE), boardOutputs, COUNT, schedules, work));
+    for (size_t i = 0; i < COUNT; i++)
+      bank.schedule(i) = schedules[i];
+    supervisor.configure(500, 2 * 3600000);
+  }
+
+  // driven without current (or with it) from the relay edge on
+  void run(size_t pump, bool running, uint32_t nowMs)
+  {
+    for (uint32_t since = FAILOVER_WINDOW_MS; since <= 700; since += FAILOVER_WINDOW_MS)
+      supervisor.window(pump, true, running, since, nowMs + since);
+  }
+};
+
+void setUp()
+{
+  lastMove = FAILOVER_HOME;
+}
+void tearDown() {}
+
+void test_detection_time()
+{
+  Bench bench;
+  // silent from its relay edge: the window inside FAILOVER_START_MS does not count, 5 more do
+  uint32_t windows = 0;
+  for (uint32_t since = FAILOVER_WINDOW_MS; !bench.supervisor.failed(0) and since <= 2000; since += FAILOVER_WINDOW_MS, windows++)
+    bench.supervisor.window(0, true, false, since, since);
+  TEST_ASSERT_EQUAL(6, windows);
+  // the air pump is in no group, a pump that is off is not silent, a blip of current starts over
+  for (uint32_t since = FAILOVER_WINDOW_MS; since <= 2000; since += FAILOVER_WINDOW_MS)
+  {
+    bench.supervisor.window(2, true, false, since, since);
+    bench.supervisor.window(1, false, false, since, since);
+    bench.supervisor.window(1, true, since == 600, since, since);
+  }
+  TEST_ASSERT_FALSE(bench.supervisor.failed(1));
+  TEST_ASSERT_FALSE(bench.supervisor.failed(2));
+}
+
+void test_window_and_pulses_move_and_come_home()
+{
+  Bench bench;
+  OutputBank<COUNT> &bank = bench.bank;
+  FailoverSupervisor<COUNT> &supervisor = bench.supervisor;
+  bench.run(0, false, 0);
+  TEST_ASSERT_TRUE(supervisor.failed(0));
+  // pump 1's window and night pulses go to pump 2 at once
+  supervisor.update(MORNING, 1000);
+  TEST_ASSERT_EQUAL(1, bank.owner(0));
+  TEST_ASSERT_EQUAL(FAILOVER_TAKEOVER, lastMove);
+  TEST_ASSERT_TRUE(bank.autoState(1, MORNING));
+  TEST_ASSERT_FALSE(bank.autoState(0, MORNING));
+  supervisor.update(START_EPOCH + 20 * 3600, 2000);
+  TEST_ASSERT_EQUAL(1, bank.owner(0));
+  TEST_ASSERT_TRUE(bank.autoState(1, START_EPOCH + 20 * 3600 + 30));
+  // no trial before FAILOVER_RETRY_MS, nor while nothing runs in the group
+  supervisor.update(MORNING + 600, 600 + FAILOVER_RETRY_MS - 1);
+  TEST_ASSERT_FALSE(bank.onTrial(0));
+  supervisor.update(START_EPOCH + 20 * 3600 + 1200, 600 + FAILOVER_RETRY_MS);
+  TEST_ASSERT_FALSE(bank.onTrial(0));
+  supervisor.update(START_EPOCH + 21 * 3600, 600 + FAILOVER_RETRY_MS);
+  TEST_ASSERT_TRUE(bank.onTrial(0));
+  TEST_ASSERT_EQUAL(1, bank.owner(0));
+  // the trial start draws current: back, and home at the next gap
+  bench.run(0, true, 0);
+  TEST_ASSERT_FALSE(supervisor.failed(0));
+  TEST_ASSERT_FALSE(bank.onTrial(0));
+  TEST_ASSERT_EQUAL(1, supervisor.recoveryCount());
+  supervisor.update(START_EPOCH + 21 * 3600 + 600, 700000);
+  supervisor.update(START_EPOCH + 22 * 3600, 701000);
+  TEST_ASSERT_EQUAL(0, bank.owner(0));
+  TEST_ASSERT_EQUAL(FAILOVER_HOME, lastMove);
+}
+
+void test_other_way_round()
+{
+  // pump 1 covers pump 2's afternoon and night pulses
+  Bench bench;
+  bench.run(1, false, 800000);
+  bench.supervisor.update(NOON, 801000);
+  TEST_ASSERT_EQUAL(0, bench.bank.owner(1));
+  TEST_ASSERT_TRUE(bench.bank.autoState(0, NOON));
+  TEST_ASSERT_FALSE(bench.bank.autoState(1, NOON));
+  bench.supervisor.update(EVENING, 802000);
+  TEST_ASSERT_EQUAL(0, bench.bank.owner(1));
+  TEST_ASSERT_TRUE(bench.bank.autoState(0, EVENING + 30));
+}
+
+void test_wear_balancing_narrows_the_gap()
+{
+  Bench bench;
+  OutputBank<COUNT> &bank = bench.bank;
+  FailoverSupervisor<COUNT> &supervisor = bench.supervisor;
+  // pump 1 is 4 h ahead: the 6 h morning run narrows that and moves
+  for (uint32_t n = 0; n < 4 * 3600 * (1000 / FAILOVER_WINDOW_MS); n++)
+    supervisor.window(0, true, true, 10000, 0);
+  supervisor.update(START_EPOCH + DAY + 6 * 3600 - 60, 903000);
+  supervisor.update(START_EPOCH + DAY + 6 * 3600, 904000);
+  TEST_ASSERT_EQUAL(1, bank.owner(0));
+  TEST_ASSERT_EQUAL(FAILOVER_BALANCE, lastMove);
+  TEST_ASSERT_EQUAL(1, supervisor.balanceCount());
+  // 2.5 h ahead the other way a 6 h run would not
+  for (uint32_t n = 0; n < 13 * 1800 * (1000 / FAILOVER_WINDOW_MS); n++)
+    supervisor.window(1, true, true, 10000, 0);
+  supervisor.update(START_EPOCH + DAY + 12 * 3600, 905000);
+  TEST_ASSERT_EQUAL(1, bank.owner(1));
+  TEST_ASSERT_EQUAL(1, bank.owner(0));
+  // the evening pulse goes back home
+  supervisor.update(START_EPOCH + DAY + 18 * 3600 + 600, 906000);
+  supervisor.update(START_EPOCH + DAY + 19 * 3600, 907000);
+  TEST_ASSERT_EQUAL(0, bank.owner(0));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_detection_time);
+  RUN_TEST(test_window_and_pulses_move_and_come_home);
+  RUN_TEST(test_other_way_round);
+  RUN_TEST(test_wear_balancing_narrows_the_gap);
+  return UNITY_END();
+}
@@ -0,0 +1,198 @@
+#include <unity.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+#include "metrics.h"
+#define TEST_COUNT_ALLOCATIONS // counts every heap allocation, recording must not make any
+#include "testSupport.h"
+
+static std::mt19937 random32(99);
+
+// a latency-like distribution: mostly short, a long tail of slow iterations
+static uint32_t latency()
+{
+  uint32_t value = 2000 + random32() % 3000;
+  if (random32() % 100 == 0)
+    value *= 50 + random32() % 200;
+  return value;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_buckets_cover_every_value()
+{
+  // every bucket holds a contiguous range within 25% of its values
+  TEST_ASSERT_EQUAL(HISTOGRAM_BUCKETS - 1, Histogram::bucketOf(UINT32_MAX));
+  TEST_ASSERT_EQUAL_UINT32(UINT32_MAX, Histogram::bucketHigh(HISTOGRAM_BUCKETS - 1));
+  uint32_t low = 0;
+  for (uint16_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+  {
+    uint32_t high = Histogram::bucketHigh(bucket);
+    TEST_ASSERT_GREATER_OR_EQUAL(low, high);
+    TEST_ASSERT_EQUAL(bucket, Histogram::bucketOf(low));
+    TEST_ASSERT_EQUAL(bucket, Histogram::bucketOf(high));
+    TEST_ASSERT_LESS_OR_EQUAL(low / 4, high - low);
+    if (bucket + 1 < HISTOGRAM_BUCKETS)
+      TEST_ASSERT_EQUAL(bucket + 1, Histogram::bucketOf(high + 1));
+    low = high + 1;
+  }
+  // powers of two start a bucket, so countBelow them is exact
+  for (uint8_t exponent = 1; exponent < 32; exponent++)
+    TEST_ASSERT_NOT_EQUAL(Histogram::bucketOf((1UL << exponent) - 1), Histogram::bucketOf(1UL << exponent));
+}
+
+void test_percentiles_against_sorted()
+{
+  Histogram histogram;
+  std::vector<uint32_t> values;
+  for (int i = 0; i < 100000; i++)
+  {
+    uint32_t value = latency();
+    values.push_back(value);
+    histogram.record(value);
+  }
+  std::sort(values.begin(), values.end());
+  TEST_ASSERT_EQUAL(values.size(), histogram.count());
+  TEST_ASSERT_EQUAL_UINT32(values.back(), histogram.max());
+  uint64_t sum = 0;
+  for (uint32_t value : values)
+    sum += value;
+  TEST_ASSERT_TRUE(sum == histogram.sum());
+  const float fractions[] = {0.5, 0.9, 0.99, 0.999};
+  for (float fraction : fractions)
+  {
+    uint32_t exact = values[(size_t)(fraction * values.size())];
+    uint32_t estimate = histogram.percentile(fraction);
+    // the upper bound of the value's bucket: never below, at most a quarter above
+    TEST_ASSERT_GREATER_OR_EQUAL(exact, estimate);
+    TEST_ASSERT_LESS_OR_EQUAL(exact + exact / 4, estimate);
+  }
+  TEST_ASSERT_EQUAL_UINT32(values.back(), histogram.percentile(1));
+  uint32_t below = std::lower_bound(values.begin(), values.end(), 4096) - values.begin();
+  TEST_ASSERT_EQUAL_UINT32(below, histogram.countBelow(4096));
+  histogram.reset();
+  TEST_ASSERT_EQUAL(0, histogram.count());
+  TEST_ASSERT_EQUAL(0, histogram.max());
+  TEST_ASSERT_EQUAL(0, histogram.percentile(0.5));
+}
+
+// the lines of a page that start with the given prefix, their values
+static std::vector<double> samples(const char *page, const char *prefix)
+{
+  std::vector<double> found;
+  for (const char *line = page; *line; line = strchr(line, '\n') + 1)
+  {
+    if (strncmp(line, prefix, strlen(prefix)) == 0)
+      found.push_back(atof(strrchr(std::string(line, strchr(line, '\n')).c_str(), ' ') + 1));
+  }
+  return found;
+}
+
+void test_prometheus_histogram()
+{
+  Histogram histogram;
+  for (uint32_t us = 1; us <= 1000; us++)
+    histogram.record(us);
+  char page[METRICS_PART_SIZE];
+  MetricsWriter writer(page, sizeof(page));
+  writer.family("greenhouse_task_run_seconds", "histogram", "Time spent in one task wakeup");
+  writer.histogram("greenhouse_task_run_seconds", "task=\"control\"", histogram, 1e-6, 4, 12);
+  writer.family("greenhouse_heap_free_bytes", "gauge", "Free heap");
+  writer.value("greenhouse_heap_free_bytes", NULL, 123456);
+  TEST_ASSERT_GREATER_THAN(0, writer.length());
+  TEST_ASSERT_EQUAL(strlen(page), writer.length());
+  TEST_ASSERT_EQUAL(0, strncmp(page, "# HELP greenhouse_task_run_seconds Time spent in one task wakeup\n# TYPE greenhouse_task_run_seconds histogram\n", 109));
+  TEST_ASSERT_NOT_NULL(strstr(page, "greenhouse_task_run_seconds_bucket{task=\"control\",le=\"1.6e-05\"} 15\n"));
+  TEST_ASSERT_NOT_NULL(strstr(page, "greenhouse_task_run_seconds_bucket{task=\"control\",le=\"+Inf\"} 1000\n"));
+  TEST_ASSERT_NOT_NULL(strstr(page, "greenhouse_task_run_seconds_count{task=\"control\"} 1000\n"));
+  TEST_ASSERT_NOT_NULL(strstr(page, "greenhouse_heap_free_bytes 123456\n"));
+  // buckets at 16, 64, 256, 1024 and 4096 us, cumulative
+  std::vector<double> buckets = samples(page, "greenhouse_task_run_seconds_bucket");
+  TEST_ASSERT_EQUAL(6, buckets.size());
+  const double expected[] = {15, 63, 255, 1000, 1000, 1000};
+  for (size_t i = 0; i < buckets.size(); i++)
+    TEST_ASSERT_EQUAL(expected[i], buckets[i]);
+  std::vector<double> sum = samples(page, "greenhouse_task_run_seconds_sum");
+  TEST_ASSERT_FLOAT_WITHIN(1e-9, 0.5005, sum[0]);
+}
+
+void test_writer_overflow()
+{
+  Histogram histogram;
+  histogram.record(1);
+  char page[64];
+  MetricsWriter writer(page, sizeof(page));
+  writer.histogram("greenhouse_task_run_seconds", "task=\"control\"", histogram, 1e-6, 0, 30);
+  TEST_ASSERT_EQUAL(0, writer.length());
+  writer.value("x", NULL, 1); // nothing more is written once it overflowed
+  TEST_ASSERT_EQUAL(0, writer.length());
+}
+
+static size_t renderPart(uint16_t part, char *out, size_t size)
+{
+  if (part == 1)
+    return 0; // does not fit
+  MetricsWriter writer(out, size);
+  char name[32];
+  snprintf(name, sizeof(name), "greenhouse_part_%u", part);
+  writer.value(name, NULL, part);
+  return writer.length();
+}
+
+void test_reader_streams_parts()
+{
+  MetricsReader reader(renderPart, 3);
+  std::string page;
+  uint8_t buffer[7]; // small chunks split lines between reads
+  size_t n;
+  while ((n = reader.read(buffer, sizeof(buffer))) != 0)
+    page.append((const char *)buffer, n);
+  TEST_ASSERT_EQUAL_STRING("greenhouse_part_0 0\n# part 1 does not fit METRICS_PART_SIZE\ngreenhouse_part_2 2\n", page.c_str());
+  TEST_ASSERT_EQUAL(0, reader.read(buffer, sizeof(buffer)));
+}
+
+void test_benchmark_record()
+{
+  static Histogram histogram;
+  const int count = 10000000;
+  std::vector<uint32_t> values(1 << 16);
+  for (uint32_t &value : values)
+    value = latency();
+  size_t before = allocations;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < count; i++)
+    histogram.record(values[i & 0xffff]);
+  double recordNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+  char page[METRICS_PART_SIZE];
+  start = std::chrono::steady_clock::now();
+  MetricsWriter writer(page, sizeof(page));
+  writer.histogram("greenhouse_loop_seconds", NULL, histogram, 1 / 240e6, 10, 30);
+  double exportUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  char line[128];
+  snprintf(line, sizeof(line), "record %.2f ns, export %.1f us, %u bytes, %u bytes of memory per histogram", recordNs, exportUs,
+           (unsigned)writer.length(), (unsigned)sizeof(Histogram));
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL(0, allocations - before);
+  TEST_ASSERT_EQUAL(count, histogram.count());
+  TEST_ASSERT_GREATER_THAN(0, writer.length());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_buckets_cover_every_value);
+  RUN_TEST(test_percentiles_against_sorted);
+  RUN_TEST(test_prometheus_histogram);
+  RUN_TEST(test_writer_overflow);
+  RUN_TEST(test_reader_streams_parts);
+  RUN_TEST(test_benchmark_record);
+  return UNITY_END();
+}
@@ -0,0 +1,406 @@
+#include <unity.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mqttClient.h"
+#include "outbox.h"
+#include "posixMqttTransport.h"
+
+// flash that loses power after a given number of written bytes
+template <size_t SIZE>
+class CrashingStorage : public JournalStorage
+{
+public:
+  uint8_t bytes[SIZE] = {};
+  uint32_t budget = UINT32_MAX; // bytes written before the power goes
+
+  bool read(uint32_t offset, void *data, size_t length) override
+  {
+    memcpy(data, bytes + offset, length);
+    return true;
+  }
+  bool write(uint32_t offset, const void *data, size_t length) override
+  {
+    size_t n = (length < budget) ? length : budget;
+    memcpy(bytes + offset, data, n);
+    budget -= n;
+    return n == length;
+  }
+};
+typedef CrashingStorage<(OUTBOX_SLOTS + 2) * sizeof(OutboxRecord)> OutboxFlash;
+
+// broker on the other end of an MqttTransport, answers straight away
+class LoopbackBroker : public MqttTransport
+{
+public:
+  bool up = true;         // accepts connections
+  uint8_t connackCode = 0;
+  bool holdAcks = false;  // swallow the PUBACK of QoS 1 publishes
+  bool open_ = false;
+  uint32_t opens = 0;
+  uint32_t pings = 0;
+  uint32_t acksSeen = 0;  // PUBACKs from the client
+  char payloads[64][OUTBOX_PAYLOAD_SIZE + 1]; // QoS 1 publishes in the order they arrived
+  uint32_t publishes = 0;
+
+  bool open(const char *, uint16_t) override
+  {
+    opens++;
+    open_ = up;
+    outLength = 0;
+    return open_;
+  }
+  bool connected() override { return open_; }
+  void close() override { open_ = false; }
+  size_t read(uint8_t *data, size_t size) override
+  {
+    size_t n = (outLength < size) ? outLength : size;
+    memcpy(data, out, n);
+    memmove(out, out + n, outLength - n);
+    outLength -= n;
+    return n;
+  }
+  size_t write(const uint8_t *data, size_t length) override
+  {
+    MqttPacket packet;
+    if (!open_ or mqttFrame(data, length, packet) != (int)length)
+      return 0;
+    switch (packet.type)
+    {
+    case MQTT_CONNECT:
+      reply(MQTT_CONNACK << 4, 0, connackCode);
+      break;
+    case MQTT_SUBSCRIBE:
+      reply(MQTT_SUBACK << 4, packet.body[0], packet.body[1], 1);
+      break;
+    case MQTT_PUBLISH:
+    {
+      MqttMessage message;
+      if (mqttParsePublish(packet, message) != NULL or message.qos != 1)
+        break;
+      if (publishes < 64)
+      {
+        memcpy(payloads[publishes], message.payload, message.length);
+        payloads[publishes][message.length] = '\0';
+      }
+      publishes++;
+      if (!holdAcks)
+        reply(MQTT_PUBACK << 4, message.packetId >> 8, message.packetId & 0xff);
+      break;
+    }
+    case MQTT_PUBACK:
+      acksSeen++;
+      break;
+    case MQTT_PINGREQ:
+      pings++;
+      reply(MQTT_PINGRESP << 4);
+      break;
+    default:
+      break;
+    }
+    return length;
+  }
+  void inject(const uint8_t *packet, size_t length)
+  {
+    memcpy(out + outLength, packet, length);
+    outLength += length;
+  }
+
+private:
+  void reply(uint8_t type, int a = -1, int b = -1, int c = -1)
+  {
+    uint8_t body[3] = {(uint8_t)a, (uint8_t)b, (uint8_t)c};
+    uint8_t length = (a >= 0) + (b >= 0) + (c >= 0);
+    out[outLength++] = type;
+    out[outLength++] = length;
+    memcpy(out + outLength, body, length);
+    outLength += length;
+  }
+
+  uint8_t out[1024];
+  size_t outLength = 0;
+};
+
+static char command[128];
+static void onCommand(const MqttMessage &message)
+{
+  snprintf(command, sizeof(command), "%s %.*s", message.topic, (int)(message.length < 32 ? message.length : 32), (const char *)message.payload);
+}
+
+// the drain step of serviceMqtt in main.cpp
+#define DRAIN_INTERVAL 250
+static void drainOutbox(MqttClient &client, Outbox &outbox, const char *topic, uint32_t now, uint32_t &lastDrain)
+{
+  if (client.delivered())
+    outbox.pop();
+  if (client.online() and !client.inFlight() and now - lastDrain >= DRAIN_INTERVAL)
+  {
+    uint8_t message[OUTBOX_PAYLOAD_SIZE];
+    size_t length = outbox.peek(message, sizeof(message));
+    if (length and client.publish(topic, message, length, 1))
+      lastDrain = now;
+  }
+}
+
+static uint32_t first(Outbox &outbox)
+{
+  uint32_t value = 0;
+  outbox.peek(&value, sizeof(value));
+  return value;
+}
+
+static OutboxFlash flash;
+
+void setUp()
+{
+  memset(flash.bytes, 0xff, sizeof(flash.bytes));
+  flash.budget = UINT32_MAX;
+  command[0] = '\0';
+}
+void tearDown() {}
+
+void test_publish_round_trip()
+{
+  // a 200 byte payload needs the two byte remaining length
+  uint8_t packet[MQTT_PACKET_SIZE];
+  uint8_t payload[200];
+  for (size_t i = 0; i < sizeof(payload); i++)
+    payload[i] = i;
+  size_t length = mqttPublish(packet, sizeof(packet), "greenhouse/telemetry", payload, sizeof(payload), 1, 77, false);
+  TEST_ASSERT_GREATER_THAN(0, length);
+  MqttPacket frame;
+  TEST_ASSERT_EQUAL(length, mqttFrame(packet, length, frame));
+  TEST_ASSERT_EQUAL(0, mqttFrame(packet, length - 1, frame)); // not all there yet
+  MqttMessage message;
+  TEST_ASSERT_NULL(mqttParsePublish(frame, message));
+  TEST_ASSERT_EQUAL_STRING("greenhouse/telemetry", message.topic);
+  TEST_ASSERT_EQUAL(1, message.qos);
+  TEST_ASSERT_EQUAL(77, message.packetId);
+  TEST_ASSERT_EQUAL(sizeof(payload), message.length);
+  TEST_ASSERT_EQUAL_MEMORY(payload, message.payload, sizeof(payload));
+}
+
+void test_malformed_length()
+{
+  const uint8_t malformed[] = {0x30, 0xff, 0xff, 0xff, 0xff, 0x01};
+  MqttPacket frame;
+  TEST_ASSERT_EQUAL(-1, mqttFrame(malformed, sizeof(malformed), frame));
+}
+
+void test_outbox_overflow_keeps_newest()
+{
+  {
+    Outbox outbox(flash, OUTBOX_SLOTS);
+    outbox.recover();
+    for (uint32_t i = 0; i < 200; i++)
+      outbox.push(&i, sizeof(i));
+    TEST_ASSERT_EQUAL(OUTBOX_SLOTS, outbox.size());
+    TEST_ASSERT_EQUAL(200 - OUTBOX_SLOTS, outbox.dropped());
+    TEST_ASSERT_EQUAL(200 - OUTBOX_SLOTS, first(outbox));
+    for (int i = 0; i < 10; i++)
+      outbox.pop();
+  }
+  // the delivered cursor survives a reboot
+  Outbox outbox(flash, OUTBOX_SLOTS);
+  outbox.recover();
+  TEST_ASSERT_EQUAL(OUTBOX_SLOTS - 10, outbox.size());
+  TEST_ASSERT_EQUAL(210 - OUTBOX_SLOTS, first(outbox));
+}
+
+void test_outbox_torn_writes()
+{
+  {
+    Outbox outbox(flash, OUTBOX_SLOTS);
+    outbox.recover();
+    for (uint32_t i = 0; i < 20; i++)
+      outbox.push(&i, sizeof(i));
+    outbox.pop();
+    // power cut half way into the next push
+    flash.budget = sizeof(OutboxRecord) / 2;
+    uint32_t next = 20;
+    outbox.push(&next, sizeof(next));
+    flash.budget = UINT32_MAX;
+  }
+  {
+    Outbox rebooted(flash, OUTBOX_SLOTS);
+    rebooted.recover();
+    TEST_ASSERT_EQUAL(19, rebooted.size());
+    // and again half way into the next pop
+    flash.budget = sizeof(OutboxRecord) / 2;
+    rebooted.pop();
+    flash.budget = UINT32_MAX;
+  }
+  Outbox again(flash, OUTBOX_SLOTS);
+  again.recover();
+  TEST_ASSERT_EQUAL(19, again.size());
+  TEST_ASSERT_EQUAL(1, first(again));
+}
+
+void test_backlog_drains_after_outage()
+{
+  // the broker is down for 30 minutes while a message is queued every minute
+  LoopbackBroker broker;
+  MqttClient client(broker, onCommand);
+  client.begin("broker", 1883, "nft-test", NULL, NULL, "greenhouse/cmd", "greenhouse/status");
+  Outbox outbox(flash, OUTBOX_SLOTS);
+  outbox.recover();
+  broker.up = false;
+  uint32_t lastDrain = 0, queued = 0, firstDelivered = 0, lastDelivered = 0;
+  bool held = false;
+  for (uint32_t now = 0; now < 45 * 60000; now += 50)
+  {
+    if (now % 60000 == 0 and queued < 30)
+    {
+      char message[16];
+      outbox.push(message, snprintf(message, sizeof(message), "{\"n\":%u}", queued++));
+    }
+    if (now == 30 * 60000)
+      broker.up = true;
+    uint32_t before = broker.publishes;
+    client.update(now, true);
+    drainOutbox(client, outbox, "greenhouse/telemetry", now, lastDrain);
+    if (broker.publishes != before)
+    {
+      firstDelivered = firstDelivered ? firstDelivered : now;
+      lastDelivered = now;
+    }
+    // hold back one acknowledgement, the message has to be sent again
+    if (broker.publishes == 10 and !held)
+      broker.holdAcks = held = true;
+    else if (broker.holdAcks and !client.online())
+      broker.holdAcks = false;
+  }
+  TEST_ASSERT_EQUAL(31, broker.publishes);
+  for (uint32_t i = 0; i < broker.publishes; i++)
+  {
+    char expected[24];
+    snprintf(expected, sizeof(expected), "{\"n\":%u}", (i <= 10) ? i : i - 1); // the unacknowledged 11th twice
+    TEST_ASSERT_EQUAL_STRING(expected, broker.payloads[i]);
+  }
+  TEST_ASSERT_EQUAL(0, outbox.size());
+  TEST_ASSERT_EQUAL(0, outbox.dropped());
+  // 31 sends at one per drain interval, plus the ack timeout and the reconnect
+  TEST_ASSERT_GREATER_OR_EQUAL(30 * 60000, firstDelivered);
+  TEST_ASSERT_LESS_OR_EQUAL(31 * DRAIN_INTERVAL + MQTT_ACK_TIMEOUT + 1000, lastDelivered - firstDelivered);
+  // retries while the broker was down back off, 30 minutes at the 2 minute cap is about 20
+  TEST_ASSERT_LESS_OR_EQUAL(30, broker.opens);
+  TEST_ASSERT_GREATER_THAN(0, broker.pings);
+}
+
+void test_command_is_handled_and_acknowledged()
+{
+  LoopbackBroker broker;
+  MqttClient client(broker, onCommand);
+  client.begin("broker", 1883, "nft-test", NULL, NULL, "greenhouse/cmd", "greenhouse/status");
+  uint32_t now = 0;
+  for (; now < 1000 and !client.online(); now += 50)
+    client.update(now, true);
+  TEST_ASSERT_TRUE(client.online());
+  uint8_t packet[MQTT_PACKET_SIZE];
+  size_t length = mqttPublish(packet, sizeof(packet), "greenhouse/cmd", (const uint8_t *)"{\"id\":5}", 8, 1, 9, false);
+  broker.inject(packet, length);
+  client.update(now, true);
+  TEST_ASSERT_EQUAL_STRING("greenhouse/cmd {\"id\":5}", command);
+  TEST_ASSERT_EQUAL(1, broker.acksSeen);
+}
+
+void test_refusing_broker_is_not_hammered()
+{
+  LoopbackBroker broker;
+  broker.connackCode = 5; // not authorized
+  MqttClient client(broker, onCommand);
+  client.begin("broker", 1883, "nft-test", NULL, NULL, "greenhouse/cmd", "greenhouse/status");
+  for (uint32_t now = 0; now < 5 * 60000; now += 50)
+    client.update(now, true);
+  TEST_ASSERT_LESS_OR_EQUAL(10, broker.opens);
+  TEST_ASSERT_FALSE(client.online());
+}
+
+// both ends on a real broker, MQTT_BROKER=host[:port] (mosquitto on the build machine)
+static uint32_t seen = 0;
+static bool inOrder = true;
+static void onTelemetry(const MqttMessage &message)
+{
+  char expected[16];
+  int n = snprintf(expected, sizeof(expected), "{\"n\":%u}", seen);
+  inOrder = inOrder and message.length == (size_t)n and memcmp(message.payload, expected, n) == 0;
+  seen++;
+}
+
+void test_real_broker()
+{
+  const char *broker = getenv("MQTT_BROKER");
+  if (broker == NULL)
+    TEST_IGNORE_MESSAGE("set MQTT_BROKER=host[:port] to run it");
+  char host[64];
+  snprintf(host, sizeof(host), "%s", broker);
+  uint16_t port = 1883;
+  char *colon = strchr(host, ':');
+  if (colon)
+  {
+    *colon = '\0';
+    port = atoi(colon + 1);
+  }
+  char base[32], telemetry[48], cmd[48], status[48];
+  snprintf(base, sizeof(base), "nft-test-%u", (unsigned)time(NULL) % 100000);
+  snprintf(telemetry, sizeof(telemetry), "%s/telemetry", base);
+  snprintf(cmd, sizeof(cmd), "%s/cmd", base);
+  snprintf(status, sizeof(status), "%s/status", base);
+
+  PosixMqttTransport bridgeSocket, observerSocket;
+  MqttClient bridge(bridgeSocket, onCommand);
+  MqttClient observer(observerSocket, onTelemetry);
+  bridge.begin(host, port, base, NULL, NULL, cmd, status);
+  char observerId[48];
+  snprintf(observerId, sizeof(observerId), "%s-observer", base);
+  observer.begin(host, port, observerId, NULL, NULL, telemetry, NULL);
+
+  Outbox outbox(flash, OUTBOX_SLOTS);
+  outbox.recover();
+  for (uint32_t i = 0; i < 20; i++)
+  {
+    char message[16];
+    outbox.push(message, snprintf(message, sizeof(message), "{\"n\":%u}", i));
+  }
+  auto start = std::chrono::steady_clock::now();
+  uint32_t lastDrain = 0;
+  bool commandSent = false;
+  for (;;)
+  {
+    uint32_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() + 1000;
+    observer.update(now, true);
+    bridge.update(now, true);
+    // the observer has to be subscribed before the first message goes out
+    if (observer.online() and now > 1500)
+      drainOutbox(bridge, outbox, telemetry, now, lastDrain);
+    if (seen == 20 and !commandSent and bridge.online())
+      commandSent = observer.publish(cmd, (const uint8_t *)"{\"id\":1}", 8, 1);
+    if ((seen == 20 and command[0]) or now > 20000)
+      break;
+    usleep(1000);
+  }
+  TEST_ASSERT_EQUAL(20, seen);
+  TEST_ASSERT_TRUE(inOrder);
+  TEST_ASSERT_EQUAL(0, outbox.size());
+  char expected[64];
+  snprintf(expected, sizeof(expected), "%s {\"id\":1}", cmd);
+  TEST_ASSERT_EQUAL_STRING(expected, command);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_publish_round_trip);
+  RUN_TEST(test_malformed_length);
+  RUN_TEST(test_outbox_overflow_keeps_newest);
+  RUN_TEST(test_outbox_torn_writes);
+  RUN_TEST(test_backlog_drains_after_outage);
+  RUN_TEST(test_command_is_handled_and_acknowledged);
+  RUN_TEST(test_refusing_broker_is_not_hammered);
+  RUN_TEST(test_real_broker);
+  return UNITY_END();
+}
@@ -0,0 +1,215 @@
+#include <unity.h>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+#include "outputDriver.h"
+
+#define PUMP_1 22
+#define PUMP_2 21
+#define AIR_PUMP 19
+#define LED 2
+
+struct Write
+{
+  uint32_t ms;
+  uint32_t setMask;
+  uint32_t clearMask;
+};
+
+static std::vector<Write> writes;
+static uint32_t nowMs = 0;
+static uint32_t pins = 0; // the output register
+
+static void writeRegister(uint32_t setMask, uint32_t clearMask)
+{
+  TEST_ASSERT_EQUAL(0, setMask & clearMask);
+  writes.push_back({nowMs, setMask, clearMask});
+  pins = (pins | setMask) & ~clearMask;
+}
+
+static void configureBoard(OutputDriver &driver, uint32_t minMs)
+{
+  TEST_ASSERT_TRUE(driver.configure(PUMP_1, minMs, minMs, true));
+  TEST_ASSERT_TRUE(driver.configure(PUMP_2, minMs, minMs, true));
+  TEST_ASSERT_TRUE(driver.configure(AIR_PUMP, minMs, minMs, true));
+  TEST_ASSERT_TRUE(driver.configure(LED, 0, 0, false));
+}
+
+void setUp()
+{
+  writes.clear();
+  nowMs = 0;
+  pins = 0;
+}
+void tearDown() {}
+
+void test_only_edges_touch_the_register()
+{
+  OutputDriver driver(writeRegister);
+  configureBoard(driver, 0);
+  TEST_ASSERT_FALSE(driver.configure(32, 0, 0, false));
+  for (nowMs = 0; nowMs < 10000; nowMs += 100)
+  {
+    driver.set(LED, true); // set on every loop pass, like controlPumps used to write
+    driver.apply(nowMs, 0);
+  }
+  TEST_ASSERT_EQUAL(1, writes.size());
+  TEST_ASSERT_EQUAL(1UL << LED, writes[0].setMask);
+  TEST_ASSERT_TRUE(driver.driven(LED));
+  // unmanaged and out of range pins are never written
+  driver.set(5, true);
+  driver.set(40, true);
+  TEST_ASSERT_FALSE(driver.pending());
+  TEST_ASSERT_EQUAL(0, driver.apply(nowMs, 0));
+  TEST_ASSERT_EQUAL(1, writes.size());
+}
+
+void test_changes_go_out_in_one_write()
+{
+  OutputDriver driver(writeRegister);
+  configureBoard(driver, 0);
+  driver.set(PUMP_1, true);
+  driver.apply(0, 100);
+  driver.set(PUMP_2, true);
+  driver.apply(1000, 101);
+  // both pumps off and the LED on at once: a single register write
+  driver.set(PUMP_1, false);
+  driver.set(PUMP_2, false);
+  driver.set(LED, true);
+  nowMs = 2000;
+  TEST_ASSERT_EQUAL((1UL << PUMP_1) | (1UL << PUMP_2) | (1UL << LED), driver.apply(nowMs, 102));
+  TEST_ASSERT_EQUAL(3, writes.size());
+  TEST_ASSERT_EQUAL(1UL << LED, writes[2].setMask);
+  TEST_ASSERT_EQUAL((1UL << PUMP_1) | (1UL << PUMP_2), writes[2].clearMask);
+  // every edge timestamped, newest first
+  TEST_ASSERT_EQUAL(5, driver.edgeLogSize());
+  TEST_ASSERT_EQUAL(102, driver.recentEdge(0).epoch);
+  TEST_ASSERT_EQUAL(2000, driver.recentEdge(0).millis);
+  TEST_ASSERT_EQUAL(PUMP_1, driver.recentEdge(4).pin);
+  TEST_ASSERT_TRUE(driver.recentEdge(4).on);
+  TEST_ASSERT_EQUAL(100, driver.recentEdge(4).epoch);
+}
+
+void test_minimum_on_and_off_time()
+{
+  OutputDriver driver(writeRegister);
+  configureBoard(driver, 10000);
+  driver.set(PUMP_1, true);
+  TEST_ASSERT_EQUAL(1UL << PUMP_1, driver.apply(5000, 0)); // no minimum before the first edge
+  driver.set(PUMP_1, false);
+  TEST_ASSERT_EQUAL(0, driver.apply(14999, 0));
+  TEST_ASSERT_TRUE(driver.driven(PUMP_1));
+  TEST_ASSERT_TRUE(driver.pending());
+  TEST_ASSERT_EQUAL(1UL << PUMP_1, driver.apply(15000, 0));
+  // a request that goes away while held never reaches the pin
+  driver.set(PUMP_1, true);
+  driver.apply(16000, 0);
+  driver.set(PUMP_1, false);
+  driver.apply(26000, 0);
+  TEST_ASSERT_EQUAL(2, driver.edgeCount());
+  TEST_ASSERT_EQUAL(10000, driver.sinceEdge(PUMP_1, 25000));
+}
+
+void test_inrush_stagger()
+{
+  OutputDriver driver(writeRegister);
+  configureBoard(driver, 0);
+  driver.set(PUMP_1, true);
+  driver.set(PUMP_2, true);
+  driver.set(AIR_PUMP, true);
+  driver.set(LED, true);
+  for (nowMs = 1000; nowMs < 3000; nowMs += 10)
+    driver.apply(nowMs, 0);
+  // one motor per write, 500 ms apart, the LED is no motor and goes with the first
+  TEST_ASSERT_EQUAL(3, writes.size());
+  TEST_ASSERT_EQUAL(1000, writes[0].ms);
+  TEST_ASSERT_EQUAL(1500, writes[1].ms);
+  TEST_ASSERT_EQUAL(2000, writes[2].ms);
+  TEST_ASSERT_TRUE(writes[0].setMask & (1UL << LED));
+  // stopping is never held back
+  driver.set(PUMP_1, false);
+  driver.set(PUMP_2, false);
+  driver.set(AIR_PUMP, false);
+  TEST_ASSERT_EQUAL((1UL << PUMP_1) | (1UL << PUMP_2) | (1UL << AIR_PUMP), driver.apply(nowMs, 0));
+}
+
+void test_simulated_day()
+{
+  // a day of the control task every 100 ms with a noisy controller behind the
+  // pumps: requests flip at random, some faster than the minimum times allow
+  const uint32_t minMs = 10000;
+  OutputDriver driver(writeRegister);
+  configureBoard(driver, minMs);
+  std::mt19937 random32(2024);
+  const uint8_t pumps[] = {PUMP_1, PUMP_2, AIR_PUMP};
+  uint32_t lastEdge[3] = {};
+  bool edged[3] = {};
+  uint32_t lastStart = 0;
+  bool started = false;
+  uint32_t loopPasses = 0;
+  for (nowMs = 0; nowMs < 86400000; nowMs += 100)
+  {
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      if (random32() % 600 == 0) // a change about once a minute
+        driver.set(pumps[i], !driver.commanded(pumps[i]));
+    }
+    if (nowMs % 60000 == 0)
+      driver.set(PUMP_1, driver.commanded(PUMP_2)); // the scheduler often commands two at once
+    size_t before = writes.size();
+    uint32_t changed = driver.apply(nowMs, nowMs / 1000);
+    loopPasses++;
+    if (changed == 0)
+    {
+      TEST_ASSERT_EQUAL(before, writes.size());
+      continue;
+    }
+    TEST_ASSERT_EQUAL(before + 1, writes.size());
+    for (uint8_t i = 0; i < 3; i++)
+    {
+      uint32_t bit = 1UL << pumps[i];
+      if (!(changed & bit))
+        continue;
+      if (edged[i])
+        TEST_ASSERT_GREATER_OR_EQUAL(minMs, nowMs - lastEdge[i]);
+      if (writes.back().setMask & bit)
+      {
+        if (started)
+          TEST_ASSERT_GREATER_OR_EQUAL(INRUSH_STAGGER_MS, nowMs - lastStart);
+        lastStart = nowMs;
+        started = true;
+      }
+      lastEdge[i] = nowMs;
+      edged[i] = true;
+    }
+  }
+  // settles on what was asked for last
+  for (uint32_t end = nowMs + minMs + 2 * INRUSH_STAGGER_MS; nowMs <= end; nowMs += 100)
+    driver.apply(nowMs, nowMs / 1000);
+  TEST_ASSERT_FALSE(driver.pending());
+  for (uint8_t pin : pumps)
+    TEST_ASSERT_EQUAL(driver.commanded(pin), (pins >> pin & 1) != 0);
+
+  uint32_t bitsWritten = 0;
+  for (const Write &write : writes)
+    bitsWritten += __builtin_popcount(write.setMask | write.clearMask);
+  TEST_ASSERT_EQUAL(driver.edgeCount(), bitsWritten);
+  TEST_ASSERT_EQUAL(driver.writeCount(), writes.size());
+  char line[128];
+  snprintf(line, sizeof(line), "%u edges in %u register writes, %u digitalWrite calls before", (unsigned)driver.edgeCount(),
+           (unsigned)driver.writeCount(), (unsigned)(loopPasses * 3));
+  TEST_MESSAGE(line);
+  TEST_ASSERT_GREATER_THAN(1000, driver.edgeCount());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_only_edges_touch_the_register);
+  RUN_TEST(test_changes_go_out_in_one_write);
+  RUN_TEST(test_minimum_on_and_off_time);
+  RUN_TEST(test_inrush_stagger);
+  RUN_TEST(test_simulated_day);
+  return UNITY_END();
+}
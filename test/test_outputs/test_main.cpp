@@ -0,0 +1,176 @@
+#include <unity.h>
+#include <string.h>
+
+#include "boardOutputs.h"
+#include "outputs.h"
+#include "pumpSchedule.h"
+#include "testSupport.h"
+
+#define HOUR 3600
+
+static bool pins[32];
+static int writes = 0;
+
+static void writePin(uint8_t pin, bool on)
+{
+  pins[pin] = on;
+  writes++;
+}
+
+// pump 1 06:00-12:00, pump 2 12:00-18:00, air pump all day
+static void schedule(OutputBank<3> &bank)
+{
+  ScheduleBuilder builder;
+  builder.addWindow(360, 720);
+  TEST_ASSERT_TRUE(builder.compile(bank.schedule(0)));
+  builder.clear();
+  builder.addWindow(720, 1080);
+  TEST_ASSERT_TRUE(builder.compile(bank.schedule(1)));
+  builder.clear();
+  builder.addWindow(0, 1440);
+  TEST_ASSERT_TRUE(builder.compile(bank.schedule(2)));
+}
+
+void setUp()
+{
+  memset(pins, 0, sizeof(pins));
+  writes = 0;
+}
+void tearDown() {}
+
+void test_config_table()
+{
+  OutputBank<3> bank(boardOutputs, writePin);
+  TEST_ASSERT_EQUAL(3, bank.size());
+  TEST_ASSERT_EQUAL(1, bank.indexOf("pump2"));
+  TEST_ASSERT_EQUAL(-1, bank.indexOf("pump3"));
+  TEST_ASSERT_EQUAL_STRING("Air Pump", bank.config(2).name);
+  for (size_t i = 0; i < bank.size(); i++)
+    TEST_ASSERT_EQUAL(i, bank.owner(i));
+}
+
+void test_auto_follows_schedule_and_writes_only_edges()
+{
+  OutputBank<3> bank(boardOutputs, writePin);
+  schedule(bank);
+  for (uint32_t t = START_EPOCH; t < START_EPOCH + 24 * HOUR; t += 10)
+    bank.control(t);
+  // pump 1 and 2 on and off once, the air pump on once
+  TEST_ASSERT_EQUAL(5, writes);
+  TEST_ASSERT_TRUE(pins[19]);
+  bank.control(START_EPOCH + 24 * HOUR + 7 * HOUR);
+  TEST_ASSERT_TRUE(pins[22]);
+  TEST_ASSERT_FALSE(pins[21]);
+  TEST_ASSERT_TRUE(bank[0].command);
+  bank.control(START_EPOCH + 24 * HOUR + 13 * HOUR);
+  TEST_ASSERT_FALSE(pins[22]);
+  TEST_ASSERT_TRUE(pins[21]);
+}
+
+void test_override_expires_back_to_auto()
+{
+  OutputBank<3> bank(boardOutputs, writePin);
+  schedule(bank);
+  uint32_t t = START_EPOCH + 7 * HOUR; // pump 1 scheduled on
+  bank.control(t);
+  bank.setOverride(0, false, 30, t);
+  TEST_ASSERT_FALSE(pins[22]);
+  TEST_ASSERT_TRUE(bank[0].override);
+  TEST_ASSERT_EQUAL(t + 30 * 60, bank[0].overrideEnd);
+  TEST_ASSERT_EQUAL(0, bank.control(t + 29 * 60));
+  TEST_ASSERT_FALSE(pins[22]);
+  TEST_ASSERT_EQUAL(1, bank.control(t + 30 * 60)); // bitmask of the outputs back in auto
+  TEST_ASSERT_FALSE(bank[0].override);
+  TEST_ASSERT_TRUE(pins[22]);
+}
+
+void test_permanent_override()
+{
+  OutputBank<3> bank(boardOutputs, writePin);
+  schedule(bank);
+  bank.setOverride(2, false, PERMANENT_OVERRIDE + 1, START_EPOCH);
+  TEST_ASSERT_EQUAL(0, bank[2].overrideEnd);
+  for (uint32_t t = START_EPOCH; t < START_EPOCH + 3 * 24 * HOUR; t += 600)
+    TEST_ASSERT_EQUAL(0, bank.control(t));
+  TEST_ASSERT_FALSE(pins[19]);
+  bank.setAuto(2, START_EPOCH + 3 * 24 * HOUR);
+  TEST_ASSERT_TRUE(pins[19]);
+}
+
+void test_restored_override_that_ran_out()
+{
+  OutputBank<3> bank(boardOutputs, writePin);
+  schedule(bank);
+  uint32_t t = START_EPOCH + 7 * HOUR;
+  bank.restoreOverride(1, true, t - 60); // saved before a reboot, ended while the power was off
+  TEST_ASSERT_TRUE(pins[21]);
+  TEST_ASSERT_EQUAL(2, bank.control(t));
+  TEST_ASSERT_FALSE(pins[21]);
+}
+
+void test_role_runs_on_another_output()
+{
+  OutputBank<3> bank(boardOutputs, writePin);
+  schedule(bank);
+  uint32_t t = START_EPOCH + 7 * HOUR; // pump 1's window
+  bank.assign(0, 1);                   // pump 2 takes over pump 1's schedule
+  bank.control(t);
+  TEST_ASSERT_FALSE(pins[22]);
+  TEST_ASSERT_TRUE(pins[21]);
+  TEST_ASSERT_EQUAL(1, bank.owner(0));
+  // pump 2 runs its own role too
+  bank.control(t + 6 * HOUR);
+  TEST_ASSERT_TRUE(pins[21]);
+  bank.control(t + 12 * HOUR);
+  TEST_ASSERT_FALSE(pins[21]);
+  // a role whose own output is in hand is not run by another one
+  bank.setOverride(0, false, 60, t + 24 * HOUR);
+  bank.control(t + 24 * HOUR);
+  TEST_ASSERT_FALSE(pins[21]);
+  TEST_ASSERT_FALSE(pins[22]);
+  bank.assign(0, 0);
+}
+
+void test_trial_start()
+{
+  OutputBank<3> bank(boardOutputs, writePin);
+  schedule(bank);
+  uint32_t t = START_EPOCH + 20 * HOUR; // nothing but the air pump scheduled
+  bank.trial(1, true);
+  bank.control(t);
+  TEST_ASSERT_TRUE(bank.onTrial(1));
+  TEST_ASSERT_TRUE(pins[21]);
+  bank.trial(1, false);
+  bank.control(t + 1);
+  TEST_ASSERT_FALSE(pins[21]);
+}
+
+void test_reschedule_picks_up_a_new_table()
+{
+  OutputBank<3> bank(boardOutputs, writePin);
+  schedule(bank);
+  uint32_t t = START_EPOCH + 20 * HOUR;
+  bank.control(t);
+  TEST_ASSERT_TRUE(pins[19]);
+  ScheduleBuilder builder;
+  TEST_ASSERT_TRUE(builder.compile(bank.schedule(2))); // all off
+  bank.control(t + 1);
+  TEST_ASSERT_TRUE(pins[19]); // cached until its next transition, constant schedules never have one
+  bank.reschedule();
+  bank.control(t + 2);
+  TEST_ASSERT_FALSE(pins[19]);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_config_table);
+  RUN_TEST(test_auto_follows_schedule_and_writes_only_edges);
+  RUN_TEST(test_override_expires_back_to_auto);
+  RUN_TEST(test_permanent_override);
+  RUN_TEST(test_restored_override_that_ran_out);
+  RUN_TEST(test_role_runs_on_another_output);
+  RUN_TEST(test_trial_start);
+  RUN_TEST(test_reschedule_picks_up_a_new_table);
+  return UNITY_END();
+}
@@ -0,0 +1,177 @@
+#include <unity.h>
+#include <string.h>
+
+#include "boardOutputs.h"
+#include "outputs.h"
+#include "powerPlanner.h"
+#include "pumpSchedule.h"
+#include "scheduleJson.h"
+#include "testSupport.h"
+
+#define DAY 86400
+
+#define COUNT BOARD_OUTPUT_COUNT
+
+static ScheduleWorkspace work;
+static WakePlanner planner;
+
+static void assertPlan(PowerState state, PowerReason reason, uint32_t sleepMs)
+{
+  PowerPlan plan = planner.plan();
+  TEST_ASSERT_EQUAL_STRING(POWER_STATE_NAMES[state], POWER_STATE_NAMES[plan.state]);
+  TEST_ASSERT_EQUAL_STRING(POWER_REASON_NAMES[reason], POWER_REASON_NAMES[plan.reason]);
+  TEST_ASSERT_EQUAL(sleepMs, plan.sleepMs);
+}
+
+void setUp()
+{
+  planner = WakePlanner();
+  planner.start(START_EPOCH);
+  planner.dueAt(0, POWER_OVERRIDE);          // permanent override
+  planner.dueAt(UINT32_MAX, POWER_SCHEDULE); // constant schedule
+}
+void tearDown() {}
+
+void test_upload_window()
+{
+  uint32_t start;
+  TEST_ASSERT_TRUE(inUploadWindow(START_EPOCH + 7260, 3600, 120, start)); // 02:01
+  TEST_ASSERT_FALSE(inUploadWindow(START_EPOCH + 7320, 3600, 120, start)); // 02:02
+  TEST_ASSERT_EQUAL(START_EPOCH + 3 * 3600, start);
+  TEST_ASSERT_TRUE(inUploadWindow(START_EPOCH + 7320, 0, 120, start)); // interval 0, always open
+}
+
+void test_nothing_due_sleeps_the_limit()
+{
+  assertPlan(POWER_SLEEP, POWER_LIMIT, POWER_MAX_SLEEP - POWER_WAKE_EARLY);
+}
+
+void test_relay_on_stays_active()
+{
+  planner.busy(POWER_RUNNING);
+  assertPlan(POWER_ACTIVE, POWER_RUNNING, 0);
+}
+
+void test_upload_window_idles()
+{
+  planner.idle(POWER_UPLOAD);
+  assertPlan(POWER_IDLE, POWER_UPLOAD, 0);
+}
+
+void test_short_gap_idles()
+{
+  planner.due(6000, POWER_WATER);
+  assertPlan(POWER_IDLE, POWER_WATER, 0);
+}
+
+void test_earliest_deadline_wins()
+{
+  planner.due(90000, POWER_DHT);
+  planner.due(60000, POWER_WATER);
+  assertPlan(POWER_SLEEP, POWER_WATER, 58000);
+}
+
+void test_late_deadline_idles()
+{
+  planner.due(-400, POWER_DHT);
+  assertPlan(POWER_IDLE, POWER_DHT, 0);
+}
+
+void test_close_edge_stays_active()
+{
+  planner.dueAt(START_EPOCH + 3, POWER_SCHEDULE);
+  assertPlan(POWER_ACTIVE, POWER_SCHEDULE, 0);
+}
+
+void test_sleeps_until_edge()
+{
+  planner.dueAt(START_EPOCH + 30, POWER_SCHEDULE);
+  assertPlan(POWER_SLEEP, POWER_SCHEDULE, 27000);
+}
+
+void test_day_of_default_schedule()
+{
+  // planned at the very end of each second: every sleep ends POWER_WAKE_EARLY
+  // before the next edge and no gap long enough to sleep in is idled away
+  OutputSchedule schedules[COUNT];
+  TEST_ASSERT_NULL(compileSchedule(DEFAULT_SCHEDULE, strlen(DEFAULT_SCHEDULE), boardOutputs, COUNT, schedules, work));
+  uint32_t early = 0, wasted = 0, asleep = 0;
+  for (uint32_t t = START_EPOCH; t < START_EPOCH + DAY; t++)
+  {
+    WakePlanner wake;
+    wake.start(t);
+    uint32_t next = UINT32_MAX;
+    for (size_t i = 0; i < COUNT; i++)
+    {
+      uint32_t edge = schedules[i].nextTransition(t);
+      wake.dueAt(edge, POWER_SCHEDULE);
+      next = (edge < next) ? edge : next;
+    }
+    PowerPlan plan = wake.plan();
+    uint64_t nowMs = (uint64_t)t * 1000 + 999;
+    if (plan.state == POWER_SLEEP)
+    {
+      asleep++;
+      early += nowMs + plan.sleepMs > (uint64_t)next * 1000 - POWER_WAKE_EARLY;
+    }
+    else if ((uint64_t)next * 1000 - nowMs > POWER_MIN_SLEEP + POWER_WAKE_EARLY + 1000 and plan.state != POWER_ACTIVE)
+    {
+      wasted++;
+    }
+  }
+  TEST_ASSERT_EQUAL_MESSAGE(0, early, "sleeps past an edge");
+  TEST_ASSERT_EQUAL_MESSAGE(0, wasted, "sleepable seconds idled");
+  TEST_ASSERT_GREATER_THAN(0, asleep);
+}
+
+void test_energy_budget()
+{
+  // an hour at full clock with the radio up, 23 asleep: (50 + 40) + 23 x 2 mAh at 5 V
+  EnergyBudget budget(POWER_RATES);
+  budget.account(POWER_ACTIVE, true, 1, 1.5, 3600000);
+  budget.account(POWER_SLEEP, false, 0, 0, 23 * 3600000);
+  float mah = POWER_ACTIVE_MA + POWER_WIFI_MA + POWER_RELAY_MA + 23 * POWER_SLEEP_MA;
+  TEST_ASSERT_FLOAT_WITHIN(0.01, mah, budget.controllerMah());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, mah * POWER_SUPPLY_VOLTS / 1000, budget.controllerWhPerDay());
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 1.5 * POWER_PUMP_VOLTS, budget.pumpWhPerDay());
+  TEST_ASSERT_FLOAT_WITHIN(1e-6, 23 / 24.0, budget.share(POWER_SLEEP));
+}
+
+void test_board_rates()
+{
+  // a board with a 10 mA sleep floor on a 12 V supply and 230 V pumps, the same day as above
+  PowerRates rates = POWER_RATES;
+  rates.sleepMa = 10;
+  rates.supplyVolts = 12;
+  rates.pumpVolts = 230;
+  EnergyBudget budget(rates);
+  budget.account(POWER_ACTIVE, true, 1, 1.5, 3600000);
+  budget.account(POWER_SLEEP, false, 0, 0, 23 * 3600000);
+  float mah = POWER_ACTIVE_MA + POWER_WIFI_MA + POWER_RELAY_MA + 23 * 10;
+  TEST_ASSERT_FLOAT_WITHIN(0.01, mah, budget.controllerMah());
+  TEST_ASSERT_FLOAT_WITHIN(0.001, mah * 12 / 1000, budget.controllerWhPerDay());
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 1.5 * 230, budget.pumpWhPerDay());
+
+  // clearing keeps the board's figures
+  budget.clear();
+  budget.account(POWER_SLEEP, false, 0, 0, 3600000);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 10, budget.controllerMah());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_upload_window);
+  RUN_TEST(test_nothing_due_sleeps_the_limit);
+  RUN_TEST(test_relay_on_stays_active);
+  RUN_TEST(test_upload_window_idles);
+  RUN_TEST(test_short_gap_idles);
+  RUN_TEST(test_earliest_deadline_wins);
+  RUN_TEST(test_late_deadline_idles);
+  RUN_TEST(test_close_edge_stays_active);
+  RUN_TEST(test_sleeps_until_edge);
+  RUN_TEST(test_day_of_default_schedule);
+  RUN_TEST(test_energy_budget);
+  RUN_TEST(test_board_rates);
+  return UNITY_END();
+}
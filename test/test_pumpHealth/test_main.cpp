@@ -0,0 +1,197 @@
+#include <unity.h>
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+
+#include "pumpHealth.h"
+
+static uint32_t seed = 11;
+
+// synthetic pump current: mains sine of rmsCounts at a random phase with 2nd and
+// 3rd harmonics, gaussian broadband noise (a share of rmsCounts) and ADC noise
+static void pumpWave(uint16_t *samples, float rmsCounts, float h2, float h3, float broadband)
+{
+  auto uniform = []() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return (seed >> 8) / 16777216.0f;
+  };
+  auto gaussian = [&uniform]() { return sqrtf(-2 * logf(1 - uniform())) * cosf(2 * M_PI * uniform()); };
+  float amplitude = rmsCounts * sqrtf(2 / (1 + h2 * h2 + h3 * h3));
+  float phase = 2 * M_PI * uniform();
+  for (int i = 0; i < PUMP_FFT_SIZE; i++)
+  {
+    float angle = 2 * M_PI * PUMP_MAINS * i / PUMP_SAMPLE_RATE + phase;
+    float value = amplitude * (sinf(angle) + h2 * sinf(2 * angle + 1) + h3 * sinf(3 * angle + 0.5)) + (broadband * rmsCounts + 3) * gaussian();
+    samples[i] = lroundf(1551 + value);
+  }
+}
+
+// RMS windows of one pump start, surge decaying with tau seconds
+static void pumpStart(PumpHealth &health, float amps, float tau)
+{
+  for (uint32_t ms = 0; ms <= PUMP_INRUSH_MS; ms += 100)
+    health.window(amps * (1 + 4 * expf(-(ms + 50.0f) / 1000 / tau)), true, true, ms);
+}
+
+// a healthy pump learned, then one start and 20 captures of the given fault;
+// returns the lowest health seen
+static float learnThenRun(PumpHealth &health, float h3, float broadband, float tau)
+{
+  uint16_t samples[PUMP_FFT_SIZE];
+  for (int i = 0; i < 2 * PUMP_MIN_CAPTURES; i++)
+  {
+    if (i % 10 == 0)
+      pumpStart(health, 1.2, 0.15);
+    pumpWave(samples, 140 * (1 + 0.02 * ((i % 7) - 3) / 3), 0, 0.08, 0);
+    health.capture(samples);
+  }
+  TEST_ASSERT_TRUE(health.learned());
+  float lowest = 100;
+  pumpStart(health, 1.2, tau);
+  for (int i = 0; i < 20; i++)
+  {
+    pumpWave(samples, 140, 0, h3, broadband);
+    health.capture(samples);
+    lowest = fminf(lowest, health.health());
+  }
+  return lowest;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_fft_matches_dft()
+{
+  for (uint8_t log2n : (const uint8_t[]){4, PUMP_FFT_LOG2})
+  {
+    uint16_t n = 1 << log2n;
+    int16_t re[PUMP_FFT_SIZE], im[PUMP_FFT_SIZE];
+    double inRe[PUMP_FFT_SIZE], inIm[PUMP_FFT_SIZE];
+    for (uint16_t i = 0; i < n; i++)
+    {
+      seed = seed * 1664525 + 1013904223;
+      re[i] = inRe[i] = (int16_t)(seed >> 16) / 2;
+      seed = seed * 1664525 + 1013904223;
+      im[i] = inIm[i] = (int16_t)(seed >> 16) / 2;
+    }
+    fftQ15(re, im, log2n);
+    double worst = 0;
+    for (uint16_t k = 0; k < n; k++)
+    {
+      double sumRe = 0, sumIm = 0;
+      for (uint16_t i = 0; i < n; i++)
+      {
+        double angle = -2 * M_PI * i * k / n;
+        sumRe += inRe[i] * cos(angle) - inIm[i] * sin(angle);
+        sumIm += inRe[i] * sin(angle) + inIm[i] * cos(angle);
+      }
+      worst = fmax(worst, fmax(fabs(sumRe / n - re[k]), fabs(sumIm / n - im[k])));
+    }
+    // rounding down in every stage, about one LSB per stage at most
+    TEST_ASSERT_TRUE(worst <= log2n);
+  }
+}
+
+void test_features_of_known_waves()
+{
+  struct
+  {
+    const char *name;
+    float rms, h2, h3, broadband;
+    PumpFeature feature;
+    float expected, tolerance;
+  } waves[] = {
+      {"sine rms", 150, 0, 0, 0, FEATURE_RMS, 150, 1.5},
+      {"sine crest", 150, 0, 0, 0, FEATURE_CREST, 1.45, 0.05}, // the ADC noise adds to the peak
+      {"sine thd", 150, 0, 0, 0, FEATURE_THD, 0.01, 0.01},      // ... and to the harmonic bins
+      {"sine noise", 150, 0, 0, 0, FEATURE_NOISE, 0, 0.01},
+      {"3rd harmonic", 150, 0.05, 0.1, 0, FEATURE_H3, 0.1, 0.01},
+      {"2nd harmonic", 150, 0.05, 0.1, 0, FEATURE_H2, 0.05, 0.01},
+      {"harmonic distortion", 150, 0.05, 0.1, 0, FEATURE_THD, 0.112, 0.01},
+      {"quiet channel", 12, 0, 0.1, 0, FEATURE_H3, 0.1, 0.03},
+      {"broadband", 150, 0, 0, 0.3, FEATURE_NOISE, 0.08, 0.03},
+  };
+  for (auto &wave : waves)
+  {
+    uint16_t samples[PUMP_FFT_SIZE];
+    float features[FEATURE_WAVEFORM];
+    float sum = 0;
+    const int rounds = 20;
+    for (int round = 0; round < rounds; round++)
+    {
+      pumpWave(samples, wave.rms, wave.h2, wave.h3, wave.broadband);
+      TEST_ASSERT_TRUE(extractFeatures(samples, features));
+      sum += features[wave.feature];
+    }
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(wave.tolerance, wave.expected, sum / rounds, wave.name);
+  }
+}
+
+void test_healthy_pump_stays_healthy()
+{
+  PumpHealth health;
+  TEST_ASSERT_TRUE(learnThenRun(health, 0.08, 0, 0.15) >= 90);
+}
+
+void test_cavitation()
+{
+  PumpHealth health;
+  learnThenRun(health, 0.08, 0.25, 0.15);
+  TEST_ASSERT_TRUE(health.health() < PUMP_HEALTH_ALARM);
+}
+
+void test_failing_capacitor()
+{
+  PumpHealth health;
+  learnThenRun(health, 0.25, 0, 0.15);
+  TEST_ASSERT_TRUE(health.health() < PUMP_HEALTH_ALARM);
+}
+
+void test_slow_start()
+{
+  PumpHealth health;
+  learnThenRun(health, 0.08, 0, 0.8);
+  TEST_ASSERT_TRUE(health.health() < PUMP_HEALTH_ALARM);
+}
+
+void test_benchmark_capture()
+{
+  // the board reports the same as section pump_fft on /metrics
+  uint16_t samples[PUMP_FFT_SIZE];
+  float features[FEATURE_WAVEFORM];
+  pumpWave(samples, 140, 0, 0.08, 0);
+  const int runs = 20000;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++)
+  {
+    samples[i % PUMP_FFT_SIZE] ^= 1; // keep the compiler from hoisting it
+    extractFeatures(samples, features);
+  }
+  double capture = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / runs;
+  int16_t re[PUMP_FFT_SIZE] = {}, im[PUMP_FFT_SIZE] = {};
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++)
+  {
+    re[i % PUMP_FFT_SIZE] = i;
+    fftQ15(re, im, PUMP_FFT_LOG2);
+  }
+  double fft = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / runs;
+  char line[128];
+  snprintf(line, sizeof(line), "%.2f us per %d point fixed-point FFT, %.2f us per capture with the features", fft, PUMP_FFT_SIZE, capture);
+  TEST_MESSAGE(line);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_fft_matches_dft);
+  RUN_TEST(test_features_of_known_waves);
+  RUN_TEST(test_healthy_pump_stays_healthy);
+  RUN_TEST(test_cavitation);
+  RUN_TEST(test_failing_capacitor);
+  RUN_TEST(test_slow_start);
+  RUN_TEST(test_benchmark_capture);
+  return UNITY_END();
+}
@@ -0,0 +1,224 @@
+#include <unity.h>
+#include <string.h>
+#include <vector>
+
+#include "boardOutputs.h"
+#include "outputDriver.h"
+#include "outputs.h"
+#include "pumpSchedule.h"
+#include "scheduleJson.h"
+#include "testSupport.h"
+
+#define WEEK (7 * SECONDS_PER_DAY)
+
+#define COUNT BOARD_OUTPUT_COUNT
+
+static ScheduleWorkspace work;
+static OutputSchedule schedules[COUNT];
+
+// DEFAULT_SCHEDULE written out minute by minute, independent of the compiler
+static bool expectedOn(size_t output, uint32_t minute)
+{
+  switch (output)
+  {
+  case 0:
+    return (minute >= 360 and minute < 720) or minute % 60 == 0;
+  case 1:
+    return (minute >= 720 and minute < 1080) or minute % 60 == 30;
+  default:
+    return minute % 30 < 15;
+  }
+}
+
+struct Edge
+{
+  uint32_t epoch;
+  uint8_t pin;
+  bool on;
+};
+
+static std::vector<Edge> edges;
+static uint32_t nowEpoch = 0;
+static uint32_t registerWrites = 0;
+static uint32_t pinWrites = 0;
+
+static void writeRegister(uint32_t setMask, uint32_t clearMask)
+{
+  registerWrites++;
+  for (uint8_t pin = 0; pin < OUTPUT_PINS; pin++)
+  {
+    if ((setMask | clearMask) >> pin & 1)
+      edges.push_back({nowEpoch, pin, (setMask >> pin & 1) != 0});
+  }
+}
+
+static OutputDriver driver(writeRegister);
+
+static void writePin(uint8_t pin, bool on)
+{
+  pinWrites++;
+  driver.set(pin, on);
+}
+
+static void compileDefault()
+{
+  TEST_ASSERT_NULL(compileSchedule(DEFAULT_SCHEDULE, strlen(DEFAULT_SCHEDULE), boardOutputs, COUNT, schedules, work));
+}
+
+void setUp()
+{
+  edges.clear();
+  registerWrites = 0;
+  pinWrites = 0;
+}
+void tearDown() {}
+
+void test_state_matches_every_minute_of_the_week()
+{
+  compileDefault();
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    for (uint32_t t = START_EPOCH; t < START_EPOCH + WEEK; t += 60)
+    {
+      uint32_t minute = (t % SECONDS_PER_DAY) / 60;
+      TEST_ASSERT_EQUAL_MESSAGE(expectedOn(i, minute), schedules[i].stateAt(t), boardOutputs[i].name);
+      TEST_ASSERT_EQUAL(expectedOn(i, minute), schedules[i].stateAt(t + 59));
+    }
+  }
+}
+
+void test_next_transition_lands_on_edges()
+{
+  compileDefault();
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    uint32_t t = START_EPOCH;
+    uint32_t transitions = 0;
+    while (t < START_EPOCH + WEEK)
+    {
+      uint32_t next = schedules[i].nextTransition(t);
+      TEST_ASSERT_GREATER_THAN(t, next);
+      TEST_ASSERT_EQUAL(0, next % 60);
+      // nothing changes between here and the next transition, which does change the state
+      TEST_ASSERT_EQUAL(schedules[i].stateAt(t), schedules[i].stateAt(next - 1));
+      TEST_ASSERT_NOT_EQUAL(schedules[i].stateAt(next - 1), schedules[i].stateAt(next));
+      t = next;
+      transitions++;
+    }
+    TEST_ASSERT_EQUAL(7 * schedules[i].transitionCount(), transitions - (t > START_EPOCH + WEEK ? 1 : 0));
+  }
+}
+
+void test_week_replay_gpio_edges()
+{
+  compileDefault();
+  OutputBank<COUNT> bank(boardOutputs, writePin);
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    bank.schedule(i) = schedules[i];
+    driver.configure(boardOutputs[i].pin, boardOutputs[i].minOn * 1000UL, boardOutputs[i].minOff * 1000UL, true);
+  }
+  // the control task: every second, like runPumpControl, the pins only change on an edge
+  for (nowEpoch = START_EPOCH; nowEpoch < START_EPOCH + WEEK; nowEpoch++)
+  {
+    bank.control(nowEpoch);
+    driver.apply((nowEpoch - START_EPOCH) * 1000, nowEpoch);
+  }
+
+  // expected sequence: every change of the minute table, starts may wait one inrush stagger
+  std::vector<Edge> expected;
+  for (uint32_t t = START_EPOCH; t < START_EPOCH + WEEK; t += 60)
+  {
+    uint32_t minute = (t % SECONDS_PER_DAY) / 60;
+    for (size_t i = 0; i < COUNT; i++)
+    {
+      bool before = t == START_EPOCH ? false : expectedOn(i, (minute + MINUTES_PER_DAY - 1) % MINUTES_PER_DAY);
+      if (expectedOn(i, minute) != before)
+        expected.push_back({t, boardOutputs[i].pin, expectedOn(i, minute)});
+    }
+  }
+  TEST_ASSERT_EQUAL(expected.size(), edges.size());
+  for (size_t e = 0; e < expected.size(); e++)
+  {
+    // edges of one minute may come out in another pin order, match by pin within the minute
+    bool found = false;
+    for (size_t a = 0; a < edges.size() and !found; a++)
+    {
+      found = edges[a].pin == expected[e].pin and edges[a].on == expected[e].on and edges[a].epoch >= expected[e].epoch and
+              edges[a].epoch <= expected[e].epoch + 1;
+    }
+    TEST_ASSERT_TRUE_MESSAGE(found, "edge missing or late");
+  }
+  // one pin write per edge, one register write per apply() that changed something
+  TEST_ASSERT_EQUAL(edges.size(), pinWrites);
+  TEST_ASSERT_EQUAL(edges.size(), driver.edgeCount());
+  TEST_ASSERT_LESS_OR_EQUAL(edges.size(), registerWrites);
+  // runs per day: pump 1 its window and 17 pulses outside it (the one at 12:00 extends it), pump 2 its window and 18, the air pump 48
+  TEST_ASSERT_EQUAL(7 * 2 * ((1 + 17) + (1 + 18) + 48), edges.size());
+}
+
+void test_missing_output_stays_off()
+{
+  const char *json = R"({"outputs":[{"pin":22,"on":[[0,1440]]}]})";
+  TEST_ASSERT_NULL(compileSchedule(json, strlen(json), boardOutputs, COUNT, schedules, work));
+  TEST_ASSERT_TRUE(schedules[0].stateAt(START_EPOCH + 12345));
+  TEST_ASSERT_EQUAL(0, schedules[0].nextTransition(START_EPOCH)); // constant
+  TEST_ASSERT_FALSE(schedules[1].stateAt(START_EPOCH + 12345));
+  TEST_ASSERT_FALSE(schedules[2].stateAt(START_EPOCH));
+}
+
+void test_window_wraps_midnight()
+{
+  const char *json = R"({"outputs":[{"pin":22,"on":[[1380,120]]}]})";
+  TEST_ASSERT_NULL(compileSchedule(json, strlen(json), boardOutputs, COUNT, schedules, work));
+  TEST_ASSERT_TRUE(schedules[0].stateAt(START_EPOCH + 23 * 3600));
+  TEST_ASSERT_TRUE(schedules[0].stateAt(START_EPOCH + 1 * 3600 + 3599));
+  TEST_ASSERT_FALSE(schedules[0].stateAt(START_EPOCH + 2 * 3600));
+  TEST_ASSERT_EQUAL(START_EPOCH + 2 * 3600, schedules[0].nextTransition(START_EPOCH));
+  TEST_ASSERT_EQUAL(START_EPOCH + 23 * 3600, schedules[0].nextTransition(START_EPOCH + 2 * 3600));
+}
+
+void test_pulse_scale()
+{
+  const char *json = R"({"outputs":[{"pin":19,"pulse":{"every":30,"at":0,"length":10}}]})";
+  float scales[COUNT] = {1, 1, 2};
+  TEST_ASSERT_NULL(compileSchedule(json, strlen(json), boardOutputs, COUNT, schedules, work, scales));
+  uint32_t onMinutes = 0;
+  for (uint32_t t = START_EPOCH; t < START_EPOCH + SECONDS_PER_DAY; t += 60)
+    onMinutes += schedules[2].stateAt(t);
+  TEST_ASSERT_INT_WITHIN(MINUTES_PER_DAY / 30, 2 * 10 * MINUTES_PER_DAY / 30, onMinutes);
+}
+
+void test_rejects_bad_schedules()
+{
+  const char *bad[] = {
+      "not json",
+      R"({"outputs":[{"pin":22,"on":[[-1,60]]}]})",
+      R"({"outputs":[{"pin":22,"on":[[0,1441]]}]})",
+      R"({"outputs":[{"pin":22,"on":[[1440,60]]}]})",
+      R"({"outputs":[{"pin":22,"on":[[60]]}]})",
+      R"({"outputs":[{"pin":22,"pulse":{"every":0}}]})",
+      R"({"outputs":[{"pin":22,"pulse":{"every":60,"at":1440}}]})",
+      R"({"outputs":[{"pin":22,"pulse":{"every":60,"length":1441}}]})",
+      R"({"outputs":[{"pin":22,"pulse":{"every":4,"at":0,"length":1}}]})", // 720 edges
+  };
+  for (const char *json : bad)
+  {
+    TEST_ASSERT_NOT_NULL_MESSAGE(compileSchedule(json, strlen(json), boardOutputs, COUNT, schedules, work), json);
+  }
+  const char *edge = R"({"outputs":[{"pin":22,"on":[[0,1440]],"pulse":{"every":1440,"at":1439,"length":1440}}]})";
+  TEST_ASSERT_NULL(compileSchedule(edge, strlen(edge), boardOutputs, COUNT, schedules, work));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_state_matches_every_minute_of_the_week);
+  RUN_TEST(test_next_transition_lands_on_edges);
+  RUN_TEST(test_week_replay_gpio_edges);
+  RUN_TEST(test_missing_output_stays_off);
+  RUN_TEST(test_window_wraps_midnight);
+  RUN_TEST(test_pulse_scale);
+  RUN_TEST(test_rejects_bad_schedules);
+  return UNITY_END();
+}
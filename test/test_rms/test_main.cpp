@@ -0,0 +1,141 @@
+#include <unity.h>
+#include <chrono>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+
+#include "rms.h"
+
+// the current sensor's window: 2400 Hz, six 60 Hz cycles
+#define SAMPLES_PER_CYCLE 40
+#define WINDOW (SAMPLES_PER_CYCLE * 6)
+#define BIAS 2048 // ACS712 output at zero current, mid scale of the 12-bit ADC
+
+static uint16_t samples[60000];
+
+// two pass reference in double precision
+static double referenceRms(const uint16_t *x, size_t count)
+{
+  double mean = 0;
+  for (size_t i = 0; i < count; i++)
+    mean += x[i];
+  mean /= count;
+  double sum = 0;
+  for (size_t i = 0; i < count; i++)
+    sum += (x[i] - mean) * (x[i] - mean);
+  return sqrt(sum / count);
+}
+
+static void sine(uint16_t *x, size_t count, double amplitude, double phase, double noise = 0, unsigned seed = 1)
+{
+  std::mt19937 random(seed);
+  std::normal_distribution<double> gauss(0, noise > 0 ? noise : 1);
+  for (size_t i = 0; i < count; i++)
+  {
+    double v = BIAS + amplitude * sin(2 * M_PI * i / SAMPLES_PER_CYCLE + phase) + (noise > 0 ? gauss(random) : 0);
+    x[i] = v < 0 ? 0 : v > 4095 ? 4095 : lround(v);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_empty_and_dc()
+{
+  TEST_ASSERT_EQUAL_FLOAT(0, acRms(samples, 0));
+  for (size_t i = 0; i < WINDOW; i++)
+    samples[i] = 3000;
+  TEST_ASSERT_EQUAL_FLOAT(0, acRms(samples, WINDOW));
+}
+
+void test_sine_over_whole_cycles()
+{
+  // any phase, the window holds whole cycles so the mean is the bias
+  for (double phase = 0; phase < 2 * M_PI; phase += 0.3)
+  {
+    sine(samples, WINDOW, 1000, phase);
+    TEST_ASSERT_FLOAT_WITHIN(1000 / sqrt(2) * 0.002, 1000 / sqrt(2), acRms(samples, WINDOW));
+  }
+  sine(samples, WINDOW, 10, 0.5);
+  TEST_ASSERT_FLOAT_WITHIN(0.3, 10 / sqrt(2), acRms(samples, WINDOW)); // a few counts, quantisation shows
+}
+
+void test_square_and_triangle()
+{
+  for (size_t i = 0; i < WINDOW; i++)
+    samples[i] = (i % SAMPLES_PER_CYCLE) < SAMPLES_PER_CYCLE / 2 ? BIAS + 500 : BIAS - 500;
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 500, acRms(samples, WINDOW));
+  for (size_t i = 0; i < WINDOW; i++)
+  {
+    int phase = i % SAMPLES_PER_CYCLE;
+    int ramp = phase < SAMPLES_PER_CYCLE / 2 ? phase : SAMPLES_PER_CYCLE - phase; // 0-20-0
+    samples[i] = BIAS + (ramp - 10) * 60;
+  }
+  TEST_ASSERT_FLOAT_WITHIN(0.02 * 600 / sqrt(3), referenceRms(samples, WINDOW), acRms(samples, WINDOW));
+  TEST_ASSERT_FLOAT_WITHIN(0.05 * 600 / sqrt(3), 600 / sqrt(3), acRms(samples, WINDOW));
+}
+
+void test_sine_with_noise()
+{
+  // the ACS712 has ~10 counts of noise, RMS adds in quadrature
+  sine(samples, WINDOW, 300, 0.1, 10, 7);
+  double expected = sqrt(300.0 * 300.0 / 2 + 10.0 * 10.0);
+  TEST_ASSERT_FLOAT_WITHIN(expected * 0.03, expected, acRms(samples, WINDOW));
+  TEST_ASSERT_FLOAT_WITHIN(referenceRms(samples, WINDOW) * 1e-5, referenceRms(samples, WINDOW), acRms(samples, WINDOW));
+  // noise alone is the noise sigma
+  sine(samples, WINDOW, 0, 0, 10, 9);
+  TEST_ASSERT_FLOAT_WITHIN(1.5, 10, acRms(samples, WINDOW));
+}
+
+void test_matches_reference_on_random_blocks()
+{
+  std::mt19937 random(42);
+  std::uniform_int_distribution<int> adc(0, 4095);
+  for (int block = 0; block < 200; block++)
+  {
+    size_t count = 1 + random() % WINDOW;
+    for (size_t i = 0; i < count; i++)
+      samples[i] = adc(random);
+    double reference = referenceRms(samples, count);
+    TEST_ASSERT_FLOAT_WITHIN(reference * 1e-5 + 1e-3, reference, acRms(samples, count));
+  }
+}
+
+void test_full_scale_long_block_does_not_overflow()
+{
+  // the integer sums are exact up to ~60000 samples of full scale swing
+  size_t count = sizeof(samples) / sizeof(samples[0]);
+  for (size_t i = 0; i < count; i++)
+    samples[i] = i % 2 ? 4095 : 0;
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 4095 / 2.0, acRms(samples, count));
+  sine(samples, count, 2047, 0);
+  TEST_ASSERT_FLOAT_WITHIN(referenceRms(samples, count) * 1e-5, referenceRms(samples, count), acRms(samples, count));
+}
+
+void test_benchmark_window()
+{
+  sine(samples, WINDOW, 1000, 0, 10, 3);
+  const int runs = 100000;
+  volatile float sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++)
+    sink = sink + acRms(samples, WINDOW);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / runs;
+  char line[96];
+  snprintf(line, sizeof(line), "acRms over %d samples: %.0f ns per window, %.2f ns per sample", WINDOW, ns, ns / WINDOW);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_GREATER_THAN(0, sink);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_empty_and_dc);
+  RUN_TEST(test_sine_over_whole_cycles);
+  RUN_TEST(test_square_and_triangle);
+  RUN_TEST(test_sine_with_noise);
+  RUN_TEST(test_matches_reference_on_random_blocks);
+  RUN_TEST(test_full_scale_long_block_does_not_overflow);
+  RUN_TEST(test_benchmark_window);
+  return UNITY_END();
+}
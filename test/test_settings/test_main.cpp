@@ -0,0 +1,99 @@
+#include <unity.h>
+#include <string.h>
+
+#include "crc32.h"
+#include "settings.h"
+#include "timeSeries.h"
+
+static Settings defaults;
+static uint8_t blob[SETTINGS_BLOB_SIZE];
+static size_t length;
+static Settings changed;
+
+void setUp()
+{
+  defaultSettings(defaults);
+  changed = defaults;
+  changed.utcOffset = -18000;
+  changed.mvPerAmp = 0.1;
+  length = encodeSettings(changed, 7, blob, sizeof(blob));
+}
+void tearDown() {}
+
+void test_defaults_are_valid()
+{
+  TEST_ASSERT_NULL(validateSettings(defaults));
+}
+
+void test_round_trip()
+{
+  Settings decoded;
+  uint32_t sequence = 0;
+  TEST_ASSERT_GREATER_THAN(0, length);
+  TEST_ASSERT_NULL(decodeSettings(blob, length, decoded, sequence));
+  TEST_ASSERT_EQUAL(0, memcmp(&decoded, &changed, sizeof(decoded)));
+  TEST_ASSERT_EQUAL(7, sequence);
+}
+
+void test_unknown_field_is_skipped()
+{
+  // a newer build stored field id 100, this one skips it and keeps the rest
+  uint8_t newer[SETTINGS_BLOB_SIZE];
+  memcpy(newer, blob, length);
+  size_t extra = length;
+  extra += putVarint(newer + extra, 100 << 1 | SETTING_INT);
+  extra += putVarint(newer + extra, zigzag(-5));
+  uint16_t payload = extra - 16;
+  memcpy(newer + 8, &payload, 2); // header length and crc
+  uint32_t crc = crc32(newer + 16, payload);
+  memcpy(newer + 12, &crc, 4);
+  Settings decoded;
+  uint32_t sequence;
+  TEST_ASSERT_NULL(decodeSettings(newer, extra, decoded, sequence));
+  TEST_ASSERT_EQUAL(0, memcmp(&decoded, &changed, sizeof(decoded)));
+}
+
+void test_corrupt_or_truncated_rejected()
+{
+  uint8_t corrupt[SETTINGS_BLOB_SIZE];
+  memcpy(corrupt, blob, length);
+  corrupt[length - 1] ^= 0x40;
+  Settings decoded;
+  uint32_t sequence;
+  TEST_ASSERT_NOT_NULL(decodeSettings(corrupt, length, decoded, sequence));
+  TEST_ASSERT_NOT_NULL(decodeSettings(blob, length - 1, decoded, sequence));
+}
+
+void test_patch_all_or_nothing()
+{
+  Settings patched = defaults;
+  const char *good = "{\"dhtInterval\":60,\"highTempAlarm\":85.5}";
+  TEST_ASSERT_NULL(patchSettings(good, strlen(good), patched));
+  TEST_ASSERT_EQUAL(60, patched.dhtInterval);
+  TEST_ASSERT_EQUAL_FLOAT(85.5, patched.highTempAlarm);
+  const char *bad[] = {"{\"dhtInterval\":60,\"waterMediumCm\":30}", "{\"dhtInterval\":1.5}", "{\"climateCoolF\":90}", "{\"nope\":1}", "[1]"};
+  for (const char *body : bad)
+  {
+    Settings before = patched;
+    TEST_ASSERT_NOT_NULL_MESSAGE(patchSettings(body, strlen(body), patched), body);
+    TEST_ASSERT_EQUAL_MESSAGE(0, memcmp(&before, &patched, sizeof(before)), body);
+  }
+}
+
+void test_json_fits()
+{
+  char json[SETTINGS_JSON_SIZE];
+  TEST_ASSERT_GREATER_THAN(0, writeSettingsJson(changed, 8, json, sizeof(json)));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_defaults_are_valid);
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_unknown_field_is_skipped);
+  RUN_TEST(test_corrupt_or_truncated_rejected);
+  RUN_TEST(test_patch_all_or_nothing);
+  RUN_TEST(test_json_fits);
+  return UNITY_END();
+}
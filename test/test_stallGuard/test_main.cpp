@@ -0,0 +1,70 @@
+#include <unity.h>
+
+#include "stallGuard.h"
+
+#define STALL_MS 1000
+#define CHECK_MS 100
+
+void setUp() {}
+void tearDown() {}
+
+void test_trips_once_after_stall_time()
+{
+  StallGuard guard(STALL_MS, CHECK_MS);
+  TEST_ASSERT_FALSE(guard.check(7, false)); // the first poll only takes the count
+  int silent = 1;
+  while (!guard.check(7, false) and silent < 100)
+    silent++;
+  TEST_ASSERT_EQUAL(STALL_MS / CHECK_MS, silent);
+  TEST_ASSERT_TRUE(guard.stalled());
+  // it stays stalled, and says so only once
+  TEST_ASSERT_FALSE(guard.check(7, false));
+  TEST_ASSERT_FALSE(guard.check(8, false));
+  TEST_ASSERT_TRUE(guard.stalled());
+}
+
+void test_moving_count_never_trips()
+{
+  // one wakeup per check is enough, the count wrapping around included
+  StallGuard guard(STALL_MS, CHECK_MS);
+  uint32_t wakeups = UINT32_MAX - 50;
+  for (int i = 0; i < 1000; i++)
+  {
+    TEST_ASSERT_FALSE(guard.check(wakeups, false));
+    wakeups += (i % 9 == 0);
+  }
+  TEST_ASSERT_FALSE(guard.stalled());
+}
+
+void test_silence_starts_over()
+{
+  // just short of the stall time, then a wakeup
+  StallGuard guard(STALL_MS, CHECK_MS);
+  for (uint32_t wakeups = 0; wakeups < 5; wakeups++)
+  {
+    for (int i = 0; i < STALL_MS / CHECK_MS; i++)
+      TEST_ASSERT_FALSE(guard.check(wakeups, false));
+  }
+  TEST_ASSERT_FALSE(guard.stalled());
+}
+
+void test_light_sleep_is_excused()
+{
+  // 5 s asleep, then the task has to move again within the stall time
+  StallGuard guard(STALL_MS, CHECK_MS);
+  for (int i = 0; i < 5000 / CHECK_MS; i++)
+    TEST_ASSERT_FALSE(guard.check(3, true));
+  for (int i = 1; i < STALL_MS / CHECK_MS; i++)
+    TEST_ASSERT_FALSE(guard.check(3, false));
+  TEST_ASSERT_TRUE(guard.check(3, false));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_trips_once_after_stall_time);
+  RUN_TEST(test_moving_count_never_trips);
+  RUN_TEST(test_silence_starts_over);
+  RUN_TEST(test_light_sleep_is_excused);
+  return UNITY_END();
+}
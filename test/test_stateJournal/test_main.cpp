@@ -0,0 +1,162 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stateJournal.h"
+#include "testSupport.h"
+
+// flash that loses power after a given number of written bytes
+template <size_t SIZE>
+class CrashingStorage : public JournalStorage
+{
+public:
+  uint8_t bytes[SIZE] = {};
+  uint32_t budget = UINT32_MAX; // bytes written before the power goes
+
+  bool read(uint32_t offset, void *data, size_t length) override
+  {
+    memcpy(data, bytes + offset, length);
+    return true;
+  }
+  bool write(uint32_t offset, const void *data, size_t length) override
+  {
+    size_t n = (length < budget) ? length : budget;
+    memcpy(bytes + offset, data, n);
+    budget -= n;
+    return n == length;
+  }
+};
+typedef CrashingStorage<JOURNAL_SLOTS * sizeof(JournalRecord)> JournalFlash;
+
+static RuntimeState journalState(uint32_t i)
+{
+  RuntimeState state = {};
+  state.epoch = START_EPOCH + i * 60;
+  state.overrides = i & 7;
+  state.overrideOn = i >> 3 & 7;
+  state.alarmsActive = i * 2654435761u;
+  state.overrideEnd[i % JOURNAL_MAX_OUTPUTS] = START_EPOCH + i * 600;
+  return state;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_records_are_sealed()
+{
+  JournalRecord record;
+  sealRecord(record, journalState(5), 9);
+  TEST_ASSERT_TRUE(intactRecord(record));
+  TEST_ASSERT_EQUAL(9, record.sequence);
+  for (size_t bit = 0; bit < sizeof(record) * 8; bit += 7)
+  {
+    JournalRecord damaged = record;
+    ((uint8_t *)&damaged)[bit / 8] ^= 1 << bit % 8;
+    TEST_ASSERT_FALSE(intactRecord(damaged));
+  }
+  RuntimeState later = journalState(5);
+  later.epoch += 3600;
+  TEST_ASSERT_TRUE(sameState(journalState(5), later)); // the capture time is not part of the state
+  TEST_ASSERT_FALSE(sameState(journalState(5), journalState(6)));
+}
+
+void test_empty_or_wiped_storage()
+{
+  JournalFlash storage;
+  RuntimeState recovered;
+  StateJournal blank(storage, JOURNAL_SLOTS);
+  TEST_ASSERT_FALSE(blank.recover(recovered));
+  memset(storage.bytes, 0xff, sizeof(storage.bytes)); // erased flash
+  StateJournal erased(storage, JOURNAL_SLOTS);
+  TEST_ASSERT_FALSE(erased.recover(recovered));
+  TEST_ASSERT_EQUAL(0, erased.sequence());
+  TEST_ASSERT_TRUE(erased.append(journalState(1)));
+  TEST_ASSERT_TRUE(erased.recover(recovered));
+  TEST_ASSERT_TRUE(sameState(journalState(1), recovered));
+}
+
+void test_power_cut_at_every_byte()
+{
+  // cut the power at every byte of 3 trips around the ring, recovery has to
+  // find the last completed append and carry on from there
+  const uint32_t appends = 3 * JOURNAL_SLOTS;
+  char message[100];
+  for (uint32_t cut = 0; cut <= appends * sizeof(JournalRecord); cut++)
+  {
+    static JournalFlash storage;
+    memset(storage.bytes, 0, sizeof(storage.bytes));
+    storage.budget = cut;
+    StateJournal before(storage, JOURNAL_SLOTS);
+    uint32_t done = 0;
+    while (done < appends and before.append(journalState(done)))
+      done++;
+
+    snprintf(message, sizeof(message), "cut after %u bytes, %u appends had completed", (unsigned)cut, (unsigned)done);
+    storage.budget = UINT32_MAX;
+    StateJournal after(storage, JOURNAL_SLOTS);
+    RuntimeState recovered;
+    bool found = after.recover(recovered);
+    TEST_ASSERT_EQUAL_MESSAGE(done > 0, found, message);
+    if (found)
+    {
+      TEST_ASSERT_TRUE_MESSAGE(sameState(recovered, journalState(done - 1)), message);
+      TEST_ASSERT_EQUAL_MESSAGE(done, after.sequence(), message);
+    }
+    // a second cut right after the reboot must not lose the recovered state either
+    RuntimeState next = journalState(done + 1);
+    storage.budget = sizeof(JournalRecord) / 2;
+    after.append(next);
+    storage.budget = UINT32_MAX;
+    TEST_ASSERT_EQUAL_MESSAGE(found, after.recover(recovered), message);
+    if (found)
+      TEST_ASSERT_TRUE_MESSAGE(sameState(recovered, journalState(done - 1)), message);
+    TEST_ASSERT_TRUE_MESSAGE(after.append(next), message);
+    TEST_ASSERT_TRUE_MESSAGE(after.recover(recovered), message);
+    TEST_ASSERT_TRUE_MESSAGE(sameState(recovered, next), message);
+  }
+}
+
+void test_unchanged_state_not_written()
+{
+  JournalFlash storage;
+  StateJournal journal(storage, JOURNAL_SLOTS);
+  journal.append(journalState(1));
+  RuntimeState later = journalState(1);
+  later.epoch += 3600;
+  journal.append(later);
+  TEST_ASSERT_EQUAL(1, journal.writeCount());
+  TEST_ASSERT_EQUAL(1, journal.skipCount());
+}
+
+void test_writes_spread_over_the_ring()
+{
+  // every slot is written once per trip around the ring, none more often
+  class CountingStorage : public JournalStorage
+  {
+  public:
+    JournalFlash flash;
+    uint32_t slotWrites[JOURNAL_SLOTS] = {};
+    bool read(uint32_t offset, void *data, size_t length) override { return flash.read(offset, data, length); }
+    bool write(uint32_t offset, const void *data, size_t length) override
+    {
+      slotWrites[offset / sizeof(JournalRecord)]++;
+      return flash.write(offset, data, length);
+    }
+  } storage;
+  StateJournal journal(storage, JOURNAL_SLOTS);
+  for (uint32_t i = 0; i < 10 * JOURNAL_SLOTS; i++)
+    TEST_ASSERT_TRUE(journal.append(journalState(i)));
+  for (uint32_t writes : storage.slotWrites)
+    TEST_ASSERT_EQUAL(10, writes);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_records_are_sealed);
+  RUN_TEST(test_empty_or_wiped_storage);
+  RUN_TEST(test_power_cut_at_every_byte);
+  RUN_TEST(test_unchanged_state_not_written);
+  RUN_TEST(test_writes_spread_over_the_ring);
+  return UNITY_END();
+}
@@ -0,0 +1,220 @@
+#include <unity.h>
+#include <ArduinoJson.h>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "stateSnapshot.h"
+#define TEST_COUNT_ALLOCATIONS // counts every heap allocation, to count them per page load
+#include "testSupport.h"
+
+static void fill(StateSnapshot &state, uint8_t outputs)
+{
+  static const char *ids[STATE_MAX_OUTPUTS] = {"pump1", "pump2", "airPump", "pump4", "pump5", "pump6", "pump7", "pump8", "pump9", "pump10"};
+  state.epoch = 1718000000;
+  state.lastSync = "Monday, June 10 2024 08:13:20";
+  state.temperature = 81.3;
+  state.humidity = 67.2;
+  state.heatIndex = 85.9;
+  state.waterLevel = "Medium";
+  state.led = true;
+  state.outputCount = outputs;
+  for (uint8_t i = 0; i < outputs; i++)
+  {
+    OutputSnapshot &output = state.outputs[i];
+    output.id = ids[i];
+    snprintf(output.command, sizeof(output.command), i % 2 ? "Off (Override 65 min)" : "On (Auto)");
+    output.status = i % 2 == 0;
+    output.alarm = i == 1;
+    output.current = 1.234 + i;
+    output.health = 97;
+  }
+}
+
+// The page as it was rendered before /api/state: the template engine of the
+// web server handed every %PLACEHOLDER% of index.html to processor(), which
+// built the value out of temporary Strings. std::string stands in for the
+// Arduino String here, its small string buffer makes the count a lower bound,
+// and the blocking DHT read TEMPERATURE used to do is left out.
+static const char *const PLACEHOLDERS[] = {"CURRENT_TIME", "LAST_SYNC_TIME",   "PUMP_1_COMMAND", "PUMP_2_COMMAND", "AIR_PUMP_COMMAND",
+                                           "TEMPERATURE",  "HUMIDITY",         "HEAT_INDEX",     "GPIO_STATE"};
+#define OLD_PAGE_SIZE 4883 // data/index.html before the static shell
+
+static std::string commandText(bool on, bool override, uint32_t minutesLeft)
+{
+  std::string command = on ? "On " : "Off ";
+  if (override)
+  {
+    std::string timeLeft = "Permanent)";
+    if (minutesLeft > 0)
+      timeLeft = std::to_string(minutesLeft) + " min)";
+    return command + "(Override " + timeLeft;
+  }
+  return command + "(Auto)";
+}
+
+static std::string processor(const std::string &var, const StateSnapshot &state)
+{
+  if (var == "GPIO_STATE")
+    return state.led ? "ON" : "OFF";
+  if (var == "CURRENT_TIME")
+    return std::string("Monday, June 10 2024 08:13 AM");
+  if (var == "LAST_SYNC_TIME")
+    return std::string(state.lastSync);
+  if (var == "TEMPERATURE")
+    return std::to_string(state.temperature);
+  if (var == "HUMIDITY")
+    return std::to_string(state.humidity);
+  if (var == "HEAT_INDEX")
+    return std::to_string(state.heatIndex);
+  if (var == "PUMP_1_COMMAND")
+    return commandText(true, false, 0);
+  if (var == "PUMP_2_COMMAND")
+    return commandText(false, true, 65);
+  if (var == "AIR_PUMP_COMMAND")
+    return commandText(true, false, 0);
+  return std::string();
+}
+
+static void buildTemplate(std::string &page)
+{
+  page.clear();
+  for (const char *name : PLACEHOLDERS)
+    page += std::string("<p><span>%") + name + "%</span></p>\n";
+  page.append(OLD_PAGE_SIZE - page.size(), ' ');
+}
+
+// returns the bytes sent, the response goes out in chunks like the async server's
+static size_t renderTemplate(const std::string &page, const StateSnapshot &state)
+{
+  char chunk[1460];
+  size_t used = 0;
+  size_t sent = 0;
+  for (size_t i = 0; i < page.size(); i++)
+  {
+    std::string value;
+    if (page[i] == '%')
+    {
+      size_t end = page.find('%', i + 1);
+      value = processor(page.substr(i + 1, end - i - 1), state);
+      i = end;
+    }
+    else
+      value = page[i];
+    for (char c : value)
+    {
+      chunk[used++] = c;
+      if (used == sizeof(chunk))
+      {
+        sent += used;
+        used = 0;
+      }
+    }
+  }
+  return sent + used;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_state_json_parses()
+{
+  static StateSnapshot state;
+  fill(state, 3);
+  char json[STATE_JSON_SIZE];
+  size_t length = writeStateJson(state, json, sizeof(json));
+  TEST_ASSERT_GREATER_THAN(0, length);
+  TEST_ASSERT_EQUAL(strlen(json), length);
+  DynamicJsonDocument doc(4096);
+  TEST_ASSERT_FALSE(deserializeJson(doc, json, length));
+  TEST_ASSERT_EQUAL(1718000000, doc["epoch"].as<uint32_t>());
+  TEST_ASSERT_FLOAT_WITHIN(0.05, 81.3, doc["temperature"].as<float>());
+  TEST_ASSERT_EQUAL_STRING("Medium", doc["waterLevel"].as<const char *>());
+  TEST_ASSERT_EQUAL(3, doc["outputs"].size());
+  TEST_ASSERT_EQUAL_STRING("pump2", doc["outputs"][1]["id"].as<const char *>());
+  TEST_ASSERT_EQUAL_STRING("Off (Override 65 min)", doc["outputs"][1]["command"].as<const char *>());
+  TEST_ASSERT_TRUE(doc["outputs"][1]["alarm"].as<bool>());
+  TEST_ASSERT_FLOAT_WITHIN(0.0005, 3.234, doc["outputs"][2]["current"].as<float>());
+}
+
+void test_failed_sensor_is_null()
+{
+  static StateSnapshot state;
+  fill(state, 1);
+  state.temperature = NAN;
+  state.outputs[0].health = NAN; // baseline still being learned
+  char json[STATE_JSON_SIZE];
+  size_t length = writeStateJson(state, json, sizeof(json));
+  TEST_ASSERT_NOT_NULL(strstr(json, "\"temperature\":null"));
+  TEST_ASSERT_NOT_NULL(strstr(json, "\"health\":null"));
+  DynamicJsonDocument doc(1024);
+  TEST_ASSERT_FALSE(deserializeJson(doc, json, length));
+  TEST_ASSERT_TRUE(doc["temperature"].isNull());
+}
+
+void test_buffer_limits()
+{
+  static StateSnapshot state;
+  fill(state, STATE_MAX_OUTPUTS);
+  for (uint8_t i = 0; i < STATE_MAX_OUTPUTS; i++)
+  {
+    memset(state.outputs[i].command, 'x', sizeof(state.outputs[i].command) - 1); // longest command text
+    state.outputs[i].command[sizeof(state.outputs[i].command) - 1] = '\0';
+    state.outputs[i].current = -99.999;
+  }
+  char json[STATE_JSON_SIZE];
+  TEST_ASSERT_GREATER_THAN(0, writeStateJson(state, json, sizeof(json)));
+  // too small: 0, and the buffer holds a terminated prefix
+  char small[100];
+  TEST_ASSERT_EQUAL(0, writeStateJson(state, small, sizeof(small)));
+  TEST_ASSERT_LESS_THAN(sizeof(small), strlen(small));
+}
+
+void test_benchmark_page_load()
+{
+  static StateSnapshot state;
+  fill(state, 3);
+  std::string page;
+  buildTemplate(page);
+  const int loads = 10000;
+
+  size_t before = allocations;
+  size_t templateBytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loads; i++)
+    templateBytes = renderTemplate(page, state);
+  double templateNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / loads;
+  double templateAllocations = (double)(allocations - before) / loads;
+
+  char json[STATE_JSON_SIZE];
+  size_t stateBytes = 0;
+  before = allocations;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < loads; i++)
+    stateBytes = writeStateJson(state, json, sizeof(json));
+  double stateNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / loads;
+  size_t stateAllocations = allocations - before;
+
+  char line[200];
+  snprintf(line, sizeof(line), "template page: %u bytes, %.1f allocations, %.0f ns per load", (unsigned)templateBytes, templateAllocations,
+           templateNs);
+  TEST_MESSAGE(line);
+  snprintf(line, sizeof(line), "/api/state: %u bytes, %u allocations, %.0f ns per load (the static page is cached)", (unsigned)stateBytes,
+           (unsigned)stateAllocations, stateNs);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_EQUAL(0, stateAllocations);
+  TEST_ASSERT_GREATER_THAN(0, templateAllocations);
+  TEST_ASSERT_LESS_THAN(templateBytes, stateBytes);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_state_json_parses);
+  RUN_TEST(test_failed_sensor_is_null);
+  RUN_TEST(test_buffer_limits);
+  RUN_TEST(test_benchmark_page_load);
+  return UNITY_END();
+}
@@ -0,0 +1,182 @@
+#include <unity.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "taskScheduler.h"
+
+// Runs the scheduler on std::threads (sim/posixTaskScheduler.cpp) in real time.
+// The host is no real time system, the bounds leave room for its jitter but
+// would catch a drifting period, a catch up burst or one task stalling another.
+typedef std::chrono::steady_clock Clock;
+
+static void runFor(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+static uint32_t micros()
+{
+  static const Clock::time_point start = Clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+static std::atomic<uint32_t> fastRuns(0), mediumRuns(0), slowRuns(0);
+static void fastJob() { fastRuns++; }
+static void mediumJob() { mediumRuns++; }
+static void slowJob() { slowRuns++; }
+
+void setUp()
+{
+  fastRuns = mediumRuns = slowRuns = 0;
+}
+void tearDown() {}
+
+void test_period_does_not_drift()
+{
+  ScheduledTask task("test", 10, 1, 0);
+  TEST_ASSERT_TRUE(task.addJob(fastJob, 0));
+  task.start();
+  runFor(1000);
+  task.stop();
+  // slots are fixed, a late wakeup does not push the next one back
+  TEST_ASSERT_INT_WITHIN(3, 100, task.wakeupCount());
+  TEST_ASSERT_EQUAL(task.wakeupCount(), fastRuns.load());
+  TEST_ASSERT_EQUAL(task.wakeupCount(), task.lateMicros().count());
+  TEST_ASSERT_LESS_THAN(5000, task.lateMicros().percentile(0.5));
+  TEST_ASSERT_EQUAL(0, task.overruns());
+}
+
+void test_job_intervals()
+{
+  ScheduledTask task("test", 10, 1, 0);
+  task.addJob(fastJob, 0);
+  task.addJob(mediumJob, 30);
+  task.addJob(slowJob, 100);
+  task.start();
+  TEST_ASSERT_FALSE(task.addJob(fastJob, 0)); // jobs are fixed once the task runs
+  runFor(1000);
+  task.stop();
+  TEST_ASSERT_INT_WITHIN(3, 100, fastRuns.load());
+  TEST_ASSERT_INT_WITHIN(2, 33, mediumRuns.load());
+  TEST_ASSERT_INT_WITHIN(1, 10, slowRuns.load());
+}
+
+static std::atomic<uint32_t> lastControl(0), worstControlGap(0);
+static void controlJob()
+{
+  uint32_t now = micros();
+  uint32_t last = lastControl.exchange(now);
+  if (last != 0 and now - last > worstControlGap)
+    worstControlGap = now - last;
+}
+static void blockingNetworkJob() { runFor(300); } // the old delay() in the WiFi reconnect
+
+void test_blocking_task_does_not_stall_control()
+{
+  ScheduledTask control("control", 10, 4, 1);
+  ScheduledTask network("network", 100, 1, 0);
+  control.addJob(controlJob, 0);
+  network.addJob(blockingNetworkJob, 0);
+  lastControl = 0;
+  worstControlGap = 0;
+  control.start();
+  network.start();
+  runFor(1000);
+  control.stop();
+  network.stop();
+  TEST_ASSERT_GREATER_OR_EQUAL(2, network.overruns());
+  TEST_ASSERT_GREATER_OR_EQUAL(300000, network.maxRunMicros());
+  TEST_ASSERT_EQUAL(0, control.overruns());
+  TEST_ASSERT_LESS_THAN(30000, worstControlGap.load()); // three periods, the network task holds its own thread for 300 ms
+  TEST_ASSERT_INT_WITHIN(5, 100, control.wakeupCount());
+}
+
+static void overrunJob() { runFor(15); }
+
+void test_overruns_counted()
+{
+  ScheduledTask task("test", 10, 1, 0);
+  task.addJob(overrunJob, 0);
+  task.start();
+  runFor(300);
+  task.stop();
+  TEST_ASSERT_GREATER_OR_EQUAL(task.wakeupCount() - 1, task.overruns());
+  TEST_ASSERT_GREATER_OR_EQUAL(15000, task.maxRunMicros());
+  TEST_ASSERT_GREATER_OR_EQUAL(15000, task.runMicros().percentile(0.5));
+}
+
+static ScheduledTask *sleeper = NULL;
+static std::atomic<bool> restartAfterSleep(false);
+static std::atomic<uint32_t> wokeAt(0), runsAfterSleep(0);
+static void sleepingJob()
+{
+  uint32_t runs = ++fastRuns;
+  if (runs == 5)
+  {
+    runFor(200); // stands in for a light sleep inside the control task
+    if (restartAfterSleep)
+      sleeper->restartSlots();
+    wokeAt = micros();
+  }
+  else if (wokeAt != 0 and micros() - wokeAt < 50000)
+    runsAfterSleep++;
+}
+
+static void runSleeper(bool restart)
+{
+  ScheduledTask task("test", 10, 1, 0);
+  sleeper = &task;
+  restartAfterSleep = restart;
+  wokeAt = 0;
+  runsAfterSleep = 0;
+  task.addJob(sleepingJob, 0);
+  task.start();
+  runFor(500);
+  task.stop();
+  sleeper = NULL;
+  if (restart)
+  {
+    // the slots start over after the sleep: no burst and nothing counted late or as run time
+    TEST_ASSERT_LESS_OR_EQUAL(6, runsAfterSleep.load());
+    TEST_ASSERT_LESS_THAN(100000, task.lateMicros().max());
+    TEST_ASSERT_LESS_THAN(100000, task.maxRunMicros());
+  }
+  else
+  {
+    // without the restart the missed slots run back to back
+    TEST_ASSERT_GREATER_OR_EQUAL(15, runsAfterSleep.load());
+    TEST_ASSERT_GREATER_OR_EQUAL(150000, task.lateMicros().max());
+  }
+}
+
+void test_restart_slots_after_sleep() { runSleeper(true); }
+void test_missed_slots_catch_up_without_restart() { runSleeper(false); }
+
+void test_set_job_interval_from_another_thread()
+{
+  ScheduledTask task("test", 10, 1, 0);
+  task.addJob(fastJob, 0);
+  task.addJob(slowJob, 10000);
+  task.start();
+  runFor(100);
+  TEST_ASSERT_EQUAL(0, slowRuns.load());
+  TEST_ASSERT_EQUAL(0, task.jobDueIn(fastJob, 0));
+  TEST_ASSERT_EQUAL(INT32_MAX, task.jobDueIn(mediumJob, 0));
+  TEST_ASSERT_TRUE(task.setJobInterval(slowJob, 20));
+  TEST_ASSERT_FALSE(task.setJobInterval(mediumJob, 20));
+  runFor(400);
+  task.stop();
+  // the first run comes right away (more than one interval behind), then every 20 ms without catching up
+  TEST_ASSERT_INT_WITHIN(3, 20, slowRuns.load());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_period_does_not_drift);
+  RUN_TEST(test_job_intervals);
+  RUN_TEST(test_blocking_task_does_not_stall_control);
+  RUN_TEST(test_overruns_counted);
+  RUN_TEST(test_restart_slots_after_sleep);
+  RUN_TEST(test_missed_slots_catch_up_without_restart);
+  RUN_TEST(test_set_job_interval_from_another_thread);
+  return UNITY_END();
+}
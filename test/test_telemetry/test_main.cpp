@@ -0,0 +1,310 @@
+#include <unity.h>
+#include <ArduinoJson.h>
+#include <map>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "telemetry.h"
+#define TEST_COUNT_ALLOCATIONS // counts every heap allocation, the firmware side must not make any
+#include "testSupport.h"
+
+typedef std::map<std::string, std::string> Fields;
+
+static void applyFrame(Fields &view, const char *frame)
+{
+  DynamicJsonDocument doc(4096);
+  TEST_ASSERT_FALSE(deserializeJson(doc, frame, strlen(frame)));
+  for (JsonPair field : doc.as<JsonObject>())
+    view[field.key().c_str()] = field.value().as<const char *>();
+}
+
+// bytes of one server sent event on the wire, as AsyncEventSource formats it
+static size_t sseBytes(uint32_t id, const char *event, size_t dataLength)
+{
+  char header[64];
+  return snprintf(header, sizeof(header), "id: %u\nevent: %s\ndata: ", (unsigned)id, event) + dataLength + 2;
+}
+
+#define CLIENT_QUEUE 32 // messages AsyncEventSource queues per client before it drops
+
+// An SSE client whose connection takes a message off its queue every drainTicks
+// network task ticks. Frames are applied when they arrive, in order, a dropped
+// one shows up as a gap in the ids and the page reloads the full state.
+struct Client
+{
+  uint32_t drainTicks;
+  uint32_t waiting;
+  uint32_t lastId;
+  bool gap;
+  uint32_t reloads;
+  size_t bytes;
+  Fields view;
+};
+
+// the web side of the network task: the fields main.cpp posts, their current values
+// and the way sendQueuedEvents turns them into frames for every connected client
+struct Harness
+{
+  Telemetry telemetry;
+  Fields truth;
+  Client clients[8];
+  size_t clientCount;
+  uint32_t sequence = 0;
+  size_t firmwareAllocations = 0;
+  size_t perFieldBytes = 0; // the old events.send per postEvent, to every client
+  size_t perFieldMessages = 0;
+  size_t frameMessages = 0;
+
+  Harness(size_t count, size_t slow) : clientCount(count)
+  {
+    for (size_t i = 0; i < count; i++)
+      clients[i] = {i < slow ? 20u : 1u, 0, 0, false, 0, 0, Fields()};
+  }
+
+  void post(const char *value, const char *event)
+  {
+    truth[event] = value;
+    perFieldMessages += clientCount;
+    perFieldBytes += clientCount * sseBytes(perFieldMessages, event, strlen(value));
+    size_t before = allocations;
+    telemetry.set(event, value);
+    firmwareAllocations += allocations - before;
+  }
+
+  void tick(uint32_t tickNumber)
+  {
+    size_t total = 0;
+    for (size_t i = 0; i < clientCount; i++)
+    {
+      if (clients[i].waiting > 0 and tickNumber % clients[i].drainTicks == 0)
+        clients[i].waiting = clients[i].drainTicks == 1 ? 0 : clients[i].waiting - 1;
+      total += clients[i].waiting;
+    }
+    size_t averageWaiting = clientCount ? (total + clientCount - 1) / clientCount : 0; // rounded up like the library
+    static char frame[TELEMETRY_FRAME_SIZE];
+    size_t before = allocations;
+    size_t length = telemetry.publish(frame, sizeof(frame), clientCount, averageWaiting);
+    firmwareAllocations += allocations - before;
+    if (length == 0)
+      return;
+    sequence++;
+    for (size_t i = 0; i < clientCount; i++)
+    {
+      Client &client = clients[i];
+      if (client.waiting == CLIENT_QUEUE)
+      {
+        client.gap = true; // dropped
+        continue;
+      }
+      client.waiting++;
+      frameMessages++;
+      client.bytes += sseBytes(sequence, "telemetry", length);
+      if (client.gap or client.lastId + 1 != sequence)
+      {
+        client.view = truth; // /api/state
+        client.reloads++;
+        client.gap = false;
+      }
+      else
+        applyFrame(client.view, frame);
+      client.lastId = sequence;
+    }
+  }
+};
+
+void setUp() {}
+void tearDown() {}
+
+void test_only_changed_fields_are_framed()
+{
+  Telemetry telemetry;
+  char frame[TELEMETRY_FRAME_SIZE];
+  TEST_ASSERT_FALSE(telemetry.changed());
+  TEST_ASSERT_EQUAL(0, telemetry.frame(frame, sizeof(frame)));
+  TEST_ASSERT_TRUE(telemetry.set("temperature", "81.3"));
+  TEST_ASSERT_TRUE(telemetry.set("humidity", "67.2"));
+  TEST_ASSERT_TRUE(telemetry.frame(frame, sizeof(frame)) > 0);
+  TEST_ASSERT_EQUAL_STRING("{\"temperature\":\"81.3\",\"humidity\":\"67.2\"}", frame);
+  TEST_ASSERT_FALSE(telemetry.set("temperature", "81.3")); // same value again
+  TEST_ASSERT_FALSE(telemetry.changed());
+  TEST_ASSERT_TRUE(telemetry.set("humidity", "67.5"));
+  telemetry.frame(frame, sizeof(frame));
+  TEST_ASSERT_EQUAL_STRING("{\"humidity\":\"67.5\"}", frame);
+  TEST_ASSERT_EQUAL(2, telemetry.frameCount());
+}
+
+void test_values_are_escaped()
+{
+  Telemetry telemetry;
+  char frame[TELEMETRY_FRAME_SIZE];
+  telemetry.set("pump1Command", "Off \"quoted\" \\ end");
+  TEST_ASSERT_TRUE(telemetry.frame(frame, sizeof(frame)) > 0);
+  Fields view;
+  applyFrame(view, frame);
+  TEST_ASSERT_EQUAL_STRING("Off \"quoted\" \\ end", view["pump1Command"].c_str());
+}
+
+void test_long_name_and_value_are_cut()
+{
+  // both are cut to their field and terminated, the cut name finds the same field
+  Telemetry telemetry;
+  char frame[TELEMETRY_FRAME_SIZE];
+  std::string name(TELEMETRY_NAME_SIZE + 8, 'n'), value(TELEMETRY_VALUE_SIZE + 8, 'v');
+  TEST_ASSERT_TRUE(telemetry.set(name.c_str(), value.c_str()));
+  TEST_ASSERT_FALSE(telemetry.set(name.c_str(), value.c_str()));
+  TEST_ASSERT_TRUE(telemetry.frame(frame, sizeof(frame)) > 0);
+  Fields view;
+  applyFrame(view, frame);
+  std::string cutName = name.substr(0, TELEMETRY_NAME_SIZE - 1), cutValue = value.substr(0, TELEMETRY_VALUE_SIZE - 1);
+  TEST_ASSERT_EQUAL(1, view.size());
+  TEST_ASSERT_EQUAL_STRING(cutValue.c_str(), view[cutName].c_str());
+}
+void test_full_frame_leaves_the_rest_pending()
+{
+  Telemetry telemetry;
+  Fields truth;
+  char value[TELEMETRY_VALUE_SIZE];
+  memset(value, 'v', sizeof(value) - 1);
+  value[sizeof(value) - 1] = '\0';
+  for (int i = 0; i < TELEMETRY_MAX_FIELDS; i++)
+  {
+    char name[TELEMETRY_NAME_SIZE];
+    snprintf(name, sizeof(name), "field%02d", i);
+    TEST_ASSERT_TRUE(telemetry.set(name, value));
+    truth[name] = value;
+  }
+  TEST_ASSERT_FALSE(telemetry.set("oneTooMany", "x")); // table full
+  char frame[TELEMETRY_FRAME_SIZE];
+  Fields view;
+  int frames = 0;
+  size_t length;
+  while ((length = telemetry.frame(frame, sizeof(frame))) != 0)
+  {
+    TEST_ASSERT_LESS_THAN(sizeof(frame), length);
+    applyFrame(view, frame);
+    frames++;
+  }
+  TEST_ASSERT_EQUAL(2, frames);
+  TEST_ASSERT_TRUE(view == truth);
+  // a buffer too small for a single field sends nothing rather than a broken object
+  telemetry.set("field00", "changed");
+  char small[12];
+  TEST_ASSERT_EQUAL(0, telemetry.frame(small, sizeof(small)));
+  TEST_ASSERT_TRUE(telemetry.changed());
+}
+
+void test_publish_holds_back_and_coalesces()
+{
+  Telemetry telemetry;
+  char frame[TELEMETRY_FRAME_SIZE];
+  telemetry.set("temperature", "80.0");
+  TEST_ASSERT_EQUAL(0, telemetry.publish(frame, sizeof(frame), 0, 0)); // nobody listening
+  TEST_ASSERT_FALSE(telemetry.changed());
+  telemetry.set("temperature", "80.1");
+  TEST_ASSERT_EQUAL(0, telemetry.publish(frame, sizeof(frame), 2, TELEMETRY_MAX_WAITING + 1));
+  telemetry.set("temperature", "80.2");
+  telemetry.set("humidity", "60.0");
+  TEST_ASSERT_GREATER_THAN(0, telemetry.publish(frame, sizeof(frame), 2, TELEMETRY_MAX_WAITING));
+  TEST_ASSERT_EQUAL_STRING("{\"temperature\":\"80.2\",\"humidity\":\"60.0\"}", frame);
+  TEST_ASSERT_EQUAL(1, telemetry.frameCount());
+}
+
+// an hour of the firmware's producers, a network task tick every 100 ms
+static void runHour(Harness &harness)
+{
+  static const char *levels[] = {"Low", "Medium", "High"};
+  std::mt19937 random32(7);
+  float temperature = 80, humidity = 65;
+  uint32_t health[3] = {97, 95, 99};
+  char value[32];
+  for (uint32_t tick = 0; tick < 36000; tick++)
+  {
+    uint32_t second = tick / 10;
+    if (tick % 10 == 0)
+    {
+      // updatePumpStatuses every second: pump 1 in its window, the air pump 15 min on, 15 off
+      const char *ids[] = {"pump1", "pump2", "airPump"};
+      bool status[] = {true, false, second / 900 % 2 == 0};
+      for (int i = 0; i < 3; i++)
+      {
+        char event[24];
+        snprintf(event, sizeof(event), "%sStatus", ids[i]);
+        harness.post(status[i] ? "1" : "0", event);
+        if (second % 60 == 0 and random32() % 4 == 0)
+          health[i] += random32() % 2 ? 1 : -1;
+        snprintf(value, sizeof(value), "%u%%", (unsigned)health[i]);
+        snprintf(event, sizeof(event), "%sHealth", ids[i]);
+        harness.post(value, event);
+        if (second % 900 == 0)
+        {
+          snprintf(event, sizeof(event), "%sCommand", ids[i]);
+          harness.post(status[i] ? "On (Auto)" : "Off (Auto)", event);
+        }
+      }
+    }
+    if (tick % 20 == 0)
+    {
+      // a DHT reading every 2 s, a tenth of a degree moves now and then
+      temperature += (int)(random32() % 3 - 1) * 0.1;
+      humidity += (int)(random32() % 3 - 1) * 0.1;
+      snprintf(value, sizeof(value), "%.1f", temperature);
+      harness.post(value, "temperature");
+      snprintf(value, sizeof(value), "%.1f", humidity);
+      harness.post(value, "humidity");
+      snprintf(value, sizeof(value), "%.1f", temperature + 3);
+      harness.post(value, "heatIndex");
+    }
+    if (tick % 600 == 0)
+    {
+      harness.post(levels[second / 1200 % 3], "waterLevel");
+      harness.post("0", "alarms");
+    }
+    harness.tick(tick);
+  }
+  // producers quiet, everything pending drains to every client
+  for (uint32_t tick = 36000; tick < 36000 + 10 * 60; tick++)
+    harness.tick(tick);
+}
+
+void test_harness_n_clients()
+{
+  const size_t counts[] = {1, 4, 8};
+  for (size_t count : counts)
+  {
+    Harness harness(count, count / 4); // one in four on a slow link
+    runHour(harness);
+    TEST_ASSERT_FALSE(harness.telemetry.changed());
+    TEST_ASSERT_EQUAL(0, harness.firmwareAllocations);
+    size_t frameBytes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      Client &client = harness.clients[i];
+      frameBytes += client.bytes;
+      TEST_ASSERT_TRUE_MESSAGE(client.view == harness.truth, "client out of date");
+      if (client.drainTicks == 1)
+        TEST_ASSERT_EQUAL_MESSAGE(0, client.reloads, "a fast client lost a frame");
+    }
+    char line[200];
+    snprintf(line, sizeof(line), "%u clients: frames %.0f B/s %.2f msg/s, per field events %.0f B/s %.2f msg/s, %u allocations",
+             (unsigned)count, frameBytes / 3600.0, harness.frameMessages / 3600.0, harness.perFieldBytes / 3600.0,
+             harness.perFieldMessages / 3600.0, (unsigned)harness.firmwareAllocations);
+    TEST_MESSAGE(line);
+    TEST_ASSERT_LESS_THAN(harness.perFieldBytes / 5, frameBytes);
+    TEST_ASSERT_LESS_THAN(harness.perFieldMessages / 10, harness.frameMessages);
+  }
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_only_changed_fields_are_framed);
+  RUN_TEST(test_values_are_escaped);
+  RUN_TEST(test_long_name_and_value_are_cut);
+  RUN_TEST(test_full_frame_leaves_the_rest_pending);
+  RUN_TEST(test_publish_holds_back_and_coalesces);
+  RUN_TEST(test_harness_n_clients);
+  return UNITY_END();
+}
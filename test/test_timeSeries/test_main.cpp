@@ -0,0 +1,252 @@
+#include <unity.h>
+#include <chrono>
+#include <limits.h>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+#include "timeSeries.h"
+
+static std::mt19937 random32(12345);
+
+void setUp() {}
+void tearDown() {}
+
+void test_varint_limits()
+{
+  uint8_t buffer[VARINT_MAX_BYTES];
+  const uint32_t values[] = {0, 1, 127, 128, 16383, 16384, UINT32_MAX - 1, UINT32_MAX};
+  const size_t sizes[] = {1, 1, 1, 2, 2, 3, 5, 5};
+  for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++)
+  {
+    TEST_ASSERT_EQUAL(sizes[i], putVarint(buffer, values[i]));
+    uint32_t v = 0;
+    TEST_ASSERT_EQUAL(sizes[i], getVarint(buffer, sizes[i], &v));
+    TEST_ASSERT_EQUAL_UINT32(values[i], v);
+    TEST_ASSERT_EQUAL(0, getVarint(buffer, sizes[i] - 1, &v)); // cut short
+  }
+  // a sixth continuation byte is corrupt, not a longer number
+  uint8_t tooLong[] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x01};
+  uint32_t v;
+  TEST_ASSERT_EQUAL(0, getVarint(tooLong, sizeof(tooLong), &v));
+  const int32_t signedValues[] = {0, -1, 1, INT32_MIN, INT32_MAX};
+  for (int32_t s : signedValues)
+    TEST_ASSERT_EQUAL_INT32(s, unzigzag(zigzag(s)));
+  TEST_ASSERT_EQUAL(1, zigzag(-1));
+  TEST_ASSERT_EQUAL(2, zigzag(1));
+}
+
+// random series mixing the usual small steps with jumps anywhere in the int32 range
+static void randomSeries(std::vector<Sample> &series, size_t count)
+{
+  series.clear();
+  Sample s = {(uint32_t)random32(), (int32_t)random32()};
+  for (size_t i = 0; i < count; i++)
+  {
+    switch (random32() % 4)
+    {
+    case 0:
+      s = {(uint32_t)random32(), (int32_t)random32()};
+      break;
+    case 1:
+      s.time += 1;
+      s.value += (int32_t)(random32() % 21) - 10;
+      break;
+    case 2:
+      s.time -= random32() % 1000; // time going backwards (clock set) still round-trips
+      s.value = random32() % 2 ? INT32_MAX : INT32_MIN;
+      break;
+    default:
+      s.time += random32() % 100000;
+      s.value ^= 1 << (random32() % 32);
+    }
+    series.push_back(s);
+  }
+}
+
+void test_fuzz_round_trip()
+{
+  std::vector<Sample> series;
+  std::vector<uint8_t> encoded;
+  for (int run = 0; run < 2000; run++)
+  {
+    randomSeries(series, 1 + random32() % 200);
+    SampleEncoder encoder;
+    encoded.clear();
+    for (const Sample &s : series)
+    {
+      uint8_t out[SAMPLE_MAX_BYTES];
+      size_t n = encoder.encode(s, out);
+      TEST_ASSERT_TRUE(n >= 2 and n <= SAMPLE_MAX_BYTES);
+      encoded.insert(encoded.end(), out, out + n);
+    }
+    // decode in random chunks, the way the history reader gets segment bytes
+    SampleDecoder decoder;
+    std::vector<uint8_t> pending;
+    size_t read = 0;
+    size_t next = 0;
+    while (read < encoded.size() or !pending.empty())
+    {
+      size_t chunk = 1 + random32() % 16;
+      for (size_t i = 0; i < chunk and read < encoded.size(); i++)
+        pending.push_back(encoded[read++]);
+      size_t used = 0;
+      Sample s;
+      size_t n;
+      while ((n = decoder.decode(pending.data() + used, pending.size() - used, &s)) != 0)
+      {
+        TEST_ASSERT_LESS_OR_EQUAL(pending.size() - used, n);
+        TEST_ASSERT_LESS_THAN(series.size(), next);
+        TEST_ASSERT_EQUAL_UINT32(series[next].time, s.time);
+        TEST_ASSERT_EQUAL_INT32(series[next].value, s.value);
+        next++;
+        used += n;
+      }
+      pending.erase(pending.begin(), pending.begin() + used);
+      TEST_ASSERT_LESS_THAN(SAMPLE_MAX_BYTES, pending.size()); // an incomplete sample never needs more
+      if (read == encoded.size() and used == 0)
+        break;
+    }
+    TEST_ASSERT_EQUAL(series.size(), next);
+    TEST_ASSERT_TRUE(pending.empty());
+  }
+}
+
+void test_fuzz_garbage_input()
+{
+  // corrupt segments must not read past their end or hang the reader
+  uint8_t garbage[64];
+  for (int run = 0; run < 100000; run++)
+  {
+    size_t len = random32() % sizeof(garbage);
+    for (size_t i = 0; i < len; i++)
+      garbage[i] = random32();
+    SampleDecoder decoder;
+    Sample s;
+    size_t used = 0;
+    size_t n;
+    while (used < len and (n = decoder.decode(garbage + used, len - used, &s)) != 0)
+    {
+      TEST_ASSERT_LESS_OR_EQUAL(len - used, n);
+      TEST_ASSERT_LESS_OR_EQUAL(SAMPLE_MAX_BYTES, n);
+      used += n;
+    }
+    // whatever is left is an incomplete or corrupt sample
+    if (used < len and len - used >= SAMPLE_MAX_BYTES)
+    {
+      uint32_t v;
+      size_t first = getVarint(garbage + used, len - used, &v);
+      TEST_ASSERT_TRUE(first == 0 or getVarint(garbage + used + first, len - used - first, &v) == 0);
+    }
+  }
+}
+
+void test_rollup_buckets()
+{
+  Rollup rollup(60);
+  Sample out;
+  TEST_ASSERT_FALSE(rollup.add(600, 10, &out));
+  TEST_ASSERT_FALSE(rollup.add(630, 11, &out));
+  TEST_ASSERT_FALSE(rollup.add(659, 12, &out));
+  TEST_ASSERT_TRUE(rollup.add(660, 100, &out)); // first reading of the next bucket emits the last
+  TEST_ASSERT_EQUAL(10, out.time);
+  TEST_ASSERT_EQUAL(11, out.value);
+  // empty buckets are skipped, not emitted as zero
+  TEST_ASSERT_TRUE(rollup.add(6000, -5, &out));
+  TEST_ASSERT_EQUAL(11, out.time);
+  TEST_ASSERT_EQUAL(100, out.value);
+  // rounding half away from zero
+  TEST_ASSERT_FALSE(rollup.add(6001, -6, &out));
+  TEST_ASSERT_TRUE(rollup.take(&out));
+  TEST_ASSERT_EQUAL(100, out.time);
+  TEST_ASSERT_EQUAL(-6, out.value);
+  TEST_ASSERT_FALSE(rollup.take(&out));
+  rollup.add(7200, 1, &out);
+  rollup.add(7201, 2, &out);
+  rollup.take(&out);
+  TEST_ASSERT_EQUAL(2, out.value);
+  // extreme readings do not overflow the sum
+  for (int i = 0; i < 1000; i++)
+    rollup.add(9000, INT32_MAX, &out);
+  rollup.take(&out);
+  TEST_ASSERT_EQUAL_INT32(INT32_MAX, out.value);
+}
+
+void test_rollup_levels()
+{
+  // 1 min, 15 min and 1 h rollups of the same readings, every 10 s for a day
+  Rollup levels[] = {Rollup(60), Rollup(900), Rollup(3600)};
+  uint32_t emitted[3] = {};
+  Sample out;
+  for (uint32_t t = 0; t < 86400; t += 10)
+  {
+    int32_t reading = 250 + (t / 3600) * 10; // steps up every hour
+    for (int level = 0; level < 3; level++)
+    {
+      if (levels[level].add(t, reading, &out))
+      {
+        emitted[level]++;
+        if (level == 2)
+          TEST_ASSERT_EQUAL(250 + out.time * 10, out.value);
+      }
+    }
+  }
+  TEST_ASSERT_EQUAL(1439, emitted[0]);
+  TEST_ASSERT_EQUAL(95, emitted[1]);
+  TEST_ASSERT_EQUAL(23, emitted[2]);
+  TEST_ASSERT_TRUE(levels[2].take(&out));
+  TEST_ASSERT_EQUAL(23, out.time);
+  TEST_ASSERT_EQUAL(480, out.value);
+}
+
+void test_benchmark_codec()
+{
+  // a temperature series in tenths of a degree, one point a minute for a year
+  const size_t count = 525600;
+  std::vector<Sample> series;
+  series.reserve(count);
+  int32_t value = 750;
+  for (size_t i = 0; i < count; i++)
+  {
+    value += (int32_t)(random32() % 5) - 2;
+    series.push_back({(uint32_t)(28000000 + i), value});
+  }
+  std::vector<uint8_t> encoded(count * SAMPLE_MAX_BYTES);
+  SampleEncoder encoder;
+  size_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (const Sample &s : series)
+    bytes += encoder.encode(s, encoded.data() + bytes);
+  auto encodedAt = std::chrono::steady_clock::now();
+  SampleDecoder decoder;
+  size_t used = 0;
+  size_t decoded = 0;
+  Sample s = {0, 0};
+  while (used < bytes)
+  {
+    used += decoder.decode(encoded.data() + used, bytes - used, &s);
+    decoded++;
+  }
+  auto decodedAt = std::chrono::steady_clock::now();
+  TEST_ASSERT_EQUAL(count, decoded);
+  TEST_ASSERT_EQUAL_INT32(value, s.value);
+  double encodeNs = std::chrono::duration<double, std::nano>(encodedAt - start).count() / count;
+  double decodeNs = std::chrono::duration<double, std::nano>(decodedAt - encodedAt).count() / count;
+  char line[128];
+  snprintf(line, sizeof(line), "%.2f bytes per sample (8 raw), encode %.1f ns, decode %.1f ns per sample", (double)bytes / count, encodeNs,
+           decodeNs);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_OR_EQUAL(2 * count + SAMPLE_MAX_BYTES, bytes); // after the first, one step and a small change fit a byte each
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_varint_limits);
+  RUN_TEST(test_fuzz_round_trip);
+  RUN_TEST(test_fuzz_garbage_input);
+  RUN_TEST(test_rollup_buckets);
+  RUN_TEST(test_rollup_levels);
+  RUN_TEST(test_benchmark_codec);
+  return UNITY_END();
+}
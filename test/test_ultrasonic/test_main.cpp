@@ -0,0 +1,165 @@
+#include <unity.h>
+#include <chrono>
+
+#include "ultrasonic.h"
+
+#define LOOP_STEP_MICROS 1000   // sensing loop period the test runs update() at
+#define LOOP_BUDGET_MICROS 1000 // host time one update() may take, pulseIn() took up to a second
+#define ECHO_DELAY_MICROS 450   // trigger to echo rising edge on the HC-SR04
+#define NO_ECHO 0               // scripted ping that never gets an echo back
+
+// synthetic sensor: each trigger pulse answers with the next scripted echo length
+static unsigned long echoes[ULTRASONIC_PINGS_PER_READING];
+static int triggers = 0;
+static bool pending = false;
+static unsigned long rise = 0;
+static unsigned long fall = 0;
+static unsigned long nowMicros = 0;
+
+static void trigger()
+{
+  unsigned long echo = echoes[triggers % ULTRASONIC_PINGS_PER_READING];
+  triggers++;
+  pending = echo != NO_ECHO;
+  rise = nowMicros + ECHO_DELAY_MICROS;
+  fall = rise + echo;
+}
+
+static Ultrasonic sensor(trigger);
+
+static void script(unsigned long a, unsigned long b, unsigned long c, unsigned long d, unsigned long e)
+{
+  unsigned long pings[ULTRASONIC_PINGS_PER_READING] = {a, b, c, d, e};
+  for (int i = 0; i < ULTRASONIC_PINGS_PER_READING; i++)
+    echoes[i] = pings[i];
+}
+
+// runs the loop until the reading completes, returns the slowest update() in host microseconds
+static long runReading(unsigned long &loops)
+{
+  long slowest = 0;
+  loops = 0;
+  triggers = 0;
+  sensor.startReading();
+  while (true)
+  {
+    // the echo interrupt fires between loop passes
+    if (pending and nowMicros >= rise and rise != 0)
+    {
+      sensor.echoEdge(true, rise);
+      rise = 0;
+    }
+    if (pending and rise == 0 and nowMicros >= fall)
+    {
+      sensor.echoEdge(false, fall);
+      pending = false;
+    }
+    auto start = std::chrono::steady_clock::now();
+    bool done = sensor.update(nowMicros);
+    long took = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    if (took > slowest)
+      slowest = took;
+    loops++;
+    nowMicros += LOOP_STEP_MICROS;
+    if (done)
+      return slowest;
+    TEST_ASSERT_LESS_THAN_MESSAGE(1000, loops, "reading never finished");
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_median_rejects_outliers()
+{
+  unsigned long loops;
+  script(1000, 1200, 9000, 1100, 300);
+  runReading(loops);
+  TEST_ASSERT_EQUAL(U_OK, sensor.fault());
+  TEST_ASSERT_EQUAL(ULTRASONIC_PINGS_PER_READING, triggers);
+  TEST_ASSERT_EQUAL(1100, sensor.durationMicros());
+  TEST_ASSERT_FALSE(sensor.busy());
+}
+
+void test_lost_echoes_keep_last_duration()
+{
+  unsigned long loops;
+  script(1500, 1500, 1500, 1500, 1500);
+  runReading(loops);
+  TEST_ASSERT_EQUAL(1500, sensor.durationMicros());
+  script(NO_ECHO, 2000, NO_ECHO, NO_ECHO, 2000);
+  runReading(loops);
+  TEST_ASSERT_EQUAL(U_TIMEOUT, sensor.fault());
+  TEST_ASSERT_EQUAL(1500, sensor.durationMicros());
+  // two of five is still a fault, three is a reading
+  script(NO_ECHO, 2000, 2100, NO_ECHO, 2200);
+  runReading(loops);
+  TEST_ASSERT_EQUAL(U_OK, sensor.fault());
+  TEST_ASSERT_EQUAL(2100, sensor.durationMicros());
+}
+
+void test_loop_latency_bounded_without_echo()
+{
+  // the pulseIn() case: no echo ever comes back
+  unsigned long loops;
+  script(NO_ECHO, NO_ECHO, NO_ECHO, NO_ECHO, NO_ECHO);
+  long slowest = runReading(loops);
+  TEST_ASSERT_EQUAL(U_TIMEOUT, sensor.fault());
+  TEST_ASSERT_LESS_THAN(LOOP_BUDGET_MICROS, slowest);
+  // the reading takes the ping spacing, spread over loop passes instead of one blocking call
+  unsigned long readingMicros = loops * LOOP_STEP_MICROS;
+  TEST_ASSERT_LESS_OR_EQUAL((ULTRASONIC_PING_SPACING + 2 * LOOP_STEP_MICROS) * ULTRASONIC_PINGS_PER_READING, readingMicros);
+  TEST_ASSERT_GREATER_OR_EQUAL(ULTRASONIC_PING_SPACING * (ULTRASONIC_PINGS_PER_READING - 1), readingMicros);
+}
+
+void test_loop_latency_bounded_with_echoes()
+{
+  unsigned long loops;
+  long slowest = 0;
+  for (int reading = 0; reading < 100; reading++)
+  {
+    unsigned long echo = 300 + reading * 200; // 5cm to 3.5m
+    script(echo, echo, echo, echo, echo);
+    long took = runReading(loops);
+    if (took > slowest)
+      slowest = took;
+    TEST_ASSERT_EQUAL(echo, sensor.durationMicros());
+  }
+  TEST_ASSERT_LESS_THAN(LOOP_BUDGET_MICROS, slowest);
+}
+
+void test_stray_edges_ignored()
+{
+  unsigned long loops;
+  script(1000, 1000, 1000, 1000, 1000);
+  sensor.echoEdge(false, nowMicros); // falling edge with no rising edge before it
+  runReading(loops);
+  TEST_ASSERT_EQUAL(U_OK, sensor.fault());
+  TEST_ASSERT_EQUAL(1000, sensor.durationMicros());
+}
+
+void test_start_ignored_while_busy()
+{
+  script(1000, 1000, 1000, 1000, 1000);
+  triggers = 0;
+  sensor.startReading();
+  sensor.update(nowMicros);
+  sensor.startReading();
+  TEST_ASSERT_TRUE(sensor.busy());
+  TEST_ASSERT_EQUAL(1, triggers);
+  unsigned long loops;
+  runReading(loops); // finishes the running one, startReading() inside is ignored
+  TEST_ASSERT_FALSE(sensor.busy());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_median_rejects_outliers);
+  RUN_TEST(test_lost_echoes_keep_last_duration);
+  RUN_TEST(test_loop_latency_bounded_without_echo);
+  RUN_TEST(test_loop_latency_bounded_with_echoes);
+  RUN_TEST(test_stray_edges_ignored);
+  RUN_TEST(test_start_ignored_while_busy);
+  return UNITY_END();
+}
@@ -0,0 +1,104 @@
+#include <unity.h>
+#include <math.h>
+#include <stdio.h>
+
+#include "waterLevel.h"
+#include "testSupport.h"
+
+static const TankGeometry tank = {40, 60, 40, 0};
+
+static uint32_t seed = 7;
+static double random01()
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed / 4294967296.0;
+}
+
+void setUp() { seed = 7; }
+void tearDown() {}
+
+void test_geometry()
+{
+  TEST_ASSERT_FLOAT_WITHIN(0.0001, 0.0343, soundSpeed(20));
+  TEST_ASSERT_TRUE(soundSpeed(35) > soundSpeed(15));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 2400, tankArea(tank));
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 72, tankLitres(tank, 10));
+  TEST_ASSERT_EQUAL_FLOAT(0, tankLitres(tank, 45)); // below the bottom: empty, not negative
+  const TankGeometry round = {50, 0, 0, 40};
+  TEST_ASSERT_FLOAT_WITHIN(0.1, M_PI * 400, tankArea(round));
+}
+
+void test_noisy_day()
+{
+  // a day of readings every minute from a 60x40 cm tank losing 0.6 L/h, with
+  // 0.3 cm of noise, 2% stray echoes, the air swinging between 15 and 35C and a
+  // refill after 12 hours. The filtered level has to stay within a few mm and the
+  // consumption within 10%
+  const float litresPerHour = 0.6;
+  WaterLevelEstimator estimator;
+  double squared = 0;
+  float worst = 0;
+  uint32_t compared = 0;
+  float truth = 10;
+  for (uint32_t minute = 0; minute < 24 * 60; minute++)
+  {
+    uint32_t epoch = START_EPOCH + minute * 60;
+    if (minute == 12 * 60)
+      truth = 10;
+    truth += litresPerHour / 60 * 1000 / tankArea(tank);
+    float celsius = 25 + 10 * sin(minute * 2 * M_PI / (24 * 60));
+    float reading = truth + 0.3 * sqrt(-2 * log(1 - random01())) * cos(2 * M_PI * random01());
+    if (random01() < 0.02)
+      reading = 5 + 30 * random01();
+    estimator.update(reading * 2 / soundSpeed(celsius), celsius, epoch);
+    // settled 30 minutes after the start and the refill
+    if (minute % (12 * 60) >= 30)
+    {
+      float error = fabsf(estimator.distance() - truth);
+      squared += error * error;
+      worst = fmaxf(worst, error);
+      compared++;
+    }
+    if (minute == 12 * 60 - 1 or minute == 24 * 60 - 1)
+    {
+      TEST_ASSERT_TRUE(estimator.rateValid());
+      TEST_ASSERT_FLOAT_WITHIN(litresPerHour / 10, litresPerHour, estimator.consumption(tank));
+      float hours = tankLitres(tank, truth) / litresPerHour;
+      TEST_ASSERT_FLOAT_WITHIN(hours / 8, hours, estimator.hoursToEmpty(tank));
+    }
+  }
+  float rms = sqrt(squared / compared);
+  char line[100];
+  snprintf(line, sizeof(line), "%.2f cm rms error, %.2f cm worst, %u outliers", rms, worst, estimator.outlierCount());
+  TEST_MESSAGE(line);
+  TEST_ASSERT_TRUE(rms < 0.2);
+  TEST_ASSERT_TRUE(worst < 1);
+  TEST_ASSERT_GREATER_THAN(0, estimator.outlierCount());
+  TEST_ASSERT_EQUAL(1, estimator.refillCount());
+}
+
+void test_no_rate_before_an_hour()
+{
+  WaterLevelEstimator estimator;
+  TEST_ASSERT_FALSE(estimator.valid());
+  TEST_ASSERT_EQUAL_FLOAT(-1, estimator.hoursToEmpty(tank));
+  for (uint32_t minute = 0; minute < 30; minute++)
+    estimator.update(20 * 2 / soundSpeed(20), 20, START_EPOCH + minute * 60);
+  TEST_ASSERT_TRUE(estimator.valid());
+  TEST_ASSERT_FLOAT_WITHIN(0.05, 20, estimator.distance()); // whole microseconds of echo
+  TEST_ASSERT_FALSE(estimator.rateValid());
+  TEST_ASSERT_EQUAL_FLOAT(0, estimator.consumption(tank));
+  estimator.reset();
+  TEST_ASSERT_FALSE(estimator.valid());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_geometry);
+  RUN_TEST(test_noisy_day);
+  RUN_TEST(test_no_rate_before_an_hour);
+  return UNITY_END();
+}
@@ -0,0 +1,320 @@
+#include <unity.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "wifiManager.h"
+
+// An access point the fake radio can see
+struct AccessPoint
+{
+  const char *ssid;
+  const char *password;
+  int32_t rssi;
+  bool up;
+};
+
+// Radio driven by a script: the test sets which access points are up, how
+// long scans and connects take, and whether scans fail. Like the real one it
+// never blocks, results show up on later polls.
+class ScriptedRadio : public WifiRadio
+{
+public:
+  std::vector<AccessPoint> aps;
+  uint32_t now = 0;
+  uint32_t scanMs = 2000;
+  uint32_t connectMs = 3000;
+  bool scanFails = false;
+  bool apMode = false;
+  bool powered = true;
+  uint32_t scans = 0;
+  std::vector<std::string> attempts;
+
+  void startScan() override
+  {
+    TEST_ASSERT_TRUE(powered);
+    scans++;
+    scanStart = now;
+    scanning = true;
+    found.clear();
+  }
+  int scanComplete() override
+  {
+    if (!scanning)
+      return -2;
+    if (now - scanStart < scanMs)
+      return -1;
+    if (scanFails)
+      return -2;
+    if (found.empty())
+    {
+      for (const AccessPoint &ap : aps)
+      {
+        if (ap.up)
+          found.push_back(ap);
+      }
+    }
+    return found.size();
+  }
+  void scanEntry(int i, char *ssid, size_t size, int32_t &rssi) override
+  {
+    snprintf(ssid, size, "%s", found[i].ssid);
+    rssi = found[i].rssi;
+  }
+  void scanDelete() override
+  {
+    scanning = false;
+    found.clear();
+  }
+  void connect(const char *ssid, const char *password) override
+  {
+    TEST_ASSERT_TRUE(powered);
+    attempts.push_back(ssid);
+    target = NULL;
+    connectStart = now;
+    for (const AccessPoint &ap : aps)
+    {
+      if (strcmp(ap.ssid, ssid) == 0 and strcmp(ap.password, password) == 0)
+        target = &ap;
+    }
+  }
+  bool connected() override { return powered and target != NULL and target->up and now - connectStart >= connectMs; }
+  void disconnect() override { target = NULL; }
+  void startAccessPoint() override { apMode = true; }
+  void stopAccessPoint() override { apMode = false; }
+  void powerOff() override
+  {
+    powered = false;
+    target = NULL;
+  }
+  void powerOn() override { powered = true; }
+
+  AccessPoint &ap(const char *ssid)
+  {
+    for (AccessPoint &ap : aps)
+    {
+      if (strcmp(ap.ssid, ssid) == 0)
+        return ap;
+    }
+    TEST_FAIL_MESSAGE("no such access point");
+    return aps[0];
+  }
+
+private:
+  bool scanning = false;
+  uint32_t scanStart = 0;
+  std::vector<AccessPoint> found;
+  const AccessPoint *target = NULL;
+  uint32_t connectStart = 0;
+};
+
+static const WifiNetwork stored[] = {
+    {"greenhouse", "tomato123"},
+    {"house", "letmein"},
+    {"phone", "hotspot1"},
+};
+
+struct Transition
+{
+  uint32_t ms;
+  WifiState state;
+  bool accessPoint;
+};
+static std::vector<Transition> transitions;
+static uint32_t clockMs = 0;
+static void onState(WifiState state, bool accessPoint) { transitions.push_back({clockMs, state, accessPoint}); }
+
+// polls the manager like the network task, every 100 ms
+static void run(WifiManager &wifi, ScriptedRadio &radio, uint32_t untilMs)
+{
+  for (; clockMs < untilMs; clockMs += 100)
+  {
+    radio.now = clockMs;
+    wifi.update(clockMs);
+  }
+  radio.now = clockMs;
+}
+
+static void setupRadio(ScriptedRadio &radio)
+{
+  radio.aps = {
+      {"neighbour", "secret", -40, true},
+      {"house", "letmein", -60, true},
+      {"greenhouse", "tomato123", -75, true},
+      {"phone", "hotspot1", -50, false},
+  };
+}
+
+void setUp()
+{
+  transitions.clear();
+  clockMs = 0;
+}
+void tearDown() {}
+
+void test_strongest_stored_network_first()
+{
+  ScriptedRadio radio;
+  setupRadio(radio);
+  WifiManager wifi(radio, stored, 3, onState);
+  wifi.begin(0, 42);
+  run(wifi, radio, 10000);
+  TEST_ASSERT_EQUAL(WIFI_CONNECTED, wifi.state());
+  TEST_ASSERT_EQUAL_STRING("house", wifi.ssid()); // the neighbour is stronger but not stored, phone is off
+  TEST_ASSERT_EQUAL(1, radio.attempts.size());
+  TEST_ASSERT_EQUAL(1, wifi.connects());
+  TEST_ASSERT_EQUAL(3, transitions.size()); // scanning, connecting, connected
+  TEST_ASSERT_EQUAL(WIFI_CONNECTED, transitions[2].state);
+  TEST_ASSERT_EQUAL(5000, transitions[2].ms); // 2 s scan and 3 s connect, no delay() on top
+}
+
+void test_next_network_after_connect_timeout()
+{
+  ScriptedRadio radio;
+  setupRadio(radio);
+  radio.ap("house").password = "changed"; // the stored password no longer works
+  WifiManager wifi(radio, stored, 3, onState);
+  wifi.begin(0, 42);
+  run(wifi, radio, 2000 + WIFI_CONNECT_TIMEOUT + 5000);
+  TEST_ASSERT_EQUAL(WIFI_CONNECTED, wifi.state());
+  TEST_ASSERT_EQUAL_STRING("greenhouse", wifi.ssid());
+  TEST_ASSERT_EQUAL(2, radio.attempts.size());
+  TEST_ASSERT_EQUAL(1, wifi.failedAttempts());
+}
+
+void test_failed_scan_tries_every_network()
+{
+  ScriptedRadio radio;
+  setupRadio(radio);
+  radio.scanFails = true;
+  radio.ap("phone").up = true; // hidden networks do not show up in scans either
+  radio.ap("greenhouse").up = false;
+  radio.ap("house").up = false;
+  WifiManager wifi(radio, stored, 3, onState);
+  wifi.begin(0, 42);
+  run(wifi, radio, 60000);
+  TEST_ASSERT_EQUAL(WIFI_CONNECTED, wifi.state());
+  TEST_ASSERT_EQUAL_STRING("phone", wifi.ssid());
+  TEST_ASSERT_EQUAL(3, radio.attempts.size()); // in stored order
+  TEST_ASSERT_EQUAL_STRING("greenhouse", radio.attempts[0].c_str());
+}
+
+void test_backoff_grows_with_jitter()
+{
+  ScriptedRadio radio;
+  setupRadio(radio);
+  for (AccessPoint &ap : radio.aps)
+    ap.up = false;
+  WifiManager wifi(radio, stored, 3, onState);
+  wifi.begin(0, 42);
+  // a round with nothing in range fails straight after the scan
+  std::vector<uint32_t> waits;
+  WifiState last = wifi.state();
+  for (; clockMs < 3 * 3600000; clockMs += 100)
+  {
+    radio.now = clockMs;
+    wifi.update(clockMs);
+    if (wifi.state() == WIFI_BACKOFF and last != WIFI_BACKOFF)
+      waits.push_back(wifi.backoffMillis());
+    last = wifi.state();
+  }
+  TEST_ASSERT_GREATER_THAN(8, waits.size());
+  uint32_t nominal = WIFI_BACKOFF_MIN;
+  for (uint32_t wait : waits)
+  {
+    TEST_ASSERT_GREATER_OR_EQUAL(nominal - nominal / 4, wait);
+    TEST_ASSERT_LESS_OR_EQUAL(nominal + nominal / 4, wait);
+    nominal = nominal * 2 < WIFI_BACKOFF_MAX ? nominal * 2 : WIFI_BACKOFF_MAX;
+  }
+  // the AP came up after WIFI_AP_AFTER offline and stays while the station is down
+  TEST_ASSERT_TRUE(wifi.accessPoint());
+  TEST_ASSERT_TRUE(radio.apMode);
+  bool apAt = false;
+  for (const Transition &t : transitions)
+  {
+    if (t.accessPoint and !apAt)
+    {
+      apAt = true;
+      TEST_ASSERT_UINT32_WITHIN(100, WIFI_AP_AFTER, t.ms);
+    }
+  }
+  TEST_ASSERT_TRUE(apAt);
+  // the network comes back: connected within one backoff, the AP goes, the backoff resets
+  radio.ap("greenhouse").up = true;
+  run(wifi, radio, clockMs + WIFI_BACKOFF_MAX * 5 / 4 + 10000);
+  TEST_ASSERT_EQUAL(WIFI_CONNECTED, wifi.state());
+  TEST_ASSERT_FALSE(wifi.accessPoint());
+  TEST_ASSERT_FALSE(radio.apMode);
+  TEST_ASSERT_EQUAL(0, wifi.backoffMillis());
+}
+
+void test_jitter_differs_between_devices()
+{
+  ScriptedRadio radioA, radioB;
+  WifiManager a(radioA, stored, 3, NULL);
+  WifiManager b(radioB, stored, 3, NULL);
+  a.begin(0, 1);
+  b.begin(0, 2);
+  for (clockMs = 0; clockMs < 3000; clockMs += 100)
+  {
+    radioA.now = radioB.now = clockMs;
+    a.update(clockMs);
+    b.update(clockMs);
+  }
+  TEST_ASSERT_EQUAL(WIFI_BACKOFF, a.state());
+  TEST_ASSERT_EQUAL(WIFI_BACKOFF, b.state());
+  TEST_ASSERT_NOT_EQUAL(a.backoffMillis(), b.backoffMillis());
+}
+
+void test_lost_connection_rescans_at_once()
+{
+  ScriptedRadio radio;
+  setupRadio(radio);
+  WifiManager wifi(radio, stored, 3, onState);
+  wifi.begin(0, 42);
+  run(wifi, radio, 10000);
+  uint32_t scans = radio.scans;
+  radio.ap("house").up = false; // AP rebooting
+  run(wifi, radio, 10200);
+  TEST_ASSERT_EQUAL(WIFI_SCANNING, wifi.state());
+  TEST_ASSERT_EQUAL(scans + 1, radio.scans);
+  run(wifi, radio, 20000);
+  TEST_ASSERT_EQUAL(WIFI_CONNECTED, wifi.state());
+  TEST_ASSERT_EQUAL_STRING("greenhouse", wifi.ssid());
+  TEST_ASSERT_EQUAL(2, wifi.connects());
+}
+
+void test_suspend_and_resume()
+{
+  ScriptedRadio radio;
+  setupRadio(radio);
+  WifiManager wifi(radio, stored, 3, onState);
+  wifi.begin(0, 42);
+  run(wifi, radio, 1000); // mid scan
+  wifi.suspend(clockMs);
+  TEST_ASSERT_TRUE(wifi.suspended());
+  TEST_ASSERT_FALSE(radio.powered);
+  run(wifi, radio, 600000); // no radio calls and no access point while off
+  TEST_ASSERT_EQUAL(WIFI_SUSPENDED, wifi.state());
+  TEST_ASSERT_FALSE(radio.apMode);
+  wifi.resume(clockMs);
+  TEST_ASSERT_TRUE(radio.powered);
+  run(wifi, radio, clockMs + 6000);
+  TEST_ASSERT_EQUAL(WIFI_CONNECTED, wifi.state());
+  wifi.resume(clockMs); // not suspended: nothing happens
+  TEST_ASSERT_EQUAL(WIFI_CONNECTED, wifi.state());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_strongest_stored_network_first);
+  RUN_TEST(test_next_network_after_connect_timeout);
+  RUN_TEST(test_failed_scan_tries_every_network);
+  RUN_TEST(test_backoff_grows_with_jitter);
+  RUN_TEST(test_jitter_differs_between_devices);
+  RUN_TEST(test_lost_connection_rescans_at_once);
+  RUN_TEST(test_suspend_and_resume);
+  return UNITY_END();
+}